@@ -42,6 +42,10 @@
 #include <linux/version.h>
 #include <linux/pm_qos.h>
 #include <linux/workqueue.h>
+#include <linux/irq_work.h>
+#include <linux/cpu_pm.h>
+#include <linux/seqlock.h>
+#include <linux/timekeeping.h>
 #include <linux/tegra-cpufreq.h>
 #include <soc/tegra/virt/syscalls.h>
 #include "tegra194-cpufreq.h"
@@ -56,6 +60,8 @@
 #define REF_CLK_MHZ		408 /* 408 MHz */
 #define US_DELAY		500
 #define US_DELAY_MIN		2
+#define CTR_SAMPLE_MIN_US	50	/* shortest window worth estimating */
+#define CTR_SAMPLE_MAX_US	USEC_PER_SEC	/* core counter wraps ~2s */
 #define CPUFREQ_TBL_STEP_HZ	(50 * KHZ_TO_HZ * KHZ_TO_HZ)
 
 #define LOOP_FOR_EACH_CLUSTER(cl)	for (cl = 0; \
@@ -70,6 +76,49 @@ static enum cpuhp_state hp_online;
 
 static uint32_t latest_freq_req[NR_CPUS];
 
+/*
+ * With cached_readback set, reading the cpu frequency never disturbs the
+ * target cpu. Each cpu samples its own counters when it leaves and
+ * enters idle and when its ndiv request changes, and readers use the
+ * resulting estimate as long as it is younger than readback_max_age_ms.
+ * Older estimates give way to the last requested frequency.
+ */
+static bool cached_readback;
+module_param(cached_readback, bool, 0644);
+MODULE_PARM_DESC(cached_readback, "Read cpu freq from passive counter samples");
+
+static uint readback_max_age_ms = 100;
+module_param(readback_max_age_ms, uint, 0644);
+MODULE_PARM_DESC(readback_max_age_ms, "Max age of a cached freq sample in ms");
+
+struct ctr_sample {
+	seqcount_t seq;		/* protects rate_khz and stamp */
+	uint32_t rate_khz;
+	u64 stamp;		/* ns, when rate_khz was computed */
+	uint32_t base_refclk_cnt;
+	uint32_t base_coreclk_cnt;
+	bool base_valid;
+};
+
+static DEFINE_PER_CPU(struct ctr_sample, ctr_sample);
+
+/* ndiv request handed to a remote cpu from the fast switch path */
+struct ndiv_update {
+	struct irq_work work;
+	uint64_t ndiv;
+};
+
+static DEFINE_PER_CPU(struct ndiv_update, ndiv_update);
+
+/*
+ * Where ndiv requests land: the request register of each cpu, or the
+ * simulated register file of the debugfs selftest.
+ */
+struct ndiv_writer {
+	smp_call_func_t write;		/* runs on the target cpu, irqs off */
+	struct ndiv_update __percpu *update; /* irq work calling write */
+};
+
 struct cc3_params {
 	u32 ndiv;
 	u32 freq;
@@ -83,6 +132,9 @@ struct per_cluster_data {
 	struct cpumask cpu_mask;
 	struct cc3_params cc3;
 	uint8_t configured;
+	struct work_struct emc_work; /* applies emc_freq off the switch path */
+	struct irq_work emc_irq_work; /* queues emc_work, safe under rq lock */
+	uint32_t emc_freq;
 };
 
 struct tegra_cpufreq_data {
@@ -178,6 +230,17 @@ static void tegra_read_counters(struct work_struct *work)
 	c->coreclk_cnt = (uint32_t) (val >> 32);
 }
 
+/* core clock cycles over a ref clock interval, in KHz */
+static inline unsigned int ctr_delta_to_khz(uint32_t delta_ccnt,
+					    uint32_t delta_refcnt)
+{
+	unsigned long rate_mhz;
+
+	rate_mhz = ((unsigned long) delta_ccnt * REF_CLK_MHZ) / delta_refcnt;
+
+	return (unsigned int) (rate_mhz * 1000); /* in KHz */
+}
+
 /**
  * Return instantaneous cpu speed
  * Instantaneous freq is calculated as -
@@ -203,7 +266,6 @@ static unsigned int tegra194_get_speed_common(uint32_t cpu, uint32_t delay)
 {
 	uint32_t delta_ccnt = 0;
 	uint32_t delta_refcnt = 0;
-	unsigned long rate_mhz = 0;
 	struct tegra_cpu_ctr c;
 	struct read_counters_work read_counters_work;
 
@@ -215,22 +277,119 @@ static unsigned int tegra194_get_speed_common(uint32_t cpu, uint32_t delay)
 	c = read_counters_work.c;
 	delta_ccnt = c.coreclk_cnt - c.last_coreclk_cnt;
 	if (!delta_ccnt)
-		goto err_out;
+		return 0;
 
 	/* ref clock is 32 bits */
 	delta_refcnt = c.refclk_cnt - c.last_refclk_cnt;
 	if (!delta_refcnt) {
 		pr_err("cpufreq: %d is idle, delta_refcnt: 0\n", cpu);
-		goto err_out;
+		return 0;
 	}
-	rate_mhz = ((unsigned long) delta_ccnt * REF_CLK_MHZ) / delta_refcnt;
-err_out:
-	return (unsigned int) (rate_mhz * 1000); /* in KHz */
+
+	return ctr_delta_to_khz(delta_ccnt, delta_refcnt);
+}
+
+/**
+ * Turn a counter window into a frequency estimate.
+ * @delta_refcnt - ref clock cycles in the window
+ * @delta_ccnt - core clock cycles in the window
+ * @rate_khz - the estimate, in KHz
+ *
+ * Returns false if the window is too short to be accurate or long enough
+ * for the core counter to have wrapped.
+ */
+static bool ctr_window_to_khz(uint32_t delta_refcnt, uint32_t delta_ccnt,
+			      unsigned int *rate_khz)
+{
+	if (delta_refcnt < CTR_SAMPLE_MIN_US * REF_CLK_MHZ ||
+	    delta_refcnt > CTR_SAMPLE_MAX_US * REF_CLK_MHZ)
+		return false;
+
+	*rate_khz = ctr_delta_to_khz(delta_ccnt, delta_refcnt);
+	return true;
+}
+
+/**
+ * Feed one counter sample to a cpu's estimator.
+ * @s - the estimator state
+ * @val - freq feedback register value, core counter in the upper half
+ * @close - end the window opened by the previous sample and turn it into
+ *          a frequency estimate if it is long enough to be accurate
+ * @open - start a new window at this sample
+ *
+ * Windows only cover time the cpu is running at a single ndiv request,
+ * so idle periods and frequency switches do not skew the estimate.
+ */
+static void ctr_sample_update(struct ctr_sample *s, uint64_t val,
+			      bool close, bool open)
+{
+	uint32_t refclk_cnt, coreclk_cnt;
+	unsigned int rate_khz;
+
+	refclk_cnt = (uint32_t)(val & 0xffffffff);
+	coreclk_cnt = (uint32_t)(val >> 32);
+
+	if (close && s->base_valid &&
+	    ctr_window_to_khz(refclk_cnt - s->base_refclk_cnt,
+			      coreclk_cnt - s->base_coreclk_cnt, &rate_khz)) {
+		write_seqcount_begin(&s->seq);
+		s->rate_khz = rate_khz;
+		s->stamp = ktime_get_mono_fast_ns();
+		write_seqcount_end(&s->seq);
+	}
+
+	s->base_refclk_cnt = refclk_cnt;
+	s->base_coreclk_cnt = coreclk_cnt;
+	s->base_valid = open;
+}
+
+/* Sample the counters of the current cpu, with irqs disabled */
+static void ctr_sample_local(bool close, bool open)
+{
+	ctr_sample_update(this_cpu_ptr(&ctr_sample), read_freq_feedback(),
+			  close, open);
+}
+
+/* Returns rate_khz if it was estimated at most max_age_ns ago, else 0 */
+static unsigned int ctr_cached_khz(unsigned int rate_khz, u64 stamp,
+				   u64 now, u64 max_age_ns)
+{
+	if (now - stamp > max_age_ns)
+		return 0;
+
+	return rate_khz;
+}
+
+/* Returns the cached freq in KHz, 0 if there is none recent enough */
+static unsigned int tegra194_get_cached_speed(uint32_t cpu)
+{
+	struct ctr_sample *s = per_cpu_ptr(&ctr_sample, cpu);
+	unsigned int seq, rate_khz;
+	u64 stamp;
+
+	do {
+		seq = read_seqcount_begin(&s->seq);
+		rate_khz = s->rate_khz;
+		stamp = s->stamp;
+	} while (read_seqcount_retry(&s->seq, seq));
+
+	return ctr_cached_khz(rate_khz, stamp, ktime_get_mono_fast_ns(),
+			      (u64)readback_max_age_ms * NSEC_PER_MSEC);
 }
 
 static unsigned int tegra194_get_speed(uint32_t cpu)
 {
-	return tegra194_get_speed_common(cpu, tfreq_data.freq_compute_delay);
+	unsigned int rate_khz;
+
+	if (!cached_readback)
+		return tegra194_get_speed_common(cpu,
+				tfreq_data.freq_compute_delay);
+
+	rate_khz = tegra194_get_cached_speed(cpu);
+	if (!rate_khz)
+		rate_khz = latest_freq_req[cpu];
+
+	return rate_khz;
 }
 
 static unsigned int tegra194_fast_get_speed(uint32_t cpu)
@@ -269,6 +428,10 @@ static void write_ndiv_request(void *val)
 	} else {
 		asm volatile("msr s3_0_c15_c0_4, %0" : : "r" (regval));
 	}
+
+	/* the running window was measured at the old request */
+	if (cached_readback)
+		ctr_sample_local(true, true);
 }
 
 #ifdef CONFIG_DEBUG_FS
@@ -288,6 +451,55 @@ static void read_ndiv_request(void *ret)
 }
 #endif
 
+static void emc_update_work(struct work_struct *work)
+{
+	struct per_cluster_data *pcl =
+		container_of(work, struct per_cluster_data, emc_work);
+
+	set_cpufreq_to_emcfreq(pcl - tfreq_data.pcluster,
+			       READ_ONCE(pcl->emc_freq));
+}
+
+static void emc_update_irq_work(struct irq_work *work)
+{
+	struct per_cluster_data *pcl =
+		container_of(work, struct per_cluster_data, emc_irq_work);
+
+	schedule_work(&pcl->emc_work);
+}
+
+/*
+ * Queue an emc floor update for a cluster; only the latest one applies.
+ * Callable from scheduler context, where waking a worker directly could
+ * deadlock on the runqueue lock.
+ */
+static void tegra_queue_emc_update(enum cluster cl, uint32_t cluster_freq)
+{
+	struct per_cluster_data *pcl = &tfreq_data.pcluster[cl];
+
+	if (!pcl->bwmgr)
+		return;
+
+	WRITE_ONCE(pcl->emc_freq, cluster_freq);
+	irq_work_queue(&pcl->emc_irq_work);
+}
+
+/* Returns the clamped ndiv for rate in kHz, 0 if cluster has no limits */
+static uint16_t cluster_rate_to_ndiv(enum cluster cl, uint32_t rate)
+{
+	struct mrq_cpu_ndiv_limits_response *nltbl;
+	uint16_t ndiv;
+
+	nltbl = &tfreq_data.pcluster[cl].ndiv_limits_tbl;
+
+	if (!nltbl->ref_clk_hz)
+		return 0;
+
+	ndiv = map_freq_to_ndiv(nltbl, rate);
+
+	return clamp_ndiv(nltbl, ndiv);
+}
+
 /**
  * tegra_update_cpu_speed - update cpu freq
  * @rate - in kHz
@@ -295,24 +507,99 @@ static void read_ndiv_request(void *ret)
  */
 static void tegra_update_cpu_speed(uint32_t rate, uint8_t cpu)
 {
-	struct mrq_cpu_ndiv_limits_response *nltbl;
 	uint64_t val;
-	enum cluster cur_cl;
-	uint16_t ndiv;
 
-	cur_cl = get_cpu_cluster(cpu);
-	nltbl = &tfreq_data.pcluster[cur_cl].ndiv_limits_tbl;
-
-	if (!nltbl->ref_clk_hz)
+	val = cluster_rate_to_ndiv(get_cpu_cluster(cpu), rate);
+	if (!val)
 		return;
 
-	ndiv = map_freq_to_ndiv(nltbl, rate);
-	ndiv = clamp_ndiv(nltbl, ndiv);
-
-	val = (uint64_t)ndiv;
 	smp_call_function_single(cpu, write_ndiv_request, &val, 1);
 }
 
+static const struct ndiv_writer ndiv_hw_writer = {
+	.write = write_ndiv_request,
+	.update = &ndiv_update,
+};
+
+/**
+ * __tegra_update_cpus_speed - update freq of a set of cpus
+ * @w - where the ndiv requests go
+ * @rate - in kHz
+ * @cpus - cpus whose freq to be updated, offline ones are skipped
+ *
+ * Issues one cross call per cluster rather than one per cpu.
+ */
+static void __tegra_update_cpus_speed(const struct ndiv_writer *w,
+				      uint32_t rate, const struct cpumask *cpus)
+{
+	struct cpumask cl_cpus;
+	uint64_t val;
+	enum cluster cl;
+
+	LOOP_FOR_EACH_CLUSTER(cl) {
+		if (!tfreq_data.pcluster[cl].configured)
+			continue;
+
+		cpumask_and(&cl_cpus, cpus, &tfreq_data.pcluster[cl].cpu_mask);
+		if (!cpumask_and(&cl_cpus, &cl_cpus, cpu_online_mask))
+			continue;
+
+		val = cluster_rate_to_ndiv(cl, rate);
+		if (!val)
+			continue;
+
+		on_each_cpu_mask(&cl_cpus, w->write, &val, true);
+	}
+}
+
+static void tegra_update_cpus_speed(uint32_t rate, const struct cpumask *cpus)
+{
+	__tegra_update_cpus_speed(&ndiv_hw_writer, rate, cpus);
+}
+
+/**
+ * tegra_fast_update_cpus_speed - update freq of a set of cpus, irqs off
+ * @w - where the ndiv requests go
+ * @rate - in kHz
+ * @cpus - cpus whose freq to be updated, offline ones are skipped
+ *
+ * Cannot cross call. The local cpu writes its own request and remote
+ * cpus pick theirs up from irq work.
+ */
+static void tegra_fast_update_cpus_speed(const struct ndiv_writer *w,
+					 uint32_t rate,
+					 const struct cpumask *cpus)
+{
+	struct ndiv_update *nu;
+	uint64_t val;
+	int cpu, this_cpu;
+
+	this_cpu = smp_processor_id();
+	for_each_cpu_and(cpu, cpus, cpu_online_mask) {
+		val = cluster_rate_to_ndiv(get_cpu_cluster(cpu), rate);
+		if (!val)
+			continue;
+
+		if (cpu == this_cpu) {
+			w->write(&val);
+			continue;
+		}
+
+		nu = per_cpu_ptr(w->update, cpu);
+		WRITE_ONCE(nu->ndiv, val);
+		/* already pending work reads the new ndiv when it runs */
+		irq_work_queue_on(&nu->work, cpu);
+	}
+}
+
+static void ndiv_update_fn(struct irq_work *work)
+{
+	struct ndiv_update *nu = container_of(work, struct ndiv_update, work);
+	uint64_t val = READ_ONCE(nu->ndiv);
+
+	write_ndiv_request(&val);
+}
+
 struct mrq_cpu_ndiv_limits_response *get_ndiv_limits(enum cluster cl)
 {
 	struct mrq_cpu_ndiv_limits_response *nltbl  = NULL;
@@ -357,11 +644,9 @@ static int tegra194_set_speed(struct cpufreq_policy *policy, unsigned int index)
 
 	cl = get_cpu_cluster(policy->cpu);
 
-	for_each_cpu_and(cpu, policy->cpus, cpu_online_mask)
-		tegra_update_cpu_speed(tgt_freq, cpu);
+	tegra_update_cpus_speed(tgt_freq, policy->cpus);
 
-	if (tfreq_data.pcluster[cl].bwmgr)
-		set_cpufreq_to_emcfreq(cl, tgt_freq);
+	tegra_queue_emc_update(cl, tgt_freq);
 
 	cpufreq_freq_transition_end(policy, &freqs, ret);
 out:
@@ -373,6 +658,35 @@ out:
 	return ret;
 }
 
+/**
+ * tegra194_fast_switch - Switch policy freq from scheduler context
+ * @policy - cpufreq policy
+ * @target_freq - requested freq in kHz, within policy limits
+ * Returns the freq switched to
+ *
+ * Runs with interrupts disabled, so it cannot cross call.
+ */
+static unsigned int tegra194_fast_switch(struct cpufreq_policy *policy,
+					 unsigned int target_freq)
+{
+	struct cpufreq_frequency_table *ftbl;
+	uint32_t tgt_freq;
+	int cpu;
+
+	ftbl = get_freqtable(policy->cpu);
+	tgt_freq = ftbl[cpufreq_frequency_table_target(policy, target_freq,
+				CPUFREQ_RELATION_L)].frequency;
+
+	for_each_cpu(cpu, policy->related_cpus)
+		latest_freq_req[cpu] = tgt_freq;
+
+	tegra_fast_update_cpus_speed(&ndiv_hw_writer, tgt_freq, policy->cpus);
+
+	tegra_queue_emc_update(get_cpu_cluster(policy->cpu), tgt_freq);
+
+	return tgt_freq;
+}
+
 static void __tegra_mce_cc3_ctrl(void *data)
 {
 	struct cc3_params *param = (struct cc3_params *)data;
@@ -624,6 +938,331 @@ static int set_cc3_ndiv(void *data, u64 val)
 DEFINE_SIMPLE_ATTRIBUTE(cc3_ndiv_ops, get_cc3_ndiv, set_cc3_ndiv,
 	"%llu\n");
 
+/*
+ * ndiv selftest: requests go to a simulated per-cpu request register
+ * instead of the hardware, so running it leaves the cpu clocks alone.
+ */
+struct ndiv_sim_reg {
+	uint64_t ndiv;
+	uint32_t writes;
+	uint32_t out_of_order;	/* writes moving against the sweep */
+};
+
+static DEFINE_PER_CPU(struct ndiv_sim_reg, ndiv_sim_reg);
+static DEFINE_PER_CPU(struct ndiv_update, ndiv_sim_update);
+static DEFINE_MUTEX(ndiv_sim_lock);
+static bool ndiv_sim_rising;
+
+static void sim_write_ndiv_request(void *val)
+{
+	struct ndiv_sim_reg *r = this_cpu_ptr(&ndiv_sim_reg);
+	uint64_t ndiv = *((uint64_t *) val);
+
+	/* a stale request landing after a newer one reverses the sweep */
+	if (r->writes && (ndiv_sim_rising ? ndiv < r->ndiv : ndiv > r->ndiv))
+		r->out_of_order++;
+	r->ndiv = ndiv;
+	r->writes++;
+}
+
+static void ndiv_sim_update_fn(struct irq_work *work)
+{
+	struct ndiv_update *nu = container_of(work, struct ndiv_update, work);
+	uint64_t val = READ_ONCE(nu->ndiv);
+
+	sim_write_ndiv_request(&val);
+}
+
+static const struct ndiv_writer ndiv_sim_writer = {
+	.write = sim_write_ndiv_request,
+	.update = &ndiv_sim_update,
+};
+
+/* Checks ndiv is the request for rate, worked out from the limits table */
+static bool ndiv_sim_expected(struct mrq_cpu_ndiv_limits_response *nltbl,
+			      uint32_t rate, uint64_t ndiv)
+{
+	uint64_t ref_khz = nltbl->ref_clk_hz / KHZ_TO_HZ;
+	uint64_t want = (uint64_t)rate * nltbl->pdiv * nltbl->mdiv;
+
+	if (ndiv < nltbl->ndiv_min || ndiv > nltbl->ndiv_max)
+		return false;
+	if (ndiv == nltbl->ndiv_min && ndiv * ref_khz >= want)
+		return true;
+	if (ndiv == nltbl->ndiv_max && ndiv * ref_khz <= want)
+		return true;
+	/* lowest ndiv reaching rate */
+	return ndiv * ref_khz >= want && (ndiv - 1) * ref_khz < want;
+}
+
+static void ndiv_sim_reset(const struct cpumask *cpus)
+{
+	int cpu;
+
+	for_each_cpu(cpu, cpus)
+		memset(per_cpu_ptr(&ndiv_sim_reg, cpu), 0,
+		       sizeof(struct ndiv_sim_reg));
+}
+
+static int ndiv_sim_check(struct seq_file *s, const struct cpumask *cpus,
+			  struct mrq_cpu_ndiv_limits_response *nltbl,
+			  uint32_t rate, const char *path)
+{
+	struct ndiv_sim_reg *r;
+	int cpu, err = 0;
+
+	for_each_cpu(cpu, cpus) {
+		r = per_cpu_ptr(&ndiv_sim_reg, cpu);
+		if (!r->writes || !ndiv_sim_expected(nltbl, rate, r->ndiv) ||
+		    r->out_of_order) {
+			seq_printf(s, "  %s: cpu%d rate %u kHz: ndiv %llu, writes %u, out of order %u\n",
+				   path, cpu, rate, r->ndiv, r->writes,
+				   r->out_of_order);
+			err = -EINVAL;
+		}
+	}
+
+	return err;
+}
+
+/* Cross call requests out of range both ways, at the edges and between */
+static int ndiv_sim_clamp(struct seq_file *s, const struct cpumask *cpus,
+			  struct mrq_cpu_ndiv_limits_response *nltbl)
+{
+	uint32_t fmin = map_ndiv_to_freq(nltbl, nltbl->ndiv_min);
+	uint32_t fmax = map_ndiv_to_freq(nltbl, nltbl->ndiv_max);
+	const uint32_t rates[] = {
+		0, fmin / 2, fmin - 1, fmin, fmin + 1,
+		fmin + (fmax - fmin) / 3, fmax - 1, fmax, fmax + 1, fmax * 2,
+	};
+	int i, err = 0;
+
+	for (i = 0; i < ARRAY_SIZE(rates); i++) {
+		ndiv_sim_reset(cpus);
+		__tegra_update_cpus_speed(&ndiv_sim_writer, rates[i], cpus);
+		if (ndiv_sim_check(s, cpus, nltbl, rates[i], "cross call"))
+			err = -EINVAL;
+	}
+
+	return err;
+}
+
+/* Fast switch sweep over every ndiv step, one direction */
+static int ndiv_sim_sweep(struct seq_file *s, const struct cpumask *cpus,
+			  struct mrq_cpu_ndiv_limits_response *nltbl,
+			  bool rising, uint32_t *writes, uint32_t *reqs)
+{
+	uint16_t ndiv, first, last;
+	uint32_t rate = 0;
+	unsigned long flags;
+	int cpu;
+
+	first = rising ? nltbl->ndiv_min : nltbl->ndiv_max;
+	last = rising ? nltbl->ndiv_max : nltbl->ndiv_min;
+
+	ndiv_sim_reset(cpus);
+	ndiv_sim_rising = rising;
+	for (ndiv = first; ; ndiv = rising ? ndiv + 1 : ndiv - 1) {
+		rate = map_ndiv_to_freq(nltbl, ndiv);
+		local_irq_save(flags);
+		tegra_fast_update_cpus_speed(&ndiv_sim_writer, rate, cpus);
+		local_irq_restore(flags);
+		(*reqs)++;
+		if (ndiv == last)
+			break;
+	}
+
+	for_each_cpu(cpu, cpus) {
+		irq_work_sync(&per_cpu(ndiv_sim_update, cpu).work);
+		*writes += per_cpu(ndiv_sim_reg, cpu).writes;
+	}
+
+	return ndiv_sim_check(s, cpus, nltbl, rate,
+			      rising ? "rising sweep" : "falling sweep");
+}
+
+static int ndiv_sim_test_show(struct seq_file *s, void *data)
+{
+	struct mrq_cpu_ndiv_limits_response *nltbl;
+	uint32_t writes, reqs;
+	struct cpumask cpus;
+	enum cluster cl;
+	int ret, err = 0;
+
+	mutex_lock(&ndiv_sim_lock);
+	get_online_cpus();
+	LOOP_FOR_EACH_CLUSTER(cl) {
+		nltbl = &tfreq_data.pcluster[cl].ndiv_limits_tbl;
+		if (!tfreq_data.pcluster[cl].configured || !nltbl->ref_clk_hz)
+			continue;
+		if (!cpumask_and(&cpus, &tfreq_data.pcluster[cl].cpu_mask,
+				 cpu_online_mask))
+			continue;
+
+		ret = ndiv_sim_clamp(s, &cpus, nltbl);
+
+		writes = 0;
+		reqs = 0;
+		ret |= ndiv_sim_sweep(s, &cpus, nltbl, true, &writes, &reqs);
+		ret |= ndiv_sim_sweep(s, &cpus, nltbl, false, &writes, &reqs);
+
+		seq_printf(s, "cluster %d: %s, ndiv %u-%u, %u sweep requests, %u register writes\n",
+			   cl, ret ? "FAIL" : "PASS", nltbl->ndiv_min,
+			   nltbl->ndiv_max, reqs * cpumask_weight(&cpus),
+			   writes);
+		if (ret)
+			err = -EINVAL;
+	}
+	put_online_cpus();
+	mutex_unlock(&ndiv_sim_lock);
+
+	seq_printf(s, "%s\n", err ? "FAIL" : "PASS");
+	return 0;
+}
+
+static int ndiv_sim_test_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ndiv_sim_test_show, inode->i_private);
+}
+
+static const struct file_operations ndiv_sim_test_fops = {
+	.open = ndiv_sim_test_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * Estimator selftest: a simulated counter source stands in for the freq
+ * feedback register and drives ctr_sample_update() through runs,
+ * frequency switches and idle periods with known core clock rates.
+ */
+struct ctr_sim {
+	uint64_t ref;
+	uint64_t core;
+	struct ctr_sample s;
+};
+
+static uint64_t ctr_sim_val(struct ctr_sim *c)
+{
+	return ((c->core & 0xffffffff) << 32) | (c->ref & 0xffffffff);
+}
+
+/* Advance by us at khz, 0 while idle as the core clock is stopped */
+static void ctr_sim_run(struct ctr_sim *c, uint32_t us, uint32_t khz)
+{
+	c->ref += (uint64_t)us * REF_CLK_MHZ;
+	c->core += (uint64_t)us * khz / 1000;
+}
+
+static void ctr_sim_sample(struct ctr_sim *c, bool close, bool open)
+{
+	ctr_sample_update(&c->s, ctr_sim_val(c), close, open);
+}
+
+static int ctr_sim_check(struct seq_file *s, const char *name,
+			 struct ctr_sim *c, unsigned int want_khz)
+{
+	/* estimates are whole MHz, rounded down */
+	bool ok = c->s.rate_khz <= want_khz &&
+		  want_khz - c->s.rate_khz < 1000;
+
+	seq_printf(s, "%-20s want %u kHz, estimate %u kHz: %s\n", name,
+		   want_khz, c->s.rate_khz, ok ? "PASS" : "FAIL");
+
+	return ok ? 0 : -EINVAL;
+}
+
+static int ctr_sample_test_show(struct seq_file *s, void *data)
+{
+	struct ctr_sim *c;
+	unsigned int prev;
+	int err = 0;
+
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if (!c)
+		return -ENOMEM;
+	seqcount_init(&c->s.seq);
+
+	ctr_sim_sample(c, false, true);
+	ctr_sim_run(c, 1000, 1500000);
+	ctr_sim_sample(c, true, true);
+	err |= ctr_sim_check(s, "steady", c, 1500000);
+
+	/* ndiv write: the window restarts at the new rate */
+	ctr_sim_run(c, 1000, 2000000);
+	ctr_sim_sample(c, true, true);
+	err |= ctr_sim_check(s, "after switch", c, 2000000);
+
+	/* idle entry closes the window, idle exit opens a new one */
+	ctr_sim_run(c, 300, 2000000);
+	ctr_sim_sample(c, true, false);
+	ctr_sim_run(c, 10000, 0);
+	ctr_sim_sample(c, false, true);
+	ctr_sim_run(c, 400, 2000000);
+	ctr_sim_sample(c, true, true);
+	err |= ctr_sim_check(s, "across idle", c, 2000000);
+
+	ctr_sim_run(c, 1000, 1234567);
+	ctr_sim_sample(c, true, true);
+	err |= ctr_sim_check(s, "fractional MHz", c, 1234567);
+
+	/* too short to be accurate: the previous estimate stays */
+	prev = c->s.rate_khz;
+	ctr_sim_run(c, CTR_SAMPLE_MIN_US - 1, 800000);
+	ctr_sim_sample(c, true, true);
+	err |= ctr_sim_check(s, "short window", c, prev);
+
+	ctr_sim_run(c, CTR_SAMPLE_MIN_US, 800000);
+	ctr_sim_sample(c, true, true);
+	err |= ctr_sim_check(s, "shortest window", c, 800000);
+
+	/* both 32 bit counters wrap inside the window */
+	c->ref = 0xfffff000;
+	c->core = 0xffff0000;
+	ctr_sim_sample(c, false, true);
+	ctr_sim_run(c, 1000, 2200000);
+	ctr_sim_sample(c, true, true);
+	err |= ctr_sim_check(s, "counter wrap", c, 2200000);
+
+	/* long enough for the core counter to have wrapped unseen */
+	prev = c->s.rate_khz;
+	ctr_sim_run(c, CTR_SAMPLE_MAX_US + 1000, 1000000);
+	ctr_sim_sample(c, true, true);
+	err |= ctr_sim_check(s, "long window", c, prev);
+
+	/* closing with no window open, e.g. an ndiv write while idle */
+	ctr_sim_sample(c, true, false);
+	ctr_sim_run(c, 1000, 500000);
+	ctr_sim_sample(c, true, false);
+	err |= ctr_sim_check(s, "no open window", c, prev);
+
+	if (ctr_cached_khz(1500000, 1000, 1000, 100) != 1500000 ||
+	    ctr_cached_khz(1500000, 1000, 1100, 100) != 1500000 ||
+	    ctr_cached_khz(1500000, 1000, 1101, 100) != 0) {
+		seq_puts(s, "max age: FAIL\n");
+		err = -EINVAL;
+	} else {
+		seq_puts(s, "max age: PASS\n");
+	}
+
+	seq_printf(s, "%s\n", err ? "FAIL" : "PASS");
+	kfree(c);
+	return 0;
+}
+
+static int ctr_sample_test_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ctr_sample_test_show, inode->i_private);
+}
+
+static const struct file_operations ctr_sample_test_fops = {
+	.open = ctr_sample_test_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static struct dentry *tegra_cpufreq_debugfs_root;
 static int __init cc3_debug_init(void)
 {
@@ -686,6 +1325,19 @@ static int __init tegra_cpufreq_debug_init(void)
 					&freq_compute_fops))
 		goto err_out;
 
+	for_each_possible_cpu(cpu)
+		init_irq_work(&per_cpu(ndiv_sim_update, cpu).work,
+			      ndiv_sim_update_fn);
+	if (!debugfs_create_file("ndiv_sim_test", RO_MODE,
+				 tegra_cpufreq_debugfs_root, NULL,
+				 &ndiv_sim_test_fops))
+		goto err_out;
+
+	if (!debugfs_create_file("ctr_sample_test", RO_MODE,
+				 tegra_cpufreq_debugfs_root, NULL,
+				 &ctr_sample_test_fops))
+		goto err_out;
+
 	if (!tegra_debugfs_create_cpu_emc_map(tegra_cpufreq_debugfs_root,
 					cpu_emc_map_ptr))
 		goto err_out;
@@ -736,6 +1388,7 @@ static int tegra194_cpufreq_init(struct cpufreq_policy *policy)
 
 	policy->cpuinfo.transition_latency =
 	TEGRA_CPUFREQ_TRANSITION_LATENCY;
+	policy->fast_switch_possible = true;
 
 	if (cpufreq_single_policy)
 		cpumask_copy(policy->cpus, cpu_possible_mask);
@@ -767,6 +1420,7 @@ static struct cpufreq_driver tegra_cpufreq_driver = {
 				CPUFREQ_NEED_INITIAL_FREQ_CHECK,
 	.verify = cpufreq_generic_frequency_table_verify,
 	.target_index = tegra194_set_speed,
+	.fast_switch = tegra194_fast_switch,
 	.get = tegra194_get_speed,
 	.init = tegra194_cpufreq_init,
 	.exit = tegra194_cpufreq_exit,
@@ -840,6 +1494,31 @@ static struct notifier_block tegra_boundaries_cpufreq_nb = {
 	.notifier_call = tegra_boundaries_policy_notifier,
 };
 
+#ifdef CONFIG_CPU_PM
+static int tegra194_cpu_pm_notifier(struct notifier_block *nb,
+		unsigned long cmd, void *v)
+{
+	if (!cached_readback)
+		return NOTIFY_OK;
+
+	switch (cmd) {
+	case CPU_PM_ENTER:
+		ctr_sample_local(true, false);
+		break;
+	case CPU_PM_ENTER_FAILED:
+	case CPU_PM_EXIT:
+		ctr_sample_local(false, true);
+		break;
+	}
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block tegra194_cpu_pm_nb = {
+	.notifier_call = tegra194_cpu_pm_notifier,
+};
+#endif
+
 static void __init pm_qos_register_notifier(void)
 {
 	pm_qos_add_min_notifier(PM_QOS_CPU_FREQ_BOUNDS,
@@ -877,11 +1556,19 @@ static int tegra194_cpufreq_offline(unsigned int cpu)
 static void free_resources(void)
 {
 	enum cluster cl;
+	int cpu;
+
+	/* a fast switch may still have requests in flight */
+	for_each_possible_cpu(cpu)
+		irq_work_sync(&per_cpu(ndiv_update, cpu).work);
 
 	LOOP_FOR_EACH_CLUSTER(cl) {
 		if (!tfreq_data.pcluster[cl].configured)
 			continue;
 
+		irq_work_sync(&tfreq_data.pcluster[cl].emc_irq_work);
+		cancel_work_sync(&tfreq_data.pcluster[cl].emc_work);
+
 		/* free table */
 		kfree(tfreq_data.pcluster[cl].clft);
 
@@ -1124,6 +1811,16 @@ static int __init tegra194_cpufreq_probe(struct platform_device *pdev)
 
 	mutex_init(&tfreq_data.mlock);
 	tfreq_data.freq_compute_delay = US_DELAY;
+	for_each_possible_cpu(cpu) {
+		seqcount_init(&per_cpu(ctr_sample, cpu).seq);
+		init_irq_work(&per_cpu(ndiv_update, cpu).work,
+			      ndiv_update_fn);
+	}
+	LOOP_FOR_EACH_CLUSTER(cl) {
+		INIT_WORK(&tfreq_data.pcluster[cl].emc_work, emc_update_work);
+		init_irq_work(&tfreq_data.pcluster[cl].emc_irq_work,
+			      emc_update_irq_work);
+	}
 	tegra_hypervisor_mode = is_tegra_hypervisor_mode();
 
 	for_each_possible_cpu(cpu) {
@@ -1188,6 +1885,9 @@ static int __init tegra194_cpufreq_probe(struct platform_device *pdev)
 
 	cpufreq_register_notifier(&tegra_boundaries_cpufreq_nb,
 					CPUFREQ_POLICY_NOTIFIER);
+#ifdef CONFIG_CPU_PM
+	cpu_pm_register_notifier(&tegra194_cpu_pm_nb);
+#endif
 	goto err_out;
 err_free_res:
 	free_allocated_res_init();
@@ -1199,6 +1899,9 @@ err_out:
 
 static int __exit tegra194_cpufreq_remove(struct platform_device *pdev)
 {
+#ifdef CONFIG_CPU_PM
+	cpu_pm_unregister_notifier(&tegra194_cpu_pm_nb);
+#endif
 	cpufreq_unregister_notifier(&tegra_boundaries_cpufreq_nb,
 					CPUFREQ_POLICY_NOTIFIER);
 
@@ -51,6 +51,9 @@
 #include <linux/version.h>
 #include <linux/pm_qos.h>
 #include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/workqueue.h>
 #include <linux/platform/tegra/emc_bwmgr.h>
 #include <dt-bindings/interconnect/tegra_icc_id.h>
 
@@ -238,6 +241,7 @@ struct tegra_se_req_context {
 	bool init;	/* For GCM */
 	u8 *hash_result; /* Hash result buffer */
 	struct tegra_se_dev *se_dev;
+	struct skcipher_request fallback_req; /* CPU request, must be last */
 };
 
 struct tegra_se_priv_data {
@@ -260,6 +264,8 @@ struct tegra_se_priv_data {
 	unsigned int aesbuf_entry;
 };
 
+struct tegra_se_key_cache_entry;
+
 /* Security Engine AES context */
 struct tegra_se_aes_context {
 	struct tegra_se_dev *se_dev;	/* Security Engine device */
@@ -269,7 +275,11 @@ struct tegra_se_aes_context {
 	u32 keylen;	/* key length in bits */
 	u32 op_mode;	/* AES operation mode */
 	bool is_key_in_mem; /* Whether key is in memory */
-	u8 key[64]; /* To store key if is_key_in_mem set */
+	bool is_key_cached; /* Whether key is loaded through the slot cache */
+	struct tegra_se_key_cache_entry *key_entry; /* Slot cache reference */
+	u8 key[64]; /* To store key if is_key_in_mem or is_key_cached set */
+	struct crypto_skcipher *fallback; /* CPU implementation */
+	bool use_fallback; /* Whether the fallback holds the current key */
 };
 
 /* Security Engine random number generator context */
@@ -409,6 +419,62 @@ static unsigned int boost_cpu_freq;
 module_param(boost_cpu_freq, uint, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(boost_cpu_freq, "CPU frequency (in MHz) to boost");
 
+static bool aes_keyslot_cache;
+module_param(aes_keyslot_cache, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(aes_keyslot_cache,
+		 "Share key slots between identical AES keys, load lazily");
+
+static unsigned int aes_keyslot_cache_size = 8;
+module_param(aes_keyslot_cache_size, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(aes_keyslot_cache_size,
+		 "Maximum number of key slots held by the AES slot cache");
+
+static unsigned long aes_keyslot_cache_hits;
+module_param(aes_keyslot_cache_hits, ulong, S_IRUGO);
+MODULE_PARM_DESC(aes_keyslot_cache_hits, "AES key slot cache hits");
+
+static unsigned long aes_keyslot_cache_misses;
+module_param(aes_keyslot_cache_misses, ulong, S_IRUGO);
+MODULE_PARM_DESC(aes_keyslot_cache_misses, "AES key slot cache misses");
+
+static unsigned long aes_keyslot_cache_evictions;
+module_param(aes_keyslot_cache_evictions, ulong, S_IRUGO);
+MODULE_PARM_DESC(aes_keyslot_cache_evictions,
+		 "AES key slots evicted from the cache");
+
+/*
+ * Size-aware AES dispatch. For small payloads the command buffer setup,
+ * syncpoint wait and completion callback cost far more than running the
+ * cipher on the CPU crypto extensions, so requests shorter than the
+ * per-mode threshold are handed to the CPU implementation instead.
+ */
+enum tegra_se_aes_dispatch_mode {
+	SE_AES_DISPATCH_XTS,
+	SE_AES_DISPATCH_CBC,
+	SE_AES_DISPATCH_ECB,
+	SE_AES_DISPATCH_CTR,
+	SE_AES_DISPATCH_OFB,
+	SE_AES_DISPATCH_NUM,
+};
+
+static unsigned int aes_cpu_threshold[SE_AES_DISPATCH_NUM];
+module_param_array(aes_cpu_threshold, uint, NULL, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(aes_cpu_threshold,
+		 "Bytes below which xts,cbc,ecb,ctr,ofb run on the CPU (0: SE)");
+
+static unsigned long aes_cpu_reqs[SE_AES_DISPATCH_NUM];
+module_param_array(aes_cpu_reqs, ulong, NULL, S_IRUGO);
+MODULE_PARM_DESC(aes_cpu_reqs, "AES requests run on the CPU per mode");
+
+static unsigned long aes_se_reqs[SE_AES_DISPATCH_NUM];
+module_param_array(aes_se_reqs, ulong, NULL, S_IRUGO);
+MODULE_PARM_DESC(aes_se_reqs, "AES requests run on the SE per mode");
+
+static bool aes_dispatch_calibrate = true;
+module_param(aes_dispatch_calibrate, bool, S_IRUGO);
+MODULE_PARM_DESC(aes_dispatch_calibrate,
+		 "Measure the CPU/SE crossover of unset thresholds at probe");
+
 static void tegra_se_restore_cpu_freq_fn(struct work_struct *work)
 {
 	struct tegra_se_dev *se_dev = container_of(
@@ -562,6 +628,131 @@ static struct tegra_se_slot *tegra_se_alloc_key_slot(void)
 	return found ? slot : NULL;
 }
 
+/*
+ * AES key slot cache. Entries are addressed by key contents, so tfms with
+ * identical keys share one entry, and each tfm holds a reference on the
+ * entry of its current key. Hardware slots are assigned to entries on
+ * use, up to aes_keyslot_cache_size of them, and taken from the least
+ * recently used entry once that many are held. Keys are written into the
+ * slot as part of the command buffer of the request that needs them, so
+ * a slot can be reassigned at any time: requests execute in channel order
+ * and each one reloads its key if the slot was taken in between. When the
+ * last tfm drops an entry the key is wiped and the slot goes back to the
+ * key slot pool. The cache is protected by se_dev->mtx.
+ */
+struct tegra_se_key_cache_entry {
+	struct list_head node;
+	struct tegra_se_slot *slot;	/* Key slot, NULL if none assigned */
+	u8 key[64];			/* Key contents */
+	u32 keylen;			/* Key length */
+	bool loaded;			/* Whether slot holds the key */
+	unsigned int refcnt;		/* Number of tfms using the key */
+	u64 last_use;			/* LRU stamp */
+};
+
+static LIST_HEAD(key_cache);
+static unsigned int key_cache_slots;
+static u64 key_cache_clock;
+
+static struct tegra_se_key_cache_entry *tegra_se_key_cache_hold(
+					const u8 *key, u32 keylen)
+{
+	struct tegra_se_key_cache_entry *e;
+
+	list_for_each_entry(e, &key_cache, node) {
+		if (e->keylen == keylen && !crypto_memneq(e->key, key, keylen)) {
+			e->refcnt++;
+			return e;
+		}
+	}
+
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if (!e)
+		return NULL;
+
+	memcpy(e->key, key, keylen);
+	e->keylen = keylen;
+	e->refcnt = 1;
+	list_add(&e->node, &key_cache);
+
+	return e;
+}
+
+static void tegra_se_key_cache_put(struct tegra_se_key_cache_entry *e)
+{
+	if (!e || --e->refcnt)
+		return;
+
+	if (e->slot) {
+		tegra_se_free_key_slot(e->slot);
+		key_cache_slots--;
+	}
+	list_del(&e->node);
+	memzero_explicit(e->key, sizeof(e->key));
+	kfree(e);
+}
+
+static struct tegra_se_slot *tegra_se_key_cache_get(
+			struct tegra_se_key_cache_entry *e, bool *load)
+{
+	struct tegra_se_key_cache_entry *lru = NULL, *it;
+	struct tegra_se_slot *slot = NULL;
+
+	e->last_use = ++key_cache_clock;
+
+	if (e->slot && e->loaded) {
+		aes_keyslot_cache_hits++;
+		*load = false;
+		return e->slot;
+	}
+
+	aes_keyslot_cache_misses++;
+
+	if (!e->slot) {
+		if (key_cache_slots < min_t(unsigned int,
+					    aes_keyslot_cache_size,
+					    TEGRA_SE_KEYSLOT_COUNT))
+			slot = tegra_se_alloc_key_slot();
+
+		if (slot) {
+			key_cache_slots++;
+		} else {
+			list_for_each_entry(it, &key_cache, node) {
+				if (it->slot &&
+				    (!lru || it->last_use < lru->last_use))
+					lru = it;
+			}
+			if (!lru)
+				return NULL;
+			slot = lru->slot;
+			lru->slot = NULL;
+			lru->loaded = false;
+			aes_keyslot_cache_evictions++;
+		}
+		e->slot = slot;
+	}
+
+	e->loaded = true;
+	*load = true;
+
+	return e->slot;
+}
+
+/* Forget the contents of the slot held by @e, e.g. after a failed load */
+static void tegra_se_key_cache_invalidate(struct tegra_se_key_cache_entry *e)
+{
+	e->loaded = false;
+}
+
+/* Forget all cached slot contents, e.g. after a failed submit */
+static void tegra_se_key_cache_flush(void)
+{
+	struct tegra_se_key_cache_entry *e;
+
+	list_for_each_entry(e, &key_cache, node)
+		tegra_se_key_cache_invalidate(e);
+}
+
 static int tegra_init_key_slot(struct tegra_se_dev *se_dev)
 {
 	int i;
@@ -2297,6 +2488,8 @@ static int tegra_se_prepare_cmdbuf(struct tegra_se_dev *se_dev,
 	struct tegra_se_req_context *req_ctx;
 	struct crypto_skcipher *tfm;
 	u32 keylen;
+	struct tegra_se_slot *slot;
+	bool load;
 
 	pr_debug("%s:%d req_cnt = %d\n", __func__, __LINE__, se_dev->req_cnt);
 
@@ -2304,8 +2497,29 @@ static int tegra_se_prepare_cmdbuf(struct tegra_se_dev *se_dev,
 		req = se_dev->reqs[i];
 		tfm = crypto_skcipher_reqtfm(req);
 		aes_ctx = crypto_skcipher_ctx(tfm);
+		slot = aes_ctx->slot;
+
+		if (aes_ctx->is_key_cached) {
+			slot = tegra_se_key_cache_get(aes_ctx->key_entry,
+						      &load);
+			if (slot && load) {
+				ret = tegra_se_send_key_data(se_dev,
+					aes_ctx->key, aes_ctx->keylen,
+					slot->slot_num,
+					SE_KEY_TABLE_TYPE_KEY_IN_MEM,
+					se_dev->opcode_addr, cpuvaddr, iova,
+					AES_CB);
+				if (ret) {
+					tegra_se_key_cache_invalidate(
+							aes_ctx->key_entry);
+					dev_err(se_dev->dev, "Error in setting Key\n");
+					goto out;
+				}
+			}
+		}
+
 		/* Ensure there is valid slot info */
-		if (!aes_ctx->slot) {
+		if (!slot) {
 			dev_err(se_dev->dev, "Invalid AES Ctx Slot\n");
 			return -EINVAL;
 		}
@@ -2315,7 +2529,7 @@ static int tegra_se_prepare_cmdbuf(struct tegra_se_dev *se_dev,
 					       "xts(aes)")) {
 				ret = tegra_se_send_key_data(
 					se_dev, aes_ctx->key, aes_ctx->keylen,
-					aes_ctx->slot->slot_num,
+					slot->slot_num,
 					SE_KEY_TABLE_TYPE_KEY_IN_MEM,
 					se_dev->opcode_addr, cpuvaddr, iova,
 					AES_CB);
@@ -2323,7 +2537,7 @@ static int tegra_se_prepare_cmdbuf(struct tegra_se_dev *se_dev,
 				keylen = aes_ctx->keylen / 2;
 				ret = tegra_se_send_key_data(se_dev,
 					aes_ctx->key, keylen,
-					aes_ctx->slot->slot_num,
+					slot->slot_num,
 					SE_KEY_TABLE_TYPE_XTS_KEY1_IN_MEM,
 					se_dev->opcode_addr, cpuvaddr, iova,
 					AES_CB);
@@ -2334,7 +2548,7 @@ static int tegra_se_prepare_cmdbuf(struct tegra_se_dev *se_dev,
 
 				ret = tegra_se_send_key_data(se_dev,
 					aes_ctx->key + keylen, keylen,
-					aes_ctx->slot->slot_num,
+					slot->slot_num,
 					SE_KEY_TABLE_TYPE_XTS_KEY2_IN_MEM,
 					se_dev->opcode_addr, cpuvaddr, iova,
 					AES_CB);
@@ -2356,7 +2570,7 @@ static int tegra_se_prepare_cmdbuf(struct tegra_se_dev *se_dev,
 			} else {
 				ret = tegra_se_send_key_data(
 				se_dev, req->iv, TEGRA_SE_AES_IV_SIZE,
-				aes_ctx->slot->slot_num,
+				slot->slot_num,
 				SE_KEY_TABLE_TYPE_UPDTDIV, se_dev->opcode_addr,
 				cpuvaddr, iova, AES_CB);
 			}
@@ -2373,14 +2587,14 @@ static int tegra_se_prepare_cmdbuf(struct tegra_se_dev *se_dev,
 			req_ctx->crypto_config = tegra_se_get_crypto_config(
 						se_dev, req_ctx->op_mode,
 						req_ctx->encrypt,
-						aes_ctx->slot->slot_num,
+						slot->slot_num,
 						aes_ctx->slot2->slot_num,
 						false);
 		} else {
 			req_ctx->crypto_config = tegra_se_get_crypto_config(
 						se_dev, req_ctx->op_mode,
 						req_ctx->encrypt,
-						aes_ctx->slot->slot_num,
+						slot->slot_num,
 						0,
 						false);
 		}
@@ -2444,6 +2658,7 @@ static void tegra_se_process_new_req(struct tegra_se_dev *se_dev)
 
 	return;
 cmdbuf_out:
+	tegra_se_key_cache_flush();
 	atomic_set(&se_dev->cmdbuf_addr_list[index].free, 1);
 index_out:
 	dma_unmap_sg(se_dev->dev, &se_dev->sg, 1, DMA_BIDIRECTIONAL);
@@ -2502,11 +2717,58 @@ static void tegra_se_work_handler(struct work_struct *work)
 	mutex_unlock(&se_dev->mtx);
 }
 
+static int tegra_se_aes_dispatch_mode(enum tegra_se_aes_op_mode op_mode)
+{
+	switch (op_mode) {
+	case SE_AES_OP_MODE_XTS:
+		return SE_AES_DISPATCH_XTS;
+	case SE_AES_OP_MODE_CBC:
+		return SE_AES_DISPATCH_CBC;
+	case SE_AES_OP_MODE_ECB:
+		return SE_AES_DISPATCH_ECB;
+	case SE_AES_OP_MODE_CTR:
+		return SE_AES_DISPATCH_CTR;
+	case SE_AES_OP_MODE_OFB:
+		return SE_AES_DISPATCH_OFB;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int tegra_se_aes_cpu_crypt(struct tegra_se_aes_context *ctx,
+				  struct skcipher_request *req)
+{
+	struct tegra_se_req_context *req_ctx = skcipher_request_ctx(req);
+	struct skcipher_request *subreq = &req_ctx->fallback_req;
+
+	skcipher_request_set_tfm(subreq, ctx->fallback);
+	skcipher_request_set_callback(subreq, req->base.flags,
+				      req->base.complete, req->base.data);
+	skcipher_request_set_crypt(subreq, req->src, req->dst,
+				   req->cryptlen, req->iv);
+
+	return req_ctx->encrypt ? crypto_skcipher_encrypt(subreq) :
+				  crypto_skcipher_decrypt(subreq);
+}
+
 static int tegra_se_aes_queue_req(struct tegra_se_dev *se_dev,
 				  struct skcipher_request *req)
 {
+	struct tegra_se_req_context *req_ctx = skcipher_request_ctx(req);
+	struct tegra_se_aes_context *ctx =
+			crypto_skcipher_ctx(crypto_skcipher_reqtfm(req));
+	int mode = tegra_se_aes_dispatch_mode(req_ctx->op_mode);
 	int err = 0;
 
+	if (mode >= 0) {
+		if (ctx->use_fallback &&
+		    req->cryptlen < READ_ONCE(aes_cpu_threshold[mode])) {
+			aes_cpu_reqs[mode]++;
+			return tegra_se_aes_cpu_crypt(ctx, req);
+		}
+		aes_se_reqs[mode]++;
+	}
+
 	mutex_lock(&se_dev->lock);
 	err = crypto_enqueue_request(&se_dev->queue, &req->base);
 
@@ -2684,8 +2946,15 @@ static int tegra_se_aes_setkey(struct crypto_skcipher *tfm,
 		return -EINVAL;
 	}
 
+	ctx->use_fallback = false;
+
 	if ((keylen >> SE_MAGIC_PATTERN_OFFSET) == SE_STORE_KEY_IN_MEM) {
+		mutex_lock(&se_dev->mtx);
+		tegra_se_key_cache_put(ctx->key_entry);
+		ctx->key_entry = NULL;
+		mutex_unlock(&se_dev->mtx);
 		ctx->is_key_in_mem = true;
+		ctx->is_key_cached = false;
 		ctx->keylen = (keylen & SE_KEY_LEN_MASK);
 		ctx->slot = &keymem_slot;
 		memcpy(ctx->key, key, ctx->keylen);
@@ -2693,7 +2962,45 @@ static int tegra_se_aes_setkey(struct crypto_skcipher *tfm,
 	}
 	ctx->is_key_in_mem = false;
 
+	/* Only plain keys can be handed to the CPU implementation */
+	if (key && ctx->fallback) {
+		crypto_skcipher_clear_flags(ctx->fallback, CRYPTO_TFM_REQ_MASK);
+		crypto_skcipher_set_flags(ctx->fallback,
+					  crypto_skcipher_get_flags(tfm) &
+					  CRYPTO_TFM_REQ_MASK);
+		ctx->use_fallback =
+			!crypto_skcipher_setkey(ctx->fallback, key, keylen);
+	}
+
 	mutex_lock(&se_dev->mtx);
+	if (key && aes_keyslot_cache &&
+	    se_dev->chipdata->kac_type == SE_KAC_T18X &&
+	    strcmp(crypto_tfm_alg_name(&tfm->base), "xts(aes)")) {
+		struct tegra_se_key_cache_entry *e;
+
+		/* Key is loaded into a shared slot on first use */
+		e = tegra_se_key_cache_hold(key, keylen);
+		if (!e) {
+			mutex_unlock(&se_dev->mtx);
+			return -ENOMEM;
+		}
+		tegra_se_key_cache_put(ctx->key_entry);
+		ctx->key_entry = e;
+		if (!ctx->is_key_cached) {
+			tegra_se_free_key_slot(ctx->slot);
+			tegra_se_free_key_slot(ctx->slot2);
+			ctx->slot = NULL;
+			ctx->slot2 = NULL;
+		}
+		memcpy(ctx->key, key, keylen);
+		ctx->keylen = keylen;
+		ctx->is_key_cached = true;
+		goto out;
+	}
+	tegra_se_key_cache_put(ctx->key_entry);
+	ctx->key_entry = NULL;
+	ctx->is_key_cached = false;
+
 	if (key) {
 		if (!ctx->slot ||
 		    (ctx->slot &&
@@ -2791,8 +3098,23 @@ out:
 
 static int tegra_se_aes_cra_init(struct crypto_skcipher *tfm)
 {
+	struct tegra_se_aes_context *ctx = crypto_tfm_ctx(&tfm->base);
+	struct crypto_skcipher *fallback;
+
 	tfm->reqsize = sizeof(struct tegra_se_req_context);
 
+	/* Without a CPU implementation every request goes to the SE */
+	fallback = crypto_alloc_skcipher(crypto_tfm_alg_name(&tfm->base), 0,
+					 CRYPTO_ALG_ASYNC |
+					 CRYPTO_ALG_NEED_FALLBACK);
+	if (IS_ERR(fallback)) {
+		ctx->fallback = NULL;
+		return 0;
+	}
+
+	ctx->fallback = fallback;
+	tfm->reqsize += crypto_skcipher_reqsize(fallback);
+
 	return 0;
 }
 
@@ -2800,10 +3122,24 @@ static void tegra_se_aes_cra_exit(struct crypto_skcipher *tfm)
 {
 	struct tegra_se_aes_context *ctx = crypto_tfm_ctx(&tfm->base);
 
+	if (ctx->key_entry) {
+		mutex_lock(&ctx->se_dev->mtx);
+		tegra_se_key_cache_put(ctx->key_entry);
+		ctx->key_entry = NULL;
+		mutex_unlock(&ctx->se_dev->mtx);
+	}
+	ctx->is_key_cached = false;
+
 	tegra_se_free_key_slot(ctx->slot);
 	tegra_se_free_key_slot(ctx->slot2);
 	ctx->slot = NULL;
 	ctx->slot2 = NULL;
+	memzero_explicit(ctx->key, sizeof(ctx->key));
+
+	if (ctx->fallback)
+		crypto_free_skcipher(ctx->fallback);
+	ctx->fallback = NULL;
+	ctx->use_fallback = false;
 }
 
 static int tegra_se_rng_drbg_init(struct crypto_tfm *tfm)
@@ -6391,7 +6727,8 @@ static struct skcipher_alg aes_algs[] = {
 		.base.cra_driver_name	= "xts-aes-tegra",
 		.base.cra_priority	= 500,
 		.base.cra_flags		= CRYPTO_ALG_TYPE_SKCIPHER |
-					  CRYPTO_ALG_ASYNC,
+					  CRYPTO_ALG_ASYNC |
+					  CRYPTO_ALG_NEED_FALLBACK,
 		.base.cra_blocksize	= TEGRA_SE_AES_BLOCK_SIZE,
 		.base.cra_ctxsize	= sizeof(struct tegra_se_aes_context),
 		.base.cra_alignmask	= 0,
@@ -6410,7 +6747,8 @@ static struct skcipher_alg aes_algs[] = {
 		.base.cra_driver_name	= "cbc-aes-tegra",
 		.base.cra_priority	= 500,
 		.base.cra_flags		= CRYPTO_ALG_TYPE_SKCIPHER |
-					  CRYPTO_ALG_ASYNC,
+					  CRYPTO_ALG_ASYNC |
+					  CRYPTO_ALG_NEED_FALLBACK,
 		.base.cra_blocksize	= TEGRA_SE_AES_BLOCK_SIZE,
 		.base.cra_ctxsize	= sizeof(struct tegra_se_aes_context),
 		.base.cra_alignmask	= 0,
@@ -6429,7 +6767,8 @@ static struct skcipher_alg aes_algs[] = {
 		.base.cra_driver_name	= "ecb-aes-tegra",
 		.base.cra_priority	= 500,
 		.base.cra_flags		= CRYPTO_ALG_TYPE_SKCIPHER |
-					  CRYPTO_ALG_ASYNC,
+					  CRYPTO_ALG_ASYNC |
+					  CRYPTO_ALG_NEED_FALLBACK,
 		.base.cra_blocksize	= TEGRA_SE_AES_BLOCK_SIZE,
 		.base.cra_ctxsize	= sizeof(struct tegra_se_aes_context),
 		.base.cra_alignmask	= 0,
@@ -6448,7 +6787,8 @@ static struct skcipher_alg aes_algs[] = {
 		.base.cra_driver_name	= "ctr-aes-tegra",
 		.base.cra_priority	= 500,
 		.base.cra_flags		= CRYPTO_ALG_TYPE_SKCIPHER |
-					  CRYPTO_ALG_ASYNC,
+					  CRYPTO_ALG_ASYNC |
+					  CRYPTO_ALG_NEED_FALLBACK,
 		.base.cra_blocksize	= TEGRA_SE_AES_BLOCK_SIZE,
 		.base.cra_ctxsize	= sizeof(struct tegra_se_aes_context),
 		.base.cra_alignmask	= 0,
@@ -6467,7 +6807,8 @@ static struct skcipher_alg aes_algs[] = {
 		.base.cra_driver_name	= "ofb-aes-tegra",
 		.base.cra_priority	= 500,
 		.base.cra_flags		= CRYPTO_ALG_TYPE_SKCIPHER |
-					  CRYPTO_ALG_ASYNC,
+					  CRYPTO_ALG_ASYNC |
+					  CRYPTO_ALG_NEED_FALLBACK,
 		.base.cra_blocksize	= TEGRA_SE_AES_BLOCK_SIZE,
 		.base.cra_ctxsize	= sizeof(struct tegra_se_aes_context),
 		.base.cra_alignmask	= 0,
@@ -7062,6 +7403,118 @@ static void tegra_se_fill_se_dev_info(struct tegra_se_dev *se_dev)
 		se_devices[SE_AEAD] = se_dev;
 }
 
+#define SE_AES_CALIB_MIN_LEN	16
+#define SE_AES_CALIB_MAX_LEN	SZ_16K
+#define SE_AES_CALIB_ITERS	8
+
+static const char * const aes_dispatch_drivers[SE_AES_DISPATCH_NUM] = {
+	[SE_AES_DISPATCH_XTS] = "xts-aes-tegra",
+	[SE_AES_DISPATCH_CBC] = "cbc-aes-tegra",
+	[SE_AES_DISPATCH_ECB] = "ecb-aes-tegra",
+	[SE_AES_DISPATCH_CTR] = "ctr-aes-tegra",
+	[SE_AES_DISPATCH_OFB] = "ofb-aes-tegra",
+};
+
+static u64 tegra_se_aes_calib_time(struct crypto_skcipher *tfm,
+				   struct scatterlist *sg, unsigned int len)
+{
+	struct skcipher_request *req;
+	DECLARE_CRYPTO_WAIT(wait);
+	u8 iv[AES_BLOCK_SIZE] = {0};
+	ktime_t start;
+	u64 ns;
+	int i, err = 0;
+
+	req = skcipher_request_alloc(tfm, GFP_KERNEL);
+	if (!req)
+		return U64_MAX;
+
+	skcipher_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG |
+				      CRYPTO_TFM_REQ_MAY_SLEEP,
+				      crypto_req_done, &wait);
+
+	start = ktime_get();
+	for (i = 0; i < SE_AES_CALIB_ITERS && !err; i++) {
+		skcipher_request_set_crypt(req, sg, sg, len, iv);
+		err = crypto_wait_req(crypto_skcipher_encrypt(req), &wait);
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	skcipher_request_free(req);
+
+	return err ? U64_MAX : ns;
+}
+
+/*
+ * Time the SE and the CPU implementation of one mode over doubling
+ * payload sizes; the threshold is the first size at which the SE wins.
+ */
+static void tegra_se_aes_calibrate_mode(int mode, void *buf)
+{
+	const char *drv = aes_dispatch_drivers[mode];
+	struct crypto_skcipher *se_tfm, *cpu_tfm;
+	unsigned int keylen, len;
+	struct scatterlist sg;
+	u8 key[2 * AES_KEYSIZE_128];
+
+	se_tfm = crypto_alloc_skcipher(drv, 0, 0);
+	if (IS_ERR(se_tfm))
+		return;
+
+	cpu_tfm = crypto_alloc_skcipher(crypto_tfm_alg_name(&se_tfm->base), 0,
+					CRYPTO_ALG_ASYNC |
+					CRYPTO_ALG_NEED_FALLBACK);
+	if (IS_ERR(cpu_tfm))
+		goto free_se;
+
+	keylen = (mode == SE_AES_DISPATCH_XTS) ? 2 * AES_KEYSIZE_128 :
+						 AES_KEYSIZE_128;
+	get_random_bytes(key, keylen);
+	if (crypto_skcipher_setkey(se_tfm, key, keylen) ||
+	    crypto_skcipher_setkey(cpu_tfm, key, keylen))
+		goto free_cpu;
+
+	sg_init_one(&sg, buf, SE_AES_CALIB_MAX_LEN);
+	for (len = SE_AES_CALIB_MIN_LEN; len <= SE_AES_CALIB_MAX_LEN;
+	     len <<= 1) {
+		if (tegra_se_aes_calib_time(se_tfm, &sg, len) <=
+		    tegra_se_aes_calib_time(cpu_tfm, &sg, len))
+			break;
+	}
+
+	/* A threshold set by the user while we were measuring wins */
+	if (!READ_ONCE(aes_cpu_threshold[mode])) {
+		WRITE_ONCE(aes_cpu_threshold[mode], len);
+		pr_info("%s: %s requests below %u bytes run on the CPU\n",
+			__func__, drv, len);
+	}
+
+free_cpu:
+	crypto_free_skcipher(cpu_tfm);
+free_se:
+	crypto_free_skcipher(se_tfm);
+	memzero_explicit(key, sizeof(key));
+}
+
+static void tegra_se_aes_calibrate_work(struct work_struct *work)
+{
+	void *buf;
+	int mode;
+
+	buf = kzalloc(SE_AES_CALIB_MAX_LEN, GFP_KERNEL);
+	if (!buf)
+		return;
+
+	for (mode = 0; mode < SE_AES_DISPATCH_NUM; mode++) {
+		if (!READ_ONCE(aes_cpu_threshold[mode]))
+			tegra_se_aes_calibrate_mode(mode, buf);
+	}
+
+	kfree(buf);
+}
+
+static DECLARE_WORK(aes_calibrate_work, tegra_se_aes_calibrate_work);
+
 static int tegra_se_probe(struct platform_device *pdev)
 {
 	struct tegra_se_dev *se_dev = NULL;
@@ -7218,6 +7671,10 @@ static int tegra_se_probe(struct platform_device *pdev)
 		}
 	}
 
+	if (aes_dispatch_calibrate &&
+	    (is_algo_supported(node, "xts") || is_algo_supported(node, "aes")))
+		schedule_work(&aes_calibrate_work);
+
 	if (is_algo_supported(node, "cmac")) {
 		err = crypto_register_ahash(&hash_algs[0]);
 		if (err) {
@@ -7408,6 +7865,7 @@ static int tegra_se_remove(struct platform_device *pdev)
 		return -ENODEV;
 	}
 
+	cancel_work_sync(&aes_calibrate_work);
 	tegra_se_boost_cpu_deinit(se_dev);
 
 	if (se_dev->aes_cmdbuf_cpuvaddr)
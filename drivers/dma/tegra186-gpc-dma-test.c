@@ -0,0 +1,304 @@
+/*
+ * DMA test of the Tegra GPC DMA controller, run at module load.
+ *
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+/*
+ * Each round requests a memcpy channel, queues descs transfers before
+ * issuing them, waits for all callbacks and releases the channel again.
+ * The default of 32 transfers is more than the default descriptor pool of
+ * a channel holds, so the pool refill and the GFP_NOWAIT fallback both run,
+ * and releasing the channel every round frees and reallocates the pools.
+ *
+ * Every fourth transfer is a memset, the others are memcpys of random
+ * length and word aligned offsets. Like dmatest, the bytes around each
+ * destination are filled with a guard value that must survive, and the
+ * bytes inside must match the source or the fill pattern.
+ */
+
+#define pr_fmt(fmt)	"tegra-gpcdma-test: " fmt
+
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+
+#define TEST_BUF_SIZE		(16 * 1024)
+#define TEST_MAX_DESCS		(256)
+#define TEST_GUARD		(0xa5)
+#define TEST_FILL		(0x5a5a5a5a)
+#define TEST_TIMEOUT_MS		(1000)
+
+static unsigned int rounds = 100;
+module_param(rounds, uint, 0444);
+MODULE_PARM_DESC(rounds, "channel request/release rounds");
+
+static unsigned int descs = 32;
+module_param(descs, uint, 0444);
+MODULE_PARM_DESC(descs, "transfers queued per round");
+
+static unsigned int seed = 1;
+module_param(seed, uint, 0444);
+MODULE_PARM_DESC(seed, "seed of the transfer sizes and data");
+
+struct gpcdma_test_xfer {
+	size_t src_off;
+	size_t dst_off;
+	size_t len;
+	bool memset;
+};
+
+struct gpcdma_test {
+	u8 *src;
+	u8 *dst;
+	struct gpcdma_test_xfer xfer[TEST_MAX_DESCS];
+	struct completion done;
+	atomic_t pending;
+	struct rnd_state rnd;
+	u64 transfers;
+	u64 bytes;
+};
+
+static void gpcdma_test_callback(void *param)
+{
+	struct gpcdma_test *t = param;
+
+	if (atomic_dec_and_test(&t->pending))
+		complete(&t->done);
+}
+
+/* random word aligned value in [0, max).*/
+static size_t gpcdma_test_rand(struct gpcdma_test *t, size_t max)
+{
+	return (prandom_u32_state(&t->rnd) % (max / 4)) * 4;
+}
+
+static void gpcdma_test_fill(struct gpcdma_test *t)
+{
+	struct gpcdma_test_xfer *x = NULL;
+	unsigned int i = 0;
+
+	prandom_bytes_state(&t->rnd, t->src, descs * TEST_BUF_SIZE);
+	memset(t->dst, TEST_GUARD, descs * TEST_BUF_SIZE);
+
+	for (i = 0; i < descs; i++) {
+		x = &t->xfer[i];
+		x->memset = (i % 4) == 3;
+		x->src_off = gpcdma_test_rand(t, TEST_BUF_SIZE);
+		x->dst_off = gpcdma_test_rand(t, TEST_BUF_SIZE);
+		x->len = 4 + gpcdma_test_rand(t, TEST_BUF_SIZE -
+					      max(x->src_off, x->dst_off));
+	}
+}
+
+static int gpcdma_test_verify(struct gpcdma_test *t)
+{
+	struct gpcdma_test_xfer *x = NULL;
+	u32 fill = TEST_FILL;
+	const u8 *dst = NULL;
+	size_t j = 0;
+	unsigned int i = 0;
+
+	for (i = 0; i < descs; i++) {
+		x = &t->xfer[i];
+		dst = t->dst + i * TEST_BUF_SIZE;
+
+		for (j = 0; j < TEST_BUF_SIZE; j++) {
+			if (j >= x->dst_off && j < x->dst_off + x->len)
+				continue;
+			if (dst[j] != TEST_GUARD) {
+				pr_err("transfer %u wrote outside 0x%zx+0x%zx at 0x%zx\n",
+				       i, x->dst_off, x->len, j);
+				return -EIO;
+			}
+		}
+
+		for (j = 0; j < x->len; j += 4) {
+			if (x->memset ?
+			    memcmp(dst + x->dst_off + j, &fill, 4) :
+			    memcmp(dst + x->dst_off + j,
+				   t->src + i * TEST_BUF_SIZE + x->src_off + j,
+				   4)) {
+				pr_err("transfer %u mismatch at 0x%zx of 0x%zx\n",
+				       i, j, x->len);
+				return -EIO;
+			}
+		}
+
+		t->bytes += x->len;
+	}
+
+	t->transfers += descs;
+	return 0;
+}
+
+static int gpcdma_test_round(struct gpcdma_test *t)
+{
+	unsigned long flags = DMA_PREP_INTERRUPT | DMA_CTRL_ACK;
+	struct dma_async_tx_descriptor *tx = NULL;
+	struct gpcdma_test_xfer *x = NULL;
+	struct dma_chan *chan = NULL;
+	struct device *dev = NULL;
+	dma_addr_t src = 0, dst = 0;
+	dma_cap_mask_t mask;
+	dma_cookie_t cookie = 0;
+	size_t size = descs * TEST_BUF_SIZE;
+	unsigned int i = 0;
+	int ret = 0;
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+	chan = dma_request_channel(mask, NULL, NULL);
+	if (!chan) {
+		pr_err("no memcpy channel\n");
+		return -ENODEV;
+	}
+	dev = chan->device->dev;
+
+	gpcdma_test_fill(t);
+
+	src = dma_map_single(dev, t->src, size, DMA_TO_DEVICE);
+	if (dma_mapping_error(dev, src)) {
+		ret = -ENOMEM;
+		goto release;
+	}
+	/* bidirectional so that the guard bytes reach memory first */
+	dst = dma_map_single(dev, t->dst, size, DMA_BIDIRECTIONAL);
+	if (dma_mapping_error(dev, dst)) {
+		ret = -ENOMEM;
+		goto unmap_src;
+	}
+
+	reinit_completion(&t->done);
+	atomic_set(&t->pending, descs);
+
+	for (i = 0; i < descs; i++) {
+		x = &t->xfer[i];
+		if (x->memset)
+			tx = dmaengine_prep_dma_memset(chan,
+					dst + i * TEST_BUF_SIZE + x->dst_off,
+					TEST_FILL, x->len, flags);
+		else
+			tx = dmaengine_prep_dma_memcpy(chan,
+					dst + i * TEST_BUF_SIZE + x->dst_off,
+					src + i * TEST_BUF_SIZE + x->src_off,
+					x->len, flags);
+		if (!tx) {
+			pr_err("prep of transfer %u failed\n", i);
+			ret = -EIO;
+			goto terminate;
+		}
+
+		tx->callback = gpcdma_test_callback;
+		tx->callback_param = t;
+		cookie = dmaengine_submit(tx);
+		if (dma_submit_error(cookie)) {
+			pr_err("submit of transfer %u failed\n", i);
+			ret = -EIO;
+			goto terminate;
+		}
+	}
+
+	dma_async_issue_pending(chan);
+	if (!wait_for_completion_timeout(&t->done,
+					 msecs_to_jiffies(TEST_TIMEOUT_MS))) {
+		pr_err("%d transfers did not complete\n",
+		       atomic_read(&t->pending));
+		ret = -ETIMEDOUT;
+		goto terminate;
+	}
+
+	if (dma_async_is_tx_complete(chan, cookie, NULL, NULL) !=
+	    DMA_COMPLETE) {
+		pr_err("last transfer not reported complete\n");
+		ret = -EIO;
+	}
+
+terminate:
+	if (ret)
+		dmaengine_terminate_all(chan);
+	dma_unmap_single(dev, dst, size, DMA_BIDIRECTIONAL);
+unmap_src:
+	dma_unmap_single(dev, src, size, DMA_TO_DEVICE);
+release:
+	dma_release_channel(chan);
+
+	if (!ret)
+		ret = gpcdma_test_verify(t);
+
+	return ret;
+}
+
+static int __init gpcdma_test_init(void)
+{
+	struct gpcdma_test *t = NULL;
+	ktime_t start;
+	u64 ns = 0;
+	unsigned int i = 0;
+	int ret = 0;
+
+	if (!descs || descs > TEST_MAX_DESCS) {
+		pr_err("descs must be 1..%d\n", TEST_MAX_DESCS);
+		return -EINVAL;
+	}
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	t->src = kmalloc(descs * TEST_BUF_SIZE, GFP_KERNEL);
+	t->dst = kmalloc(descs * TEST_BUF_SIZE, GFP_KERNEL);
+	if (!t->src || !t->dst) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	init_completion(&t->done);
+	prandom_seed_state(&t->rnd, seed);
+
+	start = ktime_get();
+	for (i = 0; i < rounds; i++) {
+		ret = gpcdma_test_round(t);
+		if (ret) {
+			pr_err("round %u failed: %d (seed %u)\n", i, ret, seed);
+			goto err;
+		}
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	pr_info("passed: %llu transfers, %llu bytes, %llu ns/transfer\n",
+		t->transfers, t->bytes,
+		t->transfers ? div64_u64(ns, t->transfers) : 0);
+
+err:
+	kfree(t->dst);
+	kfree(t->src);
+	kfree(t);
+	return ret;
+}
+
+static void __exit gpcdma_test_exit(void)
+{
+}
+
+module_init(gpcdma_test_init);
+module_exit(gpcdma_test_exit);
+
+MODULE_DESCRIPTION("NVIDIA Tegra GPC DMA test");
+MODULE_LICENSE("GPL v2");
+MODULE_AUTHOR("Nvidia Corporation");
@@ -167,6 +167,23 @@
 /* Channel base address offset from GPCDMA base address */
 #define TEGRA_GPCDMA_CHANNEL_BASE_ADD_OFFSET	0x10000
 
+/*
+ * Default per channel descriptor and sg request pool sizes, used when
+ * nvidia,preallocated-descs/sg is not given in DT.
+ */
+#define TEGRA_GPCDMA_DESC_POOL_SIZE		8
+#define TEGRA_GPCDMA_SG_REQ_POOL_SIZE		64
+
+/*
+ * Merge sg entries which are contiguous in DMA address space into one hw
+ * request, so that long sg lists take fewer EOC interrupts. Only applies to
+ * slave configs with a fixed burst size.
+ */
+static bool merge_contiguous_sg;
+module_param(merge_contiguous_sg, bool, 0644);
+MODULE_PARM_DESC(merge_contiguous_sg,
+		 "Merge DMA contiguous sg entries into one transfer");
+
 struct tegra_dma;
 
 /*
@@ -259,6 +276,10 @@ struct tegra_dma_channel {
 	struct list_head	free_dma_desc;
 	struct list_head	cb_desc;
 
+	/* Pools backing the free lists, allocated in alloc_chan_resources */
+	struct tegra_dma_desc	*desc_pool;
+	struct tegra_dma_sg_req	*sg_req_pool;
+
 	/* ISR handler and tasklet for bottom half of isr handling */
 	dma_isr_handler		isr_handler;
 	struct tasklet_struct	tasklet;
@@ -278,6 +299,9 @@ struct tegra_dma {
 	void __iomem			*base_addr;
 	const struct tegra_dma_chip_data *chip_data;
 	struct reset_control *rst;
+	/* Per channel pool sizes */
+	int desc_pool_size;
+	int sg_req_pool_size;
 	/* Last member of the structure */
 	struct tegra_dma_channel channels[0];
 };
@@ -351,26 +375,38 @@ static void tegra_dma_desc_put(struct tegra_dma_channel *tdc,
 	raw_spin_unlock_irqrestore(&tdc->lock, flags);
 }
 
+static void tegra_dma_desc_init(struct tegra_dma_channel *tdc,
+		struct tegra_dma_desc *dma_desc)
+{
+	dma_async_tx_descriptor_init(&dma_desc->txd, &tdc->dma_chan);
+	dma_desc->txd.tx_submit = tegra_dma_tx_submit;
+
+	INIT_LIST_HEAD(&dma_desc->tx_list);
+}
+
+static bool tegra_dma_desc_in_pool(struct tegra_dma_channel *tdc,
+		struct tegra_dma_desc *dma_desc)
+{
+	return tdc->desc_pool && dma_desc >= tdc->desc_pool &&
+		dma_desc < tdc->desc_pool + tdc->tdma->desc_pool_size;
+}
+
+/* Only used once the channel pool is exhausted */
 static struct tegra_dma_desc *tegra_dma_desc_alloc(
-		struct tegra_dma_channel *tdc, bool prealloc)
+		struct tegra_dma_channel *tdc)
 {
 	struct tegra_dma_desc *dma_desc;
 
 	BUG_ON(tdc2dev(tdc) == NULL);
 
-	dma_desc = devm_kzalloc(tdc2dev(tdc), sizeof(*dma_desc), GFP_ATOMIC);
+	dma_desc = kzalloc(sizeof(*dma_desc), GFP_NOWAIT);
 	if (!dma_desc) {
 		dev_err(tdc2dev(tdc), "dma_desc alloc failed\n");
 		return NULL;
 	}
+	dev_dbg(tdc2dev(tdc), "dma_desc pool exhausted\n");
 
-	dma_async_tx_descriptor_init(&dma_desc->txd, &tdc->dma_chan);
-	dma_desc->txd.tx_submit = tegra_dma_tx_submit;
-
-	INIT_LIST_HEAD(&dma_desc->tx_list);
-
-	if (prealloc)
-		tegra_dma_desc_put(tdc, dma_desc);
+	tegra_dma_desc_init(tdc, dma_desc);
 
 	return dma_desc;
 }
@@ -396,7 +432,7 @@ static struct tegra_dma_desc *tegra_dma_desc_get(
 
 	raw_spin_unlock_irqrestore(&tdc->lock, flags);
 
-	return tegra_dma_desc_alloc(tdc, false);
+	return tegra_dma_desc_alloc(tdc);
 }
 
 static void tegra_dma_sg_req_put(
@@ -419,18 +455,24 @@ static void tegra_dma_sg_req_put(
 	}
 }
 
+static bool tegra_dma_sg_req_in_pool(struct tegra_dma_channel *tdc,
+		struct tegra_dma_sg_req *sg_req)
+{
+	return tdc->sg_req_pool && sg_req >= tdc->sg_req_pool &&
+		sg_req < tdc->sg_req_pool + tdc->tdma->sg_req_pool_size;
+}
+
+/* Only used once the channel pool is exhausted */
 static struct tegra_dma_sg_req *tegra_dma_sg_req_alloc(
-		struct tegra_dma_channel *tdc,
-		bool prealloc)
+		struct tegra_dma_channel *tdc)
 {
 	struct tegra_dma_sg_req *sg_req = NULL;
-	sg_req = devm_kzalloc(tdc2dev(tdc), sizeof(struct tegra_dma_sg_req), GFP_ATOMIC);
+	sg_req = kzalloc(sizeof(struct tegra_dma_sg_req), GFP_NOWAIT);
 	if (!sg_req) {
 		dev_err(tdc2dev(tdc), "sg_req alloc failed\n");
 		return NULL;
 	}
-	if (prealloc)
-		tegra_dma_sg_req_put(tdc, sg_req, true);
+	dev_dbg(tdc2dev(tdc), "sg_req pool exhausted\n");
 	return sg_req;
 }
 
@@ -450,7 +492,7 @@ static struct tegra_dma_sg_req *tegra_dma_sg_req_get(
 	}
 	raw_spin_unlock_irqrestore(&tdc->lock, flags);
 
-	return tegra_dma_sg_req_alloc(tdc, false);
+	return tegra_dma_sg_req_alloc(tdc);
 }
 
 static int tegra_dma_slave_config(struct dma_chan *dc,
@@ -817,7 +859,9 @@ static irqreturn_t tegra_dma_isr(int irq, void *dev_id)
 				tdc->id, status);
 			tegra_dma_dump_chan_regs(tdc);
 		}
-		tasklet_schedule(&tdc->tasklet);
+		/* Intermediate sg requests have no callback to run */
+		if (!list_empty(&tdc->cb_desc))
+			tasklet_schedule(&tdc->tasklet);
 		raw_spin_unlock_irqrestore(&tdc->lock, flags);
 		return IRQ_HANDLED;
 	}
@@ -1360,8 +1404,10 @@ static struct dma_async_tx_descriptor *tegra_dma_prep_slave_sg(
 	unsigned long csr, mc_seq, apb_ptr = 0, mmio_seq = 0;
 	struct list_head req_list;
 	struct tegra_dma_sg_req *sg_req = NULL;
+	dma_addr_t next_mem = 0;
 	u32 burst_size;
 	enum dma_slave_buswidth slave_bw = 0;
+	bool merge_sg;
 	int ret;
 
 	if (!tdc->config_init) {
@@ -1378,6 +1424,13 @@ static struct dma_async_tx_descriptor *tegra_dma_prep_slave_sg(
 	if (ret < 0)
 		return NULL;
 
+	/*
+	 * Without a client burst size the MMIO burst is derived from the
+	 * length of each entry, which no longer holds once entries are
+	 * merged. Only merge when the burst does not depend on length.
+	 */
+	merge_sg = merge_contiguous_sg && ((burst_size * slave_bw) / 4);
+
 	INIT_LIST_HEAD(&req_list);
 
 	/* Enable once or continuous mode */
@@ -1445,6 +1498,18 @@ static struct dma_async_tx_descriptor *tegra_dma_prep_slave_sg(
 			return NULL;
 		}
 
+		/* Extend previous request if this entry continues it */
+		if (merge_sg && sg_req && (mem == next_mem) &&
+		    (sg_req->req_len + len <=
+				tdc->tdma->chip_data->max_dma_count)) {
+			dma_desc->bytes_requested += len;
+			sg_req->req_len += len;
+			sg_req->ch_regs.wcount = ((sg_req->req_len - 4) >> 2);
+			next_mem += len;
+			continue;
+		}
+		next_mem = mem + len;
+
 		sg_req = tegra_dma_sg_req_get(tdc);
 		if (!sg_req) {
 			dev_err(tdc2dev(tdc), "Dma sg-req not available\n");
@@ -1680,9 +1745,35 @@ static struct dma_async_tx_descriptor *tegra_dma_prep_dma_cyclic(
 static int tegra_dma_alloc_chan_resources(struct dma_chan *dc)
 {
 	struct tegra_dma_channel *tdc = to_tegra_dma_chan(dc);
+	struct tegra_dma *tdma = tdc->tdma;
+	int i;
 
 	dma_cookie_init(&tdc->dma_chan);
 	tdc->config_init = false;
+
+	/* Size the free lists up front so that prep does not allocate */
+	tdc->desc_pool = kcalloc(tdma->desc_pool_size,
+				 sizeof(*tdc->desc_pool), GFP_KERNEL);
+	tdc->sg_req_pool = kcalloc(tdma->sg_req_pool_size,
+				   sizeof(*tdc->sg_req_pool), GFP_KERNEL);
+	if (!tdc->desc_pool || !tdc->sg_req_pool) {
+		dev_err(tdc2dev(tdc), "channel %d pool alloc failed\n",
+			tdc->id);
+		kfree(tdc->desc_pool);
+		kfree(tdc->sg_req_pool);
+		tdc->desc_pool = NULL;
+		tdc->sg_req_pool = NULL;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < tdma->desc_pool_size; i++) {
+		tegra_dma_desc_init(tdc, &tdc->desc_pool[i]);
+		tegra_dma_desc_put(tdc, &tdc->desc_pool[i]);
+	}
+
+	for (i = 0; i < tdma->sg_req_pool_size; i++)
+		tegra_dma_sg_req_put(tdc, &tdc->sg_req_pool[i], true);
+
 	return 0;
 }
 
@@ -1691,6 +1782,8 @@ static void tegra_dma_free_chan_resources(struct dma_chan *dc)
 	struct tegra_dma_channel *tdc = to_tegra_dma_chan(dc);
 	struct list_head dma_desc_list;
 	struct list_head sg_req_list;
+	struct tegra_dma_desc *dma_desc, *dma_desc_tmp;
+	struct tegra_dma_sg_req *sg_req, *sg_req_tmp;
 	unsigned long flags;
 
 	INIT_LIST_HEAD(&dma_desc_list);
@@ -1709,6 +1802,23 @@ static void tegra_dma_free_chan_resources(struct dma_chan *dc)
 	tdc->isr_handler = NULL;
 	tdc->slave_id = -1;
 	raw_spin_unlock_irqrestore(&tdc->lock, flags);
+
+	tasklet_kill(&tdc->tasklet);
+
+	/* Free entries allocated past the pools, then the pools */
+	list_for_each_entry_safe(sg_req, sg_req_tmp, &sg_req_list, node) {
+		if (!tegra_dma_sg_req_in_pool(tdc, sg_req))
+			kfree(sg_req);
+	}
+	list_for_each_entry_safe(dma_desc, dma_desc_tmp, &dma_desc_list,
+				 node) {
+		if (!tegra_dma_desc_in_pool(tdc, dma_desc))
+			kfree(dma_desc);
+	}
+	kfree(tdc->desc_pool);
+	kfree(tdc->sg_req_pool);
+	tdc->desc_pool = NULL;
+	tdc->sg_req_pool = NULL;
 }
 
 static struct dma_chan *tegra_dma_of_xlate(struct of_phandle_args *dma_spec,
@@ -1816,7 +1926,8 @@ static int tegra_dma_probe(struct platform_device *pdev)
 	struct tegra_dma_chip_data *chip_data = NULL;
 	int start_chan_idx = 0;
 	int nr_chans, stream_id;
-	int preallocated_desc = 0, preallocated_sg = 0;
+	int preallocated_desc = TEGRA_GPCDMA_DESC_POOL_SIZE;
+	int preallocated_sg = TEGRA_GPCDMA_SG_REQ_POOL_SIZE;
 
 	if (pdev->dev.of_node) {
 		const struct of_device_id *match;
@@ -1857,10 +1968,8 @@ static int tegra_dma_probe(struct platform_device *pdev)
 			stream_id = TEGRA_SID_GPCDMA_0;
 
 		/*
-		 * if these properties are unreadable, leave them zeroes
-		 * zeroes imply:
-		 * - NO preallocated sg requests
-		 * - NO preallocated descriptors
+		 * Per channel pool sizes, allocated when the channel is
+		 * requested. Defaults are kept if these are not present.
 		 */
 		of_property_read_u32(pdev->dev.of_node,
 			"nvidia,preallocated-descs", &preallocated_desc);
@@ -1881,6 +1990,8 @@ static int tegra_dma_probe(struct platform_device *pdev)
 
 	tdma->dev = &pdev->dev;
 	tdma->chip_data = cdata;
+	tdma->desc_pool_size = preallocated_desc;
+	tdma->sg_req_pool_size = preallocated_sg;
 	platform_set_drvdata(pdev, tdma);
 
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
@@ -1907,7 +2018,6 @@ static int tegra_dma_probe(struct platform_device *pdev)
 	INIT_LIST_HEAD(&tdma->dma_dev.channels);
 	for (i = 0; i < cdata->nr_channels; i++) {
 		struct tegra_dma_channel *tdc = &tdma->channels[i];
-		int p;
 
 		tdc->chan_base_offset = TEGRA_GPCDMA_CHANNEL_BASE_ADD_OFFSET +
 				start_chan_idx * cdata->channel_reg_size +
@@ -1939,17 +2049,6 @@ static int tegra_dma_probe(struct platform_device *pdev)
 		INIT_LIST_HEAD(&tdc->free_dma_desc);
 		INIT_LIST_HEAD(&tdc->cb_desc);
 
-		/*
-		 * pre-allocate stuff
-		 */
-		for (p = 0; p < preallocated_desc; p++)
-			if (!tegra_dma_desc_alloc(tdc, true))
-				break;
-
-		for (p = 0; p < preallocated_sg; p++)
-			if (!tegra_dma_sg_req_alloc(tdc, true))
-				break;
-
 		/* program stream-id for this channel */
 		tegra_dma_program_sid(tdc, i, stream_id);
 	}
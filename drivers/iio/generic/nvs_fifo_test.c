@@ -0,0 +1,330 @@
+/* Copyright (c) 2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/* NVS = NVidia Sensor framework */
+/* See nvs_iio.c and nvs.h for documentation */
+
+/* Fake FIFO sensor: the same synthetic FIFO burst is pushed through the
+ * per-sample handler of one IIO device and the batched handler of another.
+ * With both IIO buffers enabled the two /dev/iio:deviceX streams must be
+ * byte identical.  The time spent in each path is reported in the stats
+ * attribute.
+ */
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/nvs.h>
+#include <linux/of.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+
+#define NVS_FIFO_TEST_DRIVER_VERSION	(1)
+#define NVS_FIFO_TEST_BURST_MAX		(4096)
+#define NVS_FIFO_TEST_PERIOD_NS		(250000) /* 4 kHz ODR */
+#define NVS_FIFO_TEST_REPEAT		(4) /* samples per value */
+
+enum NVS_FIFO_TEST_SNSR {
+	NVS_FIFO_TEST_SINGLE = 0,
+	NVS_FIFO_TEST_BATCH,
+	NVS_FIFO_TEST_N,
+};
+
+struct nvs_fifo_test_sample {
+	s16 axis[3];
+};
+
+struct nvs_fifo_test_state {
+	struct device *dev;
+	struct nvs_fn_if *nvs;
+	void *nvs_st[NVS_FIFO_TEST_N];
+	struct sensor_cfg cfg[NVS_FIFO_TEST_N];
+	struct mutex mutex;		/* serializes bursts */
+	unsigned int sts;
+	unsigned int errs;
+	unsigned int enabled;
+	s64 ts;				/* last synthetic timestamp */
+	u16 seed;			/* next synthetic value */
+	u64 samples;
+	u64 bursts;
+	u64 ns[NVS_FIFO_TEST_N];
+	unsigned int push_errs[NVS_FIFO_TEST_N];
+};
+
+static const char * const nvs_fifo_test_names[] = {
+	[NVS_FIFO_TEST_SINGLE]		= "fifo_test_single",
+	[NVS_FIFO_TEST_BATCH]		= "fifo_test_batch",
+};
+
+static struct sensor_cfg nvs_fifo_test_cfg_dflt = {
+	.part			= "nvs",
+	.vendor			= "NVIDIA",
+	.version		= NVS_FIFO_TEST_DRIVER_VERSION,
+	.ch_n			= 3,
+	.ch_sz			= -2,
+	.delay_us_min		= NVS_FIFO_TEST_PERIOD_NS / 1000,
+	.delay_us_max		= 1000000,
+	.fifo_max_evnt_cnt	= NVS_FIFO_TEST_BURST_MAX,
+};
+
+/* Runs of NVS_FIFO_TEST_REPEAT equal samples so that on-change mode has
+ * something to filter.
+ */
+static void nvs_fifo_test_fill(struct nvs_fifo_test_state *st,
+			       struct nvs_fifo_test_sample *buf, s64 *ts,
+			       unsigned int n)
+{
+	unsigned int i;
+	u16 val;
+
+	for (i = 0; i < n; i++) {
+		if (!(i % NVS_FIFO_TEST_REPEAT))
+			st->seed++;
+		val = st->seed;
+		buf[i].axis[0] = val;
+		buf[i].axis[1] = ~val;
+		buf[i].axis[2] = val * 3;
+		st->ts += NVS_FIFO_TEST_PERIOD_NS;
+		ts[i] = st->ts;
+	}
+}
+
+static int nvs_fifo_test_burst(struct nvs_fifo_test_state *st, unsigned int n)
+{
+	struct nvs_fifo_test_sample *buf;
+	s64 *ts;
+	s64 t0;
+	s64 now;
+	unsigned int i;
+	int ret;
+
+	buf = kcalloc(n, sizeof(*buf), GFP_KERNEL);
+	ts = kcalloc(n, sizeof(*ts), GFP_KERNEL);
+	if (!buf || !ts) {
+		kfree(buf);
+		kfree(ts);
+		return -ENOMEM;
+	}
+
+	mutex_lock(&st->mutex);
+	/* stay ahead of both the clock and the previous burst */
+	now = nvs_timestamp();
+	if (st->ts < now)
+		st->ts = now;
+	nvs_fifo_test_fill(st, buf, ts, n);
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < n; i++) {
+		ret = st->nvs->handler(st->nvs_st[NVS_FIFO_TEST_SINGLE],
+				       &buf[i], ts[i]);
+		if (ret < 0)
+			st->push_errs[NVS_FIFO_TEST_SINGLE]++;
+	}
+	st->ns[NVS_FIFO_TEST_SINGLE] += ktime_get_ns() - t0;
+
+	t0 = ktime_get_ns();
+	ret = st->nvs->handler_batch(st->nvs_st[NVS_FIFO_TEST_BATCH], buf,
+				     sizeof(*buf), ts, n);
+	if (ret < 0)
+		st->push_errs[NVS_FIFO_TEST_BATCH]++;
+	st->ns[NVS_FIFO_TEST_BATCH] += ktime_get_ns() - t0;
+
+	st->samples += n;
+	st->bursts++;
+	mutex_unlock(&st->mutex);
+	kfree(buf);
+	kfree(ts);
+	return 0;
+}
+
+static ssize_t nvs_fifo_test_store_burst(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
+{
+	struct nvs_fifo_test_state *st = dev_get_drvdata(dev);
+	unsigned int n;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &n);
+	if (ret)
+		return ret;
+
+	if (!n || n > NVS_FIFO_TEST_BURST_MAX)
+		return -EINVAL;
+
+	ret = nvs_fifo_test_burst(st, n);
+	if (ret)
+		return ret;
+
+	return count;
+}
+
+static ssize_t nvs_fifo_test_show_stats(struct device *dev,
+					struct device_attribute *attr,
+					char *buf)
+{
+	struct nvs_fifo_test_state *st = dev_get_drvdata(dev);
+	ssize_t t = 0;
+	unsigned int i;
+
+	mutex_lock(&st->mutex);
+	t += snprintf(buf + t, PAGE_SIZE - t, "bursts=%llu samples=%llu\n",
+		      st->bursts, st->samples);
+	for (i = 0; i < NVS_FIFO_TEST_N; i++)
+		t += snprintf(buf + t, PAGE_SIZE - t,
+			      "%s: ns=%llu ns/sample=%llu errs=%u\n",
+			      nvs_fifo_test_names[i], st->ns[i],
+			      st->samples ? div64_u64(st->ns[i], st->samples) :
+			      0, st->push_errs[i]);
+	mutex_unlock(&st->mutex);
+	return t;
+}
+
+static ssize_t nvs_fifo_test_store_stats(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
+{
+	struct nvs_fifo_test_state *st = dev_get_drvdata(dev);
+
+	mutex_lock(&st->mutex);
+	st->samples = 0;
+	st->bursts = 0;
+	memset(st->ns, 0, sizeof(st->ns));
+	memset(st->push_errs, 0, sizeof(st->push_errs));
+	mutex_unlock(&st->mutex);
+	return count;
+}
+
+static DEVICE_ATTR(burst, S_IWUSR | S_IWGRP, NULL,
+		   nvs_fifo_test_store_burst);
+static DEVICE_ATTR(stats, S_IRUGO | S_IWUSR | S_IWGRP,
+		   nvs_fifo_test_show_stats, nvs_fifo_test_store_stats);
+
+static struct attribute *nvs_fifo_test_attrs[] = {
+	&dev_attr_burst.attr,
+	&dev_attr_stats.attr,
+	NULL
+};
+
+static const struct attribute_group nvs_fifo_test_attr_group = {
+	.attrs = nvs_fifo_test_attrs,
+};
+
+static int nvs_fifo_test_enable(void *client, int snsr_id, int enable)
+{
+	struct nvs_fifo_test_state *st = (struct nvs_fifo_test_state *)client;
+
+	if (enable < 0)
+		return !!(st->enabled & (1 << snsr_id));
+
+	if (enable)
+		st->enabled |= 1 << snsr_id;
+	else
+		st->enabled &= ~(1 << snsr_id);
+	return 0;
+}
+
+static struct nvs_fn_dev nvs_fifo_test_fn_dev = {
+	.enable			= nvs_fifo_test_enable,
+};
+
+static int nvs_fifo_test_remove(struct platform_device *pdev)
+{
+	struct nvs_fifo_test_state *st = platform_get_drvdata(pdev);
+	unsigned int i;
+
+	if (st) {
+		sysfs_remove_group(&pdev->dev.kobj, &nvs_fifo_test_attr_group);
+		for (i = 0; i < NVS_FIFO_TEST_N; i++) {
+			if (st->nvs && st->nvs_st[i])
+				st->nvs->remove(st->nvs_st[i]);
+		}
+	}
+	dev_info(&pdev->dev, "removed\n");
+	return 0;
+}
+
+static int nvs_fifo_test_probe(struct platform_device *pdev)
+{
+	struct nvs_fifo_test_state *st;
+	unsigned int i;
+	int ret;
+
+	st = devm_kzalloc(&pdev->dev, sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return -ENOMEM;
+
+	mutex_init(&st->mutex);
+	platform_set_drvdata(pdev, st);
+	st->dev = &pdev->dev;
+	st->nvs = nvs_iio();
+	if (!st->nvs || !st->nvs->handler_batch)
+		return -ENODEV;
+
+	nvs_fifo_test_fn_dev.errs = &st->errs;
+	nvs_fifo_test_fn_dev.sts = &st->sts;
+	for (i = 0; i < NVS_FIFO_TEST_N; i++) {
+		memcpy(&st->cfg[i], &nvs_fifo_test_cfg_dflt,
+		       sizeof(st->cfg[i]));
+		st->cfg[i].name = nvs_fifo_test_names[i];
+		st->cfg[i].snsr_id = i;
+		if (of_property_read_bool(pdev->dev.of_node, "on-change"))
+			st->cfg[i].flags |= SENSOR_FLAG_ON_CHANGE_MODE;
+		/* same DT overrides for both so the outputs stay comparable */
+		ret = nvs_of_dt(pdev->dev.of_node, &st->cfg[i], "fifo_test");
+		if (ret == -ENODEV)
+			goto err;
+
+		ret = st->nvs->probe(&st->nvs_st[i], st, &pdev->dev,
+				     &nvs_fifo_test_fn_dev, &st->cfg[i]);
+		if (ret)
+			goto err;
+	}
+
+	ret = sysfs_create_group(&pdev->dev.kobj, &nvs_fifo_test_attr_group);
+	if (ret)
+		goto err;
+
+	dev_info(&pdev->dev, "done\n");
+	return 0;
+
+err:
+	while (i--)
+		st->nvs->remove(st->nvs_st[i]);
+	platform_set_drvdata(pdev, NULL);
+	dev_err(&pdev->dev, "ERR %d\n", ret);
+	return ret;
+}
+
+static const struct of_device_id nvs_fifo_test_of_match[] = {
+	{ .compatible = "nvidia,nvs-fifo-test", },
+	{}
+};
+
+MODULE_DEVICE_TABLE(of, nvs_fifo_test_of_match);
+
+static struct platform_driver nvs_fifo_test_driver = {
+	.driver				= {
+		.name			= "nvs-fifo-test",
+		.of_match_table		= of_match_ptr(nvs_fifo_test_of_match),
+	},
+	.probe				= nvs_fifo_test_probe,
+	.remove				= nvs_fifo_test_remove,
+};
+
+module_platform_driver(nvs_fifo_test_driver);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("NVidia NVS FIFO Test driver");
+MODULE_AUTHOR("NVIDIA Corporation");
@@ -826,12 +826,29 @@ static void nvi_flush_aux(struct nvi_state *st, int port)
 		ap->nmp.handler(NULL, 0, 0, ap->nmp.ext_driver);
 }
 
+static void nvi_push_batch_flush(struct nvi_state *st, unsigned int dev)
+{
+	struct nvi_snsr *snsr = &st->snsr[dev];
+
+	if (snsr->batch_n) {
+		st->nvs->handler_batch(snsr->nvs_st, snsr->batch_buf,
+				       sizeof(snsr->batch_buf[0]),
+				       snsr->batch_ts, snsr->batch_n);
+		snsr->batch_n = 0;
+	}
+}
+
 static void nvi_flush_push(struct nvi_state *st)
 {
 	struct aux_port *ap;
 	unsigned int i;
 	int ret;
 
+	/* samples staged for a batch push go out ahead of the flush marker */
+	if (st->push_batch) {
+		for (i = 0; i < DEV_N_AUX; i++)
+			nvi_push_batch_flush(st, i);
+	}
 	for (i = 0; i < DEV_N; i++) {
 		if (st->snsr[i].flush) {
 			ret = st->nvs->handler(st->snsr[i].nvs_st, NULL, 0LL);
@@ -2712,9 +2729,28 @@ static s32 nvi_matrix(struct nvi_state *st, signed char *matrix,
 		 (matrix[6 + axis] == -1 ? -z : 0)));
 }
 
+static void nvi_push_batch_end(struct nvi_state *st)
+{
+	unsigned int dev;
+
+	if (!st->push_batch)
+		return;
+
+	st->push_batch = false;
+	for (dev = 0; dev < DEV_N_AUX; dev++)
+		nvi_push_batch_flush(st, dev);
+}
+
+static void nvi_push_batch_start(struct nvi_state *st)
+{
+	/* samples drained from the FIFO are handed to NVS as one run */
+	if (st->nvs->handler_batch)
+		st->push_batch = true;
+}
+
 int nvi_push(struct nvi_state *st, unsigned int dev, u8 *buf, s64 ts)
 {
-	u8 buf_le[20];
+	u8 buf_le[NVI_PUSH_BUF_SIZE];
 	s32 val_le[4];
 	s32 val[AXIS_N];
 	u32 u_val;
@@ -2820,7 +2856,18 @@ int nvi_push(struct nvi_state *st, unsigned int dev, u8 *buf, s64 ts)
 		}
 	}
 
-	if (ts >= 0) {
+	if (ts >= 0 && st->push_batch &&
+	    !(st->sts & (NVI_DBG_SPEW_SNSR << dev))) {
+		n = st->snsr[dev].batch_n;
+		memcpy(st->snsr[dev].batch_buf[n], buf_le, sizeof(buf_le));
+		st->snsr[dev].batch_ts[n] = ts;
+		st->snsr[dev].batch_n++;
+		if (st->snsr[dev].batch_n >= NVI_PUSH_BATCH_N)
+			nvi_push_batch_flush(st, dev);
+	} else if (ts >= 0) {
+		/* keep the order of any samples already staged */
+		if (st->push_batch)
+			nvi_push_batch_flush(st, dev);
 		if (st->sts & (NVI_DBG_SPEW_SNSR << dev)) {
 			sts = st->sts;
 			st->sts |= NVS_STS_SPEW_DATA;
@@ -3083,6 +3130,7 @@ static int nvi_fifo_rd(struct nvi_state *st, int src, unsigned int fifo_n_max,
 		ts_now = 0;
 	}
 
+	nvi_push_batch_start(st);
 	while (fifo_n) {
 		buf_n = sizeof(st->buf) - st->buf_i;
 		if (buf_n > fifo_n)
@@ -3090,8 +3138,10 @@ static int nvi_fifo_rd(struct nvi_state *st, int src, unsigned int fifo_n_max,
 		ret = nvi_i2c_r(st, st->hal->reg->fifo_rw.bank,
 				st->hal->reg->fifo_rw.reg,
 				buf_n, &st->buf[st->buf_i]);
-		if (ret)
-			return 0;
+		if (ret) {
+			ret = 0;
+			break;
+		}
 
 		fifo_n -= buf_n;
 		buf_n += st->buf_i;
@@ -3117,6 +3167,7 @@ static int nvi_fifo_rd(struct nvi_state *st, int src, unsigned int fifo_n_max,
 		if (ret < 0)
 			break;
 	}
+	nvi_push_batch_end(st);
 
 	return ret;
 }
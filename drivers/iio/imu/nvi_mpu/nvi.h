@@ -32,6 +32,8 @@
 #define NVI_IRQ_STORM_MIN_NS		(1000000) /* storm if irq faster 1ms */
 #define NVI_IRQ_STORM_MAX_N		(100) /* max storm irqs b4 dis irq */
 #define NVI_FIFO_SAMPLE_SIZE_MAX	(38)
+#define NVI_PUSH_BUF_SIZE		(20)
+#define NVI_PUSH_BATCH_N		(32)
 #define KBUF_SZ				(64)
 #define SRC_MPU				(0)
 #define SRC_GYR				(0)
@@ -456,6 +458,9 @@ struct nvi_snsr {
 	bool ts_reset;
 	bool flush;
 	bool matrix;
+	unsigned int batch_n;
+	s64 batch_ts[NVI_PUSH_BATCH_N];
+	u8 batch_buf[NVI_PUSH_BATCH_N][NVI_PUSH_BUF_SIZE];
 };
 
 /**
@@ -504,6 +509,7 @@ struct nvi_state {
 	bool irq_set_irq_wake;
 	bool icm_dmp_war;
 	bool icm_fifo_off;
+	bool push_batch;
 	int pm;
 	u32 dmp_clk_n;
 	s64 ts_now;
@@ -152,6 +152,14 @@ unsigned vivid_debug;
 module_param(vivid_debug, uint, 0644);
 MODULE_PARM_DESC(vivid_debug, " activates debug info");
 
+static bool tpg_frame_cache[VIVID_MAX_DEVS];
+module_param_array(tpg_frame_cache, bool, NULL, 0444);
+MODULE_PARM_DESC(tpg_frame_cache, " reuse rendered test pattern frames while nothing changes, default is 0");
+
+static bool tpg_frame_cache_verify[VIVID_MAX_DEVS];
+module_param_array(tpg_frame_cache_verify, bool, NULL, 0444);
+MODULE_PARM_DESC(tpg_frame_cache_verify, " render cached test pattern frames anyway and compare them with the cache, default is 0");
+
 static bool no_error_inj;
 module_param(no_error_inj, bool, 0444);
 MODULE_PARM_DESC(no_error_inj, " if set disable the error injecting controls");
@@ -877,6 +885,8 @@ static int vivid_create_instance(struct platform_device *pdev, int inst)
 
 	/* initialize the test pattern generator */
 	tpg_init(&dev->tpg, 640, 360);
+	tpg_s_frame_cache(&dev->tpg, tpg_frame_cache[inst]);
+	tpg_s_frame_cache_verify(&dev->tpg, tpg_frame_cache_verify[inst]);
 	if (tpg_alloc(&dev->tpg, MAX_ZOOM * MAX_WIDTH))
 		goto free_dev;
 	dev->scaled_line = vzalloc(MAX_ZOOM * MAX_WIDTH);
@@ -172,6 +172,9 @@ void tpg_free(struct tpg_data *tpg)
 		tpg->contrast_line[plane] = NULL;
 		tpg->black_line[plane] = NULL;
 		tpg->random_line[plane] = NULL;
+		vfree(tpg->cache[plane].buf_lines);
+		vfree(tpg->cache[plane].data);
+		memset(&tpg->cache[plane], 0, sizeof(tpg->cache[plane]));
 	}
 }
 
@@ -1835,10 +1838,12 @@ static void tpg_recalc(struct tpg_data *tpg)
 	if (tpg->recalc_square_border) {
 		tpg->recalc_square_border = false;
 		tpg_calculate_square_border(tpg);
+		tpg->lines_gen++;
 	}
 	if (tpg->recalc_lines) {
 		tpg->recalc_lines = false;
 		tpg_precalculate_line(tpg);
+		tpg->lines_gen++;
 	}
 }
 
@@ -1888,6 +1893,10 @@ void tpg_log_status(struct tpg_data *tpg)
 	pr_info("tpg Y'CbCr encoding: %d/%d\n", tpg->ycbcr_enc, tpg->real_ycbcr_enc);
 	pr_info("tpg quantization: %d/%d\n", tpg->quantization, tpg->real_quantization);
 	pr_info("tpg RGB range: %d/%d\n", tpg->rgb_range, tpg->real_rgb_range);
+	if (tpg->frame_cache)
+		pr_info("tpg frame cache: %u hits, %u verified, %u mismatches\n",
+			tpg->frame_cache_hits, tpg->frame_cache_verified,
+			tpg->frame_cache_mismatches);
 }
 
 /*
@@ -2212,9 +2221,134 @@ static void tpg_fill_plane_pattern(const struct tpg_data *tpg,
 	}
 }
 
+/*
+ * Only frames that come out the same every time can be cached: noise
+ * and the random WSS data change per frame, and a moving pattern
+ * changes the key on every frame anyway.
+ */
+static bool tpg_frame_cacheable(const struct tpg_data *tpg,
+				const struct tpg_draw_params *params)
+{
+	if (!tpg->frame_cache)
+		return false;
+	if (tpg->pattern == TPG_PAT_NOISE || tpg->qual == TPG_QUAL_NOISE)
+		return false;
+	if (params->is_tv && !params->is_60hz && params->wss_width)
+		return false;
+	/* partially filled frames leave lines with old buffer contents */
+	if (params->hmax < tpg->compose.height && !tpg->perc_fill_blank)
+		return false;
+	return tpg->mv_hor_step == 0 && tpg->mv_vert_step == 0;
+}
+
+static void tpg_frame_cache_key(const struct tpg_data *tpg, v4l2_std_id std,
+				unsigned p, struct tpg_frame_key *key)
+{
+	/* compared with memcmp(), so clear the padding */
+	memset(key, 0, sizeof(*key));
+	key->fourcc = tpg->fourcc;
+	key->std = std;
+	key->field = tpg->field;
+	key->field_alternate = tpg->field_alternate;
+	key->src_width = tpg->src_width;
+	key->src_height = tpg->src_height;
+	key->crop = tpg->crop;
+	key->compose = tpg->compose;
+	key->border = tpg->border;
+	key->square = tpg->square;
+	key->qual = tpg->qual;
+	key->pattern = tpg->pattern;
+	key->bytesperline = tpg->bytesperline[p];
+	key->perc_fill = tpg->perc_fill;
+	key->perc_fill_blank = tpg->perc_fill_blank;
+	key->vflip = tpg->vflip;
+	key->show_border = tpg->show_border;
+	key->show_square = tpg->show_square;
+	key->insert_sav = tpg->insert_sav;
+	key->insert_eav = tpg->insert_eav;
+	key->mv_hor_count = tpg->mv_hor_count;
+	key->mv_vert_count = tpg->mv_vert_count;
+	key->lines_gen = tpg->lines_gen;
+}
+
+static bool tpg_frame_cache_hit(const struct tpg_frame_cache *cache,
+				const struct tpg_frame_key *key,
+				unsigned stride, u8 *vbuf)
+{
+	const u8 *src = cache->data;
+	unsigned i;
+
+	if (!cache->valid || memcmp(&cache->key, key, sizeof(*key)))
+		return false;
+
+	if (cache->contiguous) {
+		memcpy(vbuf, src, cache->n_lines * cache->line_width);
+		return true;
+	}
+	for (i = 0; i < cache->n_lines; i++) {
+		memcpy(vbuf + cache->buf_lines[i] * stride, src,
+		       cache->line_width);
+		src += cache->line_width;
+	}
+	return true;
+}
+
+/*
+ * Compare a freshly rendered plane with what a cache hit would have
+ * copied into it. A mismatch means the key misses something the
+ * rendering depends on, so the entry is dropped.
+ */
+static void tpg_frame_cache_check(struct tpg_data *tpg,
+				  struct tpg_frame_cache *cache,
+				  unsigned stride, const u8 *vbuf)
+{
+	const u8 *src = cache->data;
+	unsigned i;
+
+	for (i = 0; i < cache->n_lines; i++) {
+		if (memcmp(vbuf + cache->buf_lines[i] * stride, src,
+			   cache->line_width)) {
+			tpg->frame_cache_mismatches++;
+			cache->valid = false;
+			pr_warn_ratelimited("tpg frame cache: line %u differs from a fresh render\n",
+					    cache->buf_lines[i]);
+			return;
+		}
+		src += cache->line_width;
+	}
+	tpg->frame_cache_verified++;
+}
+
+/* Make room to record up to max_lines lines of line_width bytes */
+static bool tpg_frame_cache_prepare(struct tpg_frame_cache *cache,
+				    unsigned max_lines, unsigned line_width)
+{
+	size_t size = (size_t)max_lines * line_width;
+
+	cache->valid = false;
+	cache->n_lines = 0;
+	cache->line_width = line_width;
+
+	if (max_lines > cache->max_lines) {
+		vfree(cache->buf_lines);
+		cache->buf_lines = vmalloc(max_lines * sizeof(*cache->buf_lines));
+		cache->max_lines = cache->buf_lines ? max_lines : 0;
+	}
+	if (size > cache->size) {
+		vfree(cache->data);
+		cache->data = vmalloc(size);
+		cache->size = cache->data ? size : 0;
+	}
+	return cache->buf_lines && cache->data;
+}
+
 void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
 			   unsigned p, u8 *vbuf)
 {
+	struct tpg_frame_cache *cache = &tpg->cache[p];
+	struct tpg_frame_key key;
+	bool record = false;
+	bool verify = false;
 	struct tpg_draw_params params;
 	unsigned factor = V4L2_FIELD_HAS_T_OR_B(tpg->field) ? 2 : 1;
 
@@ -2239,6 +2373,22 @@ void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
 
 	vbuf += tpg_hdiv(tpg, p, tpg->compose.left);
 
+	if (tpg_frame_cacheable(tpg, &params)) {
+		tpg_frame_cache_key(tpg, std, p, &key);
+		if (tpg->frame_cache_verify) {
+			verify = cache->valid &&
+				 !memcmp(&cache->key, &key, sizeof(key));
+		} else if (tpg_frame_cache_hit(cache, &key, params.stride,
+					       vbuf)) {
+			tpg->frame_cache_hits++;
+			return;
+		}
+		if (!verify)
+			record = tpg_frame_cache_prepare(cache,
+							 tpg->compose.height,
+							 params.img_width);
+	}
+
 	for (h = 0; h < tpg->compose.height; h++) {
 		unsigned buf_line;
 
@@ -2292,7 +2442,27 @@ void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
 				vbuf + buf_line * params.stride);
 		tpg_fill_plane_extras(tpg, &params, p, h,
 				vbuf + buf_line * params.stride);
+
+		if (record) {
+			memcpy(cache->data + cache->n_lines * params.img_width,
+			       vbuf + buf_line * params.stride,
+			       params.img_width);
+			cache->buf_lines[cache->n_lines++] = buf_line;
+		}
+	}
+
+	if (record) {
+		unsigned i;
+
+		cache->contiguous = params.stride == params.img_width;
+		for (i = 0; cache->contiguous && i < cache->n_lines; i++)
+			cache->contiguous = cache->buf_lines[i] == i;
+		cache->key = key;
+		cache->valid = true;
 	}
+
+	if (verify)
+		tpg_frame_cache_check(tpg, cache, params.stride, vbuf);
 }
 
 void tpg_fillbuffer(struct tpg_data *tpg, v4l2_std_id std, unsigned p, u8 *vbuf)
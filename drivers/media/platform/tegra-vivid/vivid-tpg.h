@@ -93,6 +93,51 @@ extern const char * const tpg_aspect_strings[];
 #define TPG_MAX_PLANES 3
 #define TPG_MAX_PAT_LINES 8
 
+/*
+ * Everything a tpg_fill_plane_buffer() call depends on. Two calls with
+ * equal keys produce identical output, so the second one can be served
+ * from the frame cache.
+ */
+struct tpg_frame_key {
+	u32				fourcc;
+	v4l2_std_id			std;
+	u32				field;
+	bool				field_alternate;
+	unsigned			src_width, src_height;
+	struct v4l2_rect		crop;
+	struct v4l2_rect		compose;
+	struct v4l2_rect		border;
+	struct v4l2_rect		square;
+	enum tpg_quality		qual;
+	enum tpg_pattern		pattern;
+	unsigned			bytesperline;
+	unsigned			perc_fill;
+	bool				perc_fill_blank;
+	bool				vflip;
+	bool				show_border;
+	bool				show_square;
+	bool				insert_sav;
+	bool				insert_eav;
+	int				mv_hor_count;
+	int				mv_vert_count;
+	/* bumped whenever the precalculated lines are regenerated */
+	unsigned			lines_gen;
+};
+
+/* A rendered plane: the lines it wrote and their contents */
+struct tpg_frame_cache {
+	struct tpg_frame_key		key;
+	bool				valid;
+	/* all lines are adjacent and stride == line_width */
+	bool				contiguous;
+	unsigned			line_width;
+	unsigned			n_lines;
+	unsigned			max_lines;
+	unsigned			*buf_lines;
+	size_t				size;
+	u8				*data;
+};
+
 struct tpg_data {
 	/* Source frame size */
 	unsigned			src_width, src_height;
@@ -184,6 +229,16 @@ struct tpg_data {
 	bool				recalc_colors;
 	bool				recalc_lines;
 	bool				recalc_square_border;
+	unsigned			lines_gen;
+
+	/* Reuse rendered planes while nothing they depend on changes */
+	bool				frame_cache;
+	/* Render every cache hit anyway and compare it with the cache */
+	bool				frame_cache_verify;
+	struct tpg_frame_cache		cache[TPG_MAX_PLANES];
+	unsigned			frame_cache_hits;
+	unsigned			frame_cache_verified;
+	unsigned			frame_cache_mismatches;
 
 	/* Used to store TPG_MAX_PAT_LINES lines, each with up to two planes */
 	unsigned			max_line_width;
@@ -542,6 +597,17 @@ static inline void tpg_s_show_square(struct tpg_data *tpg,
 	tpg->show_square = show_square;
 }
 
+static inline void tpg_s_frame_cache(struct tpg_data *tpg, bool frame_cache)
+{
+	tpg->frame_cache = frame_cache;
+}
+
+static inline void tpg_s_frame_cache_verify(struct tpg_data *tpg,
+					    bool frame_cache_verify)
+{
+	tpg->frame_cache_verify = frame_cache_verify;
+}
+
 static inline void tpg_s_insert_sav(struct tpg_data *tpg, bool insert_sav)
 {
 	tpg->insert_sav = insert_sav;
@@ -18,6 +18,11 @@
  */
 
 #include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/hrtimer.h>
+#include <linux/idr.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
 #include <linux/nvhost.h>
 #include <linux/of_platform.h>
 #include <linux/printk.h>
@@ -319,6 +324,11 @@ static void vi_capture_ivc_status_callback(
 			 * the new progress status buffer mechanism
 			 */
 			complete(&capture->capture_resp);
+			spin_lock(&capture->status_notify_lock);
+			if (capture->status_notify)
+				capture->status_notify(
+					capture->status_notify_priv);
+			spin_unlock(&capture->status_notify_lock);
 		}
 		dev_dbg(chan->dev, "%s: status chan_id %u msg_id %u\n",
 				__func__, status_msg->header.channel_id,
@@ -331,6 +341,403 @@ static void vi_capture_ivc_status_callback(
 	}
 }
 
+#ifdef CONFIG_TEGRA_CAPTURE_VI_SIM
+/**
+ * @brief Simulated RCE state of a VI channel.
+ */
+struct vi_capture_sim {
+	struct vi_capture *capture; /**< VI channel capture context */
+	struct hrtimer frame_timer; /**< Ends the current frame */
+	struct kthread_work frame_work; /**< Completes the oldest request */
+	spinlock_t lock; /**< Protects the pending requests and @a stalled */
+	uint32_t *pending; /**< Buffer indices of the submitted requests */
+	uint32_t head; /**< Oldest entry of @a pending */
+	uint32_t count; /**< No. of entries in @a pending */
+	uint32_t frames; /**< Frames ended since the channel setup */
+	bool stalled; /**< No status until the channel is reset or released */
+	void *requests; /**< CPU view of a kernel client's descriptor ring */
+};
+
+/*
+ * Simulated RCE settings and counters, in debugfs capture-vi-sim. A frame
+ * ends every frame_us while requests are pending. Every stall_every'th
+ * frame hangs the channel, every error_every'th frame is reported with a
+ * correctable error; 0 disables either.
+ */
+static bool vi_sim_enable;
+static u32 vi_sim_frame_us = 1000;
+static u32 vi_sim_stall_every;
+static u32 vi_sim_error_every;
+static atomic_t vi_sim_frames;
+static atomic_t vi_sim_errors;
+static atomic_t vi_sim_stalls;
+static atomic_t vi_sim_resets;
+static struct kthread_worker *vi_sim_worker;
+static struct dentry *vi_sim_debugfs;
+static DEFINE_IDA(vi_sim_channel_ids);
+
+static inline bool vi_capture_is_sim(
+	const struct vi_capture *capture)
+{
+	return capture->sim != NULL;
+}
+
+static ktime_t vi_capture_sim_period(void)
+{
+	return ns_to_ktime((u64)max_t(u32, vi_sim_frame_us, 1U) *
+		NSEC_PER_USEC);
+}
+
+static enum hrtimer_restart vi_capture_sim_frame_timer(
+	struct hrtimer *timer)
+{
+	struct vi_capture_sim *sim = container_of(timer,
+		struct vi_capture_sim, frame_timer);
+
+	kthread_queue_work(vi_sim_worker, &sim->frame_work);
+
+	return HRTIMER_NORESTART;
+}
+
+/**
+ * @brief End a frame on a simulated channel: write the status record of the
+ * oldest pending request and send its status indication, the way RCE does.
+ *
+ * @param[in]	work	Frame work of the simulated channel
+ */
+static void vi_capture_sim_frame(
+	struct kthread_work *work)
+{
+	struct vi_capture_sim *sim = container_of(work,
+		struct vi_capture_sim, frame_work);
+	struct vi_capture *capture = sim->capture;
+	struct capture_descriptor *desc;
+	struct CAPTURE_MSG status_msg;
+	uint32_t status = CAPTURE_STATUS_SUCCESS;
+	uint32_t buffer_index;
+	uint32_t frame;
+	void *requests;
+	bool rearm;
+	u64 eof;
+
+	spin_lock(&sim->lock);
+	if (sim->count == 0 || sim->stalled) {
+		spin_unlock(&sim->lock);
+		return;
+	}
+
+	frame = ++sim->frames;
+	if (vi_sim_stall_every != 0 && frame % vi_sim_stall_every == 0) {
+		sim->stalled = true;
+		spin_unlock(&sim->lock);
+		atomic_inc(&vi_sim_stalls);
+		return;
+	}
+
+	buffer_index = sim->pending[sim->head];
+	sim->head = (sim->head + 1) % capture->queue_depth;
+	sim->count--;
+	rearm = sim->count != 0;
+	spin_unlock(&sim->lock);
+
+	if (vi_sim_error_every != 0 && frame % vi_sim_error_every == 0) {
+		status = CAPTURE_STATUS_CHANSEL_SHORT_FRAME;
+		atomic_inc(&vi_sim_errors);
+	}
+
+	requests = sim->requests ? sim->requests : capture->requests.va;
+	if (requests != NULL) {
+		desc = requests + buffer_index * capture->request_size;
+		eof = ktime_get_ns();
+		desc->status.src_stream = capture->stream_id;
+		desc->status.virtual_channel = capture->virtual_channel_id;
+		desc->status.frame_id = frame;
+		desc->status.sof_timestamp = eof -
+			ktime_to_ns(vi_capture_sim_period());
+		desc->status.eof_timestamp = eof;
+		desc->status.err_data = 0;
+		desc->status.flags = 0;
+		desc->status.status = status;
+	}
+
+	/* the status record is written before it is indicated */
+	wmb();
+
+	memset(&status_msg, 0, sizeof(status_msg));
+	status_msg.header.msg_id = CAPTURE_STATUS_IND;
+	status_msg.header.channel_id = capture->channel_id;
+	status_msg.capture_status_ind.buffer_index = buffer_index;
+	vi_capture_ivc_status_callback(&status_msg, capture);
+	atomic_inc(&vi_sim_frames);
+
+	if (rearm)
+		hrtimer_start(&sim->frame_timer, vi_capture_sim_period(),
+			HRTIMER_MODE_REL);
+}
+
+/**
+ * @brief Drop the pending requests of a simulated channel and wait until
+ * no frame is in progress on it.
+ *
+ * @param[in]	sim	Simulated channel
+ */
+static void vi_capture_sim_flush(
+	struct vi_capture_sim *sim)
+{
+	spin_lock(&sim->lock);
+	sim->head = 0;
+	sim->count = 0;
+	sim->stalled = false;
+	spin_unlock(&sim->lock);
+
+	/*
+	 * A frame already in progress may still arm the timer, whose work
+	 * then finds nothing pending and does not arm it again.
+	 */
+	kthread_cancel_work_sync(&sim->frame_work);
+	hrtimer_cancel(&sim->frame_timer);
+	kthread_cancel_work_sync(&sim->frame_work);
+}
+
+/**
+ * @brief Answer a @em capture-control message on a simulated channel.
+ * Every request succeeds.
+ *
+ * @param[in]	capture	VI channel capture context
+ * @param[in]	msg	IVC message payload
+ * @param[in]	resp_id	IVC message identifier of the response
+ *
+ * @returns	0 (success), neg. errno (failure)
+ */
+static int vi_capture_sim_control(
+	struct vi_capture *capture,
+	const struct CAPTURE_CONTROL_MSG *msg,
+	uint32_t resp_id)
+{
+	struct vi_capture_sim *sim = capture->sim;
+	struct CAPTURE_CONTROL_MSG *resp_msg = &capture->control_resp_msg;
+	const struct capture_channel_config *config =
+		&msg->channel_setup_req.channel_config;
+	uint64_t mask;
+	int id;
+
+	memset(resp_msg, 0, sizeof(*resp_msg));
+	resp_msg->header = msg->header;
+	resp_msg->header.msg_id = resp_id;
+
+	switch (msg->header.msg_id) {
+	case CAPTURE_CHANNEL_SETUP_REQ:
+		sim->pending = kcalloc(capture->queue_depth,
+			sizeof(*sim->pending), GFP_KERNEL);
+		if (sim->pending == NULL)
+			return -ENOMEM;
+
+		id = ida_simple_get(&vi_sim_channel_ids, 0,
+			CAPTURE_CHANNEL_INVALID_ID, GFP_KERNEL);
+		if (id < 0) {
+			kfree(sim->pending);
+			sim->pending = NULL;
+			resp_msg->channel_setup_resp.result =
+				CAPTURE_ERROR_NO_RESOURCES;
+			break;
+		}
+
+		mask = (config->vi_unit_id == VI_UNIT_VI2) ?
+			config->vi2_channel_mask : config->vi_channel_mask;
+		sim->frames = 0;
+		resp_msg->channel_setup_resp.channel_id = id;
+		resp_msg->channel_setup_resp.vi_channel_mask = mask & -mask;
+		break;
+	case CAPTURE_CHANNEL_RESET_REQ:
+		vi_capture_sim_flush(sim);
+		atomic_inc(&vi_sim_resets);
+		break;
+	case CAPTURE_CHANNEL_RELEASE_REQ:
+		vi_capture_sim_flush(sim);
+		kfree(sim->pending);
+		sim->pending = NULL;
+		ida_simple_remove(&vi_sim_channel_ids, capture->channel_id);
+		atomic_inc(&vi_sim_resets);
+		break;
+	default:
+		/* stream and TPG messages need nothing from the simulation */
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Queue a capture request on a simulated channel.
+ *
+ * @param[in]	capture		VI channel capture context
+ * @param[in]	buffer_index	Capture descriptor index
+ *
+ * @returns	0 (success), neg. errno (failure)
+ */
+static int vi_capture_sim_request(
+	struct vi_capture *capture,
+	uint32_t buffer_index)
+{
+	struct vi_capture_sim *sim = capture->sim;
+	bool start;
+
+	if (buffer_index >= capture->queue_depth)
+		return -EINVAL;
+
+	spin_lock(&sim->lock);
+	if (sim->count == capture->queue_depth) {
+		spin_unlock(&sim->lock);
+		return -ENOSPC;
+	}
+	sim->pending[(sim->head + sim->count) % capture->queue_depth] =
+		buffer_index;
+	start = (sim->count++ == 0) && !sim->stalled;
+	spin_unlock(&sim->lock);
+
+	if (start)
+		hrtimer_start(&sim->frame_timer, vi_capture_sim_period(),
+			HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+/**
+ * @brief Open a VI channel in sim mode if the simulation is enabled.
+ *
+ * @param[in]	capture	VI channel capture context
+ *
+ * @returns	0 (success), neg. errno (failure)
+ */
+static int vi_capture_sim_init(
+	struct vi_capture *capture)
+{
+	struct vi_capture_sim *sim;
+
+	if (!READ_ONCE(vi_sim_enable))
+		return 0;
+
+	if (vi_sim_worker == NULL)
+		return -ENODEV;
+
+	sim = kzalloc(sizeof(*sim), GFP_KERNEL);
+	if (sim == NULL)
+		return -ENOMEM;
+
+	sim->capture = capture;
+	spin_lock_init(&sim->lock);
+	hrtimer_init(&sim->frame_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sim->frame_timer.function = vi_capture_sim_frame_timer;
+	kthread_init_work(&sim->frame_work, vi_capture_sim_frame);
+	capture->sim = sim;
+
+	return 0;
+}
+
+static void vi_capture_sim_free(
+	struct vi_capture *capture)
+{
+	if (capture->sim == NULL)
+		return;
+
+	vi_capture_sim_flush(capture->sim);
+	kfree(capture->sim->pending);
+	kfree(capture->sim);
+	capture->sim = NULL;
+}
+
+void vi_capture_sim_set_requests(
+	struct tegra_vi_channel *chan,
+	void *requests)
+{
+	struct vi_capture *capture = chan->capture_data;
+
+	if (capture != NULL && capture->sim != NULL)
+		capture->sim->requests = requests;
+}
+EXPORT_SYMBOL_GPL(vi_capture_sim_set_requests);
+
+static void vi_capture_sim_probe(
+	struct device *dev)
+{
+	struct kthread_worker *worker;
+	struct dentry *dir;
+
+	worker = kthread_create_worker(0, "vi-capture-sim");
+	if (IS_ERR(worker)) {
+		dev_warn(dev, "failed to create sim worker\n");
+		return;
+	}
+	vi_sim_worker = worker;
+
+	dir = debugfs_create_dir("capture-vi-sim", NULL);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+
+	debugfs_create_bool("enable", 0644, dir, &vi_sim_enable);
+	debugfs_create_u32("frame_us", 0644, dir, &vi_sim_frame_us);
+	debugfs_create_u32("stall_every", 0644, dir, &vi_sim_stall_every);
+	debugfs_create_u32("error_every", 0644, dir, &vi_sim_error_every);
+	debugfs_create_atomic_t("frames", 0644, dir, &vi_sim_frames);
+	debugfs_create_atomic_t("errors", 0644, dir, &vi_sim_errors);
+	debugfs_create_atomic_t("stalls", 0644, dir, &vi_sim_stalls);
+	debugfs_create_atomic_t("resets", 0644, dir, &vi_sim_resets);
+	vi_sim_debugfs = dir;
+}
+
+static void vi_capture_sim_remove(void)
+{
+	debugfs_remove_recursive(vi_sim_debugfs);
+	vi_sim_debugfs = NULL;
+
+	if (vi_sim_worker != NULL) {
+		kthread_destroy_worker(vi_sim_worker);
+		vi_sim_worker = NULL;
+	}
+}
+#else
+static inline bool vi_capture_is_sim(
+	const struct vi_capture *capture)
+{
+	return false;
+}
+
+static inline int vi_capture_sim_control(
+	struct vi_capture *capture,
+	const struct CAPTURE_CONTROL_MSG *msg,
+	uint32_t resp_id)
+{
+	return -ENODEV;
+}
+
+static inline int vi_capture_sim_request(
+	struct vi_capture *capture,
+	uint32_t buffer_index)
+{
+	return -ENODEV;
+}
+
+static inline int vi_capture_sim_init(
+	struct vi_capture *capture)
+{
+	return 0;
+}
+
+static inline void vi_capture_sim_free(
+	struct vi_capture *capture)
+{
+}
+
+static inline void vi_capture_sim_probe(
+	struct device *dev)
+{
+}
+
+static inline void vi_capture_sim_remove(void)
+{
+}
+#endif /* CONFIG_TEGRA_CAPTURE_VI_SIM */
+
 /**
  * @brief Send a @em capture-control IVC message to RCE on a VI channel, and
  * block w/ timeout, waiting for the RCE response.
@@ -358,6 +765,12 @@ static int vi_capture_ivc_send_control(
 	resp_header.msg_id = resp_id;
 	/* Send capture control IVC message */
 	mutex_lock(&capture->control_msg_lock);
+	if (vi_capture_is_sim(capture)) {
+		err = vi_capture_sim_control(capture, msg, resp_id);
+		mutex_unlock(&capture->control_msg_lock);
+		return err;
+	}
+
 	err = tegra_capture_ivc_control_submit(msg, size);
 	if (err < 0) {
 		dev_err(chan->dev, "IVC control submit failed\n");
@@ -456,6 +869,7 @@ int vi_capture_init(
 	struct vi_capture *capture;
 	struct device_node *dn;
 	struct platform_device *rtc_pdev;
+	int err;
 
 	dev_dbg(chan->dev, "%s++\n", __func__);
 	dn = of_find_node_by_path("tegra-camera-rtcpu");
@@ -483,6 +897,7 @@ int vi_capture_init(
 	mutex_init(&capture->reset_lock);
 	mutex_init(&capture->control_msg_lock);
 	mutex_init(&capture->unpins_list_lock);
+	spin_lock_init(&capture->status_notify_lock);
 
 	capture->vi_channel = chan;
 	chan->capture_data = capture;
@@ -495,6 +910,14 @@ int vi_capture_init(
 	capture->csi_port = NVCSI_PORT_UNSPECIFIED;
 	capture->virtual_channel_id = NVCSI_STREAM_INVALID_TPG_VC_ID;
 
+	err = vi_capture_sim_init(capture);
+	if (err < 0) {
+		dev_err(chan->dev, "failed to open simulated channel\n");
+		chan->capture_data = NULL;
+		kfree(capture);
+		return err;
+	}
+
 	return 0;
 }
 
@@ -531,6 +954,7 @@ void vi_capture_shutdown(
 		vfree(capture->unpins_list);
 		capture->unpins_list = NULL;
 	}
+	vi_capture_sim_free(capture);
 	kfree(capture);
 	chan->capture_data = NULL;
 }
@@ -670,12 +1094,16 @@ int vi_capture_setup(
 		goto syncpt_fail;
 	}
 
-	err = tegra_capture_ivc_register_control_cb(
-			&vi_capture_ivc_control_callback,
-			&transaction, capture);
-	if (err < 0) {
-		dev_err(chan->dev, "failed to register control callback\n");
-		goto control_cb_fail;
+	transaction = 0;
+	if (!vi_capture_is_sim(capture)) {
+		err = tegra_capture_ivc_register_control_cb(
+				&vi_capture_ivc_control_callback,
+				&transaction, capture);
+		if (err < 0) {
+			dev_err(chan->dev,
+				"failed to register control callback\n");
+			goto control_cb_fail;
+		}
 	}
 
 	memset(&control_desc, 0, sizeof(control_desc));
@@ -770,6 +1198,9 @@ int vi_capture_setup(
 	}
 
 
+	if (vi_capture_is_sim(capture))
+		goto done;
+
 	err = tegra_capture_ivc_notify_chan_id(capture->channel_id,
 			transaction);
 	if (err < 0) {
@@ -785,6 +1216,7 @@ int vi_capture_setup(
 		goto cb_fail;
 	}
 
+done:
 	channels[setup->csi_stream_id][setup->virtual_channel_id] = chan;
 
 	return 0;
@@ -803,7 +1235,8 @@ unpin_alloc_fail:
 		capture->requests_memoryinfo_iova);
 	capture->requests_memoryinfo = NULL;
 memoryinfo_alloc_fail:
-	tegra_capture_ivc_unregister_control_cb(transaction);
+	if (!vi_capture_is_sim(capture))
+		tegra_capture_ivc_unregister_control_cb(transaction);
 control_cb_fail:
 	vi_capture_release_syncpts(chan);
 syncpt_fail:
@@ -860,8 +1293,9 @@ int vi_capture_reset(
 	memset(&capture_desc, 0, sizeof(capture_desc));
 	capture_desc.header.msg_id = CAPTURE_RESET_BARRIER_IND;
 	capture_desc.header.channel_id = capture->channel_id;
-	err = tegra_capture_ivc_capture_submit(&capture_desc,
-			sizeof(capture_desc));
+	if (!vi_capture_is_sim(capture))
+		err = tegra_capture_ivc_capture_submit(&capture_desc,
+				sizeof(capture_desc));
 	if (err < 0) {
 		dev_err(chan->dev, "%s:IVC capture submit failed\n", __func__);
 		goto submit_fail;
@@ -960,18 +1394,22 @@ int vi_capture_release(
 		capture->requests_memoryinfo = NULL;
 	}
 
-	ret = tegra_capture_ivc_unregister_capture_cb(capture->channel_id);
-	if (ret < 0 && err == 0) {
-		dev_err(chan->dev,
-			"failed to unregister capture callback\n");
-		err = ret;
-	}
+	if (!vi_capture_is_sim(capture)) {
+		ret = tegra_capture_ivc_unregister_capture_cb(
+				capture->channel_id);
+		if (ret < 0 && err == 0) {
+			dev_err(chan->dev,
+				"failed to unregister capture callback\n");
+			err = ret;
+		}
 
-	ret = tegra_capture_ivc_unregister_control_cb(capture->channel_id);
-	if (ret < 0 && err == 0) {
-		dev_err(chan->dev,
-			"failed to unregister control callback\n");
-		err = ret;
+		ret = tegra_capture_ivc_unregister_control_cb(
+				capture->channel_id);
+		if (ret < 0 && err == 0) {
+			dev_err(chan->dev,
+				"failed to unregister control callback\n");
+			err = ret;
+		}
 	}
 
 	for (i = 0; i < capture->queue_depth; i++)
@@ -1404,6 +1842,12 @@ int vi_capture_request(
 
 	mutex_lock(&capture->reset_lock);
 
+	if (vi_capture_is_sim(capture)) {
+		err = vi_capture_sim_request(capture, req->buffer_index);
+		mutex_unlock(&capture->reset_lock);
+		return err;
+	}
+
 	memset(&capture_desc, 0, sizeof(capture_desc));
 	capture_desc.header.msg_id = CAPTURE_REQUEST_REQ;
 	capture_desc.header.channel_id = capture->channel_id;
@@ -1496,6 +1940,50 @@ int vi_capture_status(
 	return 0;
 }
 
+int vi_capture_status_poll(
+	struct tegra_vi_channel *chan)
+{
+	struct vi_capture *capture = chan->capture_data;
+
+	if (capture == NULL) {
+		dev_err(chan->dev,
+			 "%s: vi capture uninitialized\n", __func__);
+		return -ENODEV;
+	}
+
+	if (capture->channel_id == CAPTURE_CHANNEL_INVALID_ID) {
+		dev_err(chan->dev,
+			"%s: setup channel first\n", __func__);
+		return -ENODEV;
+	}
+
+	if (!try_wait_for_completion(&capture->capture_resp))
+		return -EAGAIN;
+
+	return 0;
+}
+
+int vi_capture_set_status_notify(
+	struct tegra_vi_channel *chan,
+	void (*notify)(void *priv),
+	void *priv)
+{
+	struct vi_capture *capture = chan->capture_data;
+
+	if (capture == NULL) {
+		dev_err(chan->dev,
+			 "%s: vi capture uninitialized\n", __func__);
+		return -ENODEV;
+	}
+
+	spin_lock(&capture->status_notify_lock);
+	capture->status_notify = notify;
+	capture->status_notify_priv = priv;
+	spin_unlock(&capture->status_notify_lock);
+
+	return 0;
+}
+
 int vi_capture_set_compand(struct tegra_vi_channel *chan,
 		struct vi_capture_compand *compand)
 {
@@ -1770,6 +2258,8 @@ static int capture_vi_probe(struct platform_device *pdev)
 
 	memset(channels, 0 , sizeof(channels));
 
+	vi_capture_sim_probe(dev);
+
 	return 0;
 
 cleanup:
@@ -1790,6 +2280,8 @@ static int capture_vi_remove(struct platform_device *pdev)
 
 	info = platform_get_drvdata(pdev);
 
+	vi_capture_sim_remove();
+
 	for (ii = 0; ii < info->num_vi_devices; ii++)
 		put_device(&info->vi_pdevices[ii]->dev);
 
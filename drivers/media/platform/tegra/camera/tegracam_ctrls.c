@@ -358,7 +358,9 @@ static int tegracam_set_grouphold_ex(struct tegracam_device *tc_dev,
 
 		/* TODO: block this write selectively from VI5 */
 		if (tc_dev->is_streaming) {
-			err = write_sensor_blob(s_data->regmap, blob);
+			err = write_sensor_blob_cached(s_data->regmap,
+				&s_data->tegracam_ctrl_hdl->sensor_data.shadow,
+				blob);
 			if (err)
 				return err;
 		}
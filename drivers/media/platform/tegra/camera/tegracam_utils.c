@@ -223,6 +223,244 @@ int write_sensor_blob(struct regmap *regmap, struct sensor_blob *blob)
 }
 EXPORT_SYMBOL_GPL(write_sensor_blob);
 
+/* largest run of registers merged into one bus transaction */
+#define TEGRACAM_SHADOW_MAX_RUN	32
+
+struct tegracam_shadow_run {
+	u32 addr;
+	u32 len;
+	u8 buf[TEGRACAM_SHADOW_MAX_RUN];
+};
+
+void tegracam_shadow_invalidate(struct tegracam_reg_shadow *shadow)
+{
+	shadow->num_regs = 0;
+	shadow->next_evict = 0;
+}
+EXPORT_SYMBOL_GPL(tegracam_shadow_invalidate);
+
+/*
+ * tegracam_shadow_set_nocache - exclude registers from the shadow
+ *
+ * Writes to these registers are never dropped as redundant, for
+ * registers where the write itself is the command, such as group hold
+ * launch or a software trigger. @regs must stay valid while in use.
+ */
+void tegracam_shadow_set_nocache(struct tegracam_reg_shadow *shadow,
+			const u32 *regs, u32 num_regs)
+{
+	shadow->nocache_regs = regs;
+	shadow->num_nocache_regs = num_regs;
+	tegracam_shadow_invalidate(shadow);
+}
+EXPORT_SYMBOL_GPL(tegracam_shadow_set_nocache);
+
+static bool shadow_nocache(struct tegracam_reg_shadow *shadow, u32 addr)
+{
+	u32 i;
+
+	for (i = 0; i < shadow->num_nocache_regs; i++)
+		if (shadow->nocache_regs[i] == addr)
+			return true;
+
+	return false;
+}
+
+static int shadow_find(struct tegracam_reg_shadow *shadow, u32 addr)
+{
+	u32 i;
+
+	for (i = 0; i < shadow->num_regs; i++)
+		if (shadow->regs[i].addr == addr)
+			return i;
+
+	return -1;
+}
+
+static bool shadow_match(struct tegracam_reg_shadow *shadow, u32 addr, u8 val)
+{
+	int i;
+
+	if (shadow_nocache(shadow, addr))
+		return false;
+
+	i = shadow_find(shadow, addr);
+
+	return i >= 0 && shadow->regs[i].val == val;
+}
+
+static void shadow_update(struct tegracam_reg_shadow *shadow, u32 addr, u8 val)
+{
+	int i = shadow_find(shadow, addr);
+
+	if (i < 0) {
+		if (shadow->num_regs < TEGRACAM_SHADOW_SIZE) {
+			i = shadow->num_regs++;
+		} else {
+			i = shadow->next_evict;
+			shadow->next_evict = (i + 1) % TEGRACAM_SHADOW_SIZE;
+		}
+		shadow->regs[i].addr = addr;
+	}
+	shadow->regs[i].val = val;
+}
+
+static int shadow_write(struct regmap *regmap,
+			struct tegracam_reg_shadow *shadow,
+			u32 addr, const u8 *buf, u32 len)
+{
+	int err;
+	u32 i;
+
+	err = regmap_bulk_write(regmap, addr, buf, len);
+	if (err) {
+		/* sensor state is unknown after a failed transfer */
+		tegracam_shadow_invalidate(shadow);
+		return err;
+	}
+
+	for (i = 0; i < len; i++)
+		shadow_update(shadow, addr + i, buf[i]);
+
+	return 0;
+}
+
+static int shadow_flush(struct regmap *regmap,
+			struct tegracam_reg_shadow *shadow,
+			struct tegracam_shadow_run *run)
+{
+	u32 len = run->len;
+	u32 i;
+
+	if (!len)
+		return 0;
+
+	run->len = 0;
+
+	/* pending writes were reverted before reaching the bus */
+	for (i = 0; i < len; i++)
+		if (!shadow_match(shadow, run->addr + i, run->buf[i]))
+			break;
+	if (i == len)
+		return 0;
+
+	return shadow_write(regmap, shadow, run->addr, run->buf, len);
+}
+
+static int shadow_queue_write(struct regmap *regmap,
+			struct tegracam_reg_shadow *shadow,
+			struct tegracam_shadow_run *run,
+			u32 addr, const u8 *data, u32 size)
+{
+	u32 first, last;
+	int err;
+
+	/*
+	 * Rewrite of a register still held in the pending run. Both values
+	 * must reach the sensor in order, e.g. group hold end then launch
+	 * on the same register, so settle the run before comparing.
+	 */
+	if (run->len && addr < run->addr + run->len &&
+		addr + size > run->addr) {
+		err = shadow_flush(regmap, shadow, run);
+		if (err)
+			return err;
+	}
+
+	/* trim registers which already hold the requested value */
+	for (first = 0; first < size; first++)
+		if (!shadow_match(shadow, addr + first, data[first]))
+			break;
+	if (first == size)
+		return 0;
+	for (last = size; last > first; last--)
+		if (!shadow_match(shadow, addr + last - 1, data[last - 1]))
+			break;
+
+	/* contiguous with the pending run, send both in one transaction */
+	if (run->len && run->addr + run->len == addr &&
+		run->len + last <= TEGRACAM_SHADOW_MAX_RUN) {
+		memcpy(&run->buf[run->len], data, last);
+		run->len += last;
+		return 0;
+	}
+
+	err = shadow_flush(regmap, shadow, run);
+	if (err)
+		return err;
+
+	if (last - first > TEGRACAM_SHADOW_MAX_RUN)
+		return shadow_write(regmap, shadow, addr + first,
+				&data[first], last - first);
+
+	run->addr = addr + first;
+	run->len = last - first;
+	memcpy(run->buf, &data[first], run->len);
+
+	return 0;
+}
+
+/*
+ * write_sensor_blob_cached - write a blob skipping redundant registers
+ *
+ * Writes which match the last value written to the sensor are dropped,
+ * and the remaining writes to consecutive registers are merged into a
+ * single bulk transfer. Command order is preserved, so writes issued
+ * inside a group hold window stay inside it, and repeated writes to one
+ * register within a blob all reach the sensor. The shadow must be
+ * invalidated whenever the sensor registers change behind its back,
+ * such as on mode switch or power cycle.
+ */
+int write_sensor_blob_cached(struct regmap *regmap,
+			struct tegracam_reg_shadow *shadow,
+			struct sensor_blob *blob)
+{
+	struct tegracam_shadow_run run;
+	int err = 0;
+	int cmd_idx = 0;
+	int buf_index = 0;
+
+	/* shadow tracks 8-bit registers only */
+	if (shadow == NULL || regmap_get_val_bytes(regmap) != 1)
+		return write_sensor_blob(regmap, blob);
+
+	run.len = 0;
+	while (cmd_idx < blob->num_cmds) {
+		struct sensor_cmd *cmd = &blob->cmds[cmd_idx++];
+		u32 val;
+
+		val = cmd->opcode;
+		if ((val >> 24) == SENSOR_OPCODE_DONE)
+			break;
+
+		if ((val >> 24) == SENSOR_OPCODE_SLEEP) {
+			err = shadow_flush(regmap, shadow, &run);
+			if (err)
+				return err;
+			val = val & 0x00FFFFFF;
+			usleep_range(val, val + 10);
+			continue;
+		}
+
+		if ((val >> 24) == SENSOR_OPCODE_WRITE) {
+			int size = val & 0x00FFFFFF;
+
+			err = shadow_queue_write(regmap, shadow, &run,
+					cmd->addr, &blob->buf[buf_index], size);
+			if (err)
+				return err;
+			buf_index += size;
+		} else {
+			pr_err("blob has been packaged with errors\n");
+			shadow_flush(regmap, shadow, &run);
+			return -EINVAL;
+		}
+	}
+
+	return shadow_flush(regmap, shadow, &run);
+}
+EXPORT_SYMBOL_GPL(write_sensor_blob_cached);
+
 int tegracam_write_blobs(struct tegracam_ctrl_handler *hdl)
 {
 	struct camera_common_data *s_data = hdl->tc_dev->s_data;
@@ -242,6 +480,8 @@ int tegracam_write_blobs(struct tegracam_ctrl_handler *hdl)
 	 * and stop streaming cases
 	 */
 	if (mode_blob->num_cmds) {
+		/* mode tables rewrite registers behind the shadow */
+		tegracam_shadow_invalidate(&sensor_data->shadow);
 		err = write_sensor_blob(s_data->regmap, mode_blob);
 		if (err) {
 			dev_err(s_data->dev, "Error writing mode blob\n");
@@ -249,7 +489,8 @@ int tegracam_write_blobs(struct tegracam_ctrl_handler *hdl)
 		}
 	}
 
-	err = write_sensor_blob(s_data->regmap, ctrl_blob);
+	err = write_sensor_blob_cached(s_data->regmap, &sensor_data->shadow,
+			ctrl_blob);
 	if (err) {
 		dev_err(s_data->dev, "Error writing control blob\n");
 		return err;
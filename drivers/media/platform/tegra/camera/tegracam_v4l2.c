@@ -38,6 +38,7 @@ static int v4l2sd_stream(struct v4l2_subdev *sd, int enable)
 	/* reset control packet at start/stop streaming */
 	memset(ctrl_blob, 0, sizeof(struct sensor_blob));
 	memset(mode_blob, 0, sizeof(struct sensor_blob));
+	tegracam_shadow_invalidate(&sensor_data->shadow);
 	if (enable) {
 		/* increase ref count so module can't be unloaded */
 		if (!try_module_get(s_data->owner))
@@ -116,8 +117,21 @@ static struct v4l2_subdev_video_ops v4l2sd_video_ops = {
 	.g_input_status = v4l2sd_g_input_status,
 };
 
+static int v4l2sd_s_power(struct v4l2_subdev *sd, int on)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct camera_common_data *s_data = to_camera_common_data(&client->dev);
+
+	/* register contents do not survive a power cycle */
+	if (s_data->tegracam_ctrl_hdl)
+		tegracam_shadow_invalidate(
+			&s_data->tegracam_ctrl_hdl->sensor_data.shadow);
+
+	return camera_common_s_power(sd, on);
+}
+
 static struct v4l2_subdev_core_ops v4l2sd_core_ops = {
-	.s_power	= camera_common_s_power,
+	.s_power	= v4l2sd_s_power,
 };
 
 static int v4l2sd_get_fmt(struct v4l2_subdev *sd,
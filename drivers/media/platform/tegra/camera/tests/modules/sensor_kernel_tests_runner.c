@@ -46,6 +46,11 @@ struct skt_test skt_available_tests[] = {
 		.description = "Asserts compliance of sensor DT",
 		.run = sensor_verify_dt,
 	},
+	{
+		.name = "Sensor Blob Cache Test",
+		.description = "Counts bus transactions of cached blob writes",
+		.run = sensor_verify_blob_cache,
+	},
 };
 
 int skt_runner_num_tests(void)
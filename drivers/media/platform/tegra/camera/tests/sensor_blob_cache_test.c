@@ -0,0 +1,326 @@
+/*
+ * sensor_blob_cache_test - cached sensor blob write test
+ *
+ * Copyright (c) 2018, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/kernel.h>
+#include <linux/regmap.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "media/tegracam_core.h"
+#include "media/tegracam_utils.h"
+#include "tegracam_tests.h"
+#include "utils/tegracam_log.h"
+
+#define SBC_REG_BYTES                 (2U)
+#define SBC_MAX_XFERS                 (16U)
+
+/* OV style group hold register and its commands */
+#define SBC_GROUP_HOLD                (0x3208U)
+#define SBC_GROUP_HOLD_START          (0x00U)
+#define SBC_GROUP_HOLD_END            (0x10U)
+#define SBC_GROUP_HOLD_LAUNCH         (0xA0U)
+#define SBC_EXPOSURE                  (0x3500U)
+#define SBC_GAIN                      (0x350aU)
+
+/**
+ * sbc_xfer - one bus transaction seen by the fake regmap
+ *
+ * @addr:  first register written
+ * @len:   number of registers written
+ * @first: value of the first register
+ * @last:  value of the last register
+ */
+struct sbc_xfer {
+	u32 addr;
+	u32 len;
+	u8 first;
+	u8 last;
+};
+
+/**
+ * sbc_bus - fake sensor bus counting transactions and payload
+ *
+ * @nxfers: transactions since the last reset
+ * @nbytes: register values written since the last reset
+ * @xfers:  first SBC_MAX_XFERS transactions
+ */
+struct sbc_bus {
+	u32 nxfers;
+	u32 nbytes;
+	struct sbc_xfer xfers[SBC_MAX_XFERS];
+};
+
+struct sbc_ctx {
+	struct sbc_bus bus;
+	struct regmap *regmap;
+	struct tegracam_reg_shadow shadow;
+	struct sensor_blob blob;
+};
+
+static int sbc_bus_write(void *context, const void *data, size_t count)
+{
+	struct sbc_bus *bus = context;
+	const u8 *buf = data;
+	struct sbc_xfer *xfer;
+
+	if (count <= SBC_REG_BYTES)
+		return -EINVAL;
+
+	if (bus->nxfers < SBC_MAX_XFERS) {
+		xfer = &bus->xfers[bus->nxfers];
+		xfer->addr = (buf[0] << 8) | buf[1];
+		xfer->len = count - SBC_REG_BYTES;
+		xfer->first = buf[SBC_REG_BYTES];
+		xfer->last = buf[count - 1];
+	}
+	bus->nxfers++;
+	bus->nbytes += count - SBC_REG_BYTES;
+
+	return 0;
+}
+
+static int sbc_bus_read(void *context, const void *reg, size_t reg_size,
+		void *val, size_t val_size)
+{
+	memset(val, 0, val_size);
+
+	return 0;
+}
+
+static const struct regmap_bus sbc_regmap_bus = {
+	.write = sbc_bus_write,
+	.read = sbc_bus_read,
+};
+
+static const struct regmap_config sbc_regmap_config = {
+	.name = "skt-blob-cache",
+	.reg_bits = 16,
+	.val_bits = 8,
+	.cache_type = REGCACHE_NONE,
+};
+
+static void sbc_reset(struct sbc_ctx *ctx)
+{
+	memset(&ctx->bus, 0, sizeof(ctx->bus));
+	memset(&ctx->blob, 0, sizeof(ctx->blob));
+}
+
+static void sbc_write(struct sbc_ctx *ctx, u32 addr, u8 val)
+{
+	prepare_write_cmd(&ctx->blob, 1, addr, &val);
+}
+
+/* Control blob of a typical gain/exposure update under group hold */
+static void sbc_make_ctrl_blob(struct sbc_ctx *ctx, u8 exposure, u8 gain)
+{
+	u8 exp[3] = { 0x00, exposure, 0x00 };
+
+	sbc_write(ctx, SBC_GROUP_HOLD, SBC_GROUP_HOLD_START);
+	prepare_write_cmd(&ctx->blob, sizeof(exp), SBC_EXPOSURE, exp);
+	sbc_write(ctx, SBC_GAIN, 0x00);
+	sbc_write(ctx, SBC_GAIN + 1, gain);
+	sbc_write(ctx, SBC_GROUP_HOLD, SBC_GROUP_HOLD_END);
+	sbc_write(ctx, SBC_GROUP_HOLD, SBC_GROUP_HOLD_LAUNCH);
+	prepare_done_cmd(&ctx->blob);
+}
+
+static int sbc_flush_blob(struct sbc_ctx *ctx)
+{
+	int err;
+
+	err = write_sensor_blob_cached(ctx->regmap, &ctx->shadow, &ctx->blob);
+	if (err)
+		camtest_log(KERN_ERR "  cached blob write failed: %d\n", err);
+
+	return err;
+}
+
+static int sbc_expect(struct sbc_ctx *ctx, const char *what,
+		u32 nxfers, u32 nbytes)
+{
+	if (ctx->bus.nxfers == nxfers && ctx->bus.nbytes == nbytes)
+		return 0;
+
+	camtest_log(KERN_ERR "  %s: %u transactions/%u bytes, expected %u/%u\n",
+			what, ctx->bus.nxfers, ctx->bus.nbytes,
+			nxfers, nbytes);
+	return -EINVAL;
+}
+
+static int sbc_expect_xfer(struct sbc_ctx *ctx, u32 idx, u32 addr, u8 val)
+{
+	const struct sbc_xfer *xfer = &ctx->bus.xfers[idx];
+
+	if (idx < ctx->bus.nxfers && xfer->addr == addr &&
+			xfer->len == 1 && xfer->first == val)
+		return 0;
+
+	camtest_log(KERN_ERR "  transaction %u is not 0x%04x = 0x%02x\n",
+			idx, addr, val);
+	return -EINVAL;
+}
+
+/* First write sends everything, runs merged into one transaction each */
+static int sbc_test_cold(struct sbc_ctx *ctx)
+{
+	int err;
+
+	tegracam_shadow_invalidate(&ctx->shadow);
+	sbc_reset(ctx);
+	sbc_make_ctrl_blob(ctx, 0x40, 0x80);
+	err = sbc_flush_blob(ctx);
+	if (err)
+		return err;
+
+	/* hold start, exposure, gain, hold end, launch */
+	return sbc_expect(ctx, "cold write", 5, 8);
+}
+
+/* Unchanged controls only resend the group hold commands */
+static int sbc_test_redundant(struct sbc_ctx *ctx)
+{
+	int err;
+
+	sbc_reset(ctx);
+	sbc_make_ctrl_blob(ctx, 0x40, 0x80);
+	err = sbc_flush_blob(ctx);
+	if (err)
+		return err;
+
+	err = sbc_expect(ctx, "unchanged controls", 3, 3);
+	if (err)
+		return err;
+
+	err = sbc_expect_xfer(ctx, 0, SBC_GROUP_HOLD, SBC_GROUP_HOLD_START);
+	err |= sbc_expect_xfer(ctx, 1, SBC_GROUP_HOLD, SBC_GROUP_HOLD_END);
+	err |= sbc_expect_xfer(ctx, 2, SBC_GROUP_HOLD, SBC_GROUP_HOLD_LAUNCH);
+
+	return err;
+}
+
+/* Only the changed register is sent, in order inside the hold window */
+static int sbc_test_partial(struct sbc_ctx *ctx)
+{
+	int err;
+
+	sbc_reset(ctx);
+	sbc_make_ctrl_blob(ctx, 0x40, 0x81);
+	err = sbc_flush_blob(ctx);
+	if (err)
+		return err;
+
+	err = sbc_expect(ctx, "gain change", 4, 4);
+	if (err)
+		return err;
+
+	err = sbc_expect_xfer(ctx, 1, SBC_GAIN + 1, 0x81);
+	err |= sbc_expect_xfer(ctx, 3, SBC_GROUP_HOLD, SBC_GROUP_HOLD_LAUNCH);
+
+	return err;
+}
+
+/* Back-to-back writes to one register are both sent */
+static int sbc_test_back_to_back(struct sbc_ctx *ctx)
+{
+	int err;
+
+	sbc_reset(ctx);
+	sbc_write(ctx, SBC_GROUP_HOLD, SBC_GROUP_HOLD_END);
+	sbc_write(ctx, SBC_GROUP_HOLD, SBC_GROUP_HOLD_LAUNCH);
+	prepare_done_cmd(&ctx->blob);
+	err = sbc_flush_blob(ctx);
+	if (err)
+		return err;
+
+	err = sbc_expect(ctx, "back-to-back writes", 2, 2);
+	if (err)
+		return err;
+
+	err = sbc_expect_xfer(ctx, 0, SBC_GROUP_HOLD, SBC_GROUP_HOLD_END);
+	err |= sbc_expect_xfer(ctx, 1, SBC_GROUP_HOLD, SBC_GROUP_HOLD_LAUNCH);
+
+	return err;
+}
+
+/* Registers marked nocache are written even when unchanged */
+static int sbc_test_nocache(struct sbc_ctx *ctx)
+{
+	static const u32 nocache[] = { SBC_GROUP_HOLD };
+	int err;
+
+	tegracam_shadow_set_nocache(&ctx->shadow, nocache,
+			ARRAY_SIZE(nocache));
+
+	sbc_reset(ctx);
+	sbc_write(ctx, SBC_GROUP_HOLD, SBC_GROUP_HOLD_LAUNCH);
+	prepare_done_cmd(&ctx->blob);
+	err = sbc_flush_blob(ctx);
+	if (err)
+		return err;
+
+	sbc_reset(ctx);
+	sbc_write(ctx, SBC_GROUP_HOLD, SBC_GROUP_HOLD_LAUNCH);
+	prepare_done_cmd(&ctx->blob);
+	err = sbc_flush_blob(ctx);
+
+	tegracam_shadow_set_nocache(&ctx->shadow, NULL, 0);
+	if (err)
+		return err;
+
+	return sbc_expect(ctx, "nocache rewrite", 1, 1);
+}
+
+int sensor_verify_blob_cache(struct device_node *node, const u32 tvcf_version)
+{
+	struct sbc_ctx *ctx;
+	int err;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (ctx == NULL)
+		return -ENOMEM;
+
+	ctx->regmap = regmap_init(NULL, &sbc_regmap_bus, &ctx->bus,
+			&sbc_regmap_config);
+	if (IS_ERR(ctx->regmap)) {
+		camtest_log(KERN_ERR "Could not create fake regmap\n");
+		err = PTR_ERR(ctx->regmap);
+		goto free_ctx;
+	}
+
+	err = sbc_test_cold(ctx);
+	if (err == 0)
+		err = sbc_test_redundant(ctx);
+	if (err == 0)
+		err = sbc_test_partial(ctx);
+	if (err == 0)
+		err = sbc_test_back_to_back(ctx);
+	if (err == 0)
+		err = sbc_test_nocache(ctx);
+
+	regmap_exit(ctx->regmap);
+
+free_ctx:
+	kfree(ctx);
+
+	if (err == 0)
+		camtest_log(KERN_INFO "Sensor blob cache test passed\n");
+	else
+		camtest_log(KERN_INFO "Sensor blob cache test failed\n");
+
+	return err;
+}
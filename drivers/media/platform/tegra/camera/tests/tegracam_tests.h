@@ -22,5 +22,7 @@
  * Tegra Camera Kernel Tests
  */
 int sensor_verify_dt(struct device_node *node, const u32 tvcf_version);
+int sensor_verify_blob_cache(struct device_node *node,
+		const u32 tvcf_version);
 
 #endif // __TEGRACAM_TESTS_H__
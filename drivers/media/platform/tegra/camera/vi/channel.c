@@ -791,8 +791,11 @@ static void tegra_channel_buffer_queue(struct vb2_buffer *vb)
 	list_add_tail(&buf->queue, &chan->capture);
 	spin_unlock(&chan->start_lock);
 
-	/* Wake up kthread for capture */
-	wake_up_interruptible(&chan->start_wait);
+	/* Submit it right away if the vi can, else wake up kthread */
+	if (chan->vi->fops && chan->vi->fops->vi_buffer_queue)
+		chan->vi->fops->vi_buffer_queue(chan);
+	else
+		wake_up_interruptible(&chan->start_wait);
 }
 
 
@@ -2476,6 +2479,7 @@ int tegra_channel_init(struct tegra_channel *chan)
 	init_waitqueue_head(&chan->dequeue_wait);
 	spin_lock_init(&chan->dequeue_lock);
 	mutex_init(&chan->stop_kthread_lock);
+	mutex_init(&chan->enqueue_lock);
 	init_rwsem(&chan->reset_lock);
 	atomic_set(&chan->is_streaming, DISABLE);
 	spin_lock_init(&chan->capture_state_lock);
@@ -10,11 +10,10 @@
  * published by the Free Software Foundation.
  */
 
-#include <linux/freezer.h>
-#include <linux/kthread.h>
 #include <linux/nvhost.h>
 #include <linux/semaphore.h>
 #include <linux/version.h>
+#include <linux/workqueue.h>
 #include <media/tegra_camera_platform.h>
 #include <media/mc_common.h>
 #include <media/tegra-v4l2-camera.h>
@@ -35,6 +34,13 @@
 
 #define CAPTURE_TIMEOUT_MS	2500
 
+/* frames of all channels are retired by one small shared pool */
+#define CAPTURE_WQ_MAX_ACTIVE	4
+
+static struct workqueue_struct *vi5_capture_wq;
+static unsigned int vi5_capture_wq_users;
+static DEFINE_MUTEX(vi5_capture_wq_lock);
+
 static const struct vi_capture_setup default_setup = {
 	.channel_flags = 0
 	| CAPTURE_CHANNEL_FLAG_VIDEO
@@ -256,6 +262,35 @@ static struct tegra_csi_channel *find_linked_csi_channel(
 	return csi_chan;
 }
 
+/* Frame status arrived: retire finished buffers from the shared pool */
+static void vi5_capture_status_notify(void *priv)
+{
+	struct tegra_channel *chan = priv;
+
+	if (READ_ONCE(chan->capture_running))
+		mod_delayed_work(vi5_capture_wq, &chan->retire_work, 0);
+}
+
+/* Make sure the retire work runs by the head buffer's deadline */
+static void vi5_capture_arm_timeout(struct tegra_channel *chan)
+{
+	unsigned long deadline, delay = 0;
+	bool pending;
+
+	spin_lock(&chan->dequeue_lock);
+	pending = !list_empty(&chan->dequeue);
+	deadline = chan->retire_deadline;
+	spin_unlock(&chan->dequeue_lock);
+
+	if (!pending)
+		return;
+
+	if (time_after(deadline, jiffies))
+		delay = deadline - jiffies;
+
+	queue_delayed_work(vi5_capture_wq, &chan->retire_work, delay);
+}
+
 static int tegra_channel_capture_setup(struct tegra_channel *chan)
 {
 	struct vi_capture_setup setup = default_setup;
@@ -305,6 +340,10 @@ static int tegra_channel_capture_setup(struct tegra_channel *chan)
 		return err;
 	}
 
+	vi_capture_sim_set_requests(chan->tegra_vi_channel, chan->request);
+	vi_capture_set_status_notify(chan->tegra_vi_channel,
+		vi5_capture_status_notify, chan);
+
 	return 0;
 }
 
@@ -403,10 +442,13 @@ static void vi5_capture_enqueue(struct tegra_channel *chan,
 
 	/* Move buffer into dequeue queue */
 	spin_lock(&chan->dequeue_lock);
+	if (list_empty(&chan->dequeue))
+		chan->retire_deadline = jiffies +
+			msecs_to_jiffies(CAPTURE_TIMEOUT_MS);
 	list_add_tail(&buf->queue, &chan->dequeue);
 	spin_unlock(&chan->dequeue_lock);
 
-	wake_up_interruptible(&chan->dequeue_wait);
+	vi5_capture_arm_timeout(chan);
 
 	return;
 
@@ -414,12 +456,18 @@ uncorr_err:
 	spin_lock_irqsave(&chan->capture_state_lock, flags);
 	chan->capture_state = CAPTURE_ERROR;
 	spin_unlock_irqrestore(&chan->capture_state_lock, flags);
+
+	/* let the retire work recover the channel */
+	mod_delayed_work(vi5_capture_wq, &chan->retire_work, 0);
 }
 
+/*
+ * Complete a buffer taken off the dequeue queue. @err is the result of
+ * waiting for its capture status.
+ */
 static void vi5_capture_dequeue(struct tegra_channel *chan,
-	struct tegra_channel_buffer *buf)
+	struct tegra_channel_buffer *buf, int err)
 {
-	int err = 0;
 	unsigned long flags;
 	struct tegra_mc_vi *vi = chan->vi;
 	struct vb2_v4l2_buffer *vb = &buf->buf;
@@ -434,8 +482,7 @@ static void vi5_capture_dequeue(struct tegra_channel *chan,
 	if (buf->vb2_state != VB2_BUF_STATE_ACTIVE)
 		goto rel_buf;
 
-	/* Dequeue a frame and check its capture status */
-	err = vi_capture_status(chan->tegra_vi_channel, CAPTURE_TIMEOUT_MS);
+	/* Check the capture status of the frame */
 	if (err) {
 		if (err == -ETIMEDOUT) {
 			dev_err(vi->dev,
@@ -502,8 +549,6 @@ done:
 	}
 	spin_unlock_irqrestore(&chan->capture_state_lock, flags);
 
-	wake_up_interruptible(&chan->start_wait);
-
 	goto rel_buf;
 
 uncorr_err:
@@ -548,7 +593,7 @@ static int vi5_channel_error_recover(struct tegra_channel *chan,
 		if (!buf)
 			break;
 		buf->vb2_state = VB2_BUF_STATE_ERROR;
-		vi5_capture_dequeue(chan, buf);
+		vi5_capture_dequeue(chan, buf, 0);
 	}
 
 	/* report queue error to application */
@@ -589,149 +634,180 @@ done:
 	return err;
 }
 
-static int tegra_channel_kthread_capture_enqueue(void *data)
+/* Submit queued buffers while capture descriptors are free */
+static void vi5_capture_fill(struct tegra_channel *chan)
 {
-	struct tegra_channel *chan = data;
 	struct tegra_channel_buffer *buf;
 	unsigned long flags;
+	bool full;
 
-	set_freezable();
-
-	while (1) {
-		try_to_freeze();
+	mutex_lock(&chan->enqueue_lock);
 
-		wait_event_interruptible(chan->start_wait,
-			(kthread_should_stop() || !list_empty(&chan->capture)));
-
-		while (!(kthread_should_stop() || list_empty(&chan->capture))) {
-			spin_lock_irqsave(&chan->capture_state_lock, flags);
-			if ((chan->capture_state == CAPTURE_ERROR)
-					|| !(chan->capture_reqs_enqueued
-					< chan->capture_queue_depth)) {
-				spin_unlock_irqrestore(
-					&chan->capture_state_lock, flags);
-				break;
-			}
-			spin_unlock_irqrestore(&chan->capture_state_lock,
-				flags);
-
-			buf = dequeue_buffer(chan, false);
-			if (!buf)
-				break;
+	while (chan->capture_running) {
+		spin_lock_irqsave(&chan->capture_state_lock, flags);
+		full = (chan->capture_state == CAPTURE_ERROR)
+			|| !(chan->capture_reqs_enqueued
+				< chan->capture_queue_depth);
+		spin_unlock_irqrestore(&chan->capture_state_lock, flags);
+		if (full)
+			break;
 
-			buf->vb2_state = VB2_BUF_STATE_ACTIVE;
+		buf = dequeue_buffer(chan, false);
+		if (!buf)
+			break;
 
-			vi5_capture_enqueue(chan, buf);
-		}
+		buf->vb2_state = VB2_BUF_STATE_ACTIVE;
 
-		if (kthread_should_stop())
-			break;
+		vi5_capture_enqueue(chan, buf);
 	}
 
-	return 0;
+	mutex_unlock(&chan->enqueue_lock);
 }
 
-static int tegra_channel_kthread_capture_dequeue(void *data)
+static void vi5_buffer_queue(struct tegra_channel *chan)
 {
-	int err = 0;
-	unsigned long flags;
-	struct tegra_channel *chan = data;
+	vi5_capture_fill(chan);
+}
+
+/*
+ * Retire every buffer whose capture status has arrived, in order. Runs
+ * on a status notification, or at the head buffer's deadline to catch
+ * frames that never complete.
+ */
+static void vi5_capture_retire(struct work_struct *work)
+{
+	struct tegra_channel *chan = container_of(to_delayed_work(work),
+		struct tegra_channel, retire_work);
 	struct tegra_channel_buffer *buf;
+	unsigned long flags;
+	bool error = false;
+	int err;
 
-	set_freezable();
+	while (READ_ONCE(chan->capture_running)) {
+		spin_lock_irqsave(&chan->capture_state_lock, flags);
+		error = (chan->capture_state == CAPTURE_ERROR);
+		spin_unlock_irqrestore(&chan->capture_state_lock, flags);
+		if (error)
+			break;
 
-	while (1) {
-		try_to_freeze();
+		spin_lock(&chan->dequeue_lock);
+		buf = list_first_entry_or_null(&chan->dequeue,
+			struct tegra_channel_buffer, queue);
+		spin_unlock(&chan->dequeue_lock);
+		if (!buf)
+			break;
 
-		wait_event_interruptible(chan->dequeue_wait,
-			(kthread_should_stop()
-				|| !list_empty(&chan->dequeue)
-				|| (chan->capture_state == CAPTURE_ERROR)));
+		err = 0;
+		if (buf->vb2_state == VB2_BUF_STATE_ACTIVE) {
+			err = vi_capture_status_poll(chan->tegra_vi_channel);
+			if (err == -EAGAIN) {
+				if (time_before(jiffies, chan->retire_deadline))
+					break;
+				err = -ETIMEDOUT;
+			}
+		}
 
-		while (!(kthread_should_stop() || list_empty(&chan->dequeue)
-				|| (chan->capture_state == CAPTURE_ERROR))) {
+		spin_lock(&chan->dequeue_lock);
+		list_del_init(&buf->queue);
+		chan->retire_deadline = jiffies +
+			msecs_to_jiffies(CAPTURE_TIMEOUT_MS);
+		spin_unlock(&chan->dequeue_lock);
 
-			buf = dequeue_dequeue_buffer(chan);
-			if (!buf)
-				break;
+		vi5_capture_dequeue(chan, buf, err);
+	}
 
-			vi5_capture_dequeue(chan, buf);
-		}
+	if (!READ_ONCE(chan->capture_running))
+		return;
 
-		spin_lock_irqsave(&chan->capture_state_lock, flags);
-		if (chan->capture_state == CAPTURE_ERROR) {
-			spin_unlock_irqrestore(&chan->capture_state_lock,
-				flags);
-			err = tegra_channel_error_recover(chan, false);
-			if (err) {
-				dev_err(chan->vi->dev,
-					"fatal: error recovery failed\n");
-				break;
-			}
-		} else
-			spin_unlock_irqrestore(&chan->capture_state_lock,
-				flags);
-		if (kthread_should_stop())
-			break;
+	if (error) {
+		err = tegra_channel_error_recover(chan, false);
+		if (err) {
+			dev_err(chan->vi->dev,
+				"fatal: error recovery failed\n");
+			return;
+		}
 	}
 
-	return 0;
+	/* retired frames freed capture descriptors */
+	vi5_capture_fill(chan);
+	vi5_capture_arm_timeout(chan);
 }
 
-static int vi5_channel_start_kthreads(struct tegra_channel *chan)
+static int vi5_capture_wq_get(void)
 {
 	int err = 0;
 
-	/* Start the kthread for capture enqueue */
-	if (chan->kthread_capture_start) {
-		dev_err(chan->vi->dev, "enqueue kthread already initialized\n");
-		err = -1;
-		goto done;
-	}
-	chan->kthread_capture_start = kthread_run(
-		tegra_channel_kthread_capture_enqueue, chan, chan->video->name);
-	if (IS_ERR(chan->kthread_capture_start)) {
-		dev_err(&chan->video->dev,
-			"failed to run kthread for capture enqueue\n");
-		err = PTR_ERR(chan->kthread_capture_start);
-		goto done;
+	mutex_lock(&vi5_capture_wq_lock);
+	if (!vi5_capture_wq_users) {
+		vi5_capture_wq = alloc_workqueue("vi5_capture",
+			WQ_UNBOUND | WQ_HIGHPRI | WQ_FREEZABLE,
+			CAPTURE_WQ_MAX_ACTIVE);
+		if (!vi5_capture_wq)
+			err = -ENOMEM;
 	}
+	if (!err)
+		vi5_capture_wq_users++;
+	mutex_unlock(&vi5_capture_wq_lock);
 
-	/* Start the kthread for capture dequeue */
-	if (chan->kthread_capture_dequeue) {
-		dev_err(chan->vi->dev, "dequeue kthread already initialized\n");
-		err = -1;
-		goto done;
+	return err;
+}
+
+static void vi5_capture_wq_put(void)
+{
+	mutex_lock(&vi5_capture_wq_lock);
+	if (!--vi5_capture_wq_users) {
+		destroy_workqueue(vi5_capture_wq);
+		vi5_capture_wq = NULL;
 	}
-	chan->kthread_capture_dequeue = kthread_run(
-		tegra_channel_kthread_capture_dequeue, chan, chan->video->name);
-	if (IS_ERR(chan->kthread_capture_dequeue)) {
-		dev_err(&chan->video->dev,
-			"failed to run kthread for capture dequeue\n");
-		err = PTR_ERR(chan->kthread_capture_dequeue);
-		goto done;
+	mutex_unlock(&vi5_capture_wq_lock);
+}
+
+static int vi5_channel_start_capture(struct tegra_channel *chan)
+{
+	int err;
+
+	err = vi5_capture_wq_get();
+	if (err) {
+		dev_err(chan->vi->dev, "failed to create capture workqueue\n");
+		return err;
 	}
 
-done:
-	return err;
+	INIT_DELAYED_WORK(&chan->retire_work, vi5_capture_retire);
+
+	mutex_lock(&chan->enqueue_lock);
+	chan->capture_running = true;
+	mutex_unlock(&chan->enqueue_lock);
+
+	/* submit buffers queued before streaming started */
+	vi5_capture_fill(chan);
+
+	return 0;
 }
 
-static void vi5_channel_stop_kthreads(struct tegra_channel *chan)
+static void vi5_channel_stop_capture(struct tegra_channel *chan)
 {
 	mutex_lock(&chan->stop_kthread_lock);
 
-	/* Stop the kthread for capture enqueue */
-	if (chan->kthread_capture_start) {
-		kthread_stop(chan->kthread_capture_start);
-		chan->kthread_capture_start = NULL;
-	}
-
-	/* Stop the kthread for capture dequeue */
-	if (chan->kthread_capture_dequeue) {
-		kthread_stop(chan->kthread_capture_dequeue);
-		chan->kthread_capture_dequeue = NULL;
+	mutex_lock(&chan->enqueue_lock);
+	if (!chan->capture_running) {
+		mutex_unlock(&chan->enqueue_lock);
+		goto done;
 	}
+	chan->capture_running = false;
+	mutex_unlock(&chan->enqueue_lock);
+
+	/*
+	 * A status may have seen capture_running still set; once the notify
+	 * is unregistered no callback is left to queue the retire work on
+	 * a workqueue that is about to go away.
+	 */
+	if (!IS_ERR_OR_NULL(chan->tegra_vi_channel))
+		vi_capture_set_status_notify(chan->tegra_vi_channel,
+			NULL, NULL);
+	cancel_delayed_work_sync(&chan->retire_work);
+	vi5_capture_wq_put();
 
+done:
 	mutex_unlock(&chan->stop_kthread_lock);
 }
 
@@ -841,9 +917,9 @@ static int vi5_channel_start_streaming(struct vb2_queue *vq, u32 count)
 		chan->sequence = 0;
 		tegra_channel_init_ring_buffer(chan);
 
-		ret = vi5_channel_start_kthreads(chan);
+		ret = vi5_channel_start_capture(chan);
 		if (ret != 0)
-			goto err_start_kthreads;
+			goto err_start_capture;
 	}
 
 	/* csi stream/sensor devices should be streamon post vi channel setup */
@@ -862,9 +938,9 @@ err_write_blobs:
 
 err_set_stream:
 	if (!chan->bypass)
-		vi5_channel_stop_kthreads(chan);
+		vi5_channel_stop_capture(chan);
 
-err_start_kthreads:
+err_start_capture:
 	if (!chan->bypass)
 		vi_capture_release(chan->tegra_vi_channel,
 			CAPTURE_CHANNEL_RESET_FLAG_IMMEDIATE);
@@ -888,7 +964,7 @@ static int vi5_channel_stop_streaming(struct vb2_queue *vq)
 	long err;
 
 	if (!chan->bypass)
-		vi5_channel_stop_kthreads(chan);
+		vi5_channel_stop_capture(chan);
 
 	/* csi stream/sensor(s) devices to be closed before vi channel */
 	tegra_channel_set_stream(chan, false);
@@ -978,4 +1054,5 @@ struct tegra_vi_fops vi5_fops = {
 	.vi_add_ctrls = vi5_add_ctrls,
 	.vi_init_video_formats = vi5_init_video_formats,
 	.vi_unit_get_device_handle = vi5_unit_get_device_handle,
+	.vi_buffer_queue = vi5_buffer_queue,
 };
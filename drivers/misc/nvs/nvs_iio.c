@@ -86,7 +86,7 @@
 #include <linux/iio/buffer_impl.h>
 #endif
 
-#define NVS_IIO_DRIVER_VERSION		(224)
+#define NVS_IIO_DRIVER_VERSION		(225)
 
 enum NVS_ATTR {
 	NVS_ATTR_ENABLE,
@@ -724,6 +724,133 @@ static int nvs_buf_push(struct iio_dev *indio_dev, unsigned char *data, s64 ts)
 	return ret;
 }
 
+/* Copy one sample into the scan buffer.  Returns true when the sample must
+ * be pushed as far as the data is concerned: no data channel is enabled or,
+ * when cmp is set (on-change), the data differs from the buffered data.
+ */
+static bool nvs_buf_store(struct nvs_state *st, unsigned char *data,
+			  unsigned int data_chan_n, bool cmp)
+{
+	bool buf_data = false;
+	bool changed = false;
+	unsigned int src_i = 0;
+	unsigned int i;
+
+	for (i = 0; i < data_chan_n; i++) {
+		if (st->ch[i].i < 0)
+			continue;
+
+		buf_data = true;
+		if (cmp && !changed && memcmp(&st->buf[st->ch[i].i],
+					      &data[src_i], st->ch[i].n))
+			changed = true;
+		if (!(st->dbg_data_lock & (1 << i)))
+			memcpy(&st->buf[st->ch[i].i], &data[src_i],
+			       st->ch[i].n);
+		src_i += st->ch[i].n;
+	}
+	return changed || !buf_data;
+}
+
+/* Push a run of samples, e.g. a drained hardware FIFO, with the same result
+ * as calling nvs_buf_push for each sample in turn.  The per-run state is
+ * resolved once and on-change samples arriving faster than batch_period are
+ * dropped before they're copied, only the last one of a dropped run is
+ * folded into the scan buffer as the next on-change reference.
+ * Returns the number of samples processed or a negative error code.
+ */
+static int nvs_buf_push_batch(struct iio_dev *indio_dev, unsigned char *data,
+			      unsigned int stride, s64 *ts, unsigned int n)
+{
+	struct nvs_state *st = iio_priv(indio_dev);
+	unsigned char *pend = NULL;
+	s64 pend_ts = 0;
+	s64 period_ns;
+	unsigned int data_chan_n;
+	unsigned int ts_i;
+	unsigned int i;
+	bool scan_ts;
+	bool buf_en;
+	bool push;
+	int err = 0;
+	int ret;
+
+	data_chan_n = indio_dev->num_channels - 1;
+	if (!data || !data_chan_n || st->one_shot ||
+	    (*st->fn_dev->sts & (NVS_STS_SPEW_DATA | NVS_STS_SPEW_BUF))) {
+		/* nothing to gain, keep the per-sample semantics and spew */
+		for (i = 0; i < n; i++) {
+			ret = nvs_buf_push(indio_dev,
+					   data ? &data[i * stride] : NULL, ts[i]);
+			if (ret < 0)
+				err = ret;
+		}
+		return err ? err : n;
+	}
+
+	scan_ts = indio_dev->buffer->scan_timestamp;
+	buf_en = iio_buffer_enabled(indio_dev);
+	ts_i = st->ch[data_chan_n].i;
+	period_ns = (s64)st->batch_period_us * 1000;
+	for (i = 0; i < n; i++, data += stride) {
+		if (!ts[i]) {
+			/* flush marker */
+			if (pend) {
+				nvs_buf_store(st, pend, data_chan_n, false);
+				pend = NULL;
+			}
+			ret = nvs_buf_push(indio_dev, data, 0);
+			if (ret < 0)
+				err = ret;
+			continue;
+		}
+
+		st->ts_diff = ts[i] - st->ts;
+		if (st->ts_diff < 0) {
+			dev_err(st->dev, "%s %s ts_diff=%lld\n",
+				__func__, st->cfg->name, st->ts_diff);
+		} else if (st->on_change && !st->first_push &&
+			   st->ts_diff < period_ns) {
+			/* data rate faster than requested */
+			pend = data;
+			pend_ts = ts[i];
+			continue;
+		}
+
+		if (pend) {
+			nvs_buf_store(st, pend, data_chan_n, false);
+			pend = NULL;
+		}
+		push = nvs_buf_store(st, data, data_chan_n, st->on_change);
+		if (!st->on_change || st->first_push)
+			push = true;
+		if (scan_ts)
+			memcpy(&st->buf[ts_i], &ts[i], st->ch[data_chan_n].n);
+		/*
+		 * The IIO core only takes one scan per call: the demux and
+		 * the kfifo store behind iio_push_to_buffers() are private
+		 * to it and have no multi-scan entry point. What is batched
+		 * here is everything on the nvs side of that call.
+		 */
+		if (push && buf_en) {
+			ret = iio_push_to_buffers(indio_dev, st->buf);
+			if (ret) {
+				err = ret;
+			} else {
+				st->first_push = false;
+				st->ts = ts[i]; /* log ts push */
+			}
+		}
+	}
+	if (pend) {
+		nvs_buf_store(st, pend, data_chan_n, false);
+		if (scan_ts)
+			memcpy(&st->buf[ts_i], &pend_ts,
+			       st->ch[data_chan_n].n);
+	}
+	return err ? err : n;
+}
+
 static int nvs_handler(void *handle, void *buffer, s64 ts)
 {
 	struct iio_dev *indio_dev = (struct iio_dev *)handle;
@@ -735,6 +862,17 @@ static int nvs_handler(void *handle, void *buffer, s64 ts)
 	return ret;
 }
 
+static int nvs_handler_batch(void *handle, void *buffer, unsigned int stride,
+			     s64 *ts, unsigned int n)
+{
+	struct iio_dev *indio_dev = (struct iio_dev *)handle;
+	int ret = 0;
+
+	if (indio_dev)
+		ret = nvs_buf_push_batch(indio_dev, buffer, stride, ts, n);
+	return ret;
+}
+
 static int nvs_enable(struct iio_dev *indio_dev, bool en)
 {
 	struct nvs_state *st = iio_priv(indio_dev);
@@ -2017,6 +2155,7 @@ static struct nvs_fn_if nvs_fn_if_iio = {
 	.suspend			= nvs_suspend,
 	.resume				= nvs_resume,
 	.handler			= nvs_handler,
+	.handler_batch			= nvs_handler_batch,
 };
 
 struct nvs_fn_if *nvs_iio(void)
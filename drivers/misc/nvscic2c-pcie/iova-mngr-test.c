@@ -0,0 +1,321 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+/*
+ * Stress test of the IOVA space manager, run at module load.
+ *
+ * Every reserved block is checked against a bitmap of the IOVA space in
+ * TEST_GRANULE units: it must lie inside the space, be aligned as asked and
+ * not overlap any block still reserved. A failed reservation is checked
+ * too: the bitmap must not hold a free aligned run of the requested size.
+ * After all blocks are released the whole space must be reservable again
+ * as one block, which only works if every release coalesced.
+ *
+ * The fragmentation pass replays a fixed trace of the pattern that broke
+ * first fit: small and large mappings interleaved, the small ones
+ * released, then small ones that must land in the holes and large aligned
+ * ones requested. The random pass reserves and releases blocks of random
+ * size and alignment for the given number of iterations.
+ */
+
+#define pr_fmt(fmt)	"nvscic2c-pcie: iova-mngr-test: " fmt
+
+#include <linux/bitmap.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+
+#include "iova-mngr.h"
+
+#define TEST_BASE		(0x80000000ULL)
+#define TEST_GRANULE		(0x1000UL)
+#define TEST_GRANULES		(16384)	/* 64MB of IOVA space */
+#define TEST_MAX_BLOCKS		(512)
+#define TEST_MAX_ORDER		(6)	/* sizes and alignments in granules */
+
+static unsigned int iterations = 100000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "random reserve/release operations");
+
+static unsigned int seed = 1;
+module_param(seed, uint, 0444);
+MODULE_PARM_DESC(seed, "seed of the random pass");
+
+struct test_block {
+	void *handle;
+	u64 address;
+	size_t size;
+};
+
+struct test_ctx {
+	void *mngr;
+	unsigned long *map;
+	struct test_block blocks[TEST_MAX_BLOCKS];
+	unsigned int nr_blocks;
+	unsigned long reserved;
+	unsigned long failed;
+	unsigned long released;
+};
+
+/* true if the bitmap holds a free run of nr granules aligned to align.*/
+static bool
+test_fits(struct test_ctx *t, unsigned long nr, unsigned long align)
+{
+	unsigned long start = 0, next = 0;
+
+	for (start = 0; start + nr <= TEST_GRANULES; start += align) {
+		next = find_next_bit(t->map, start + nr, start);
+		if (next >= start + nr)
+			return true;
+		start = round_down(next, align);
+	}
+
+	return false;
+}
+
+static int
+test_reserve(struct test_ctx *t, unsigned long nr, unsigned long align)
+{
+	struct test_block *b = &t->blocks[t->nr_blocks];
+	unsigned long first = 0;
+	size_t offset = 0;
+	int ret = 0;
+
+	if (t->nr_blocks == TEST_MAX_BLOCKS)
+		return 0;
+
+	b->handle = NULL;
+	ret = iova_mngr_block_reserve_aligned(t->mngr, nr * TEST_GRANULE,
+					      align * TEST_GRANULE,
+					      &b->address, &offset,
+					      &b->handle);
+	if (ret == -ENOMEM) {
+		if (test_fits(t, nr, align)) {
+			pr_err("reserve of %lu granules, align %lu failed with room left\n",
+			       nr, align);
+			return -EINVAL;
+		}
+		t->failed++;
+		return 0;
+	}
+	if (ret) {
+		pr_err("reserve of %lu granules failed: %d\n", nr, ret);
+		return ret;
+	}
+
+	if (b->address < TEST_BASE ||
+	    b->address + nr * TEST_GRANULE >
+	    TEST_BASE + TEST_GRANULES * TEST_GRANULE ||
+	    offset != b->address - TEST_BASE ||
+	    !IS_ALIGNED(b->address, align * TEST_GRANULE)) {
+		pr_err("bad block 0x%llx offset 0x%zx, %lu granules, align %lu\n",
+		       b->address, offset, nr, align);
+		return -EINVAL;
+	}
+
+	first = (b->address - TEST_BASE) / TEST_GRANULE;
+	if (find_next_bit(t->map, first + nr, first) < first + nr) {
+		pr_err("block 0x%llx overlaps a reserved block\n", b->address);
+		return -EINVAL;
+	}
+	bitmap_set(t->map, first, nr);
+
+	b->size = nr * TEST_GRANULE;
+	t->nr_blocks++;
+	t->reserved++;
+	return 0;
+}
+
+static int
+test_release(struct test_ctx *t, unsigned int i)
+{
+	struct test_block *b = &t->blocks[i];
+	int ret = 0;
+
+	ret = iova_mngr_block_release(t->mngr, &b->handle);
+	if (ret || b->handle) {
+		pr_err("release of 0x%llx failed: %d\n", b->address, ret);
+		return ret ? ret : -EINVAL;
+	}
+
+	bitmap_clear(t->map, (b->address - TEST_BASE) / TEST_GRANULE,
+		     b->size / TEST_GRANULE);
+	t->blocks[i] = t->blocks[--t->nr_blocks];
+	t->released++;
+	return 0;
+}
+
+/* release everything, then the whole space must come back as one block.*/
+static int
+test_drain(struct test_ctx *t)
+{
+	int ret = 0;
+
+	while (t->nr_blocks) {
+		ret = test_release(t, t->nr_blocks - 1);
+		if (ret)
+			return ret;
+	}
+
+	ret = test_reserve(t, TEST_GRANULES, 1);
+	if (ret)
+		return ret;
+	if (t->nr_blocks != 1) {
+		pr_err("free space did not coalesce\n");
+		return -EINVAL;
+	}
+
+	return test_release(t, 0);
+}
+
+static int
+test_fragmentation(struct test_ctx *t)
+{
+	struct test_block *b = NULL;
+	u64 holes_end = 0;
+	unsigned int i = 0;
+	int ret = 0;
+
+	/* 1 granule and 31 granule mappings interleaved.*/
+	for (i = 0; i < TEST_MAX_BLOCKS; i++) {
+		ret = test_reserve(t, (i & 1) ? 31 : 1, 1);
+		if (ret)
+			return ret;
+		b = &t->blocks[t->nr_blocks - 1];
+		holes_end = max(holes_end, b->address + b->size);
+	}
+
+	/* every small one goes, leaving 1 granule holes.*/
+	for (i = t->nr_blocks; i-- > 0;) {
+		if (t->blocks[i].size == TEST_GRANULE) {
+			ret = test_release(t, i);
+			if (ret)
+				return ret;
+		}
+	}
+
+	/* small ones refill the holes, large aligned ones use the tail.*/
+	for (i = 0; i < TEST_MAX_BLOCKS / 2; i++) {
+		ret = test_reserve(t, (i & 1) ? 32 : 1, (i & 1) ? 32 : 1);
+		if (ret)
+			return ret;
+		b = &t->blocks[t->nr_blocks - 1];
+		if (!(i & 1) && b->address >= holes_end) {
+			pr_err("best fit passed over a hole for 0x%llx\n",
+			       b->address);
+			return -EINVAL;
+		}
+	}
+
+	return test_drain(t);
+}
+
+static int
+test_random(struct test_ctx *t, struct rnd_state *rnd)
+{
+	unsigned long nr = 0, align = 0;
+	unsigned int i = 0;
+	u32 r = 0;
+	int ret = 0;
+
+	for (i = 0; i < iterations; i++) {
+		r = prandom_u32_state(rnd);
+		if (t->nr_blocks && (!(r & 1) ||
+				     t->nr_blocks == TEST_MAX_BLOCKS)) {
+			ret = test_release(t, (r >> 1) % t->nr_blocks);
+		} else {
+			nr = 1 + ((r >> 1) % (1 << TEST_MAX_ORDER));
+			align = 1UL << ((r >> 8) % (TEST_MAX_ORDER + 1));
+			ret = test_reserve(t, nr, align);
+		}
+		if (ret)
+			return ret;
+	}
+
+	return test_drain(t);
+}
+
+static int __init
+iova_mngr_test_init(void)
+{
+	struct rnd_state rnd;
+	struct test_ctx *t = NULL;
+	ktime_t start;
+	u64 ops = 0;
+	u64 ns = 0;
+	int ret = 0;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	t->map = kcalloc(BITS_TO_LONGS(TEST_GRANULES), sizeof(*t->map),
+			 GFP_KERNEL);
+	if (!t->map) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	ret = iova_mngr_init("iova-mngr-test", TEST_BASE,
+			     TEST_GRANULES * TEST_GRANULE, &t->mngr);
+	if (ret)
+		goto err;
+
+	ret = test_fragmentation(t);
+	if (ret) {
+		pr_err("fragmentation pass failed: %d\n", ret);
+		goto deinit;
+	}
+
+	prandom_seed_state(&rnd, seed);
+	t->reserved = 0;
+	t->failed = 0;
+	t->released = 0;
+	start = ktime_get();
+	ret = test_random(t, &rnd);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret) {
+		pr_err("random pass failed: %d (seed %u)\n", ret, seed);
+		goto deinit;
+	}
+
+	ops = t->reserved + t->failed + t->released;
+	pr_info("passed: %lu reserved, %lu full, %lu released, %llu ns/op with checks\n",
+		t->reserved, t->failed, t->released,
+		ops ? div64_u64(ns, ops) : 0);
+
+deinit:
+	iova_mngr_deinit(&t->mngr);
+err:
+	kfree(t->map);
+	kfree(t);
+	return ret;
+}
+
+static void __exit
+iova_mngr_test_exit(void)
+{
+}
+
+module_init(iova_mngr_test_init);
+module_exit(iova_mngr_test_exit);
+
+MODULE_DESCRIPTION("NvSciC2c-Pcie IOVA manager test");
+MODULE_LICENSE("GPL v2");
+MODULE_AUTHOR("Nvidia Corporation");
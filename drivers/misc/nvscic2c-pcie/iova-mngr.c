@@ -15,8 +15,11 @@
 #define pr_fmt(fmt)	"nvscic2c-pcie: iova-mgr: " fmt
 
 #include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
 #include <linux/mutex.h>
 #include <linux/printk.h>
+#include <linux/rbtree.h>
 #include <linux/slab.h>
 #include <linux/types.h>
 
@@ -29,13 +32,19 @@
  *
  * IOVA manager chunks entire IOVA space into these blocks/chunks.
  *
- * The chunk/block is also a node for linking to previous and next
- * nodes of a circular doubly linked list - free or reserved.
+ * A reserved chunk/block is a node of the circular doubly linked reserved
+ * list. A free chunk/block is a node of two rb-trees, one ordered by
+ * address for coalescing and one ordered by size (then address) for the
+ * best fit search.
  */
 struct block_t {
-	/* for management of this chunk in either avail or reserve lists.*/
+	/* for management of this chunk in reserved or spare lists.*/
 	struct list_head node;
 
+	/* free chunk only: by address and by size.*/
+	struct rb_node addr_node;
+	struct rb_node size_node;
+
 	/* block address.*/
 	u64 address;
 
@@ -47,10 +56,9 @@ struct block_t {
  * INTERNAL datastructure for IOVA space manager.
  *
  * IOVA space manager would fragment and manage the IOVA region
- * using two circular doubly linked lists - reserved list and
- * free list. These lists contain blocks/chunks reserved
- * or free for use by clients (callers) from the overall
- * IOVA region the IOVA manager was configured with.
+ * using a reserved list and two rb-trees of free blocks. These contain
+ * blocks/chunks reserved or free for use by clients (callers) from the
+ * overall IOVA region the IOVA manager was configured with.
  */
 struct mngr_ctx_t {
 	/*
@@ -61,12 +69,12 @@ struct mngr_ctx_t {
 	char name[NAME_MAX];
 
 	/*
-	 * Circular doubly linked list of blocks indicating
-	 * available/free IOVA space(s). When IOVA manager is
-	 * initialised all of the IOVA space is marked as available
-	 * to begin with.
+	 * Available/free IOVA space(s), by address and by size. When IOVA
+	 * manager is initialised all of the IOVA space is marked as
+	 * available to begin with.
 	 */
-	struct list_head *free_list;
+	struct rb_root free_by_addr;
+	struct rb_root free_by_size;
 
 	/*
 	 * Book-keeping of the user IOVA blocks in a circular double
@@ -74,6 +82,12 @@ struct mngr_ctx_t {
 	 */
 	struct list_head *reserved_list;
 
+	/*
+	 * block_t metadata no longer in use, recycled on the next split
+	 * instead of going back to the allocator.
+	 */
+	struct list_head spare_list;
+
 	/* Ensuring reserve, free and the list operations are serialized.*/
 	struct mutex lock;
 
@@ -81,94 +95,239 @@ struct mngr_ctx_t {
 	u64 base_address;
 };
 
+static struct block_t *
+block_alloc(struct mngr_ctx_t *ctx)
+{
+	struct block_t *block = NULL;
+
+	if (!list_empty(&ctx->spare_list)) {
+		block = list_first_entry(&ctx->spare_list, struct block_t,
+					 node);
+		list_del(&block->node);
+		memset(block, 0, sizeof(*block));
+		return block;
+	}
+
+	return kzalloc(sizeof(*block), GFP_KERNEL);
+}
+
+static void
+block_recycle(struct mngr_ctx_t *ctx, struct block_t *block)
+{
+	list_add(&block->node, &ctx->spare_list);
+}
+
+static void
+free_insert(struct mngr_ctx_t *ctx, struct block_t *block)
+{
+	struct rb_node **link = NULL, *parent = NULL;
+	struct block_t *curr = NULL;
+
+	link = &ctx->free_by_addr.rb_node;
+	while (*link) {
+		parent = *link;
+		curr = rb_entry(parent, struct block_t, addr_node);
+		if (block->address < curr->address)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&block->addr_node, parent, link);
+	rb_insert_color(&block->addr_node, &ctx->free_by_addr);
+
+	parent = NULL;
+	link = &ctx->free_by_size.rb_node;
+	while (*link) {
+		parent = *link;
+		curr = rb_entry(parent, struct block_t, size_node);
+		if (block->size < curr->size ||
+		    (block->size == curr->size &&
+		     block->address < curr->address))
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&block->size_node, parent, link);
+	rb_insert_color(&block->size_node, &ctx->free_by_size);
+}
+
+static void
+free_erase(struct mngr_ctx_t *ctx, struct block_t *block)
+{
+	rb_erase(&block->addr_node, &ctx->free_by_addr);
+	rb_erase(&block->size_node, &ctx->free_by_size);
+}
+
+/* smallest free block of at least size bytes, NULL if none.*/
+static struct block_t *
+free_lower_bound(struct mngr_ctx_t *ctx, size_t size)
+{
+	struct rb_node *rb = ctx->free_by_size.rb_node;
+	struct block_t *curr = NULL, *best = NULL;
+
+	while (rb) {
+		curr = rb_entry(rb, struct block_t, size_node);
+		if (curr->size >= size) {
+			best = curr;
+			rb = rb->rb_left;
+		} else {
+			rb = rb->rb_right;
+		}
+	}
+
+	return best;
+}
+
+/* free blocks immediately below and above address, if any.*/
+static void
+free_neighbours(struct mngr_ctx_t *ctx, u64 address,
+		struct block_t **prev, struct block_t **next)
+{
+	struct rb_node *rb = ctx->free_by_addr.rb_node;
+	struct block_t *curr = NULL;
+
+	*prev = NULL;
+	*next = NULL;
+	while (rb) {
+		curr = rb_entry(rb, struct block_t, addr_node);
+		if (address < curr->address) {
+			*next = curr;
+			rb = rb->rb_left;
+		} else {
+			*prev = curr;
+			rb = rb->rb_right;
+		}
+	}
+}
+
 /*
- * Reserves a block from the free IOVA regions. Once reserved, the block
- * is marked reserved and appended in the reserved list (no ordering
- * required and trying to do so shall increase the time)
+ * Reserves a block from the free IOVA regions, the block address aligned
+ * to align (a power of 2). Best fit: the smallest free block which can
+ * hold the aligned request. Once reserved, the block is marked reserved
+ * and appended in the reserved list (no ordering required and trying to do
+ * so shall increase the time)
  */
 int
-iova_mngr_block_reserve(void *mngr_handle, size_t size,
-			u64 *address, size_t *offset,
-			void **block_handle)
+iova_mngr_block_reserve_aligned(void *mngr_handle, size_t size, size_t align,
+				u64 *address, size_t *offset,
+				void **block_handle)
 {
 	struct mngr_ctx_t *ctx = (struct mngr_ctx_t *)(mngr_handle);
-	struct block_t *reserve = NULL, *curr = NULL, *best = NULL;
+	struct block_t *reserve = NULL, *head = NULL, *best = NULL;
+	struct rb_node *rb = NULL;
+	u64 start = 0;
+	size_t pad = 0;
 	int ret = 0;
 
 	if (WARN_ON(!ctx || *block_handle || !size))
 		return -EINVAL;
+	if (WARN_ON(!align || !is_power_of_2(align)))
+		return -EINVAL;
 
 	mutex_lock(&ctx->lock);
 
 	/* if there are no free blocks to reserve. */
-	if (list_empty(ctx->free_list)) {
+	if (RB_EMPTY_ROOT(&ctx->free_by_addr)) {
 		ret = -ENOMEM;
 		pr_err("(%s): No memory available to reserve block of size:(%lu)\n",
 		       ctx->name, size);
 		goto err;
 	}
 
-	/* find the best of all free bocks to reserve.*/
-	list_for_each_entry(curr, ctx->free_list, node) {
-		if (curr->size >= size) {
-			if (!best)
-				best = curr;
-			else if (curr->size < best->size)
-				best = curr;
-		}
+	/*
+	 * find the best of all free bocks to reserve: walk up in size from
+	 * the smallest one large enough, the first aligned fit is the best.
+	 */
+	best = free_lower_bound(ctx, size);
+	for (rb = best ? &best->size_node : NULL; rb; rb = rb_next(rb)) {
+		best = rb_entry(rb, struct block_t, size_node);
+		start = ALIGN(best->address, (u64)align);
+		pad = start - best->address;
+		if (pad <= best->size && (best->size - pad) >= size)
+			break;
 	}
 
 	/* if there isn't any free block of requested size. */
-	if (!best) {
+	if (!rb) {
 		ret = -ENOMEM;
 		pr_err("(%s): No enough mem available to reserve block sz:(%lu)\n",
 		       ctx->name, size);
 		goto err;
-	} else {
-		struct block_t *found = NULL;
+	}
 
-		/* perfect fit.*/
-		if (best->size == size) {
-			list_del(&best->node);
-			list_add_tail(&best->node, ctx->reserved_list);
-			found = best;
-		} else {
-			/* chunk out a new block, adjust the free block.*/
-			reserve = kzalloc(sizeof(*reserve), GFP_KERNEL);
-			if (WARN_ON(!reserve)) {
-				ret = -ENOMEM;
-				goto err;
-			}
-			reserve->address = best->address;
-			reserve->size = size;
-			best->address += size;
-			best->size -= size;
-			list_add_tail(&reserve->node, ctx->reserved_list);
-			found = reserve;
+	/* metadata for the chunks split off, before touching the trees.*/
+	if (pad) {
+		head = block_alloc(ctx);
+		if (WARN_ON(!head)) {
+			ret = -ENOMEM;
+			goto err;
+		}
+	}
+	if (best->size - pad != size) {
+		reserve = block_alloc(ctx);
+		if (WARN_ON(!reserve)) {
+			if (head)
+				block_recycle(ctx, head);
+			ret = -ENOMEM;
+			goto err;
 		}
-		*block_handle = (void *)(found);
+	}
 
-		if (address)
-			*address = found->address;
-		if (offset)
-			*offset = (found->address - ctx->base_address);
+	free_erase(ctx, best);
+	if (head) {
+		/* alignment padding stays free.*/
+		head->address = best->address;
+		head->size = pad;
+		best->address += pad;
+		best->size -= pad;
+		free_insert(ctx, head);
+	}
+	if (reserve) {
+		/* chunk out a new block, adjust the free block.*/
+		reserve->address = best->address;
+		reserve->size = size;
+		best->address += size;
+		best->size -= size;
+		free_insert(ctx, best);
+	} else {
+		/* perfect fit.*/
+		reserve = best;
 	}
+	list_add_tail(&reserve->node, ctx->reserved_list);
+	*block_handle = (void *)(reserve);
+
+	if (address)
+		*address = reserve->address;
+	if (offset)
+		*offset = (reserve->address - ctx->base_address);
 err:
 	mutex_unlock(&ctx->lock);
 	return ret;
 }
 
+/*
+ * Reserves a block from the free IOVA regions. Once reserved, the block
+ * is marked reserved and appended in the reserved list.
+ */
+int
+iova_mngr_block_reserve(void *mngr_handle, size_t size,
+			u64 *address, size_t *offset,
+			void **block_handle)
+{
+	return iova_mngr_block_reserve_aligned(mngr_handle, size, 1, address,
+					       offset, block_handle);
+}
+
 /*
  * Release an already reserved IOVA block/chunk by the caller back to
- * free list.
+ * free list, merged with the immediate prev and/or next free blocks.
  */
 int
 iova_mngr_block_release(void *mngr_handle, void **block_handle)
 {
 	struct mngr_ctx_t *ctx = (struct mngr_ctx_t *)(mngr_handle);
 	struct block_t *release = (struct block_t *)(*block_handle);
-	struct block_t *curr = NULL, *prev = NULL;
-	bool done = false;
+	struct block_t *prev = NULL, *next = NULL;
 	int ret = 0;
 
 	if (!ctx || !release)
@@ -176,77 +335,25 @@ iova_mngr_block_release(void *mngr_handle, void **block_handle)
 
 	mutex_lock(&ctx->lock);
 
-	list_for_each_entry(curr, ctx->free_list, node) {
-		if (release->address < curr->address) {
-			/* if the immediate next node is available for merge.*/
-			if (curr->address == release->address + release->size) {
-				curr->address = release->address;
-				curr->size += release->size;
-				list_del(&release->node);
-				kfree(release);
-				/*
-				 * if the immediate previous node is also
-				 * available for merge.
-				 */
-				if ((prev) &&
-				    ((prev->address + prev->size)
-				      == curr->address)) {
-					prev->size += curr->size;
-					list_del(&curr->node);
-					kfree(curr);
-				}
-			} else if ((prev) &&
-				   ((prev->address + prev->size)
-				    == release->address)) {
-				/*
-				 * if only the immediate prev node is available
-				 */
-				prev->size += release->size;
-				list_del(&release->node);
-				kfree(release);
-			} else {
-				/*
-				 * cannot be merged with either the immediate
-				 * prev or the immediate next node. Add it in the
-				 * free list before the current node.
-				 */
-				list_del(&release->node);
-				list_add_tail(&release->node, &curr->node);
-			}
-			done = true;
-			break;
-		}
-		prev = curr;
+	list_del(&release->node);
+	free_neighbours(ctx, release->address, &prev, &next);
+
+	/* if the immediate next node is available for merge.*/
+	if (next && next->address == release->address + release->size) {
+		free_erase(ctx, next);
+		release->size += next->size;
+		block_recycle(ctx, next);
 	}
 
-	/*
-	 * Even if after traversing each entry in list, we could not
-	 * add the block to be released back in free list, because:
-	 */
-	if (!done) {
-		if (!list_empty(ctx->free_list)) {
-			/*
-			 * The block to be freed has the highest order
-			 * address of all the existing blocks in free list.
-			 */
-			struct block_t *last =
-			list_last_entry(ctx->free_list, struct block_t, node);
-			if ((last->address + last->size) == release->address) {
-				/* can be merged with last node of list.*/
-				last->size += release->size;
-				list_del(&release->node);
-				kfree(release);
-			} else {
-				/* cannot be merged, add as the last node.*/
-				list_del(&release->node);
-				list_add_tail(&release->node, ctx->free_list);
-			}
-		} else {
-			/* free list was empty.*/
-			list_del(&release->node);
-			list_add_tail(&release->node, ctx->free_list);
-		}
+	/* if the immediate previous node is available for merge.*/
+	if (prev && (prev->address + prev->size) == release->address) {
+		free_erase(ctx, prev);
+		prev->size += release->size;
+		block_recycle(ctx, release);
+		release = prev;
 	}
+
+	free_insert(ctx, release);
 	*block_handle = NULL;
 
 	mutex_unlock(&ctx->lock);
@@ -266,16 +373,21 @@ iova_mngr_print(void *mngr_handle)
 {
 	struct mngr_ctx_t *ctx = (struct mngr_ctx_t *)(mngr_handle);
 	struct block_t *block = NULL;
+	struct rb_node *rb = NULL;
 
 	if (ctx) {
 		mutex_lock(&ctx->lock);
 		pr_debug("(%s): Reserved\n", ctx->name);
-		list_for_each_entry(block, ctx->reserved_list, node) {
-			pr_debug("\t\t (%s): address = 0x%pa[p], size = 0x%lx\n",
-				 ctx->name, &block->address, block->size);
+		if (ctx->reserved_list) {
+			list_for_each_entry(block, ctx->reserved_list, node) {
+				pr_debug("\t\t (%s): address = 0x%pa[p], size = 0x%lx\n",
+					 ctx->name, &block->address,
+					 block->size);
+			}
 		}
 		pr_debug("(%s): Free\n", ctx->name);
-		list_for_each_entry(block, ctx->free_list, node) {
+		for (rb = rb_first(&ctx->free_by_addr); rb; rb = rb_next(rb)) {
+			block = rb_entry(rb, struct block_t, addr_node);
 			pr_debug("\t\t (%s): address = 0x%pa[p], size = 0x%lx\n",
 				 ctx->name, &block->address, block->size);
 		}
@@ -285,8 +397,8 @@ iova_mngr_print(void *mngr_handle)
 
 /*
  * Initialises the IOVA space manager with the base address + size
- * provided. IOVA manager would use two lists for book-keeping reserved
- * memory blocks and free memory blocks.
+ * provided. IOVA manager would use a list for book-keeping reserved
+ * memory blocks and rb-trees for free memory blocks.
  *
  * When initialised all of the IOVA region: base_address + size is free.
  */
@@ -306,18 +418,17 @@ iova_mngr_init(char *name, u64 base_address, size_t size, void **mngr_handle)
 		ret = -ENOMEM;
 		goto err;
 	}
-
-	ctx->free_list = kzalloc(sizeof(*ctx->free_list), GFP_KERNEL);
-	if (WARN_ON(!ctx->free_list)) {
-		ret = -ENOMEM;
-		goto err;
-	}
+	INIT_LIST_HEAD(&ctx->spare_list);
+	ctx->free_by_addr = RB_ROOT;
+	ctx->free_by_size = RB_ROOT;
+	mutex_init(&ctx->lock);
 
 	ctx->reserved_list = kzalloc(sizeof(*ctx->reserved_list), GFP_KERNEL);
 	if (WARN_ON(!ctx->reserved_list)) {
 		ret = -ENOMEM;
 		goto err;
 	}
+	INIT_LIST_HEAD(ctx->reserved_list);
 
 	if (strlen(name) > (NAME_MAX - 1)) {
 		ret = -EINVAL;
@@ -325,9 +436,6 @@ iova_mngr_init(char *name, u64 base_address, size_t size, void **mngr_handle)
 		goto err;
 	}
 	strcpy(ctx->name, name);
-	INIT_LIST_HEAD(ctx->reserved_list);
-	INIT_LIST_HEAD(ctx->free_list);
-	mutex_init(&ctx->lock);
 	ctx->base_address = base_address;
 
 	/* add the base_addrss+size as one whole free block.*/
@@ -338,7 +446,7 @@ iova_mngr_init(char *name, u64 base_address, size_t size, void **mngr_handle)
 	}
 	block->address = base_address;
 	block->size = size;
-	list_add(&block->node, ctx->free_list);
+	free_insert(ctx, block);
 
 	*mngr_handle = ctx;
 	return ret;
@@ -357,6 +465,7 @@ void
 iova_mngr_deinit(void **mngr_handle)
 {
 	struct block_t *block = NULL;
+	struct rb_node *rb = NULL;
 	struct list_head *curr = NULL, *next = NULL;
 	struct mngr_ctx_t *ctx = (struct mngr_ctx_t *)(*mngr_handle);
 
@@ -365,7 +474,7 @@ iova_mngr_deinit(void **mngr_handle)
 		iova_mngr_print(*mngr_handle);
 
 		/* ideally, all blocks should have returned before this.*/
-		if (!list_empty(ctx->reserved_list)) {
+		if (ctx->reserved_list && !list_empty(ctx->reserved_list)) {
 			list_for_each_safe(curr, next, ctx->reserved_list) {
 				block = list_entry(curr, struct block_t, node);
 				iova_mngr_block_release(*mngr_handle,
@@ -374,7 +483,13 @@ iova_mngr_deinit(void **mngr_handle)
 		}
 
 		/* ideally, just one whole free block should remain as free.*/
-		list_for_each_safe(curr, next, ctx->free_list) {
+		while ((rb = rb_first(&ctx->free_by_addr))) {
+			block = rb_entry(rb, struct block_t, addr_node);
+			free_erase(ctx, block);
+			kfree(block);
+		}
+
+		list_for_each_safe(curr, next, &ctx->spare_list) {
 			block = list_entry(curr, struct block_t, node);
 			list_del(&block->node);
 			kfree(block);
@@ -382,7 +497,6 @@ iova_mngr_deinit(void **mngr_handle)
 
 		mutex_destroy(&ctx->lock);
 		kfree(ctx->reserved_list);
-		kfree(ctx->free_list);
 		kfree(ctx);
 		*mngr_handle = NULL;
 	}
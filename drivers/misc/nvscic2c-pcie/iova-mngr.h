@@ -29,6 +29,17 @@ iova_mngr_block_reserve(void *mngr_handle, size_t size,
 			u64 *address, size_t *offset,
 			void **block_handle);
 
+/*
+ * iova_mngr_block_reserve_aligned
+ *
+ * Same as iova_mngr_block_reserve with the block address aligned to
+ * align, which must be a power of 2.
+ */
+int
+iova_mngr_block_reserve_aligned(void *mngr_handle, size_t size, size_t align,
+				u64 *address, size_t *offset,
+				void **block_handle);
+
 /*
  * iova_mngr_block_release
  *
@@ -52,8 +63,8 @@ void iova_mngr_print(void *handle);
  * iova_mngr_init
  *
  * Initialises the IOVA space manager with the base address + size
- * provided. IOVA manager would use two lists for book-keeping reserved
- * memory blocks and free memory blocks.
+ * provided. IOVA manager would use a list for book-keeping reserved
+ * memory blocks and rb-trees for free memory blocks.
  *
  * When initialised all of the IOVA region: base_address + size is free.
  */
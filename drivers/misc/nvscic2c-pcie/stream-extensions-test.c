@@ -0,0 +1,567 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+/*
+ * Test of submit-copy striping against a fake eDMA, run at module load.
+ *
+ * stream-extensions.c is built into this module with
+ * tegra_pcie_edma_submit_xfer() redirected to a fake eDMA engine. The
+ * engine keeps one FIFO per write channel and a thread completes the
+ * heads of randomly picked channels, so the channels finish out of order
+ * against each other the way the hardware ones may. Descriptor addresses
+ * are kernel virtual addresses and the engine copies with memcpy().
+ *
+ * Copy requests are built directly from random flush ranges and remote
+ * post-fences, striped and submitted as the submit-copy ioctl does. The
+ * engine checks that a remote post-fence is only written after all data
+ * of its copy request landed. Every so often a submission is refused or
+ * completes with an error; such a copy request must still be reclaimed
+ * and must not write its fences. When a copy request is reused, and at
+ * the end, its data and fences are checked, and once drained no bytes may
+ * be left accounted on any channel.
+ */
+
+#include <linux/types.h>
+#include <linux/tegra-pcie-edma.h>
+
+static edma_xfer_status_t
+fake_edma_submit_xfer(void *cookie, struct tegra_pcie_edma_xfer_info *tx_info);
+
+#define tegra_pcie_edma_submit_xfer	fake_edma_submit_xfer
+#include "stream-extensions.c"
+#undef tegra_pcie_edma_submit_xfer
+
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
+
+#define TEST_COPY_REQUESTS	(8)
+#define TEST_RANGES		(4)
+#define TEST_FENCES		(2)
+#define TEST_RANGE_MAX		(SZ_256K)
+#define TEST_DATA_MAX		(TEST_RANGES * TEST_RANGE_MAX)
+#define TEST_TIMEOUT_MS		(5000)
+
+static unsigned int iterations = 10000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "copy requests to submit");
+
+static unsigned int seed = 1;
+module_param(seed, uint, 0444);
+MODULE_PARM_DESC(seed, "seed of the ranges and the completion order");
+
+static unsigned int submit_fail_every = 89;
+module_param(submit_fail_every, uint, 0444);
+MODULE_PARM_DESC(submit_fail_every, "refuse every nth submission, 0 never");
+
+static unsigned int xfer_fail_every = 97;
+module_param(xfer_fail_every, uint, 0444);
+MODULE_PARM_DESC(xfer_fail_every, "fail every nth completion, 0 never");
+
+/* one submission queued on a fake channel.*/
+struct fake_edma_xfer {
+	struct list_head node;
+	struct tegra_pcie_edma_xfer_info info;
+};
+
+struct fake_edma {
+	spinlock_t lock;
+	struct list_head chan[DMA_WR_CHNL_NUM];
+	u32 queued;
+	wait_queue_head_t waitq;
+	struct task_struct *thread;
+	struct rnd_state rnd;
+	u32 submits;
+	u32 completions;
+	u64 chan_xfers[DMA_WR_CHNL_NUM];
+	atomic_t errors;
+};
+
+/* buffers of the copy request currently using one copy_request.*/
+struct test_slot {
+	struct copy_request *cr;
+	u8 *src;
+	u8 *dst;
+	u64 size;
+	u32 fence_val;
+	u32 fences[TEST_FENCES];
+	bool used;
+	bool failed;
+};
+
+struct test_ctx {
+	struct fake_edma edma;
+	struct stream_ext_ctx_t *ctx;
+	struct test_slot slots[TEST_COPY_REQUESTS];
+	struct rnd_state rnd;
+	u64 submitted;
+	u64 failed;
+	u64 bytes;
+};
+
+static struct test_slot *
+test_find_slot(struct test_ctx *t, struct copy_request *cr)
+{
+	u32 i = 0;
+
+	for (i = 0; i < TEST_COPY_REQUESTS; i++) {
+		if (t->slots[i].cr == cr)
+			return &t->slots[i];
+	}
+
+	return NULL;
+}
+
+static edma_xfer_status_t
+fake_edma_submit_xfer(void *cookie, struct tegra_pcie_edma_xfer_info *tx_info)
+{
+	struct test_ctx *t = cookie;
+	struct fake_edma *edma = &t->edma;
+	struct copy_stripe *stripe = tx_info->priv;
+	struct fake_edma_xfer *xfer = NULL;
+	unsigned long flags = 0;
+
+	if (tx_info->type != EDMA_XFER_WRITE ||
+	    tx_info->channel_num >= DMA_WR_CHNL_NUM || !tx_info->nents) {
+		pr_err("edma test: bad submission on channel %u\n",
+		       tx_info->channel_num);
+		atomic_inc(&edma->errors);
+		return EDMA_XFER_FAIL_INVAL_INPUTS;
+	}
+
+	xfer = kzalloc(sizeof(*xfer), GFP_ATOMIC);
+	if (!xfer)
+		return EDMA_XFER_FAIL_NOMEM;
+	xfer->info = *tx_info;
+
+	spin_lock_irqsave(&edma->lock, flags);
+	if (submit_fail_every && !(++edma->submits % submit_fail_every)) {
+		spin_unlock_irqrestore(&edma->lock, flags);
+		test_find_slot(t, stripe->cr)->failed = true;
+		kfree(xfer);
+		return EDMA_XFER_FAIL_NOMEM;
+	}
+	list_add_tail(&xfer->node, &edma->chan[tx_info->channel_num]);
+	edma->queued++;
+	spin_unlock_irqrestore(&edma->lock, flags);
+
+	wake_up(&edma->waitq);
+	return EDMA_XFER_SUCCESS;
+}
+
+/* perform one queued submission and complete it.*/
+static void
+fake_edma_run(struct test_ctx *t, struct fake_edma_xfer *xfer)
+{
+	struct fake_edma *edma = &t->edma;
+	struct tegra_pcie_edma_xfer_info *info = &xfer->info;
+	struct copy_stripe *stripe = info->priv;
+	struct test_slot *slot = test_find_slot(t, stripe->cr);
+	edma_xfer_status_t status = EDMA_XFER_SUCCESS;
+	struct tegra_pcie_edma_desc *desc = NULL;
+	u32 i = 0;
+
+	if (xfer_fail_every && !(++edma->completions % xfer_fail_every)) {
+		slot->failed = true;
+		status = EDMA_XFER_FAIL_TIMEOUT;
+		goto complete;
+	}
+
+	if (stripe == &stripe->cr->fence_stripe &&
+	    memcmp(slot->dst, slot->src, slot->size)) {
+		pr_err("edma test: remote fence issued before the data landed\n");
+		atomic_inc(&edma->errors);
+	}
+
+	for (i = 0; i < info->nents; i++) {
+		desc = &info->desc[i];
+		memcpy((void *)(uintptr_t)desc->dst,
+		       (void *)(uintptr_t)desc->src, desc->sz);
+	}
+	edma->chan_xfers[info->channel_num]++;
+
+complete:
+	info->complete(info->priv, status, info->desc);
+	kfree(xfer);
+}
+
+static int
+fake_edma_thread(void *data)
+{
+	struct test_ctx *t = data;
+	struct fake_edma *edma = &t->edma;
+	struct fake_edma_xfer *xfer = NULL;
+	u32 ch = 0;
+	u32 i = 0;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(edma->waitq,
+					 READ_ONCE(edma->queued) ||
+					 kthread_should_stop());
+
+		xfer = NULL;
+		spin_lock_irq(&edma->lock);
+		ch = prandom_u32_state(&edma->rnd) % DMA_WR_CHNL_NUM;
+		for (i = 0; i < DMA_WR_CHNL_NUM && !xfer; i++) {
+			xfer = list_first_entry_or_null
+				(&edma->chan[(ch + i) % DMA_WR_CHNL_NUM],
+				 struct fake_edma_xfer, node);
+		}
+		if (xfer) {
+			list_del(&xfer->node);
+			edma->queued--;
+		}
+		spin_unlock_irq(&edma->lock);
+
+		if (xfer)
+			fake_edma_run(t, xfer);
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/* data and fences of the last copy request that used the slot.*/
+static int
+test_check_slot(struct test_slot *slot)
+{
+	u32 i = 0;
+
+	if (!slot->used)
+		return 0;
+
+	for (i = 0; i < TEST_FENCES; i++) {
+		if (slot->failed ? (slot->fences[i] != 0) :
+		    (slot->fences[i] != slot->fence_val)) {
+			pr_err("edma test: fence %u is 0x%x, %s copy request\n",
+			       i, slot->fences[i],
+			       slot->failed ? "failed" : "completed");
+			return -EIO;
+		}
+	}
+
+	if (!slot->failed && memcmp(slot->dst, slot->src, slot->size)) {
+		pr_err("edma test: data of a completed copy request differs\n");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/* the stripes must carry every flush-range byte once.*/
+static int
+test_check_stripes(struct stream_ext_ctx_t *ctx, struct test_slot *slot)
+{
+	struct copy_stripe *stripe = NULL;
+	u64 bytes = 0;
+	u64 sum = 0;
+	u32 ch = 0;
+	u32 i = 0;
+
+	for (ch = 0; ch < DMA_WR_CHNL_NUM; ch++) {
+		stripe = &slot->cr->stripes[ch];
+		if (stripe->num_desc > ctx->cr_limits.max_flush_ranges) {
+			pr_err("edma test: %llu chunks on channel %u\n",
+			       stripe->num_desc, ch);
+			return -EIO;
+		}
+		sum = 0;
+		for (i = 0; i < stripe->num_desc; i++)
+			sum += stripe->desc[i].sz;
+		if (sum != stripe->bytes) {
+			pr_err("edma test: channel %u accounts %llu of %llu bytes\n",
+			       ch, stripe->bytes, sum);
+			return -EIO;
+		}
+		bytes += sum;
+	}
+
+	if (bytes != slot->size) {
+		pr_err("edma test: stripes carry %llu of %llu bytes\n",
+		       bytes, slot->size);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/* random flush ranges back to back in the slot buffers, then fences.*/
+static void
+test_fill_request(struct test_ctx *t, struct test_slot *slot)
+{
+	struct copy_request *cr = slot->cr;
+	struct tegra_pcie_edma_desc *desc = NULL;
+	u32 nr_ranges = 1 + prandom_u32_state(&t->rnd) % TEST_RANGES;
+	u64 off = 0;
+	u32 sz = 0;
+	u32 i = 0;
+
+	for (i = 0; i < nr_ranges; i++) {
+		sz = 4 * (1 + prandom_u32_state(&t->rnd) %
+			  (TEST_RANGE_MAX / 4));
+		desc = &cr->edma_desc[i];
+		desc->src = (dma_addr_t)(uintptr_t)(slot->src + off);
+		desc->dst = (dma_addr_t)(uintptr_t)(slot->dst + off);
+		desc->sz = sz;
+		off += sz;
+	}
+	slot->size = off;
+	prandom_bytes_state(&t->rnd, slot->src, slot->size);
+	memset(slot->dst, 0, slot->size);
+
+	slot->fence_val = (u32)t->submitted + 1;
+	for (i = 0; i < TEST_FENCES; i++) {
+		slot->fences[i] = 0;
+		desc = &cr->edma_desc[nr_ranges + i];
+		desc->src = (dma_addr_t)(uintptr_t)&slot->fence_val;
+		desc->dst = (dma_addr_t)(uintptr_t)&slot->fences[i];
+		desc->sz = sizeof(slot->fence_val);
+	}
+
+	cr->num_handles = 0;
+	cr->num_local_post_fences = 0;
+	cr->num_data_desc = nr_ranges;
+	cr->num_edma_desc = nr_ranges + TEST_FENCES;
+	slot->used = true;
+	slot->failed = false;
+}
+
+static int
+test_submit(struct test_ctx *t)
+{
+	struct stream_ext_ctx_t *ctx = t->ctx;
+	struct copy_request *cr = NULL;
+	struct test_slot *slot = NULL;
+	int ret = 0;
+
+	/* copy requests come back with wake_up_interruptible_all().*/
+	if (wait_event_interruptible_timeout
+			(ctx->transfer_waitq, !list_empty(&ctx->free_list),
+			 msecs_to_jiffies(TEST_TIMEOUT_MS)) <= 0) {
+		pr_err("edma test: no copy request came back\n");
+		return -ETIMEDOUT;
+	}
+
+	mutex_lock(&ctx->free_lock);
+	cr = list_first_entry(&ctx->free_list, struct copy_request, node);
+	list_del(&cr->node);
+	mutex_unlock(&ctx->free_lock);
+
+	slot = test_find_slot(t, cr);
+	ret = test_check_slot(slot);
+	if (ret)
+		return ret;
+	if (slot->failed)
+		t->failed++;
+
+	test_fill_request(t, slot);
+	stripe_edma_desc(ctx, cr);
+	ret = test_check_stripes(ctx, slot);
+	if (ret)
+		return ret;
+
+	t->submitted++;
+	t->bytes += slot->size;
+	atomic_inc(&ctx->transfer_count);
+	ret = submit_copy_request(ctx, cr);
+	if (ret && !slot->failed) {
+		pr_err("edma test: submit failed: %d\n", ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+static int
+test_drain(struct test_ctx *t)
+{
+	struct stream_ext_ctx_t *ctx = t->ctx;
+	struct copy_request *cr = NULL;
+	u32 nr_free = 0;
+	u32 i = 0;
+	int ret = 0;
+
+	if (wait_event_interruptible_timeout
+			(ctx->transfer_waitq, !atomic_read(&ctx->transfer_count),
+			 msecs_to_jiffies(TEST_TIMEOUT_MS)) <= 0) {
+		pr_err("edma test: %d copy requests still in flight\n",
+		       atomic_read(&ctx->transfer_count));
+		return -ETIMEDOUT;
+	}
+
+	for (i = 0; i < TEST_COPY_REQUESTS; i++) {
+		ret = test_check_slot(&t->slots[i]);
+		if (ret)
+			return ret;
+		if (t->slots[i].failed)
+			t->failed++;
+		t->slots[i].used = false;
+	}
+
+	for (i = 0; i < DMA_WR_CHNL_NUM; i++) {
+		if (atomic64_read(&ctx->chan_load[i])) {
+			pr_err("edma test: %lld bytes left on channel %u\n",
+			       (s64)atomic64_read(&ctx->chan_load[i]), i);
+			return -EIO;
+		}
+	}
+
+	mutex_lock(&ctx->free_lock);
+	list_for_each_entry(cr, &ctx->free_list, node)
+		nr_free++;
+	mutex_unlock(&ctx->free_lock);
+	if (nr_free != TEST_COPY_REQUESTS) {
+		pr_err("edma test: %u of %u copy requests reclaimed\n",
+		       nr_free, TEST_COPY_REQUESTS);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int
+test_setup(struct test_ctx *t)
+{
+	struct nvscic2c_pcie_max_copy_args args = {0};
+	struct stream_ext_params params = {0};
+	struct node_info_t node = {0};
+	struct copy_request *cr = NULL;
+	void *stream_ext_h = NULL;
+	u32 i = 0;
+	int ret = 0;
+
+	params.local_node = &node;
+	params.peer_node = &node;
+	params.ep_name = "edma-test";
+	params.drv_mode = DRV_MODE_EPC;
+	params.edma_h = t;
+	ret = stream_extension_init(&params, &stream_ext_h);
+	if (ret)
+		return ret;
+	t->ctx = stream_ext_h;
+
+	args.max_copy_requests = TEST_COPY_REQUESTS;
+	args.max_flush_ranges = TEST_RANGES;
+	args.max_post_fences = TEST_FENCES;
+	ret = ioctl_set_max_copy_requests(t->ctx, &args);
+	if (ret)
+		return ret;
+
+	list_for_each_entry(cr, &t->ctx->free_list, node) {
+		t->slots[i].cr = cr;
+		t->slots[i].src = vmalloc(TEST_DATA_MAX);
+		t->slots[i].dst = vmalloc(TEST_DATA_MAX);
+		if (!t->slots[i].src || !t->slots[i].dst)
+			return -ENOMEM;
+		i++;
+	}
+
+	return 0;
+}
+
+static void
+test_teardown(struct test_ctx *t)
+{
+	struct stream_ext_ctx_t *ctx = t->ctx;
+	struct copy_request *cr = NULL, *next = NULL;
+	u32 i = 0;
+
+	for (i = 0; i < TEST_COPY_REQUESTS; i++) {
+		vfree(t->slots[i].src);
+		vfree(t->slots[i].dst);
+	}
+
+	if (!ctx)
+		return;
+
+	list_for_each_entry_safe(cr, next, &ctx->free_list, node) {
+		list_del(&cr->node);
+		free_copy_request(&cr);
+	}
+	free_copy_req_params(&ctx->cr_params);
+	mutex_destroy(&ctx->free_lock);
+	kfree(ctx);
+}
+
+static int __init
+stream_ext_test_init(void)
+{
+	struct test_ctx *t = NULL;
+	struct fake_edma *edma = NULL;
+	u32 i = 0;
+	int ret = 0;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	edma = &t->edma;
+	spin_lock_init(&edma->lock);
+	for (i = 0; i < DMA_WR_CHNL_NUM; i++)
+		INIT_LIST_HEAD(&edma->chan[i]);
+	init_waitqueue_head(&edma->waitq);
+	atomic_set(&edma->errors, 0);
+	prandom_seed_state(&edma->rnd, seed);
+	prandom_seed_state(&t->rnd, seed + 1);
+
+	ret = test_setup(t);
+	if (ret)
+		goto err;
+
+	edma->thread = kthread_run(fake_edma_thread, t, "fake-edma");
+	if (IS_ERR(edma->thread)) {
+		ret = PTR_ERR(edma->thread);
+		goto err;
+	}
+
+	for (i = 0; i < iterations && !ret; i++)
+		ret = test_submit(t);
+	if (!ret)
+		ret = test_drain(t);
+	else
+		test_drain(t);
+
+	kthread_stop(edma->thread);
+	if (!ret && atomic_read(&edma->errors))
+		ret = -EIO;
+
+	if (ret) {
+		pr_err("edma test: failed: %d (seed %u)\n", ret, seed);
+		goto err;
+	}
+
+	pr_info("edma test: passed: %llu copy requests, %llu failed, %llu bytes\n",
+		t->submitted, t->failed, t->bytes);
+	for (i = 0; i < DMA_WR_CHNL_NUM; i++)
+		pr_info("edma test: channel %u: %llu submissions\n",
+			i, edma->chan_xfers[i]);
+
+err:
+	test_teardown(t);
+	kfree(t);
+	return ret;
+}
+
+static void __exit
+stream_ext_test_exit(void)
+{
+}
+
+module_init(stream_ext_test_init);
+module_exit(stream_ext_test_exit);
+
+MODULE_DESCRIPTION("NvSciC2c-Pcie submit-copy striping test");
+MODULE_LICENSE("GPL v2");
+MODULE_AUTHOR("Nvidia Corporation");
@@ -24,6 +24,7 @@
 #include <linux/nvhost.h>
 #include <linux/nvhost_t194.h>
 #include <linux/platform_device.h>
+#include <linux/sizes.h>
 #include <linux/slab.h>
 #include <linux/syscalls.h>
 #include <linux/tegra-pcie-edma.h>
@@ -41,6 +42,22 @@
 /* forward declaration.*/
 struct stream_ext_ctx_t;
 struct stream_ext_obj;
+struct copy_request;
+
+/*
+ * flush ranges of at least twice this size are cut into chunks spread over
+ * the eDMA write channels, chunk boundaries are page aligned.
+ */
+#define EDMA_STRIPE_MIN_SZ	(SZ_64K)
+
+/* one eDMA submission of a copy request on one eDMA write channel.*/
+struct copy_stripe {
+	struct copy_request *cr;
+	u32 channel_num;
+	u64 num_desc;
+	u64 bytes;
+	struct tegra_pcie_edma_desc *desc;
+};
 
 /* limits as set for copy requests.*/
 struct copy_req_limits {
@@ -100,6 +117,25 @@ struct copy_request {
 	 * all the post-fences for remote signalling by eDMA.
 	 */
 	struct tegra_pcie_edma_desc *edma_desc;
+	/* edma_desc[0, num_data_desc) are flush ranges, rest remote fences.*/
+	u64 num_data_desc;
+
+	/*
+	 * flush-range descriptors regrouped per eDMA write channel, each
+	 * channel has room for max_flush_ranges chunks as a flush range
+	 * contributes at most one chunk to a channel.
+	 */
+	struct tegra_pcie_edma_desc *stripe_desc;
+	struct copy_stripe stripes[DMA_WR_CHNL_NUM];
+	/*
+	 * remote post-fences are written only once all the stripes landed,
+	 * eDMA write channels are not ordered against each other.
+	 */
+	struct copy_stripe fence_stripe;
+	/* stripes in flight + one while submitting.*/
+	atomic_t pending;
+	bool failed;
+	bool fences_issued;
 
 	/*
 	 * actual number of local_post-fences per the submit-copy request.
@@ -186,6 +222,9 @@ struct stream_ext_ctx_t {
 	struct mutex free_lock;
 	atomic_t transfer_count;
 	wait_queue_head_t transfer_waitq;
+
+	/* bytes in flight per eDMA write channel, drives striping.*/
+	atomic64_t chan_load[DMA_WR_CHNL_NUM];
 };
 
 static int
@@ -199,11 +238,15 @@ signal_local_post_fences(struct copy_request *cr);
 
 static int
 prepare_edma_desc(enum drv_mode_t drv_mode, struct copy_req_params *params,
-		  struct tegra_pcie_edma_desc *desc, u64 *num_desc);
+		  struct tegra_pcie_edma_desc *desc, u64 *num_desc,
+		  u64 *num_data_desc);
+static void
+stripe_edma_desc(struct stream_ext_ctx_t *ctx, struct copy_request *cr);
+static int
+submit_copy_request(struct stream_ext_ctx_t *ctx, struct copy_request *cr);
 
 static edma_xfer_status_t
-schedule_edma_xfer(void *edma_h, void *priv, u64 num_desc,
-		   struct tegra_pcie_edma_desc *desc);
+schedule_edma_xfer(void *edma_h, struct copy_stripe *stripe);
 static void
 callback_edma_xfer(void *priv, edma_xfer_status_t status,
 		   struct tegra_pcie_edma_desc *desc);
@@ -477,7 +520,6 @@ ioctl_submit_copy_request(struct stream_ext_ctx_t *ctx,
 {
 	int ret = 0;
 	struct copy_request *cr = NULL;
-	edma_xfer_status_t edma_status = EDMA_XFER_FAIL_INVAL_INPUTS;
 
 	/* copy user-supplied submit-copy args.*/
 	ret = copy_args_from_user(ctx, args, &ctx->cr_params);
@@ -517,24 +559,21 @@ ioctl_submit_copy_request(struct stream_ext_ctx_t *ctx,
 
 	/* generate eDMA descriptors from flush_ranges, remote_post_fences.*/
 	ret = prepare_edma_desc(ctx->drv_mode, &ctx->cr_params, cr->edma_desc,
-				&cr->num_edma_desc);
+				&cr->num_edma_desc, &cr->num_data_desc);
 	if (ret) {
 		release_copy_request_handles(cr);
 		goto reclaim_cr;
 	}
 
-	/* schedule asynchronous eDMA.*/
-	atomic_inc(&ctx->transfer_count);
-	edma_status = schedule_edma_xfer(ctx->edma_h, (void *)cr,
-					 cr->num_edma_desc, cr->edma_desc);
-	if (edma_status != EDMA_XFER_SUCCESS) {
-		ret = -EIO;
-		atomic_dec(&ctx->transfer_count);
-		release_copy_request_handles(cr);
-		goto reclaim_cr;
-	}
+	/* spread flush_ranges over eDMA write channels.*/
+	stripe_edma_desc(ctx, cr);
 
-	return ret;
+	/*
+	 * schedule asynchronous eDMA. On failure, the copy request is
+	 * reclaimed once the stripes already submitted (if any) completed.
+	 */
+	atomic_inc(&ctx->transfer_count);
+	return submit_copy_request(ctx, cr);
 
 reclaim_cr:
 	mutex_lock(&ctx->free_lock);
@@ -658,6 +697,7 @@ stream_extension_ioctl(void *stream_ext_h, unsigned int cmd, void *args)
 int
 stream_extension_init(struct stream_ext_params *params, void **stream_ext_h)
 {
+	u32 i = 0;
 	struct stream_ext_ctx_t *ctx = NULL;
 
 	if (WARN_ON(!params || !stream_ext_h || *stream_ext_h))
@@ -683,6 +723,8 @@ stream_extension_init(struct stream_ext_params *params, void **stream_ext_h)
 	INIT_LIST_HEAD(&ctx->free_list);
 	atomic_set(&ctx->transfer_count, 0);
 	init_waitqueue_head(&ctx->transfer_waitq);
+	for (i = 0; i < DMA_WR_CHNL_NUM; i++)
+		atomic64_set(&ctx->chan_load[i], 0);
 
 	*stream_ext_h = (void *)ctx;
 
@@ -813,50 +855,215 @@ allocate_handle(struct stream_ext_ctx_t *ctx, enum nvscic2c_pcie_obj_type type,
 }
 
 static edma_xfer_status_t
-schedule_edma_xfer(void *edma_h, void *priv, u64 num_desc,
-		   struct tegra_pcie_edma_desc *desc)
+schedule_edma_xfer(void *edma_h, struct copy_stripe *stripe)
 {
 	struct tegra_pcie_edma_xfer_info info = {0};
+	struct stream_ext_ctx_t *ctx = stripe->cr->ctx;
+	edma_xfer_status_t status;
 
-	if (WARN_ON(!num_desc || !desc))
-		return -EINVAL;
+	if (WARN_ON(!stripe->num_desc || !stripe->desc))
+		return EDMA_XFER_FAIL_INVAL_INPUTS;
 
 	info.type = EDMA_XFER_WRITE;
-	info.channel_num = 0; // no use-case to use all WR channels yet.
-	info.desc = desc;
-	info.nents = num_desc;
+	info.channel_num = stripe->channel_num;
+	info.desc = stripe->desc;
+	info.nents = stripe->num_desc;
 	info.complete = callback_edma_xfer;
-	info.priv = priv;
+	info.priv = (void *)stripe;
+
+	atomic64_add(stripe->bytes, &ctx->chan_load[stripe->channel_num]);
+	status = tegra_pcie_edma_submit_xfer(edma_h, &info);
+	if (status != EDMA_XFER_SUCCESS)
+		atomic64_sub(stripe->bytes,
+			     &ctx->chan_load[stripe->channel_num]);
 
-	return tegra_pcie_edma_submit_xfer(edma_h, &info);
+	return status;
 }
 
-/* Callback with each async eDMA submit xfer.*/
+static u32
+least_loaded_channel(struct stream_ext_ctx_t *ctx, u64 *load, u32 used)
+{
+	u32 i = 0;
+	u32 ch = DMA_WR_CHNL_NUM;
+
+	for (i = 0; i < DMA_WR_CHNL_NUM; i++) {
+		if (used & BIT(i))
+			continue;
+		if (ch == DMA_WR_CHNL_NUM || load[i] < load[ch])
+			ch = i;
+	}
+
+	return ch;
+}
+
+/*
+ * Spread the flush-range descriptors over the eDMA write channels. Large
+ * ranges are cut into page aligned chunks, every chunk of a range going to
+ * a different channel. Each chunk goes to the channel with the fewest bytes
+ * queued, counting what other copy requests still have in flight.
+ */
 static void
-callback_edma_xfer(void *priv, edma_xfer_status_t status,
-		   struct tegra_pcie_edma_desc *desc)
+stripe_edma_desc(struct stream_ext_ctx_t *ctx, struct copy_request *cr)
 {
-	struct copy_request *cr = (struct copy_request *)priv;
+	u32 i = 0;
+	u32 ch = 0;
+	u32 used = 0;
+	u64 n = 0;
+	u64 off = 0;
+	u64 len = 0;
+	u64 chunk = 0;
+	u64 load[DMA_WR_CHNL_NUM];
+	struct copy_stripe *stripe = NULL;
+	struct tegra_pcie_edma_desc *desc = NULL;
+	u64 max_ranges = ctx->cr_limits.max_flush_ranges;
+
+	for (ch = 0; ch < DMA_WR_CHNL_NUM; ch++) {
+		stripe = &cr->stripes[ch];
+		stripe->cr = cr;
+		stripe->channel_num = ch;
+		stripe->num_desc = 0;
+		stripe->bytes = 0;
+		stripe->desc = &cr->stripe_desc[ch * max_ranges];
+		load[ch] = atomic64_read(&ctx->chan_load[ch]);
+	}
+
+	for (i = 0; i < cr->num_data_desc; i++) {
+		desc = &cr->edma_desc[i];
+
+		n = 1;
+		chunk = desc->sz;
+		if (desc->sz >= (2 * EDMA_STRIPE_MIN_SZ)) {
+			n = min_t(u64, DMA_WR_CHNL_NUM,
+				  desc->sz / EDMA_STRIPE_MIN_SZ);
+			chunk = ALIGN(DIV_ROUND_UP_ULL(desc->sz, n), PAGE_SIZE);
+		}
+
+		used = 0;
+		for (off = 0; off < desc->sz; off += len) {
+			len = min_t(u64, chunk, desc->sz - off);
+			ch = least_loaded_channel(ctx, load, used);
+			used |= BIT(ch);
+
+			stripe = &cr->stripes[ch];
+			stripe->desc[stripe->num_desc].src = desc->src + off;
+			stripe->desc[stripe->num_desc].dst = desc->dst + off;
+			stripe->desc[stripe->num_desc].sz = len;
+			stripe->num_desc++;
+			stripe->bytes += len;
+			load[ch] += len;
+		}
+	}
+
+	stripe = &cr->fence_stripe;
+	stripe->cr = cr;
+	stripe->channel_num = 0;
+	stripe->num_desc = cr->num_edma_desc - cr->num_data_desc;
+	stripe->bytes = stripe->num_desc * 4;
+	stripe->desc = &cr->edma_desc[cr->num_data_desc];
+}
+
+/* all eDMA for the copy request done (or failed), signal and reclaim.*/
+static void
+complete_copy_request(struct copy_request *cr)
+{
+	struct stream_ext_ctx_t *ctx = cr->ctx;
 
 	/* increment num_local_fences.*/
-	if (status == EDMA_XFER_SUCCESS)
+	if (!cr->failed)
 		signal_local_post_fences(cr);
 
 	/* releases the references of the cubmit-copy handles.*/
 	release_copy_request_handles(cr);
 
 	/* reclaim the copy_request for reuse.*/
-	mutex_lock(&cr->ctx->free_lock);
-	list_add_tail(&cr->node, &cr->ctx->free_list);
-	mutex_unlock(&cr->ctx->free_lock);
+	mutex_lock(&ctx->free_lock);
+	list_add_tail(&cr->node, &ctx->free_list);
+	mutex_unlock(&ctx->free_lock);
+
+	atomic_dec(&ctx->transfer_count);
+	wake_up_interruptible_all(&ctx->transfer_waitq);
+}
+
+/* drop one pending stripe, issue remote post-fences after the last one.*/
+static void
+put_copy_request_stripe(struct copy_request *cr)
+{
+	struct stream_ext_ctx_t *ctx = cr->ctx;
+	struct copy_stripe *stripe = &cr->fence_stripe;
+	u64 load[DMA_WR_CHNL_NUM];
+	u32 ch = 0;
+
+	if (!atomic_dec_and_test(&cr->pending))
+		return;
+
+	if (!cr->failed && !cr->fences_issued && stripe->num_desc) {
+		cr->fences_issued = true;
+		for (ch = 0; ch < DMA_WR_CHNL_NUM; ch++)
+			load[ch] = atomic64_read(&ctx->chan_load[ch]);
+		stripe->channel_num = least_loaded_channel(ctx, load, 0);
+
+		atomic_set(&cr->pending, 1);
+		if (schedule_edma_xfer(ctx->edma_h, stripe) ==
+		    EDMA_XFER_SUCCESS)
+			return;
+		atomic_set(&cr->pending, 0);
+		cr->failed = true;
+	}
+
+	complete_copy_request(cr);
+}
 
-	atomic_dec(&cr->ctx->transfer_count);
-	wake_up_interruptible_all(&cr->ctx->transfer_waitq);
+static int
+submit_copy_request(struct stream_ext_ctx_t *ctx, struct copy_request *cr)
+{
+	u32 ch = 0;
+	int ret = 0;
+	struct copy_stripe *stripe = NULL;
+
+	cr->failed = false;
+	cr->fences_issued = false;
+	/* hold one while submitting, stripes may complete meanwhile.*/
+	atomic_set(&cr->pending, 1);
+	for (ch = 0; ch < DMA_WR_CHNL_NUM; ch++) {
+		stripe = &cr->stripes[ch];
+		if (!stripe->num_desc)
+			continue;
+
+		atomic_inc(&cr->pending);
+		if (schedule_edma_xfer(ctx->edma_h, stripe) !=
+		    EDMA_XFER_SUCCESS) {
+			atomic_dec(&cr->pending);
+			cr->failed = true;
+			ret = -EIO;
+			break;
+		}
+	}
+
+	/* cr must not be accessed beyond this point.*/
+	put_copy_request_stripe(cr);
+
+	return ret;
+}
+
+/* Callback with each async eDMA submit xfer.*/
+static void
+callback_edma_xfer(void *priv, edma_xfer_status_t status,
+		   struct tegra_pcie_edma_desc *desc)
+{
+	struct copy_stripe *stripe = (struct copy_stripe *)priv;
+	struct copy_request *cr = stripe->cr;
+
+	atomic64_sub(stripe->bytes, &cr->ctx->chan_load[stripe->channel_num]);
+	if (status != EDMA_XFER_SUCCESS)
+		cr->failed = true;
+
+	put_copy_request_stripe(cr);
 }
 
 static int
 prepare_edma_desc(enum drv_mode_t drv_mode, struct copy_req_params *params,
-		  struct tegra_pcie_edma_desc *desc, u64 *num_desc)
+		  struct tegra_pcie_edma_desc *desc, u64 *num_desc,
+		  u64 *num_data_desc)
 {
 	u32 i = 0;
 	int ret = 0;
@@ -889,6 +1096,7 @@ prepare_edma_desc(enum drv_mode_t drv_mode, struct copy_req_params *params,
 		desc[iter].sz = flush_range->size;
 		iter++;
 	}
+	*num_data_desc = iter;
 	for (i = 0; i < params->num_remote_post_fences; i++) {
 		handle = params->remote_post_fences[i];
 
@@ -1193,6 +1401,7 @@ free_copy_request(struct copy_request **copy_request)
 		return;
 
 	kfree(cr->local_post_fences);
+	kfree(cr->stripe_desc);
 	kfree(cr->edma_desc);
 	kfree(cr->handles);
 	kfree(cr);
@@ -1239,6 +1448,16 @@ allocate_copy_request(struct stream_ext_ctx_t *ctx,
 		goto err;
 	}
 
+	/* each flush range gives at most one chunk to each eDMA channel.*/
+	cr->stripe_desc = kzalloc((sizeof(*cr->stripe_desc) *
+				   ctx->cr_limits.max_flush_ranges *
+				   DMA_WR_CHNL_NUM),
+				  GFP_KERNEL);
+	if (WARN_ON(!cr->stripe_desc)) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
 	/* OR all max_post_fences could be local_post_fence. */
 	cr->local_post_fences = kzalloc((sizeof(*cr->local_post_fences) *
 					 ctx->cr_limits.max_post_fences),
@@ -37,6 +37,13 @@
 /* Based off of max device tree node name length */
 #define MAX_PROFILE_NAME_LENGTH	31
 
+/* predictive mode defaults and tuning, temperatures in millicelsius */
+#define PRED_HORIZON_MS		3000
+#define PRED_MAX_LEAD		10000
+#define SLOPE_EWMA_WEIGHT	4
+#define SLOPE_RISING		200	/* per second */
+#define SLOPE_STABLE		50	/* per second */
+
 static void fan_set_trip_temp_hyst(struct therm_fan_estimator *est, int trip,
 							unsigned long hyst_temp,
 							unsigned long trip_temp)
@@ -48,6 +55,52 @@ static void fan_set_trip_temp_hyst(struct therm_fan_estimator *est, int trip,
 	}
 }
 
+/*
+ * Track the slope of the estimate and, in predictive mode, return how
+ * far to lead it: predict_horizon_ms worth of rise, so fan trips are
+ * crossed before the temperature gets there. The estimate itself is
+ * left alone. Polling speeds up while the estimate is rising and backs
+ * off while it is stable.
+ */
+static long therm_fan_est_predict(struct therm_fan_estimator *est, long temp)
+{
+	unsigned long now = jiffies;
+	long dt_ms, inst, lead = 0;
+
+	if (est->last_sample_jiffies) {
+		dt_ms = jiffies_to_msecs(now - est->last_sample_jiffies);
+		if (dt_ms > 0) {
+			inst = (temp - est->last_est_temp) * 1000 / dt_ms;
+			est->slope = (est->slope * (SLOPE_EWMA_WEIGHT - 1) +
+					inst) / SLOPE_EWMA_WEIGHT;
+		}
+		/* compare modes by how long each lets the zone run hot */
+		if (est->throttle_temp && temp >= est->throttle_temp)
+			est->time_above_throttle_ms += dt_ms;
+	}
+	est->last_sample_jiffies = now;
+	est->last_est_temp = temp;
+
+	if (!est->predictive) {
+		est->cur_polling_period = est->polling_period;
+		return 0;
+	}
+
+	if (est->slope >= SLOPE_RISING)
+		est->cur_polling_period = est->min_polling_period;
+	else if (abs(est->slope) < SLOPE_STABLE)
+		est->cur_polling_period = min(est->cur_polling_period * 2,
+						est->max_polling_period);
+	else
+		est->cur_polling_period = est->polling_period;
+
+	if (est->slope > 0)
+		lead = min(est->slope * est->predict_horizon_ms / 1000,
+				(long)PRED_MAX_LEAD);
+
+	return lead;
+}
+
 static void therm_fan_est_work_func(struct work_struct *work)
 {
 	int i, j, group, index, trip_index = 0;
@@ -85,6 +138,8 @@ static void therm_fan_est_work_func(struct work_struct *work)
 #else
 	est->cur_temp = est->cur_temp_debug;
 #endif
+	est->lead = therm_fan_est_predict(est, est->cur_temp);
+	est->trip_cmp_temp = est->cur_temp + est->lead;
 
 	if (est->is_continuous_gov)
 		goto next_work;
@@ -94,13 +149,14 @@ static void therm_fan_est_work_func(struct work_struct *work)
 		est->current_trip_level = 0;
 	}
 
-	if (est->cur_temp != est->pre_temp) {
-		if (est->cur_temp > est->pre_temp) {
+	if (est->trip_cmp_temp != est->pre_temp) {
+		if (est->trip_cmp_temp > est->pre_temp) {
 			/* temperature is rising */
 			read_lock(&est->state_lock);
 			for (trip_index = 0;
 				trip_index < (MAX_ACTIVE_STATES + 1); trip_index++) {
-				if (est->cur_temp < est->active_trip_temps[trip_index])
+				if (est->trip_cmp_temp <
+					est->active_trip_temps[trip_index])
 					break;
 			}
 			read_unlock(&est->state_lock);
@@ -108,12 +164,13 @@ static void therm_fan_est_work_func(struct work_struct *work)
 			if (est->current_trip_level < trip_index
 				&& est->current_trip_level != (trip_index - 1))
 				update_flag = true;
-		} else if (est->cur_temp < est->pre_temp) {
+		} else if (est->trip_cmp_temp < est->pre_temp) {
 			/* temperature is cooling */
 			read_lock(&est->state_lock);
 			for (trip_index = 1;
 				trip_index < (MAX_ACTIVE_STATES + 1); trip_index++) {
-				if (est->cur_temp < (est->active_trip_temps[trip_index]
+				if (est->trip_cmp_temp <
+					(est->active_trip_temps[trip_index]
 					- est->active_hysteresis[trip_index]))
 					break;
 			}
@@ -128,7 +185,8 @@ static void therm_fan_est_work_func(struct work_struct *work)
 		if (update_flag) {
 			est->current_trip_level = trip_index - 1;
 			pr_info("FAN %s trip_level:%d cur_temp:%ld trip_temps[%d]:%d\n",
-				(est->cur_temp < est->pre_temp)?"cooling":"rising",
+				(est->trip_cmp_temp < est->pre_temp) ?
+					"cooling" : "rising",
 				est->current_trip_level, est->cur_temp,
 				trip_index, est->active_trip_temps[trip_index]);
 
@@ -140,7 +198,7 @@ static void therm_fan_est_work_func(struct work_struct *work)
 		#endif
 		}
 
-		est->pre_temp = est->cur_temp;
+		est->pre_temp = est->trip_cmp_temp;
 	}
 	/*
 	 * spec for sleep mode is to attempt to turn off fan once only
@@ -157,7 +215,7 @@ static void therm_fan_est_work_func(struct work_struct *work)
 next_work:
 	est->ntemp++;
 	queue_delayed_work(est->workqueue, &est->therm_fan_est_work,
-				msecs_to_jiffies(est->polling_period));
+				msecs_to_jiffies(est->cur_polling_period));
 }
 
 #ifdef CONFIG_THERMAL_GOV_CONTINUOUS
@@ -244,6 +302,8 @@ static int therm_fan_est_get_trip_temp(struct thermal_zone_device *thz,
 		else /* not tripped, then upper */
 			*temp = est->active_trip_temps[trip];
 	}
+	/* the governor sees the real estimate, so move the trip instead */
+	*temp -= READ_ONCE(est->lead);
 out:
 	read_unlock(&est->state_lock);
 	return ret;
@@ -530,6 +590,95 @@ static ssize_t show_temps(struct device *dev,
 	return strlen(buf);
 }
 
+static ssize_t show_predictive(struct device *dev,
+				struct device_attribute *da,
+				char *buf)
+{
+	struct therm_fan_estimator *est = dev_get_drvdata(dev);
+
+	if (!est)
+		return -EINVAL;
+	return sprintf(buf, "%d\n", est->predictive);
+}
+
+static ssize_t set_predictive(struct device *dev,
+				struct device_attribute *da,
+				const char *buf, size_t count)
+{
+	struct therm_fan_estimator *est = dev_get_drvdata(dev);
+	int flag;
+
+	if (kstrtoint(buf, 0, &flag))
+		return -EINVAL;
+
+	if (flag != 0 && flag != 1)
+		return -EINVAL;
+
+	est->predictive = flag;
+
+	return count;
+}
+
+static ssize_t show_slope(struct device *dev,
+				struct device_attribute *da,
+				char *buf)
+{
+	struct therm_fan_estimator *est = dev_get_drvdata(dev);
+
+	if (!est)
+		return -EINVAL;
+	return sprintf(buf, "%ld\n", est->slope);
+}
+
+static ssize_t show_throttle_temp(struct device *dev,
+				struct device_attribute *da,
+				char *buf)
+{
+	struct therm_fan_estimator *est = dev_get_drvdata(dev);
+
+	if (!est)
+		return -EINVAL;
+	return sprintf(buf, "%ld\n", est->throttle_temp);
+}
+
+static ssize_t set_throttle_temp(struct device *dev,
+				struct device_attribute *da,
+				const char *buf, size_t count)
+{
+	struct therm_fan_estimator *est = dev_get_drvdata(dev);
+	long temp;
+
+	if (kstrtol(buf, 0, &temp) || temp < 0)
+		return -EINVAL;
+
+	est->throttle_temp = temp;
+
+	return count;
+}
+
+static ssize_t show_time_above_throttle(struct device *dev,
+				struct device_attribute *da,
+				char *buf)
+{
+	struct therm_fan_estimator *est = dev_get_drvdata(dev);
+
+	if (!est)
+		return -EINVAL;
+	return sprintf(buf, "%llu\n", est->time_above_throttle_ms);
+}
+
+/* any write restarts the count, e.g. before switching modes */
+static ssize_t reset_time_above_throttle(struct device *dev,
+				struct device_attribute *da,
+				const char *buf, size_t count)
+{
+	struct therm_fan_estimator *est = dev_get_drvdata(dev);
+
+	est->time_above_throttle_ms = 0;
+
+	return count;
+}
+
 #if DEBUG
 static ssize_t set_temps(struct device *dev,
 				struct device_attribute *da,
@@ -554,6 +703,14 @@ static struct sensor_device_attribute therm_fan_est_nodes[] = {
 				show_fan_profile, set_fan_profile, 0),
 	SENSOR_ATTR(sleep_mode, S_IRUGO | S_IWUSR,
 				show_sleep_mode, set_sleep_mode, 0),
+	SENSOR_ATTR(predictive, S_IRUGO | S_IWUSR,
+				show_predictive, set_predictive, 0),
+	SENSOR_ATTR(slope, S_IRUGO, show_slope, 0, 0),
+	SENSOR_ATTR(throttle_temp, S_IRUGO | S_IWUSR,
+				show_throttle_temp, set_throttle_temp, 0),
+	SENSOR_ATTR(time_above_throttle_ms, S_IRUGO | S_IWUSR,
+				show_time_above_throttle,
+				reset_time_above_throttle, 0),
 #if DEBUG
 	SENSOR_ATTR(temps, S_IRUGO | S_IWUSR, show_temps, set_temps, 0),
 #else
@@ -715,6 +872,28 @@ static int therm_fan_est_probe(struct platform_device *pdev)
 		goto free_subdevs;
 	}
 	est_data->polling_period = (long)value;
+	est_data->cur_polling_period = est_data->polling_period;
+
+	/* optional predictive mode */
+	est_data->predictive = of_property_read_bool(data_node, "predictive");
+	if (of_property_read_u32(data_node, "predict_horizon_ms", &value))
+		value = PRED_HORIZON_MS;
+	est_data->predict_horizon_ms = (long)value;
+	if (of_property_read_u32(data_node, "min_polling_period", &value))
+		value = est_data->polling_period / 4;
+	/* a zero period would requeue the work without any delay */
+	est_data->min_polling_period = clamp_t(long, value, 1,
+					max(est_data->polling_period, 1L));
+	if (of_property_read_u32(data_node, "max_polling_period", &value))
+		value = est_data->polling_period * 4;
+	est_data->max_polling_period = max_t(long, value,
+					max(est_data->polling_period, 1L));
+	if (of_property_read_u32(data_node, "throttle_temp", &value))
+		value = 0;
+	est_data->throttle_temp = (long)value;
+	pr_debug("THERMAL EST predictive: %d, polling %ld-%ld ms\n",
+		est_data->predictive, est_data->min_polling_period,
+		est_data->max_polling_period);
 
 	/* fan trip temp/hyst profiles */
 	est_data->num_profiles = 0;
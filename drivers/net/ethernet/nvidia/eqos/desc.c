@@ -376,46 +376,76 @@ static int desc_alloc_skb(struct eqos_prv_data *pdata,
 			  struct rx_swcx_desc *prx_swcx_desc, gfp_t gfp,
 			  unsigned int qinx)
 {
-	struct sk_buff *skb = prx_swcx_desc->skb;
-	dma_addr_t dma = prx_swcx_desc->dma;
-
-	if (skb) {
-		/* Recycled skbs should have zero length and their buffer
-		 * still DMA mapped.
-		 */
-		if (WARN_ON(skb->len != 0))
-			skb_trim(skb, 0);
-		if (WARN_ON(!dma))
-			goto dma_map;
+	unsigned int size = PAGE_SIZE << pdata->rx_page_order;
+	struct page *page = prx_swcx_desc->page;
+	dma_addr_t dma;
 
+	if (page)
+		goto set_dma;
+
+	/* Reserved skb is only released by the Rx path */
+	if (prx_swcx_desc->skb)
 		return 0;
-	}
 
-	skb = __netdev_alloc_skb_ip_align(pdata->dev, pdata->rx_buffer_len,
-					  gfp);
-	if (unlikely(!skb)) {
-		netdev_err(pdata->dev, "RX skb allocation failed, using reserved buffer\n");
+	page = __dev_alloc_pages(gfp | __GFP_NOWARN, pdata->rx_page_order);
+	if (unlikely(!page)) {
+		netdev_err(pdata->dev, "RX page allocation failed, using reserved buffer\n");
 		prx_swcx_desc->skb = pdata->resv_skb;
 		prx_swcx_desc->dma = pdata->resv_dma;
 		pdata->xstats.q_re_alloc_rx_buf_failed[qinx]++;
 		return 0;
 	}
 
-dma_map:
-	dma = dma_map_single(&pdata->pdev->dev, skb->data, pdata->rx_buffer_len,
-			     DMA_FROM_DEVICE);
+	/* The whole page stays mapped; ownership of each buffer is passed
+	 * with partial syncs below and in the Rx path instead.
+	 */
+	dma = dma_map_page_attrs(&pdata->pdev->dev, page, 0, size,
+				 DMA_FROM_DEVICE, DMA_ATTR_SKIP_CPU_SYNC);
 	if (unlikely(dma_mapping_error(&pdata->pdev->dev, dma))) {
-		netdev_err(pdata->dev, "RX skb dma map failed\n");
-		dev_kfree_skb_any(skb);
+		netdev_err(pdata->dev, "RX page dma map failed\n");
+		__free_pages(page, pdata->rx_page_order);
 		return -ENOMEM;
 	}
 
-	prx_swcx_desc->skb = skb;
-	prx_swcx_desc->dma = dma;
+	/* Take references up front so handing a half to the stack is a
+	 * counter decrement rather than an atomic page_ref operation.
+	 */
+	page_ref_add(page, USHRT_MAX - 1);
+
+	prx_swcx_desc->page = page;
+	prx_swcx_desc->page_dma = dma;
+	prx_swcx_desc->page_offset = 0;
+	prx_swcx_desc->pagecnt_bias = USHRT_MAX;
+	pdata->xstats.rx_page_alloc_n++;
+
+set_dma:
+	prx_swcx_desc->dma = prx_swcx_desc->page_dma +
+			     prx_swcx_desc->page_offset + EQOS_RX_HEADROOM;
+
+	/* Hand only the area the device may write back to it */
+	dma_sync_single_range_for_device(&pdata->pdev->dev,
+					 prx_swcx_desc->page_dma,
+					 prx_swcx_desc->page_offset +
+					 EQOS_RX_HEADROOM,
+					 pdata->rx_buffer_len,
+					 DMA_FROM_DEVICE);
 
 	return 0;
 }
 
+/* Size the Rx page buffers for the current rx_buffer_len: each page
+ * holds two buffers, each with headroom and room for skb_shared_info.
+ */
+static void eqos_rx_buf_geometry(struct eqos_prv_data *pdata)
+{
+	unsigned int truesize =
+		SKB_DATA_ALIGN(EQOS_RX_HEADROOM + pdata->rx_buffer_len) +
+		SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	pdata->rx_page_order = get_order(2 * truesize);
+	pdata->rx_buf_truesize = (PAGE_SIZE << pdata->rx_page_order) / 2;
+}
+
 /*!
 * \brief API to initialize the receive descriptors.
 *
@@ -488,6 +518,8 @@ static void eqos_wrapper_rx_descriptor_init(struct eqos_prv_data *pdata)
 	unsigned int qinx;
 
 	pr_debug("-->eqos_wrapper_rx_descriptor_init\n");
+	eqos_rx_buf_geometry(pdata);
+
 	pdata->resv_skb = __netdev_alloc_skb_ip_align(pdata->dev,
 						      pdata->rx_buffer_len,
 						      GFP_KERNEL);
@@ -1074,15 +1106,8 @@ static void eqos_unmap_rx_skb(struct eqos_prv_data *pdata,
 {
 	pr_debug("-->eqos_unmap_rx_skb\n");
 
-	/* unmap the first buffer */
-	if (prx_swcx_desc->dma) {
-		if (pdata->resv_dma != prx_swcx_desc->dma) {
-			dma_unmap_single(&pdata->pdev->dev, prx_swcx_desc->dma,
-					 pdata->rx_buffer_len,
-					 DMA_FROM_DEVICE);
-		}
-		prx_swcx_desc->dma = 0;
-	}
+	/* the buffer address is owned by the page or the reserved skb */
+	prx_swcx_desc->dma = 0;
 
 	if (prx_swcx_desc->skb) {
 		if (pdata->resv_skb != prx_swcx_desc->skb) {
@@ -1091,6 +1116,23 @@ static void eqos_unmap_rx_skb(struct eqos_prv_data *pdata,
 		prx_swcx_desc->skb = NULL;
 	}
 
+	/* release the page buffer; halves still owned by the stack
+	 * keep the page alive until they are freed
+	 */
+	if (prx_swcx_desc->page) {
+		/* received data was already synced for the cpu */
+		dma_unmap_page_attrs(&pdata->pdev->dev,
+				     prx_swcx_desc->page_dma,
+				     PAGE_SIZE << pdata->rx_page_order,
+				     DMA_FROM_DEVICE, DMA_ATTR_SKIP_CPU_SYNC);
+		if (page_ref_sub_and_test(prx_swcx_desc->page,
+					  prx_swcx_desc->pagecnt_bias))
+			__free_pages(prx_swcx_desc->page,
+				     pdata->rx_page_order);
+		prx_swcx_desc->page = NULL;
+		prx_swcx_desc->page_dma = 0;
+	}
+
 	pr_debug("<--eqos_unmap_rx_skb\n");
 }
 
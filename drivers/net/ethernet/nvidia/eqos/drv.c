@@ -90,6 +90,11 @@ module_param_array(q_op_mode, int, NULL, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(q_op_mode,
 		 "MTL queue operation mode [0-DISABLED, 1-AVB, 2-DCB, 3-GENERIC]");
 
+static unsigned int rx_copybreak = EQOS_RX_COPYBREAK_DEFAULT;
+module_param(rx_copybreak, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(rx_copybreak,
+		 "Copy Rx frames up to this length and reuse their buffer");
+
 u64 eqos_get_ptptime(void *data)
 {
 	struct eqos_prv_data *pdata = data;
@@ -1873,6 +1878,21 @@ static inline int eqos_get_rx_tstamp_status(struct s_rx_desc *context_desc)
 * \retval 2 if time stamp is corrupted
 */
 
+/* Whether a context descriptor with the timestamp follows prx_desc */
+static inline bool eqos_rx_tstamp_avail(struct eqos_prv_data *pdata,
+					struct s_rx_desc *prx_desc)
+{
+	if (!pdata->hw_feat.tsstssel || !pdata->hwts_rx_en)
+		return false;
+
+	if (unlikely(!(prx_desc->rdes3 & EQOS_RDESC3_RS1V) ||
+		     !(prx_desc->rdes1 & EQOS_RDESC1_TSA)) ||
+		      (prx_desc->rdes1 & EQOS_RDESC1_TD))
+		return false;
+
+	return true;
+}
+
 static int eqos_get_rx_hwtstamp(struct eqos_prv_data *pdata,
 				struct sk_buff *skb,
 				struct s_rx_desc *prx_desc,
@@ -1882,12 +1902,7 @@ static int eqos_get_rx_hwtstamp(struct eqos_prv_data *pdata,
 	int retry, ret = 0;
 	u64 ns;
 
-	if (!pdata->hw_feat.tsstssel || !pdata->hwts_rx_en)
-		return -ENOTSUPP;
-
-	if (unlikely(!(prx_desc->rdes3 & EQOS_RDESC3_RS1V) ||
-		     !(prx_desc->rdes1 & EQOS_RDESC1_TSA)) ||
-		      (prx_desc->rdes1 & EQOS_RDESC1_TD))
+	if (!eqos_rx_tstamp_avail(pdata, prx_desc))
 		return -ENOTSUPP;
 
 	eqos_print_rx_tstamp_info(prx_desc);
@@ -2239,6 +2254,80 @@ static inline void eqos_get_rx_vlan(struct eqos_prv_data *pdata,
 	}
 }
 
+/* The half just handed out may still be in the stack; the page can
+ * only flip to its other half if nothing else holds a reference.
+ */
+static inline bool eqos_rx_page_reusable(struct rx_swcx_desc *prx_swcx_desc)
+{
+	struct page *page = prx_swcx_desc->page;
+
+	if (unlikely(page_is_pfmemalloc(page) ||
+		     page_to_nid(page) != numa_mem_id()))
+		return false;
+
+	if (page_ref_count(page) - prx_swcx_desc->pagecnt_bias > 1)
+		return false;
+
+	if (unlikely(prx_swcx_desc->pagecnt_bias == 1)) {
+		page_ref_add(page, USHRT_MAX - 1);
+		prx_swcx_desc->pagecnt_bias = USHRT_MAX;
+	}
+
+	return true;
+}
+
+/*
+ * Turn a received buffer into an skb. Short frames are copied and the
+ * buffer stays on the descriptor; longer ones are wrapped with
+ * build_skb() and the page flips to its other half when possible.
+ * Returns NULL if no skb could be allocated; the buffer is then kept.
+ */
+static struct sk_buff *eqos_rx_get_skb(struct eqos_prv_data *pdata,
+				       struct eqos_rx_queue *rx_queue,
+				       struct rx_swcx_desc *prx_swcx_desc,
+				       unsigned int pkt_len)
+{
+	u8 *va = page_address(prx_swcx_desc->page) +
+		 prx_swcx_desc->page_offset;
+	struct sk_buff *skb;
+
+	dma_sync_single_range_for_cpu(&pdata->pdev->dev,
+				      prx_swcx_desc->page_dma,
+				      prx_swcx_desc->page_offset +
+				      EQOS_RX_HEADROOM,
+				      pkt_len, DMA_FROM_DEVICE);
+
+	if (pkt_len <= rx_copybreak) {
+		skb = napi_alloc_skb(&rx_queue->napi, pkt_len);
+		if (unlikely(!skb))
+			return NULL;
+
+		memcpy(__skb_put(skb, pkt_len), va + EQOS_RX_HEADROOM,
+		       pkt_len);
+		pdata->xstats.rx_copybreak_n++;
+		return skb;
+	}
+
+	skb = build_skb(va, pdata->rx_buf_truesize);
+	if (unlikely(!skb))
+		return NULL;
+
+	skb_reserve(skb, EQOS_RX_HEADROOM);
+	__skb_put(skb, pkt_len);
+
+	/* that half now belongs to the skb */
+	prx_swcx_desc->pagecnt_bias--;
+
+	if (eqos_rx_page_reusable(prx_swcx_desc)) {
+		prx_swcx_desc->page_offset ^= pdata->rx_buf_truesize;
+		pdata->xstats.rx_page_reuse_n++;
+	} else {
+		pdata->desc_if.unmap_rx_skb(pdata, prx_swcx_desc);
+	}
+
+	return skb;
+}
+
 static inline int eqos_rx_dirty(struct rx_ring *prx_ring)
 {
 	BUILD_BUG_ON_NOT_POWER_OF_2(RX_DESC_CNT);
@@ -2313,17 +2402,16 @@ static int process_rx_completions(struct eqos_rx_queue *rx_queue, int quota)
 #endif
 		if (likely(!(status & EQOS_RDESC3_ES_BITS) &&
 			   (status & EQOS_RDESC3_LD))) {
-			/* Unmap the SKB */
-			skb = prx_swcx_desc->skb;
-			prx_swcx_desc->skb = NULL;
-
-			dma_unmap_single(&pdata->pdev->dev, prx_swcx_desc->dma,
-					 pdata->rx_buffer_len, DMA_FROM_DEVICE);
-
-			prx_swcx_desc->dma = 0;
-
 			pkt_len = (status & EQOS_RDESC3_PL);
-			skb_put(skb, pkt_len);
+			skb = eqos_rx_get_skb(pdata, rx_queue, prx_swcx_desc,
+					      pkt_len);
+			if (unlikely(!skb)) {
+				/* buffer stays on the descriptor */
+				dev->stats.rx_dropped++;
+				if (eqos_rx_tstamp_avail(pdata, prx_desc))
+					INCR_RX_DESC_INDEX(prx_ring->cur_rx, 1);
+				goto next_desc;
+			}
 
 #ifdef EQOS_ENABLE_RX_PKT_DUMP
 			print_pkt(skb, pkt_len, 0, entry);
@@ -2350,6 +2438,7 @@ static int process_rx_completions(struct eqos_rx_queue *rx_queue, int quota)
 			eqos_update_rx_errors(dev, status);
 		}
 
+next_desc:
 		received++;
 		if (eqos_rx_dirty(prx_ring) >=
 		    prx_ring->skb_realloc_threshold)
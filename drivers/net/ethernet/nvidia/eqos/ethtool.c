@@ -150,6 +150,9 @@ static const struct eqos_stats eqos_gstrings_stats[] = {
 	EQOS_EXTRA_STAT(tx_timestamp_captured_n),
 	EQOS_EXTRA_STAT(rx_timestamp_captured_n),
 	EQOS_EXTRA_STAT(tx_tso_pkt_n),
+	EQOS_EXTRA_STAT(rx_page_alloc_n),
+	EQOS_EXTRA_STAT(rx_page_reuse_n),
+	EQOS_EXTRA_STAT(rx_copybreak_n),
 
 	/* Tx/Rx frames per channels/queues */
 	EQOS_EXTRA_STAT(q_tx_pkt_n[0]),
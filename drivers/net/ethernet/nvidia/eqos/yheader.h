@@ -141,6 +141,12 @@
  */
 #define EQOS_RX_BUF_LEN 2048
 
+/* Room left in front of each Rx page buffer for build_skb() */
+#define EQOS_RX_HEADROOM (NET_SKB_PAD + NET_IP_ALIGN)
+
+/* Frames up to this length are copied and their page buffer reused */
+#define EQOS_RX_COPYBREAK_DEFAULT 256
+
 /* Max value of RXPBL */
 #define MAX_RXPBL 32
 
@@ -974,10 +980,18 @@ struct eqos_tx_queue {
 
 /* wrapper buffer structure to hold received pkt details */
 struct rx_swcx_desc {
-	dma_addr_t dma;		/* dma address of skb */
-	struct sk_buff *skb;	/* virtual address of skb */
+	dma_addr_t dma;		/* dma address of the Rx buffer */
+	struct sk_buff *skb;	/* only set to the reserved skb */
 	bool inte;	/* set to non-zero if INTE is set for
 				corresponding desc */
+	/* Page backing the buffer; mapped once and split in two halves
+	 * that are handed to the stack in turn.
+	 */
+	struct page *page;
+	dma_addr_t page_dma;
+	unsigned int page_offset;
+	/* page references still owned by the driver */
+	unsigned int pagecnt_bias;
 };
 
 struct rx_ring {
@@ -1253,6 +1267,10 @@ struct eqos_extra_stats {
 	unsigned long tx_timestamp_captured_n;
 	unsigned long rx_timestamp_captured_n;
 	unsigned long tx_tso_pkt_n;
+	/* Rx page buffers */
+	unsigned long rx_page_alloc_n;
+	unsigned long rx_page_reuse_n;
+	unsigned long rx_copybreak_n;
 
 	/* Tx/Rx frames per channels/queues */
 	unsigned long q_tx_pkt_n[8];
@@ -1423,6 +1441,9 @@ struct eqos_prv_data {
 
 	unsigned int rx_buffer_len;
 	unsigned int rx_max_frame_size;
+	/* Rx page geometry, derived from rx_buffer_len */
+	unsigned int rx_page_order;
+	unsigned int rx_buf_truesize;
 
 	/* variable frame burst size */
 	UINT drop_tx_pktburstcnt;
@@ -12,11 +12,32 @@
  */
 
 #include <linux/aer.h>
+#include <linux/delay.h>
 #include <linux/etherdevice.h>
 #include <linux/module.h>
 #include <linux/netdevice.h>
 #include <linux/pci.h>
 #include <linux/tegra_vnet.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+
+#if ENABLE_DMA
+/* Poll period for Tx completions in case DMA done MSI is not delivered */
+#define TVNET_TX_POLL_JIFFIES	1
+/* Restart EP DMA if no Tx desc retires for this long */
+#define TVNET_TX_STALL_MS	1000
+
+/* Host side state of one EP DMA read desc */
+struct tvnet_tx_buf {
+	/* Set only on the last desc of a packet */
+	struct sk_buff *skb;
+	dma_addr_t iova;
+	u32 len;
+	bool page;
+	/* H2EP empty buffer the packet is written to */
+	u64 dst_iova;
+};
+#endif
 
 struct tvnet_priv {
 	struct net_device *ndev;
@@ -34,6 +55,21 @@ struct tvnet_priv {
 	struct tvnet_dma_desc *dma_desc;
 #if ENABLE_DMA
 	struct dma_desc_cnt desc_cnt;
+	/* EP address of dma_desc, used to decode DMA LLP register */
+	u64 dma_desc_iova;
+	struct tvnet_tx_buf tx_buf[DMA_DESC_COUNT];
+	/* Packets queued to EP DMA and not yet pushed to H2EP full ring */
+	u32 tx_pkts;
+	/* Descs are queued but doorbell is not rung yet */
+	bool tx_db_pending;
+	/* To protect desc_cnt, tx_buf and tx_pkts */
+	spinlock_t tx_lock;
+	struct timer_list tx_timer;
+	unsigned long tx_last_done;
+	/* Restarts a stalled EP DMA engine, needs to sleep */
+	struct work_struct tx_reset_work;
+	/* Drains EP DMA on remote link down before sending the ack */
+	struct work_struct link_down_work;
 #endif
 	enum dir_link_state tx_link_state;
 	enum dir_link_state rx_link_state;
@@ -106,6 +142,274 @@ static void tvnet_host_raise_ep_data_irq(struct tvnet_priv *tvnet)
 	}
 }
 
+#if ENABLE_DMA
+static u32 tvnet_host_tx_desc_avail(struct tvnet_priv *tvnet)
+{
+	struct dma_desc_cnt *desc_cnt = &tvnet->desc_cnt;
+
+	/* Keep one desc unused so that LLP == rd_cnt means nothing retired */
+	return DMA_DESC_COUNT - 1 -
+		(READ_ONCE(desc_cnt->wr_cnt) - READ_ONCE(desc_cnt->rd_cnt));
+}
+#endif
+
+/* Check if a max sized skb can be queued */
+static bool tvnet_host_tx_avail(struct tvnet_priv *tvnet)
+{
+	if (!tvnet_ivc_rd_available(&tvnet->h2ep_empty))
+		return false;
+
+#if ENABLE_DMA
+	/* Full msgs of in flight packets are pushed on DMA completion */
+	if (tvnet_ivc_wr_available(&tvnet->h2ep_full) <=
+	    READ_ONCE(tvnet->tx_pkts))
+		return false;
+
+	return tvnet_host_tx_desc_avail(tvnet) > MAX_SKB_FRAGS;
+#else
+	return !tvnet_ivc_full(&tvnet->h2ep_full);
+#endif
+}
+
+#if ENABLE_DMA
+static void tvnet_host_tx_unmap(struct tvnet_priv *tvnet,
+				struct tvnet_tx_buf *tx_buf)
+{
+	struct device *d = &tvnet->pdev->dev;
+
+	if (tx_buf->page)
+		dma_unmap_page(d, tx_buf->iova, tx_buf->len, DMA_TO_DEVICE);
+	else
+		dma_unmap_single(d, tx_buf->iova, tx_buf->len, DMA_TO_DEVICE);
+}
+
+/* Ring EP DMA doorbell for all queued descs */
+static void tvnet_host_tx_kick(struct tvnet_priv *tvnet)
+{
+	if (!tvnet->tx_db_pending)
+		return;
+
+	tvnet->tx_db_pending = false;
+	dma_common_wr(tvnet->dma_base, DMA_RD_DATA_CH, DMA_READ_DOORBELL_OFF);
+	/* Raise an interrupt to let EP populate H2EP_EMPTY_BUF ring */
+	tvnet_host_raise_ep_ctrl_irq(tvnet);
+
+	if (!timer_pending(&tvnet->tx_timer))
+		mod_timer(&tvnet->tx_timer, jiffies + TVNET_TX_POLL_JIFFIES);
+}
+
+/*
+ * Restart EP DMA read channel from the oldest pending desc. The engine needs
+ * time to settle after disable, so this sleeps and must not be called with
+ * tx_lock held.
+ */
+static void tvnet_host_reset_dma(struct tvnet_priv *tvnet)
+{
+	struct dma_desc_cnt *desc_cnt = &tvnet->desc_cnt;
+	unsigned long flags;
+	u32 desc_ridx;
+	u64 llp;
+
+	spin_lock_irqsave(&tvnet->tx_lock, flags);
+	dma_common_wr(tvnet->dma_base, DMA_READ_ENGINE_EN_OFF_DISABLE,
+		      DMA_READ_ENGINE_EN_OFF);
+	spin_unlock_irqrestore(&tvnet->tx_lock, flags);
+
+	usleep_range(1000, 2000);
+
+	spin_lock_irqsave(&tvnet->tx_lock, flags);
+	desc_ridx = desc_cnt->rd_cnt % DMA_DESC_COUNT;
+	llp = tvnet->dma_desc_iova + desc_ridx * sizeof(struct tvnet_dma_desc);
+	dma_common_wr(tvnet->dma_base, DMA_READ_ENGINE_EN_OFF_ENABLE,
+		      DMA_READ_ENGINE_EN_OFF);
+	dma_channel_wr(tvnet->dma_base, DMA_RD_DATA_CH, lower_32_bits(llp),
+		       DMA_LLP_LOW_OFF_RDCH);
+	dma_channel_wr(tvnet->dma_base, DMA_RD_DATA_CH, upper_32_bits(llp),
+		       DMA_LLP_HIGH_OFF_RDCH);
+	dma_common_wr(tvnet->dma_base, BIT(DMA_RD_DATA_CH) |
+		      BIT(DMA_RD_DATA_CH + 16), DMA_READ_INT_CLEAR_OFF);
+	/* Descs queued while the engine was down still need a doorbell */
+	if (desc_cnt->rd_cnt != desc_cnt->wr_cnt)
+		dma_common_wr(tvnet->dma_base, DMA_RD_DATA_CH,
+			      DMA_READ_DOORBELL_OFF);
+	tvnet->tx_last_done = jiffies;
+	spin_unlock_irqrestore(&tvnet->tx_lock, flags);
+}
+
+static void tvnet_host_tx_reset_work(struct work_struct *work)
+{
+	struct tvnet_priv *tvnet = container_of(work, struct tvnet_priv,
+						tx_reset_work);
+
+	pr_err("dma took more time, reset dma engine\n");
+	tvnet_host_reset_dma(tvnet);
+}
+
+/*
+ * Retire descs which EP DMA is done with and push their packets to H2EP full
+ * ring. EP DMA processes descs in order and its LLP register points to the
+ * desc in progress (or to the one with CB unset once it runs dry), so every
+ * desc from rd_cnt up to LLP is complete. Called from xmit, ctrl irq (DMA done
+ * MSI is routed to it) and tx timer.
+ */
+static int tvnet_host_tx_complete(struct tvnet_priv *tvnet)
+{
+	struct net_device *ndev = tvnet->ndev;
+	struct host_ring_buf *host_mem = &tvnet->host_mem;
+	struct data_msg *h2ep_full_msg = host_mem->h2ep_full_msgs;
+	struct tvnet_dma_desc *dma_desc = tvnet->dma_desc;
+	struct dma_desc_cnt *desc_cnt = &tvnet->desc_cnt;
+	u32 val, llp, hw_idx, desc_ridx, wr_cnt;
+	unsigned long flags;
+	int pushed = 0;
+
+	spin_lock_irqsave(&tvnet->tx_lock, flags);
+	if (desc_cnt->rd_cnt == desc_cnt->wr_cnt)
+		goto unlock;
+
+	/* Clear status before reading LLP so that no completion is missed */
+	val = dma_common_rd(tvnet->dma_base, DMA_READ_INT_STATUS_OFF);
+	if (val & BIT(DMA_RD_DATA_CH + 16))
+		pr_err("%s: dma read abort, status: 0x%x\n", __func__, val);
+	if (val)
+		dma_common_wr(tvnet->dma_base, val, DMA_READ_INT_CLEAR_OFF);
+
+	llp = dma_channel_rd(tvnet->dma_base, DMA_RD_DATA_CH,
+			     DMA_LLP_LOW_OFF_RDCH);
+	hw_idx = (llp - lower_32_bits(tvnet->dma_desc_iova)) /
+			sizeof(struct tvnet_dma_desc);
+	/* Parked on link element, next desc to run is 0 */
+	if (hw_idx >= DMA_DESC_COUNT)
+		hw_idx = 0;
+
+	wr_cnt = tvnet_ivc_get_wr_cnt(&tvnet->h2ep_full);
+	while (desc_cnt->rd_cnt != desc_cnt->wr_cnt) {
+		struct tvnet_tx_buf *tx_buf;
+		u32 wr_idx;
+
+		desc_ridx = desc_cnt->rd_cnt % DMA_DESC_COUNT;
+		if (desc_ridx == hw_idx)
+			break;
+
+		/* Clear DMA cycle bit so that desc can be reused */
+		dma_desc[desc_ridx].ctrl_reg.ctrl_e.cb = 0;
+
+		tx_buf = &tvnet->tx_buf[desc_ridx];
+		tvnet_host_tx_unmap(tvnet, tx_buf);
+		if (tx_buf->skb) {
+			wr_idx = (wr_cnt + pushed) % RING_COUNT;
+			h2ep_full_msg[wr_idx].u.full_buffer.packet_size =
+							tx_buf->skb->len;
+			h2ep_full_msg[wr_idx].u.full_buffer.pcie_address =
+							tx_buf->dst_iova;
+			h2ep_full_msg[wr_idx].msg_id = DATA_MSG_FULL_BUF;
+			ndev->stats.tx_packets++;
+			ndev->stats.tx_bytes += tx_buf->skb->len;
+			dev_consume_skb_any(tx_buf->skb);
+			tx_buf->skb = NULL;
+			tvnet->tx_pkts--;
+			pushed++;
+		}
+		desc_cnt->rd_cnt++;
+	}
+
+	if (pushed) {
+		/* BAR0 mmio address is wc mem, add mb to make sure that full
+		 * buffers and cleared CB bits are written before updating
+		 * counters.
+		 */
+		mb();
+		tvnet_ivc_set_wr(&tvnet->h2ep_full, wr_cnt + pushed);
+		tvnet_host_raise_ep_data_irq(tvnet);
+		tvnet->tx_last_done = jiffies;
+	}
+
+unlock:
+	spin_unlock_irqrestore(&tvnet->tx_lock, flags);
+
+	if (pushed && netif_queue_stopped(ndev) &&
+	    (tvnet->os_link_state == OS_LINK_STATE_UP) &&
+	    tvnet_host_tx_avail(tvnet))
+		netif_wake_queue(ndev);
+
+	return pushed;
+}
+
+static bool tvnet_host_tx_pending(struct tvnet_priv *tvnet)
+{
+	return READ_ONCE(tvnet->desc_cnt.rd_cnt) !=
+		READ_ONCE(tvnet->desc_cnt.wr_cnt);
+}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 15, 0))
+static void tvnet_host_tx_timer(struct timer_list *t)
+{
+	struct tvnet_priv *tvnet = from_timer(tvnet, t, tx_timer);
+#else
+static void tvnet_host_tx_timer(unsigned long data)
+{
+	struct tvnet_priv *tvnet = (struct tvnet_priv *)data;
+#endif
+
+	tvnet_host_tx_complete(tvnet);
+	if (!tvnet_host_tx_pending(tvnet))
+		return;
+
+	if (time_after(jiffies, tvnet->tx_last_done +
+		       msecs_to_jiffies(TVNET_TX_STALL_MS)))
+		schedule_work(&tvnet->tx_reset_work);
+
+	mod_timer(&tvnet->tx_timer, jiffies + TVNET_TX_POLL_JIFFIES);
+}
+
+/*
+ * Wait for queued EP DMA to retire before EP buffers are given up, drop
+ * whatever is still pending after timeout. Sleeps, called from
+ * link_down_work.
+ */
+static void tvnet_host_flush_tx(struct tvnet_priv *tvnet)
+{
+	struct tvnet_dma_desc *dma_desc = tvnet->dma_desc;
+	struct dma_desc_cnt *desc_cnt = &tvnet->desc_cnt;
+	unsigned long timeout = jiffies + msecs_to_jiffies(TVNET_TX_STALL_MS);
+	unsigned long flags;
+
+	while (true) {
+		tvnet_host_tx_complete(tvnet);
+		if (!tvnet_host_tx_pending(tvnet))
+			return;
+		if (time_after(jiffies, timeout))
+			break;
+		usleep_range(1000, 2000);
+	}
+
+	pr_err("%s: dma took more time, drop pending tx\n", __func__);
+	spin_lock_irqsave(&tvnet->tx_lock, flags);
+	/* Stop DMA before pending src buffers are unmapped */
+	dma_common_wr(tvnet->dma_base, DMA_READ_ENGINE_EN_OFF_DISABLE,
+		      DMA_READ_ENGINE_EN_OFF);
+	while (desc_cnt->rd_cnt != desc_cnt->wr_cnt) {
+		u32 desc_ridx = desc_cnt->rd_cnt % DMA_DESC_COUNT;
+		struct tvnet_tx_buf *tx_buf = &tvnet->tx_buf[desc_ridx];
+
+		dma_desc[desc_ridx].ctrl_reg.ctrl_e.cb = 0;
+		tvnet_host_tx_unmap(tvnet, tx_buf);
+		if (tx_buf->skb) {
+			tvnet->ndev->stats.tx_dropped++;
+			dev_kfree_skb_any(tx_buf->skb);
+			tx_buf->skb = NULL;
+			tvnet->tx_pkts--;
+		}
+		desc_cnt->rd_cnt++;
+	}
+	mb();
+	spin_unlock_irqrestore(&tvnet->tx_lock, flags);
+
+	/* DMA LLP must point to the next desc to be queued */
+	tvnet_host_reset_dma(tvnet);
+}
+#endif
+
 static void tvnet_host_read_ctrl_msg(struct tvnet_priv *tvnet,
 				     struct ctrl_msg *msg)
 {
@@ -310,18 +614,40 @@ static void tvnet_host_rcv_link_up_msg(struct tvnet_priv *tvnet)
 	tvnet_host_update_link_sm(tvnet);
 }
 
-static void tvnet_host_rcv_link_down_msg(struct tvnet_priv *tvnet)
+static void tvnet_host_send_link_down_ack(struct tvnet_priv *tvnet)
 {
 	struct ctrl_msg msg;
 
-	/* Stop using empty buffers of remote system */
-	tvnet_host_stop_tx_queue(tvnet);
 	msg.msg_id = CTRL_MSG_LINK_DOWN_ACK;
 	tvnet_host_write_ctrl_msg(tvnet, &msg);
 	tvnet->tx_link_state = DIR_LINK_STATE_DOWN;
 	tvnet_host_update_link_sm(tvnet);
 }
 
+#if ENABLE_DMA
+static void tvnet_host_link_down_work(struct work_struct *work)
+{
+	struct tvnet_priv *tvnet = container_of(work, struct tvnet_priv,
+						link_down_work);
+
+	/* EP buffers stay in use until in-flight DMA has retired */
+	tvnet_host_flush_tx(tvnet);
+	tvnet_host_send_link_down_ack(tvnet);
+}
+#endif
+
+static void tvnet_host_rcv_link_down_msg(struct tvnet_priv *tvnet)
+{
+	/* Stop using empty buffers of remote system */
+	tvnet_host_stop_tx_queue(tvnet);
+#if ENABLE_DMA
+	/* Draining may take up to TVNET_TX_STALL_MS, not in irq context */
+	schedule_work(&tvnet->link_down_work);
+#else
+	tvnet_host_send_link_down_ack(tvnet);
+#endif
+}
+
 static void tvnet_host_rcv_link_down_ack(struct tvnet_priv *tvnet)
 {
 	/* Stop using empty buffers(which are full in rx) of local system */
@@ -399,145 +725,186 @@ static netdev_tx_t tvnet_host_start_xmit(struct sk_buff *skb,
 					 struct net_device *ndev)
 {
 	struct tvnet_priv *tvnet = netdev_priv(ndev);
-	struct host_ring_buf *host_mem = &tvnet->host_mem;
-	struct data_msg *h2ep_full_msg = host_mem->h2ep_full_msgs;
-	struct skb_shared_info *info = skb_shinfo(skb);
 	struct ep_ring_buf *ep_mem = &tvnet->ep_mem;
 	struct data_msg *h2ep_empty_msg = ep_mem->h2ep_empty_msgs;
-	struct device *d = &tvnet->pdev->dev;
 #if ENABLE_DMA
+	struct skb_shared_info *info = skb_shinfo(skb);
+	struct device *d = &tvnet->pdev->dev;
 	struct tvnet_dma_desc *dma_desc = tvnet->dma_desc;
 	struct dma_desc_cnt *desc_cnt = &tvnet->desc_cnt;
-	u32 desc_widx, desc_ridx, val;
-	u32 ctrl_d;
-	unsigned long timeout;
+	int nr_desc = info->nr_frags + 1;
+	struct tvnet_tx_buf *tx_buf;
+	u32 desc_widx, ctrl_d;
+	unsigned long flags;
+	bool more, stop;
+	u32 off = 0;
+	int i;
+#else
+	struct host_ring_buf *host_mem = &tvnet->host_mem;
+	struct data_msg *h2ep_full_msg = host_mem->h2ep_full_msgs;
+	void *dst_virt;
+	u32 wr_idx;
 #endif
-	dma_addr_t src_iova;
 	dma_addr_t dst_iova;
 	u32 rd_idx;
-	u32 wr_idx;
-	void *dst_virt;
-	int len;
 
-	/* TODO Not expecting skb frags, remove this after testing */
-	WARN_ON(info->nr_frags);
+#if ENABLE_DMA
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0))
+	more = netdev_xmit_more();
+#else
+	more = skb->xmit_more;
+#endif
+#endif
 
 	/* Check if H2EP_EMPTY_BUF available to read */
 	if (!tvnet_ivc_rd_available(&tvnet->h2ep_empty)) {
 		tvnet_host_raise_ep_ctrl_irq(tvnet);
 		pr_debug("%s: No H2EP empty msg, stop tx\n", __func__);
 		netif_stop_queue(ndev);
-		return NETDEV_TX_BUSY;
-	}
-
-	/* Check if H2EP_FULL_BUF available to write */
-	if (tvnet_ivc_full(&tvnet->h2ep_full)) {
-		tvnet_host_raise_ep_ctrl_irq(tvnet);
-		pr_debug("%s: No H2EP full buf, stop tx\n", __func__);
-		netif_stop_queue(ndev);
+#if ENABLE_DMA
+		tvnet_host_tx_kick(tvnet);
+#endif
 		return NETDEV_TX_BUSY;
 	}
 
 #if ENABLE_DMA
-	/* Check if dma desc available */
-	if ((desc_cnt->wr_cnt - desc_cnt->rd_cnt) >= DMA_DESC_COUNT) {
-		pr_debug("%s: dma descriptors are not available\n", __func__);
-		netif_stop_queue(ndev);
-		return NETDEV_TX_BUSY;
+	/* Check if H2EP_FULL_BUF and dma desc available */
+	if ((tvnet_ivc_wr_available(&tvnet->h2ep_full) <=
+	     READ_ONCE(tvnet->tx_pkts)) ||
+	    (tvnet_host_tx_desc_avail(tvnet) < nr_desc)) {
+		tvnet_host_tx_complete(tvnet);
+		if ((tvnet_ivc_wr_available(&tvnet->h2ep_full) <=
+		     READ_ONCE(tvnet->tx_pkts)) ||
+		    (tvnet_host_tx_desc_avail(tvnet) < nr_desc)) {
+			pr_debug("%s: No H2EP full buf or dma desc, stop tx\n",
+				 __func__);
+			netif_stop_queue(ndev);
+			tvnet_host_tx_kick(tvnet);
+			return NETDEV_TX_BUSY;
+		}
 	}
-#endif
-
-	len = skb_headlen(skb);
 
-	src_iova = dma_map_single(d, skb->data, len, DMA_TO_DEVICE);
-	if (dma_mapping_error(d, src_iova)) {
-		pr_err("%s: dma_map_single failed\n", __func__);
+	if (skb->ip_summed == CHECKSUM_PARTIAL && skb_checksum_help(skb)) {
 		dev_kfree_skb_any(skb);
-		return NETDEV_TX_OK;
+		ndev->stats.tx_dropped++;
+		goto out;
+	}
+
+	/* Map head and frags, one dma desc each */
+	for (i = 0; i < nr_desc; i++) {
+		desc_widx = (desc_cnt->wr_cnt + i) % DMA_DESC_COUNT;
+		tx_buf = &tvnet->tx_buf[desc_widx];
+		if (i == 0) {
+			tx_buf->len = skb_headlen(skb);
+			tx_buf->page = false;
+			tx_buf->iova = dma_map_single(d, skb->data, tx_buf->len,
+						      DMA_TO_DEVICE);
+		} else {
+			const skb_frag_t *frag = &info->frags[i - 1];
+
+			tx_buf->len = skb_frag_size(frag);
+			tx_buf->page = true;
+			tx_buf->iova = skb_frag_dma_map(d, frag, 0, tx_buf->len,
+							DMA_TO_DEVICE);
+		}
+		if (dma_mapping_error(d, tx_buf->iova)) {
+			pr_err("%s: dma map failed\n", __func__);
+			while (--i >= 0) {
+				desc_widx = (desc_cnt->wr_cnt + i) %
+						DMA_DESC_COUNT;
+				tvnet_host_tx_unmap(tvnet,
+						    &tvnet->tx_buf[desc_widx]);
+			}
+			dev_kfree_skb_any(skb);
+			ndev->stats.tx_dropped++;
+			goto out;
+		}
+		tx_buf->skb = NULL;
 	}
+#endif
 
 	/* Get H2EP empty msg */
 	rd_idx = tvnet_ivc_get_rd_cnt(&tvnet->h2ep_empty) %
 				RING_COUNT;
 	dst_iova = h2ep_empty_msg[rd_idx].u.empty_buffer.pcie_address;
-	dst_virt = tvnet->mmio_base + (dst_iova - tvnet->bar_md->bar0_base_phy);
 	/* Advance read count after all failure cases complated, to avoid
 	 * dangling buffer at endpoint.
 	 */
 	tvnet_ivc_advance_rd(&tvnet->h2ep_empty);
-	/* Raise an interrupt to let EP populate H2EP_EMPTY_BUF ring */
-	tvnet_host_raise_ep_ctrl_irq(tvnet);
 
 #if ENABLE_DMA
-	/* Trigger DMA write from src_iova to dst_iova */
-	desc_widx = desc_cnt->wr_cnt % DMA_DESC_COUNT;
-	dma_desc[desc_widx].size = len;
-	dma_desc[desc_widx].sar_low = lower_32_bits(src_iova);
-	dma_desc[desc_widx].sar_high = upper_32_bits(src_iova);
-	dma_desc[desc_widx].dar_low = lower_32_bits(dst_iova);
-	dma_desc[desc_widx].dar_high = upper_32_bits(dst_iova);
+	/* Gather head and frags back to back into the EP buffer */
+	for (i = 0; i < nr_desc; i++) {
+		desc_widx = (desc_cnt->wr_cnt + i) % DMA_DESC_COUNT;
+		tx_buf = &tvnet->tx_buf[desc_widx];
+		dma_desc[desc_widx].size = tx_buf->len;
+		dma_desc[desc_widx].sar_low = lower_32_bits(tx_buf->iova);
+		dma_desc[desc_widx].sar_high = upper_32_bits(tx_buf->iova);
+		dma_desc[desc_widx].dar_low = lower_32_bits(dst_iova + off);
+		dma_desc[desc_widx].dar_high = upper_32_bits(dst_iova + off);
+		off += tx_buf->len;
+	}
+	tx_buf->skb = skb;
+	tx_buf->dst_iova = dst_iova;
+
 	/* CB bit should be set at the end */
 	mb();
-	/* RIE is not required for polling mode */
-	ctrl_d = DMA_CH_CONTROL1_OFF_RDCH_RIE;
-	ctrl_d |= DMA_CH_CONTROL1_OFF_RDCH_LIE;
-	ctrl_d |= DMA_CH_CONTROL1_OFF_RDCH_CB;
-	dma_desc[desc_widx].ctrl_reg.ctrl_d = ctrl_d;
+	for (i = 0; i < nr_desc; i++) {
+		desc_widx = (desc_cnt->wr_cnt + i) % DMA_DESC_COUNT;
+		ctrl_d = DMA_CH_CONTROL1_OFF_RDCH_CB;
+		/* Only the last desc of a packet raises DMA done irq */
+		if (i == nr_desc - 1) {
+			ctrl_d |= DMA_CH_CONTROL1_OFF_RDCH_RIE;
+			ctrl_d |= DMA_CH_CONTROL1_OFF_RDCH_LIE;
+		}
+		dma_desc[desc_widx].ctrl_reg.ctrl_d = ctrl_d;
+	}
 	/*
 	 * Read after write to avoid EP DMA reading LLE before CB is written to
 	 * EP's system memory.
 	 */
 	ctrl_d = dma_desc[desc_widx].ctrl_reg.ctrl_d;
 
-	/* DMA write should not go out of order wrt CB bit set */
+	/* DMA doorbell should not go out of order wrt CB bit set */
 	mb();
 
-	timeout = jiffies + msecs_to_jiffies(1000);
-	dma_common_wr(tvnet->dma_base, DMA_RD_DATA_CH, DMA_READ_DOORBELL_OFF);
-
-	desc_cnt->wr_cnt++;
-
-	while (true) {
-		val = dma_common_rd(tvnet->dma_base, DMA_READ_INT_STATUS_OFF);
-		if (val == BIT(DMA_RD_DATA_CH)) {
-			dma_common_wr(tvnet->dma_base, val,
-				      DMA_READ_INT_CLEAR_OFF);
-			break;
-		}
-		if (time_after(jiffies, timeout)) {
-			pr_err("dma took more time, reset dma engine\n");
-			dma_common_wr(tvnet->dma_base,
-				      DMA_READ_ENGINE_EN_OFF_DISABLE,
-				      DMA_READ_ENGINE_EN_OFF);
-			mdelay(1);
-			dma_common_wr(tvnet->dma_base,
-				      DMA_READ_ENGINE_EN_OFF_ENABLE,
-				      DMA_READ_ENGINE_EN_OFF);
-			desc_cnt->wr_cnt--;
-			dma_unmap_single(d, src_iova, len, DMA_TO_DEVICE);
-			return NETDEV_TX_BUSY;
-		}
-	}
-
-	desc_ridx = tvnet->desc_cnt.rd_cnt % DMA_DESC_COUNT;
-	/* Clear DMA cycle bit and increment rd_cnt */
-	dma_desc[desc_ridx].ctrl_reg.ctrl_e.cb = 0;
-	mb();
+	spin_lock_irqsave(&tvnet->tx_lock, flags);
+	if (!tvnet_host_tx_pending(tvnet))
+		tvnet->tx_last_done = jiffies;
+	desc_cnt->wr_cnt += nr_desc;
+	tvnet->tx_pkts++;
+	spin_unlock_irqrestore(&tvnet->tx_lock, flags);
+	tvnet->tx_db_pending = true;
 
-	tvnet->desc_cnt.rd_cnt++;
+out:
+	/*
+	 * Ring doorbell once per batch, H2EP full msgs are pushed from
+	 * tvnet_host_tx_complete() as the batch retires.
+	 */
+	stop = !tvnet_host_tx_avail(tvnet);
+	if (stop)
+		netif_stop_queue(ndev);
+	if (!more || stop)
+		tvnet_host_tx_kick(tvnet);
+	/* Completion may have freed resources before queue is stopped */
+	if (stop && tvnet_host_tx_avail(tvnet))
+		netif_wake_queue(ndev);
 #else
-	/* Copy skb->data to endpoint dst address, use CPU virt addr */
-	memcpy(dst_virt, skb->data, len);
+	dst_virt = tvnet->mmio_base + (dst_iova - tvnet->bar_md->bar0_base_phy);
+	/* Raise an interrupt to let EP populate H2EP_EMPTY_BUF ring */
+	tvnet_host_raise_ep_ctrl_irq(tvnet);
+
+	/* Copy skb head and frags to endpoint dst address, use CPU virt addr */
+	skb_copy_bits(skb, 0, dst_virt, skb->len);
 	/* BAR0 mmio address is wc mem, add mb to make sure that complete
 	 * skb->data is written before updating counters.
 	 */
 	mb();
-#endif
 
 	/* Push dst to H2EP full ring */
 	wr_idx = tvnet_ivc_get_wr_cnt(&tvnet->h2ep_full) %
 				RING_COUNT;
-	h2ep_full_msg[wr_idx].u.full_buffer.packet_size = len;
+	h2ep_full_msg[wr_idx].u.full_buffer.packet_size = skb->len;
 	h2ep_full_msg[wr_idx].u.full_buffer.pcie_address = dst_iova;
 	h2ep_full_msg[wr_idx].msg_id = DATA_MSG_FULL_BUF;
 	/* BAR0 mmio address is wc mem, add mb to make sure that full
@@ -548,8 +915,8 @@ static netdev_tx_t tvnet_host_start_xmit(struct sk_buff *skb,
 	tvnet_host_raise_ep_data_irq(tvnet);
 
 	/* Free skb */
-	dma_unmap_single(d, src_iova, len, DMA_TO_DEVICE);
 	dev_kfree_skb_any(skb);
+#endif
 
 	return NETDEV_TX_OK;
 }
@@ -588,6 +955,10 @@ static void tvnet_host_setup_bar0_md(struct tvnet_priv *tvnet)
 
 	tvnet->dma_desc = (struct tvnet_dma_desc *)(tvnet->mmio_base +
 					tvnet->bar_md->host_dma_offset);
+#if ENABLE_DMA
+	tvnet->dma_desc_iova = tvnet->bar_md->bar0_base_phy +
+					tvnet->bar_md->host_dma_offset;
+#endif
 
 	tvnet->h2ep_ctrl.rd = &ep_mem->ep_cnt->h2ep_ctrl_rd_cnt;
 	tvnet->h2ep_ctrl.wr = &host_mem->host_cnt->h2ep_ctrl_wr_cnt;
@@ -679,10 +1050,14 @@ static irqreturn_t tvnet_irq_ctrl(int irq, void *data)
 	struct net_device *ndev = data;
 	struct tvnet_priv *tvnet = netdev_priv(ndev);
 
+#if ENABLE_DMA
+	/* EP DMA done MSI is routed to this vector */
+	tvnet_host_tx_complete(tvnet);
+#endif
+
 	if (netif_queue_stopped(ndev)) {
 		if ((tvnet->os_link_state == OS_LINK_STATE_UP) &&
-		    tvnet_ivc_rd_available(&tvnet->h2ep_empty) &&
-		    !tvnet_ivc_full(&tvnet->h2ep_full)) {
+		    tvnet_host_tx_avail(tvnet)) {
 			pr_debug("%s: wake net tx queue\n", __func__);
 			netif_wake_queue(ndev);
 		}
@@ -803,6 +1178,21 @@ static int tvnet_host_probe(struct pci_dev *pdev,
 	netif_napi_add(ndev, &tvnet->napi, tvnet_host_poll, TVNET_NAPI_WEIGHT);
 
 	ndev->mtu = TVNET_DEFAULT_MTU;
+#if ENABLE_DMA
+	/* Frags are gathered by EP DMA, checksum is done in xmit */
+	ndev->hw_features = NETIF_F_SG | NETIF_F_HW_CSUM;
+	ndev->features |= ndev->hw_features;
+
+	spin_lock_init(&tvnet->tx_lock);
+	INIT_WORK(&tvnet->tx_reset_work, tvnet_host_tx_reset_work);
+	INIT_WORK(&tvnet->link_down_work, tvnet_host_link_down_work);
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 15, 0))
+	timer_setup(&tvnet->tx_timer, tvnet_host_tx_timer, 0);
+#else
+	setup_timer(&tvnet->tx_timer, tvnet_host_tx_timer,
+		    (unsigned long)tvnet);
+#endif
+#endif
 
 	ret = register_netdev(ndev);
 	if (ret) {
@@ -871,6 +1261,11 @@ static void tvnet_host_remove(struct pci_dev *pdev)
 	free_irq(pci_irq_vector(pdev, 1), tvnet->ndev);
 	pci_free_irq_vectors(pdev);
 	unregister_netdev(tvnet->ndev);
+#if ENABLE_DMA
+	cancel_work_sync(&tvnet->link_down_work);
+	del_timer_sync(&tvnet->tx_timer);
+	cancel_work_sync(&tvnet->tx_reset_work);
+#endif
 	netif_napi_del(&tvnet->napi);
 	pci_disable_device(pdev);
 	free_netdev(tvnet->ndev);
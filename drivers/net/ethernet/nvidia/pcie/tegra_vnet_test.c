@@ -0,0 +1,1145 @@
+/*
+ * Transmit test of the Tegra PCIe virtual network host driver, run at
+ * module load.
+ *
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+/*
+ * tegra_vnet.c is built into this module and run against a fake endpoint
+ * instead of a PCI device. BAR0 is plain memory laid out as the EP function
+ * driver does it, and the EP DMA registers are routed to a model of the
+ * read channel: a doorbell walks the desc ring from LLP while CB is set,
+ * copies each desc into the EP buffer it names and raises the DMA done MSI
+ * for descs with LIE set. Writes to the EP irq addresses in BAR0 run the EP
+ * side from a work item. It answers link messages, checks every H2EP full
+ * message against the buffers it posted and the packet that was sent, and
+ * posts the buffers again. The host ctrl vector is called with irqs off,
+ * one call at a time. DMA mappings are the CPU address of the buffer, so
+ * the model can copy from them, and only the number of live mappings is
+ * kept.
+ *
+ * Packets of 60 to 1514 bytes, linear and with up to TEST_MAX_FRAGS frags,
+ * are handed to ndo_start_xmit() the way the stack does, in xmit_more
+ * batches of 1, 8 and the batch parameter. Every packet must arrive in
+ * order and intact, and the doorbell may only be rung once per batch plus
+ * once per queue stop. Doorbells, EP irqs and the time per packet are
+ * reported. Then the EP takes the link down while DMA is held, and the
+ * ack must not come before those packets are pushed. At the end no DMA
+ * mapping may be left. The receive path is not covered.
+ */
+
+#define pr_fmt(fmt)	"tegra_vnet_test: " fmt
+
+#include <linux/aer.h>
+#include <linux/delay.h>
+#include <linux/dma-mapping.h>
+#include <linux/etherdevice.h>
+#include <linux/io.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/pci.h>
+#include <linux/sizes.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/tegra_vnet.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <asm/unaligned.h>
+
+static atomic_t tvnet_test_maps = ATOMIC_INIT(0);
+static atomic_t tvnet_test_stops = ATOMIC_INIT(0);
+
+static void tvnet_test_unmapped(void);
+
+static dma_addr_t tvnet_test_map_single(struct device *d, void *ptr,
+					size_t size,
+					enum dma_data_direction dir)
+{
+	atomic_inc(&tvnet_test_maps);
+	return (dma_addr_t)(uintptr_t)ptr;
+}
+
+static dma_addr_t tvnet_test_frag_map(struct device *d,
+				      const skb_frag_t *frag, size_t offset,
+				      size_t size,
+				      enum dma_data_direction dir)
+{
+	atomic_inc(&tvnet_test_maps);
+	return (dma_addr_t)(uintptr_t)(skb_frag_address(frag) + offset);
+}
+
+static void tvnet_test_unmap(struct device *d, dma_addr_t iova, size_t size,
+			     enum dma_data_direction dir)
+{
+	if (atomic_dec_return(&tvnet_test_maps) < 0)
+		tvnet_test_unmapped();
+}
+
+static int tvnet_test_mapping_error(struct device *d, dma_addr_t iova)
+{
+	return 0;
+}
+
+/* no vector is allocated, irq calls on this number return at once */
+static int tvnet_test_irq_vector(struct pci_dev *pdev, unsigned int nr)
+{
+	return -ENXIO;
+}
+
+static void tvnet_test_stop_queue(struct net_device *ndev)
+{
+	atomic_inc(&tvnet_test_stops);
+	netif_stop_queue(ndev);
+}
+
+static void tvnet_test_ep_irq(u32 val, void __iomem *addr);
+static void tvnet_test_dma_wr(void __iomem *p, u32 val, u32 offset);
+static u32 tvnet_test_dma_rd(void __iomem *p, u32 offset);
+static void tvnet_test_dma_ch_wr(void __iomem *p, u8 channel, u32 val,
+				 u32 offset);
+static u32 tvnet_test_dma_ch_rd(void __iomem *p, u8 channel, u32 offset);
+
+/* the test must not bind to, or be loaded for, a real endpoint */
+#undef module_pci_driver
+#define module_pci_driver(__pci_driver) \
+	static struct pci_driver *tvnet_test_driver __maybe_unused = \
+		&(__pci_driver)
+#undef MODULE_DESCRIPTION
+#define MODULE_DESCRIPTION(desc)
+
+#undef dma_map_single
+#define dma_map_single		tvnet_test_map_single
+#undef dma_unmap_single
+#define dma_unmap_single	tvnet_test_unmap
+#undef dma_unmap_page
+#define dma_unmap_page		tvnet_test_unmap
+#define dma_mapping_error	tvnet_test_mapping_error
+#define skb_frag_dma_map	tvnet_test_frag_map
+#define pci_irq_vector		tvnet_test_irq_vector
+#define netif_stop_queue	tvnet_test_stop_queue
+/* only the EP irqs are raised with writel() */
+#undef writel
+#define writel(v, a)		tvnet_test_ep_irq(v, a)
+#define dma_common_wr		tvnet_test_dma_wr
+#define dma_common_rd		tvnet_test_dma_rd
+#define dma_channel_wr		tvnet_test_dma_ch_wr
+#define dma_channel_rd		tvnet_test_dma_ch_rd
+#include "tegra_vnet.c"
+#undef dma_channel_rd
+#undef dma_channel_wr
+#undef dma_common_rd
+#undef dma_common_wr
+#undef writel
+#undef netif_stop_queue
+#undef pci_irq_vector
+#undef skb_frag_dma_map
+#undef dma_mapping_error
+#undef MODULE_DESCRIPTION
+#define MODULE_DESCRIPTION(desc)	MODULE_INFO(description, desc)
+
+#define TEST_BAR0_PHY		(0x40000000ULL)
+#define TEST_BAR0_SIZE		(SZ_1M)
+#define TEST_BUF_SIZE		(SZ_2K)
+#define TEST_ETH_P		(0x88b5)	/* local experimental */
+#define TEST_MAX_FRAGS		(4)
+#define TEST_DRAIN_PKTS		(8)
+#define TEST_DRAIN_HOLD_MS	(20)
+#define TEST_TIMEOUT_MS		(2 * TVNET_TX_STALL_MS)
+
+static unsigned int packets = 20000;
+module_param(packets, uint, 0444);
+MODULE_PARM_DESC(packets, "packets sent per batch size");
+
+static unsigned int batch = 64;
+module_param(batch, uint, 0444);
+MODULE_PARM_DESC(batch, "packets per xmit_more batch for the last pass");
+
+/* EP DMA read channel */
+struct tvnet_test_dma {
+	spinlock_t lock;
+	bool enabled;
+	/* set by the test to hold queued descs */
+	bool paused;
+	u32 llp_low;
+	u32 llp_high;
+	u32 int_status;
+	u32 doorbells;
+};
+
+struct tvnet_test {
+	struct net_device *ndev;
+	struct tvnet_priv *tvnet;
+	struct pci_dev *pdev;
+	u8 *bar0;
+	bool registered;
+	bool opened;
+
+	struct tvnet_test_dma dma;
+	struct work_struct dma_work;
+
+	/* EP side, the ring counters are the host's, they point into BAR0 */
+	struct mutex ep_lock;
+	struct work_struct ep_work;
+	u16 free[RING_COUNT];
+	unsigned int free_n;
+	/* H2EP empty buffers in the order they were posted */
+	u16 posted[RING_COUNT];
+	unsigned int posted_head;
+	unsigned int posted_n;
+	/* posted and not yet returned by a full msg */
+	bool owned[RING_COUNT];
+	u8 ep_frame[ETH_FRAME_LEN];
+	u32 rx_seq;
+	bool acked;
+	u32 acked_full;
+
+	u8 frame[ETH_FRAME_LEN];
+	u32 tx_seq;
+	u32 frag_pkts;
+
+	/* serializes calls of the host ctrl vector */
+	spinlock_t irq_lock;
+	/* no work is scheduled once stopped is set */
+	spinlock_t lock;
+	bool stopped;
+	wait_queue_head_t wq;
+	atomic_t ctrl_irqs;
+	atomic_t data_irqs;
+	atomic_t errors;
+};
+
+static struct tvnet_test *test;
+
+#define tvnet_test_fail(t, fmt, arg...)					\
+do {									\
+	atomic_inc(&(t)->errors);					\
+	pr_err_ratelimited(fmt "\n", ##arg);				\
+} while (0)
+
+#define tvnet_test_wait(t, cond)					\
+	wait_event_timeout((t)->wq, (cond) || atomic_read(&(t)->errors), \
+			   msecs_to_jiffies(TEST_TIMEOUT_MS))
+
+static void tvnet_test_unmapped(void)
+{
+	tvnet_test_fail(test, "buffer unmapped that was not mapped");
+}
+
+static void tvnet_test_kick(struct tvnet_test *t, struct work_struct *work)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&t->lock, flags);
+	if (!t->stopped)
+		schedule_work(work);
+	spin_unlock_irqrestore(&t->lock, flags);
+}
+
+/* MSI of the ctrl vector, the DMA done MSI is routed to it as well */
+static void tvnet_test_host_irq(struct tvnet_test *t)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&t->irq_lock, flags);
+	tvnet_irq_ctrl(0, t->ndev);
+	spin_unlock_irqrestore(&t->irq_lock, flags);
+}
+
+/*****************************************************************************/
+
+static u64 tvnet_test_buf_addr(struct tvnet_test *t, int b)
+{
+	struct bar_md *md = (struct bar_md *)t->bar0;
+
+	return TEST_BAR0_PHY + md->ep_rx_pkt_offset + b * TEST_BUF_SIZE;
+}
+
+/* EP buffer holding [addr, addr + len), -1 if there is none */
+static int tvnet_test_buf(struct tvnet_test *t, u64 addr, u32 len)
+{
+	u64 base = tvnet_test_buf_addr(t, 0);
+	u64 off;
+
+	if (addr < base)
+		return -1;
+
+	off = addr - base;
+	if (off >= RING_COUNT * TEST_BUF_SIZE ||
+	    off % TEST_BUF_SIZE + len > TEST_BUF_SIZE)
+		return -1;
+
+	return off / TEST_BUF_SIZE;
+}
+
+static void *tvnet_test_buf_va(struct tvnet_test *t, int b)
+{
+	return t->bar0 + (tvnet_test_buf_addr(t, b) - TEST_BAR0_PHY);
+}
+
+static void tvnet_test_set_llp(struct tvnet_test_dma *dma, u64 llp)
+{
+	dma->llp_low = lower_32_bits(llp);
+	dma->llp_high = upper_32_bits(llp);
+}
+
+static void tvnet_test_dma_work(struct work_struct *work)
+{
+	struct tvnet_test *t = container_of(work, struct tvnet_test,
+					    dma_work);
+	struct tvnet_test_dma *dma = &t->dma;
+	struct tvnet_priv *tvnet = t->tvnet;
+	u64 base = tvnet->dma_desc_iova;
+	struct tvnet_dma_desc *desc;
+	unsigned long flags;
+	bool done = false;
+	unsigned int n;
+	u64 llp, sar, dar;
+	u32 idx, ctrl;
+	int b;
+
+	spin_lock_irqsave(&dma->lock, flags);
+	/* the host may queue more while this runs, yield after a ring */
+	for (n = 0; n <= DMA_DESC_COUNT; n++) {
+		if (!dma->enabled || dma->paused)
+			break;
+
+		llp = ((u64)dma->llp_high << 32) | dma->llp_low;
+		if (llp < base || (llp - base) % sizeof(*desc) ||
+		    (llp - base) / sizeof(*desc) > DMA_DESC_COUNT) {
+			tvnet_test_fail(t, "LLP 0x%llx is outside of the ring",
+					llp);
+			dma->enabled = false;
+			break;
+		}
+
+		idx = (llp - base) / sizeof(*desc);
+		desc = &tvnet->dma_desc[idx];
+		ctrl = desc->ctrl_reg.ctrl_d;
+		if (idx == DMA_DESC_COUNT) {
+			sar = ((u64)desc->sar_high << 32) | desc->sar_low;
+			tvnet_test_set_llp(dma, sar);
+			continue;
+		}
+
+		if (!(ctrl & DMA_CH_CONTROL1_OFF_RDCH_CB))
+			break;
+
+		/* the host writes CB after the rest of the desc */
+		rmb();
+		sar = ((u64)desc->sar_high << 32) | desc->sar_low;
+		dar = ((u64)desc->dar_high << 32) | desc->dar_low;
+		b = tvnet_test_buf(t, dar, desc->size);
+		if (!desc->size || b < 0 || !READ_ONCE(t->owned[b]))
+			tvnet_test_fail(t, "desc %u writes %u bytes to 0x%llx outside a held buffer",
+					idx, desc->size, dar);
+		else
+			memcpy(t->bar0 + (dar - TEST_BAR0_PHY),
+			       (void *)(uintptr_t)sar, desc->size);
+
+		tvnet_test_set_llp(dma, llp + sizeof(*desc));
+		if (ctrl & DMA_CH_CONTROL1_OFF_RDCH_LIE) {
+			dma->int_status |= BIT(DMA_RD_DATA_CH);
+			done = true;
+		}
+	}
+	spin_unlock_irqrestore(&dma->lock, flags);
+
+	if (n > DMA_DESC_COUNT)
+		tvnet_test_kick(t, &t->dma_work);
+	if (done)
+		tvnet_test_host_irq(t);
+}
+
+static void tvnet_test_dma_wr(void __iomem *p, u32 val, u32 offset)
+{
+	struct tvnet_test_dma *dma = (__force struct tvnet_test_dma *)p;
+	struct tvnet_test *t = container_of(dma, struct tvnet_test, dma);
+	unsigned long flags;
+	bool run = false;
+
+	spin_lock_irqsave(&dma->lock, flags);
+	switch (offset) {
+	case DMA_READ_ENGINE_EN_OFF:
+		dma->enabled = val & DMA_READ_ENGINE_EN_OFF_ENABLE;
+		break;
+	case DMA_READ_DOORBELL_OFF:
+		if (val != DMA_RD_DATA_CH)
+			tvnet_test_fail(t, "doorbell for channel %u", val);
+		dma->doorbells++;
+		run = true;
+		break;
+	case DMA_READ_INT_CLEAR_OFF:
+		dma->int_status &= ~val;
+		break;
+	default:
+		/* MSI settings are not modelled */
+		break;
+	}
+	spin_unlock_irqrestore(&dma->lock, flags);
+
+	if (run)
+		tvnet_test_kick(t, &t->dma_work);
+}
+
+static u32 tvnet_test_dma_rd(void __iomem *p, u32 offset)
+{
+	struct tvnet_test_dma *dma = (__force struct tvnet_test_dma *)p;
+	unsigned long flags;
+	u32 val = 0;
+
+	spin_lock_irqsave(&dma->lock, flags);
+	if (offset == DMA_READ_INT_STATUS_OFF)
+		val = dma->int_status;
+	spin_unlock_irqrestore(&dma->lock, flags);
+
+	return val;
+}
+
+static void tvnet_test_dma_ch_wr(void __iomem *p, u8 channel, u32 val,
+				 u32 offset)
+{
+	struct tvnet_test_dma *dma = (__force struct tvnet_test_dma *)p;
+	struct tvnet_test *t = container_of(dma, struct tvnet_test, dma);
+	unsigned long flags;
+
+	if (channel != DMA_RD_DATA_CH) {
+		tvnet_test_fail(t, "write to channel %u", channel);
+		return;
+	}
+
+	spin_lock_irqsave(&dma->lock, flags);
+	if (offset == DMA_LLP_LOW_OFF_RDCH)
+		dma->llp_low = val;
+	else if (offset == DMA_LLP_HIGH_OFF_RDCH)
+		dma->llp_high = val;
+	spin_unlock_irqrestore(&dma->lock, flags);
+}
+
+static u32 tvnet_test_dma_ch_rd(void __iomem *p, u8 channel, u32 offset)
+{
+	struct tvnet_test_dma *dma = (__force struct tvnet_test_dma *)p;
+	unsigned long flags;
+	u32 val = 0;
+
+	spin_lock_irqsave(&dma->lock, flags);
+	if (offset == DMA_LLP_LOW_OFF_RDCH)
+		val = dma->llp_low;
+	else if (offset == DMA_LLP_HIGH_OFF_RDCH)
+		val = dma->llp_high;
+	spin_unlock_irqrestore(&dma->lock, flags);
+
+	return val;
+}
+
+/*****************************************************************************/
+
+static unsigned int tvnet_test_len(u32 seq)
+{
+	return ETH_ZLEN + (seq * 97) % (ETH_FRAME_LEN - ETH_ZLEN + 1);
+}
+
+static void tvnet_test_frame(struct tvnet_test *t, u8 *buf, u32 seq)
+{
+	struct ethhdr *eth = (struct ethhdr *)buf;
+	unsigned int len = tvnet_test_len(seq);
+	unsigned int i;
+
+	eth_broadcast_addr(eth->h_dest);
+	ether_addr_copy(eth->h_source, t->ndev->dev_addr);
+	eth->h_proto = htons(TEST_ETH_P);
+	put_unaligned_le32(seq, buf + ETH_HLEN);
+	for (i = ETH_HLEN + sizeof(seq); i < len; i++)
+		buf[i] = (u8)(seq * 7 + i);
+}
+
+static bool tvnet_test_ep_send(struct tvnet_test *t, u32 msg_id)
+{
+	struct tvnet_priv *tvnet = t->tvnet;
+	struct ctrl_msg *msg;
+	u32 idx;
+
+	if (tvnet_ivc_full(&tvnet->ep2h_ctrl)) {
+		tvnet_test_fail(t, "EP2H ctrl ring is full");
+		return false;
+	}
+
+	idx = tvnet_ivc_get_wr_cnt(&tvnet->ep2h_ctrl) % RING_COUNT;
+	msg = &tvnet->ep_mem.ep2h_ctrl_msgs[idx];
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_id = msg_id;
+	mb();
+	tvnet_ivc_advance_wr(&tvnet->ep2h_ctrl);
+
+	return true;
+}
+
+static bool tvnet_test_ep_ctrl(struct tvnet_test *t)
+{
+	struct tvnet_priv *tvnet = t->tvnet;
+	struct ctrl_msg msg;
+	bool irq = false;
+	u32 idx;
+
+	while (tvnet_ivc_rd_available(&tvnet->h2ep_ctrl)) {
+		/* read the msg only after seeing the counter */
+		rmb();
+		idx = tvnet_ivc_get_rd_cnt(&tvnet->h2ep_ctrl) % RING_COUNT;
+		memcpy(&msg, &tvnet->host_mem.h2ep_ctrl_msgs[idx],
+		       sizeof(msg));
+		tvnet_ivc_advance_rd(&tvnet->h2ep_ctrl);
+
+		switch (msg.msg_id) {
+		case CTRL_MSG_LINK_UP:
+			/* the EP netdev is up already */
+			irq |= tvnet_test_ep_send(t, CTRL_MSG_LINK_UP);
+			break;
+		case CTRL_MSG_LINK_DOWN:
+			irq |= tvnet_test_ep_send(t, CTRL_MSG_LINK_DOWN_ACK);
+			break;
+		case CTRL_MSG_LINK_DOWN_ACK:
+			/* packets DMA'd before the ack are pushed by now */
+			t->acked_full = tvnet_ivc_get_wr_cnt(&tvnet->h2ep_full);
+			WRITE_ONCE(t->acked, true);
+			break;
+		default:
+			tvnet_test_fail(t, "unknown ctrl msg %u", msg.msg_id);
+		}
+	}
+
+	return irq;
+}
+
+static void tvnet_test_ep_check(struct tvnet_test *t, int b, u32 len)
+{
+	u32 seq = t->rx_seq;
+
+	if (len != tvnet_test_len(seq)) {
+		tvnet_test_fail(t, "packet %u has %u bytes, want %u",
+				seq, len, tvnet_test_len(seq));
+	} else {
+		tvnet_test_frame(t, t->ep_frame, seq);
+		if (memcmp(tvnet_test_buf_va(t, b), t->ep_frame, len))
+			tvnet_test_fail(t, "packet %u is corrupt", seq);
+	}
+
+	WRITE_ONCE(t->rx_seq, seq + 1);
+}
+
+static void tvnet_test_ep_rx(struct tvnet_test *t)
+{
+	struct tvnet_priv *tvnet = t->tvnet;
+	struct data_msg *msg;
+	u64 addr;
+	u32 idx, len;
+	int b;
+
+	while (tvnet_ivc_rd_available(&tvnet->h2ep_full)) {
+		rmb();
+		idx = tvnet_ivc_get_rd_cnt(&tvnet->h2ep_full) % RING_COUNT;
+		msg = &tvnet->host_mem.h2ep_full_msgs[idx];
+		addr = msg->u.full_buffer.pcie_address;
+		len = msg->u.full_buffer.packet_size;
+		b = tvnet_test_buf(t, addr, len);
+
+		/* the host takes empty buffers in order */
+		if (msg->msg_id != DATA_MSG_FULL_BUF || b < 0 ||
+		    addr != tvnet_test_buf_addr(t, b) || !t->posted_n ||
+		    t->posted[t->posted_head] != b) {
+			tvnet_test_fail(t, "full msg for 0x%llx is not the next posted buffer",
+					addr);
+			tvnet_ivc_advance_rd(&tvnet->h2ep_full);
+			continue;
+		}
+
+		t->posted_head = (t->posted_head + 1) % RING_COUNT;
+		t->posted_n--;
+		tvnet_test_ep_check(t, b, len);
+		WRITE_ONCE(t->owned[b], false);
+		t->free[t->free_n++] = b;
+		tvnet_ivc_advance_rd(&tvnet->h2ep_full);
+	}
+}
+
+static bool tvnet_test_ep_post(struct tvnet_test *t)
+{
+	struct tvnet_priv *tvnet = t->tvnet;
+	struct data_msg *msg;
+	bool posted = false;
+	u32 idx;
+	int b;
+
+	while (t->free_n && !tvnet_ivc_full(&tvnet->h2ep_empty)) {
+		b = t->free[--t->free_n];
+		idx = tvnet_ivc_get_wr_cnt(&tvnet->h2ep_empty) % RING_COUNT;
+		msg = &tvnet->ep_mem.h2ep_empty_msgs[idx];
+		msg->msg_id = DATA_MSG_EMPTY_BUF;
+		msg->u.empty_buffer.buffer_len = TEST_BUF_SIZE;
+		msg->u.empty_buffer.pcie_address = tvnet_test_buf_addr(t, b);
+		t->posted[(t->posted_head + t->posted_n++) % RING_COUNT] = b;
+		WRITE_ONCE(t->owned[b], true);
+		mb();
+		tvnet_ivc_advance_wr(&tvnet->h2ep_empty);
+		posted = true;
+	}
+
+	return posted;
+}
+
+static void tvnet_test_ep_work(struct work_struct *work)
+{
+	struct tvnet_test *t = container_of(work, struct tvnet_test,
+					    ep_work);
+	bool irq;
+
+	mutex_lock(&t->ep_lock);
+	irq = tvnet_test_ep_ctrl(t);
+	tvnet_test_ep_rx(t);
+	irq |= tvnet_test_ep_post(t);
+	mutex_unlock(&t->ep_lock);
+
+	if (irq)
+		tvnet_test_host_irq(t);
+
+	wake_up(&t->wq);
+}
+
+static void tvnet_test_ep_irq(u32 val, void __iomem *addr)
+{
+	struct tvnet_test *t = test;
+	struct bar_md *md = (struct bar_md *)t->bar0;
+	u8 *a = (__force u8 *)addr;
+
+	if (a == t->bar0 + md->irq_ctrl.irq_addr) {
+		atomic_inc(&t->ctrl_irqs);
+	} else if (a == t->bar0 + md->irq_data.irq_addr) {
+		atomic_inc(&t->data_irqs);
+	} else {
+		tvnet_test_fail(t, "write to BAR0 offset 0x%tx", a - t->bar0);
+		return;
+	}
+
+	tvnet_test_kick(t, &t->ep_work);
+}
+
+/*****************************************************************************/
+
+/* the same layout as the EP function driver */
+static int tvnet_test_setup_bar0(struct tvnet_test *t)
+{
+	struct bar_md *md = (struct bar_md *)t->bar0;
+	struct tvnet_dma_desc *desc;
+	u32 off = ALIGN(sizeof(*md), 64);
+	u64 iova;
+
+	md->irq_ctrl.irq_type = IRQ_SIMPLE;
+	md->irq_ctrl.irq_addr = off;
+	md->irq_data.irq_type = IRQ_SIMPLE;
+	md->irq_data.irq_addr = off + sizeof(u32);
+	off += 64;
+
+	/* EP owned memory */
+	md->ep_own_cnt_offset = off;
+	off += sizeof(struct ep_own_cnt);
+	md->ctrl_md.ep2h_offset = off;
+	md->ctrl_md.ep2h_size = RING_COUNT;
+	off += RING_COUNT * sizeof(struct ctrl_msg);
+	md->ep2h_md.ep2h_offset = off;
+	md->ep2h_md.ep2h_size = RING_COUNT;
+	off += RING_COUNT * sizeof(struct data_msg);
+	md->h2ep_md.ep2h_offset = off;
+	md->h2ep_md.ep2h_size = RING_COUNT;
+	off += RING_COUNT * sizeof(struct data_msg);
+
+	/* Host owned memory */
+	md->host_own_cnt_offset = off;
+	off += sizeof(struct host_own_cnt);
+	md->ctrl_md.h2ep_offset = off;
+	md->ctrl_md.h2ep_size = RING_COUNT;
+	off += RING_COUNT * sizeof(struct ctrl_msg);
+	md->ep2h_md.h2ep_offset = off;
+	md->ep2h_md.h2ep_size = RING_COUNT;
+	off += RING_COUNT * sizeof(struct data_msg);
+	md->h2ep_md.h2ep_offset = off;
+	md->h2ep_md.h2ep_size = RING_COUNT;
+	off += RING_COUNT * sizeof(struct data_msg);
+
+	md->host_dma_offset = ALIGN(off, 64);
+	md->host_dma_size = (DMA_DESC_COUNT + 1) * sizeof(*desc);
+	md->bar0_base_phy = TEST_BAR0_PHY;
+	md->ep_rx_pkt_offset = PAGE_ALIGN(md->host_dma_offset +
+					  md->host_dma_size);
+	md->ep_rx_pkt_size = RING_COUNT * TEST_BUF_SIZE;
+	if (md->ep_rx_pkt_offset + md->ep_rx_pkt_size > TEST_BAR0_SIZE)
+		return -EINVAL;
+
+	/* Set link list pointer to create a dma desc ring */
+	desc = (struct tvnet_dma_desc *)(t->bar0 + md->host_dma_offset);
+	iova = TEST_BAR0_PHY + md->host_dma_offset;
+	desc[DMA_DESC_COUNT].sar_low = lower_32_bits(iova);
+	desc[DMA_DESC_COUNT].sar_high = upper_32_bits(iova);
+	desc[DMA_DESC_COUNT].ctrl_reg.ctrl_e.llp = 1;
+
+	return 0;
+}
+
+/* userspace must not open the test device, the test drives it */
+static int tvnet_test_open(struct net_device *ndev)
+{
+	return -EBUSY;
+}
+
+static const struct net_device_ops tvnet_test_netdev_ops = {
+	.ndo_open = tvnet_test_open,
+	.ndo_start_xmit	= tvnet_host_start_xmit,
+};
+
+static int tvnet_test_setup(struct tvnet_test *t)
+{
+	struct tvnet_priv *tvnet;
+	struct net_device *ndev;
+	int i, ret;
+
+	t->bar0 = vzalloc(TEST_BAR0_SIZE);
+	t->pdev = kzalloc(sizeof(*t->pdev), GFP_KERNEL);
+	if (!t->bar0 || !t->pdev)
+		return -ENOMEM;
+
+	ret = tvnet_test_setup_bar0(t);
+	if (ret)
+		return ret;
+
+	/* as tvnet_host_probe() without the PCI and irq parts */
+	ndev = alloc_etherdev(sizeof(struct tvnet_priv));
+	if (!ndev)
+		return -ENOMEM;
+
+	t->ndev = ndev;
+	eth_hw_addr_random(ndev);
+	ndev->netdev_ops = &tvnet_test_netdev_ops;
+	tvnet = netdev_priv(ndev);
+	t->tvnet = tvnet;
+	tvnet->ndev = ndev;
+	tvnet->pdev = t->pdev;
+	tvnet->mmio_base = (__force void __iomem *)t->bar0;
+	tvnet->dma_base = (__force void __iomem *)&t->dma;
+	tvnet_host_setup_bar0_md(tvnet);
+
+	netif_napi_add(ndev, &tvnet->napi, tvnet_host_poll, TVNET_NAPI_WEIGHT);
+
+	ndev->mtu = ETH_DATA_LEN;
+	ndev->hw_features = NETIF_F_SG | NETIF_F_HW_CSUM;
+	ndev->features |= ndev->hw_features;
+
+	spin_lock_init(&tvnet->tx_lock);
+	INIT_WORK(&tvnet->tx_reset_work, tvnet_host_tx_reset_work);
+	INIT_WORK(&tvnet->link_down_work, tvnet_host_link_down_work);
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 15, 0))
+	timer_setup(&tvnet->tx_timer, tvnet_host_tx_timer, 0);
+#else
+	setup_timer(&tvnet->tx_timer, tvnet_host_tx_timer,
+		    (unsigned long)tvnet);
+#endif
+
+	tvnet->rx_link_state = DIR_LINK_STATE_DOWN;
+	tvnet->tx_link_state = DIR_LINK_STATE_DOWN;
+	tvnet->os_link_state = OS_LINK_STATE_DOWN;
+	mutex_init(&tvnet->link_state_lock);
+	init_waitqueue_head(&tvnet->link_state_wq);
+	INIT_LIST_HEAD(&tvnet->ep2h_empty_list);
+	spin_lock_init(&tvnet->ep2h_empty_lock);
+
+	/* as the EP: read engine on, LLP at desc 0 and all buffers posted */
+	t->dma.enabled = true;
+	tvnet_test_set_llp(&t->dma, tvnet->dma_desc_iova);
+	for (i = RING_COUNT - 1; i >= 0; i--)
+		t->free[t->free_n++] = i;
+	mutex_lock(&t->ep_lock);
+	tvnet_test_ep_post(t);
+	mutex_unlock(&t->ep_lock);
+
+	ret = register_netdev(ndev);
+	if (ret) {
+		pr_err("register_netdev() failed: %d\n", ret);
+		return ret;
+	}
+	t->registered = true;
+	netif_carrier_off(ndev);
+
+	return 0;
+}
+
+static void tvnet_test_teardown(struct tvnet_test *t)
+{
+	struct tvnet_priv *tvnet = t->tvnet;
+	unsigned long flags;
+
+	spin_lock_irqsave(&t->lock, flags);
+	t->stopped = true;
+	spin_unlock_irqrestore(&t->lock, flags);
+	cancel_work_sync(&t->ep_work);
+	cancel_work_sync(&t->dma_work);
+
+	if (t->ndev) {
+		if (t->opened)
+			napi_disable(&tvnet->napi);
+		/* drop what a failed run left behind */
+		if (tvnet_host_tx_pending(tvnet))
+			tvnet_host_flush_tx(tvnet);
+		tvnet_host_free_empty_buffers(tvnet);
+
+		/* as tvnet_host_remove() */
+		if (t->registered)
+			unregister_netdev(t->ndev);
+		cancel_work_sync(&tvnet->link_down_work);
+		del_timer_sync(&tvnet->tx_timer);
+		cancel_work_sync(&tvnet->tx_reset_work);
+		netif_napi_del(&tvnet->napi);
+		free_netdev(t->ndev);
+	}
+
+	kfree(t->pdev);
+	vfree(t->bar0);
+}
+
+/*****************************************************************************/
+
+static struct sk_buff *tvnet_test_skb(struct tvnet_test *t, u32 seq)
+{
+	unsigned int len = tvnet_test_len(seq);
+	unsigned int nr_frags = seq % (TEST_MAX_FRAGS + 1);
+	unsigned int head, pos, size, off, i;
+	struct sk_buff *skb;
+	struct page *page;
+
+	tvnet_test_frame(t, t->frame, seq);
+	head = nr_frags ? ETH_HLEN + seq % 32 : len;
+	skb = alloc_skb(head, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	memcpy(skb_put(skb, head), t->frame, head);
+	for (i = 0, pos = head; i < nr_frags; i++, pos += size) {
+		size = i < nr_frags - 1 ? (len - head) / nr_frags : len - pos;
+		/* frags do not start on a dword boundary either */
+		off = (seq + i) % 256;
+		page = alloc_page(GFP_KERNEL);
+		if (!page) {
+			kfree_skb(skb);
+			return NULL;
+		}
+
+		memcpy(page_address(page) + off, t->frame + pos, size);
+		skb_fill_page_desc(skb, i, page, off, size);
+		skb->len += size;
+		skb->data_len += size;
+		skb->truesize += PAGE_SIZE;
+	}
+
+	if (nr_frags)
+		t->frag_pkts++;
+	skb->dev = t->ndev;
+	skb->protocol = htons(TEST_ETH_P);
+
+	return skb;
+}
+
+/* hand skb to the driver as the stack does, requeue it while busy */
+static int tvnet_test_xmit(struct tvnet_test *t, struct sk_buff *skb,
+			   bool more)
+{
+	struct net_device *ndev = t->ndev;
+	struct netdev_queue *txq = netdev_get_tx_queue(ndev, 0);
+	unsigned long timeout = jiffies + msecs_to_jiffies(TEST_TIMEOUT_MS);
+	netdev_tx_t ret;
+
+	while (true) {
+		while (netif_xmit_stopped(txq)) {
+			if (atomic_read(&t->errors) ||
+			    time_after(jiffies, timeout)) {
+				pr_err("tx queue is not woken up\n");
+				kfree_skb(skb);
+				return -ETIMEDOUT;
+			}
+			usleep_range(10, 20);
+		}
+
+		local_bh_disable();
+		__netif_tx_lock(txq, smp_processor_id());
+		ret = netdev_start_xmit(skb, ndev, txq, more);
+		__netif_tx_unlock(txq);
+		local_bh_enable();
+
+		if (ret == NETDEV_TX_OK)
+			return 0;
+		if (ret != NETDEV_TX_BUSY) {
+			pr_err("xmit returned %d\n", ret);
+			return -EIO;
+		}
+	}
+}
+
+static int tvnet_test_send(struct tvnet_test *t, unsigned int n)
+{
+	struct sk_buff *skb;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < n; i++) {
+		skb = tvnet_test_skb(t, t->tx_seq);
+		if (!skb)
+			return -ENOMEM;
+
+		ret = tvnet_test_xmit(t, skb, i < n - 1);
+		if (ret)
+			return ret;
+		t->tx_seq++;
+	}
+
+	return 0;
+}
+
+static int tvnet_test_wait_rx(struct tvnet_test *t)
+{
+	if (!tvnet_test_wait(t, READ_ONCE(t->rx_seq) == t->tx_seq)) {
+		pr_err("%u packets did not reach the EP\n",
+		       t->tx_seq - READ_ONCE(t->rx_seq));
+		return -ETIMEDOUT;
+	}
+
+	return atomic_read(&t->errors) ? -EIO : 0;
+}
+
+static u32 tvnet_test_doorbells(struct tvnet_test *t)
+{
+	unsigned long flags;
+	u32 val;
+
+	spin_lock_irqsave(&t->dma.lock, flags);
+	val = t->dma.doorbells;
+	spin_unlock_irqrestore(&t->dma.lock, flags);
+
+	return val;
+}
+
+static int tvnet_test_pass(struct tvnet_test *t, unsigned int n)
+{
+	u32 doorbells = tvnet_test_doorbells(t);
+	u32 stops = atomic_read(&tvnet_test_stops);
+	u32 data_irqs = atomic_read(&t->data_irqs);
+	u32 ctrl_irqs = atomic_read(&t->ctrl_irqs);
+	u32 frag_pkts = t->frag_pkts;
+	u32 sent, batches = 0;
+	ktime_t start;
+	u64 ns;
+	int ret;
+
+	start = ktime_get();
+	for (sent = 0; sent < packets; sent += n, batches++) {
+		ret = tvnet_test_send(t, min(n, packets - sent));
+		if (ret)
+			return ret;
+	}
+	ret = tvnet_test_wait_rx(t);
+	if (ret)
+		return ret;
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	doorbells = tvnet_test_doorbells(t) - doorbells;
+	stops = atomic_read(&tvnet_test_stops) - stops;
+	data_irqs = atomic_read(&t->data_irqs) - data_irqs;
+	ctrl_irqs = atomic_read(&t->ctrl_irqs) - ctrl_irqs;
+
+	pr_info("batch %u: %u packets, %u with frags, %u doorbells, %u queue stops, %u EP data irqs, %u EP ctrl irqs, %llu ns/packet\n",
+		n, packets, t->frag_pkts - frag_pkts, doorbells, stops,
+		data_irqs, ctrl_irqs, div_u64(ns, packets));
+
+	if (doorbells > batches + stops) {
+		pr_err("batch %u: %u doorbells for %u batches and %u queue stops\n",
+		       n, doorbells, batches, stops);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int tvnet_test_link_up(struct tvnet_test *t)
+{
+	struct tvnet_priv *tvnet = t->tvnet;
+
+	tvnet_host_open(t->ndev);
+	t->opened = true;
+
+	if (!tvnet_test_wait(t, tvnet->os_link_state == OS_LINK_STATE_UP)) {
+		pr_err("link did not come up\n");
+		return -ETIMEDOUT;
+	}
+
+	return atomic_read(&t->errors) ? -EIO : 0;
+}
+
+/* EP goes down with DMA in flight, the ack must wait for it */
+static int tvnet_test_drain(struct tvnet_test *t)
+{
+	struct tvnet_priv *tvnet = t->tvnet;
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&t->dma.lock, flags);
+	t->dma.paused = true;
+	spin_unlock_irqrestore(&t->dma.lock, flags);
+
+	ret = tvnet_test_send(t, TEST_DRAIN_PKTS);
+	if (ret)
+		return ret;
+
+	mutex_lock(&t->ep_lock);
+	tvnet_test_ep_send(t, CTRL_MSG_LINK_DOWN);
+	mutex_unlock(&t->ep_lock);
+	tvnet_test_host_irq(t);
+
+	msleep(TEST_DRAIN_HOLD_MS);
+	if (READ_ONCE(t->acked)) {
+		pr_err("link down acked with DMA in flight\n");
+		return -EIO;
+	}
+
+	spin_lock_irqsave(&t->dma.lock, flags);
+	t->dma.paused = false;
+	spin_unlock_irqrestore(&t->dma.lock, flags);
+	tvnet_test_kick(t, &t->dma_work);
+
+	if (!tvnet_test_wait(t, READ_ONCE(t->acked))) {
+		pr_err("link down was not acked\n");
+		return -ETIMEDOUT;
+	}
+
+	if (t->acked_full != t->tx_seq) {
+		pr_err("link down acked after %u of %u packets\n",
+		       t->acked_full, t->tx_seq);
+		return -EIO;
+	}
+
+	ret = tvnet_test_wait_rx(t);
+	if (ret)
+		return ret;
+
+	if (tvnet->os_link_state != OS_LINK_STATE_DOWN) {
+		pr_err("link is still up\n");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int tvnet_test_close(struct tvnet_test *t)
+{
+	struct tvnet_priv *tvnet = t->tvnet;
+	int ret;
+
+	ret = tvnet_host_close(t->ndev);
+	t->opened = false;
+	if (ret) {
+		pr_err("close failed: %d\n", ret);
+		return ret;
+	}
+
+	if (atomic_read(&tvnet_test_maps)) {
+		pr_err("%d DMA mappings left after close\n",
+		       atomic_read(&tvnet_test_maps));
+		return -EIO;
+	}
+
+	if (tvnet_host_tx_pending(tvnet) || tvnet->tx_pkts ||
+	    t->ndev->stats.tx_packets != t->tx_seq ||
+	    t->ndev->stats.tx_dropped) {
+		pr_err("%lu of %u packets sent, %lu dropped, %u pending\n",
+		       t->ndev->stats.tx_packets, t->tx_seq,
+		       t->ndev->stats.tx_dropped, tvnet->tx_pkts);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int tvnet_test_run(struct tvnet_test *t)
+{
+	const unsigned int batches[] = { 1, 8, batch };
+	unsigned int i;
+	int ret;
+
+	ret = tvnet_test_link_up(t);
+	for (i = 0; !ret && i < ARRAY_SIZE(batches); i++)
+		ret = tvnet_test_pass(t, batches[i]);
+	if (!ret)
+		ret = tvnet_test_drain(t);
+	if (!ret)
+		ret = tvnet_test_close(t);
+
+	return ret;
+}
+
+static int __init tvnet_test_init(void)
+{
+	struct tvnet_test *t;
+	int ret;
+
+	if (!packets || !batch) {
+		pr_err("packets and batch must be set\n");
+		return -EINVAL;
+	}
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	spin_lock_init(&t->dma.lock);
+	INIT_WORK(&t->dma_work, tvnet_test_dma_work);
+	mutex_init(&t->ep_lock);
+	INIT_WORK(&t->ep_work, tvnet_test_ep_work);
+	spin_lock_init(&t->irq_lock);
+	spin_lock_init(&t->lock);
+	init_waitqueue_head(&t->wq);
+	atomic_set(&t->ctrl_irqs, 0);
+	atomic_set(&t->data_irqs, 0);
+	atomic_set(&t->errors, 0);
+	test = t;
+
+	ret = tvnet_test_setup(t);
+	if (!ret)
+		ret = tvnet_test_run(t);
+	tvnet_test_teardown(t);
+
+	if (!ret && atomic_read(&t->errors))
+		ret = -EIO;
+	if (ret)
+		pr_err("failed: %d, %d errors\n", ret,
+		       atomic_read(&t->errors));
+	else
+		pr_info("passed\n");
+
+	test = NULL;
+	kfree(t);
+	return ret;
+}
+
+static void __exit tvnet_test_exit(void)
+{
+}
+
+module_init(tvnet_test_init);
+module_exit(tvnet_test_exit);
+
+MODULE_DESCRIPTION("Tegra PCIe virtual network transmit test");
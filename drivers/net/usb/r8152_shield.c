@@ -437,7 +437,7 @@ enum rtl_register_content {
 };
 
 #define RTL8152_MAX_TX		4
-#define RTL8152_MAX_RX		10
+#define RTL8152_MAX_RX		32
 #define INTBUFSIZE		2
 #define CRC_SIZE		4
 #define TX_ALIGN		4
@@ -463,7 +463,9 @@ enum rtl_register_content {
 #define RTL8153_RMS		RTL8153_MAX_PACKET
 #define RTL8152_TX_TIMEOUT	(5 * HZ)
 #define AGG_BUF_SZ		16384 /* 16K */
-#define RX_THRESHOLD_CLONED	(AGG_BUF_SZ / 1)
+#define AGG_BUF_ORDER		get_order(AGG_BUF_SZ)
+#define RX_COPYBREAK_DEFAULT	256
+#define RX_FRAG_HEAD_SZ		128
 
 /* rtl8152 flags */
 enum rtl8152_flags {
@@ -552,7 +554,8 @@ struct rx_agg {
 	struct list_head list;
 	struct urb *urb;
 	struct r8152 *context;
-	struct sk_buff *skb;
+	struct page *page;
+	void *buffer;
 };
 
 struct tx_agg {
@@ -574,7 +577,7 @@ struct r8152 {
 	struct urb *intr_urb;
 	struct tx_agg tx_info[RTL8152_MAX_TX];
 	struct rx_agg rx_info[RTL8152_MAX_RX];
-	struct list_head rx_done, tx_free;
+	struct list_head rx_done, rx_idle, rx_used, tx_free;
 	struct sk_buff_head tx_queue;
 	spinlock_t rx_lock, tx_lock;
 	struct delayed_work schedule;
@@ -596,6 +599,9 @@ struct r8152 {
 	u32 saved_wolopts;
 	u32 msg_enable;
 	u32 tx_qlen;
+	u32 rx_active;	/* aggregates owned by usb or rx_done */
+	u32 rx_target;	/* wanted number of rx_active */
+	u32 rx_base;	/* rx_target floor for the current link speed */
 	u16 ocp_base;
 	u8 *intr_buff;
 	u8 version;
@@ -624,6 +630,13 @@ enum tx_csum_stat {
  */
 static const int multicast_filter_limit = 32;
 
+/* Frames longer than this are passed up as page fragments of the rx
+ * aggregate instead of being copied into a freshly allocated skb.
+ */
+static unsigned int rx_copybreak = RX_COPYBREAK_DEFAULT;
+module_param(rx_copybreak, uint, 0644);
+MODULE_PARM_DESC(rx_copybreak, "Maximum rx frame size copied out of the aggregate");
+
 #define RTL_LIMITED_TSO_SIZE	(AGG_BUF_SZ - sizeof(struct tx_desc) - \
 				 VLAN_ETH_HLEN - VLAN_HLEN)
 
@@ -1320,8 +1333,11 @@ static void free_all_mem(struct r8152 *tp)
 		usb_free_urb(tp->rx_info[i].urb);
 		tp->rx_info[i].urb = NULL;
 
-		kfree_skb(tp->rx_info[i].skb);
-		tp->rx_info[i].skb = NULL;
+		/* the stack may still hold fragments; they keep the page */
+		if (tp->rx_info[i].page)
+			put_page(tp->rx_info[i].page);
+		tp->rx_info[i].page = NULL;
+		tp->rx_info[i].buffer = NULL;
 	}
 
 	for (i = 0; i < RTL8152_MAX_TX; i++) {
@@ -1340,29 +1356,25 @@ static void free_all_mem(struct r8152 *tp)
 	tp->intr_buff = NULL;
 }
 
-static struct sk_buff *rtl_alloc_rx_skb(struct r8152 *tp, gfp_t gfp_mask)
+static int rtl_rx_agg_new_page(struct rx_agg *agg, int node, gfp_t gfp)
 {
-	struct net_device *netdev = tp->netdev;
-	struct sk_buff *skb;
+	struct page *page;
 
-	skb = __netdev_alloc_skb(netdev, AGG_BUF_SZ, gfp_mask);
-	if (!skb)
-		goto out1;
+	page = alloc_pages_node(node, gfp | __GFP_COMP | __GFP_NOWARN,
+				AGG_BUF_ORDER);
+	if (!page)
+		return -ENOMEM;
 
-	if (skb->data != rx_agg_align(skb->data)) {
-		int rl;
+	/* Drop our reference only; any fragments the stack still holds
+	 * keep the old page alive until they are freed.
+	 */
+	if (agg->page)
+		put_page(agg->page);
 
-		kfree_skb(skb);
-		skb = __netdev_alloc_skb(netdev, AGG_BUF_SZ + RX_ALIGN,
-					 gfp_mask);
-		if (!skb)
-			goto out1;
+	agg->page = page;
+	agg->buffer = page_address(page);
 
-		rl = (int)(rx_agg_align(skb->data) - (void *)skb->data);
-		skb_reserve(skb, rl);
-	}
-out1:
-	return skb;
+	return 0;
 }
 
 static int alloc_all_mem(struct r8152 *tp)
@@ -1382,22 +1394,16 @@ static int alloc_all_mem(struct r8152 *tp)
 	skb_queue_head_init(&tp->tx_queue);
 
 	for (i = 0; i < RTL8152_MAX_RX; i++) {
-		struct sk_buff *skb;
-
-		skb = rtl_alloc_rx_skb(tp, GFP_KERNEL);
-		if (!skb)
+		if (rtl_rx_agg_new_page(&tp->rx_info[i], node, GFP_KERNEL))
 			goto err1;
 
 		urb = usb_alloc_urb(0, GFP_KERNEL);
-		if (!urb) {
-			kfree_skb(skb);
+		if (!urb)
 			goto err1;
-		}
 
 		INIT_LIST_HEAD(&tp->rx_info[i].list);
 		tp->rx_info[i].context = tp;
 		tp->rx_info[i].urb = urb;
-		tp->rx_info[i].skb = skb;
 	}
 
 	for (i = 0; i < RTL8152_MAX_TX; i++) {
@@ -1781,13 +1787,99 @@ return_result:
 	return checksum;
 }
 
+static u32 rtl_rx_base_target(u8 speed)
+{
+	if (!(speed & LINK_STATUS))
+		return 2;
+	if (speed & _1000bps)
+		return RTL8152_MAX_RX / 2;
+	if (speed & _100bps)
+		return 4;
+	return 2;
+}
+
+/* Keep rx_target aggregates in flight.  Aggregates whose page has been
+ * released by the stack are reused as is; when none is left, the oldest
+ * one still referenced gets a new page so that the pipe never drains.
+ */
+static int rtl_rx_refill(struct r8152 *tp, gfp_t mem_flags)
+{
+	struct rx_agg *agg, *next;
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&tp->rx_lock, flags);
+
+	list_for_each_entry_safe(agg, next, &tp->rx_used, list) {
+		if (page_count(agg->page) == 1)
+			list_move(&agg->list, &tp->rx_idle);
+	}
+
+	while (tp->rx_active < tp->rx_target) {
+		bool in_use = false;
+
+		if (!list_empty(&tp->rx_idle)) {
+			agg = list_first_entry(&tp->rx_idle, struct rx_agg,
+					       list);
+		} else if (!list_empty(&tp->rx_used)) {
+			agg = list_first_entry(&tp->rx_used, struct rx_agg,
+					       list);
+			in_use = true;
+		} else {
+			break;
+		}
+
+		list_del_init(&agg->list);
+		tp->rx_active++;
+		spin_unlock_irqrestore(&tp->rx_lock, flags);
+
+		if (in_use && rtl_rx_agg_new_page(agg, NUMA_NO_NODE,
+						  mem_flags)) {
+			spin_lock_irqsave(&tp->rx_lock, flags);
+			tp->rx_active--;
+			list_add(&agg->list, &tp->rx_used);
+			ret = -ENOMEM;
+			break;
+		}
+
+		ret = r8152_submit_rx(tp, agg, mem_flags);
+		spin_lock_irqsave(&tp->rx_lock, flags);
+		if (ret)
+			break;
+	}
+
+	spin_unlock_irqrestore(&tp->rx_lock, flags);
+
+	/* Nothing is in flight to call us back; retry from the workqueue. */
+	if (ret == -ENOMEM && !tp->rx_active) {
+		set_bit(SCHEDULE_TASKLET, &tp->flags);
+		schedule_delayed_work(&tp->schedule, 1);
+	}
+
+	return ret;
+}
+
+static void rtl_rx_put_agg(struct r8152 *tp, struct rx_agg *agg)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&tp->rx_lock, flags);
+	tp->rx_active--;
+	if (page_count(agg->page) == 1)
+		list_add(&agg->list, &tp->rx_idle);
+	else
+		list_add_tail(&agg->list, &tp->rx_used);
+	spin_unlock_irqrestore(&tp->rx_lock, flags);
+}
+
 static void rx_bottom(struct r8152 *tp)
 {
 	unsigned long flags;
 	struct list_head *cursor, *next, rx_queue;
+	u32 backlog = 0;
 
 	if (list_empty(&tp->rx_done))
-		return;
+		goto refill;
 
 	INIT_LIST_HEAD(&rx_queue);
 	spin_lock_irqsave(&tp->rx_lock, flags);
@@ -1796,39 +1888,27 @@ static void rx_bottom(struct r8152 *tp)
 
 	list_for_each_safe(cursor, next, &rx_queue) {
 		struct rx_desc *rx_desc;
-		struct sk_buff *rx_skb;
-		bool cloned = false;
 		struct rx_agg *agg;
 		int len_used = 0;
 		struct urb *urb;
 		u8 *rx_data;
 
 		list_del_init(cursor);
+		backlog++;
 
 		agg = list_entry(cursor, struct rx_agg, list);
 		urb = agg->urb;
 		if (urb->actual_length < ETH_ZLEN)
 			goto submit;
 
-		rx_skb = agg->skb;
-		rx_desc = (struct rx_desc *)rx_skb->data;
-		rx_data = rx_skb->data;
+		rx_desc = agg->buffer;
+		rx_data = agg->buffer;
 		len_used += sizeof(struct rx_desc);
 
-		if (urb->actual_length > RX_THRESHOLD_CLONED) {
-			struct sk_buff *new_skb;
-
-			new_skb = rtl_alloc_rx_skb(tp, GFP_ATOMIC);
-			if (new_skb) {
-				agg->skb = new_skb;
-				cloned = true;
-			}
-		}
-
 		while (urb->actual_length > len_used) {
 			struct net_device *netdev = tp->netdev;
 			struct net_device_stats *stats;
-			unsigned int pkt_len;
+			unsigned int pkt_len, hdr_len;
 			struct sk_buff *skb;
 
 			pkt_len = le32_to_cpu(rx_desc->opts1) & RX_LEN_MASK;
@@ -1844,11 +1924,15 @@ static void rx_bottom(struct r8152 *tp)
 			pkt_len -= CRC_SIZE;
 			rx_data += sizeof(struct rx_desc);
 
-			if (cloned)
-				skb = skb_clone(rx_skb, GFP_ATOMIC);
-			else
-				skb = netdev_alloc_skb_ip_align(netdev,
-								pkt_len);
+			/* Copy small frames; for larger ones copy only the
+			 * headers and hang the payload off the aggregate page.
+			 */
+			hdr_len = pkt_len;
+			if (pkt_len > rx_copybreak)
+				hdr_len = min_t(unsigned int, pkt_len,
+						RX_FRAG_HEAD_SZ);
+
+			skb = netdev_alloc_skb_ip_align(netdev, hdr_len);
 			if (!skb) {
 				stats->rx_dropped++;
 				goto find_next_rx;
@@ -1856,12 +1940,18 @@ static void rx_bottom(struct r8152 *tp)
 
 			skb->ip_summed = r8152_rx_csum(tp, rx_desc);
 
-			if (cloned)
-				skb_reserve(skb, (int)(rx_data - rx_skb->data));
-			else
-				memcpy(skb->data, rx_data, pkt_len);
+			memcpy(skb->data, rx_data, hdr_len);
+			skb_put(skb, hdr_len);
+
+			if (pkt_len > hdr_len) {
+				void *frag = rx_data + hdr_len;
 
-			skb_put(skb, pkt_len);
+				get_page(agg->page);
+				skb_add_rx_frag(skb, 0, agg->page,
+						frag - agg->buffer,
+						pkt_len - hdr_len,
+						SKB_DATA_ALIGN(pkt_len - hdr_len));
+			}
 
 			skb->protocol = eth_type_trans(skb, netdev);
 
@@ -1874,17 +1964,25 @@ static void rx_bottom(struct r8152 *tp)
 find_next_rx:
 			rx_data = rx_agg_align(rx_data + pkt_len + CRC_SIZE);
 			rx_desc = (struct rx_desc *)rx_data;
-			len_used = (int)(rx_data - rx_skb->data);
+			len_used = (int)(rx_data - (u8 *)agg->buffer);
 			len_used += sizeof(struct rx_desc);
 		}
 
-		/* free the cloned skb */
-		if (cloned)
-			kfree_skb(rx_skb);
-
 submit:
-		r8152_submit_rx(tp, agg, GFP_ATOMIC);
+		rtl_rx_put_agg(tp, agg);
 	}
+
+	/* Grow the in-flight window while completions keep piling up
+	 * between two runs, and shrink it back towards the link speed
+	 * baseline once they arrive one at a time again.
+	 */
+	if (backlog * 2 >= tp->rx_target && tp->rx_target < RTL8152_MAX_RX)
+		tp->rx_target++;
+	else if (backlog == 1 && tp->rx_target > tp->rx_base)
+		tp->rx_target--;
+
+refill:
+	rtl_rx_refill(tp, GFP_ATOMIC);
 }
 
 static void tx_bottom(struct r8152 *tp)
@@ -1952,11 +2050,10 @@ static void bottom_half(unsigned long data)
 static
 int r8152_submit_rx(struct r8152 *tp, struct rx_agg *agg, gfp_t mem_flags)
 {
-	struct sk_buff *skb = agg->skb;
 	int ret = 0;
 
 	usb_fill_bulk_urb(agg->urb, tp->udev, usb_rcvbulkpipe(tp->udev, 1),
-			  skb->data, AGG_BUF_SZ,
+			  agg->buffer, AGG_BUF_SZ,
 			  (usb_complete_t)read_bulk_callback, agg);
 
 	ret = usb_submit_urb(agg->urb, mem_flags);
@@ -1967,6 +2064,9 @@ int r8152_submit_rx(struct r8152 *tp, struct rx_agg *agg, gfp_t mem_flags)
 	} else if (ret) {
 		unsigned long flags;
 
+		/* rx_bottom must not parse a stale length from the page */
+		agg->urb->actual_length = 0;
+
 		spin_lock_irqsave(&tp->rx_lock, flags);
 		list_add_tail(&agg->list, &tp->rx_done);
 		spin_unlock_irqrestore(&tp->rx_lock, flags);
@@ -2163,22 +2263,29 @@ static void rxdy_gated_en(struct r8152 *tp, bool enable)
 
 static int rtl_start_rx(struct r8152 *tp)
 {
-	int i, ret = 0;
+	int i, ret;
 
 	INIT_LIST_HEAD(&tp->rx_done);
-	for (i = 0; i < RTL8152_MAX_RX; i++) {
-		int rr;
+	INIT_LIST_HEAD(&tp->rx_idle);
+	INIT_LIST_HEAD(&tp->rx_used);
+	tp->rx_active = 0;
+	tp->rx_base = rtl_rx_base_target(rtl8152_get_speed(tp));
+	tp->rx_target = tp->rx_base;
 
-		INIT_LIST_HEAD(&tp->rx_info[i].list);
+	for (i = 0; i < RTL8152_MAX_RX; i++) {
+		struct rx_agg *agg = &tp->rx_info[i];
 
-		rr = r8152_submit_rx(tp, &tp->rx_info[i], GFP_KERNEL);
-		if (rr)
-			netif_err(tp, rx_err, tp->netdev,
-				  "Couldn't submit rx[%d], ret = %d\n", i, rr);
-		if (!ret)
-			ret = rr;
+		if (page_count(agg->page) == 1)
+			list_add_tail(&agg->list, &tp->rx_idle);
+		else
+			list_add_tail(&agg->list, &tp->rx_used);
 	}
 
+	ret = rtl_rx_refill(tp, GFP_KERNEL);
+	if (ret)
+		netif_err(tp, rx_err, tp->netdev,
+			  "Couldn't submit rx, ret = %d\n", ret);
+
 	return ret;
 }
 
@@ -0,0 +1,550 @@
+/*
+ *  Copyright (c) 2021, NVIDIA Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ */
+
+/*
+ * Rx aggregate test of the RTL8152/RTL8153 driver, run at module load.
+ *
+ * r8152_shield.c is built into this module with usb_submit_urb() and
+ * netif_receive_skb() redirected to a fake device and a fake stack. The
+ * device fills submitted aggregates with synthetic frames, one rx_desc
+ * each, and completes a random number of them through read_bulk_callback()
+ * before rx_bottom() runs. Every so often the last frame of an aggregate
+ * is cut short, and a submission is refused so that the aggregate comes
+ * back with no data.
+ *
+ * Each frame handed to the stack must be the next one the device sent,
+ * with the right length, VLAN tag and contents. The stack holds the skbs
+ * for a number of frames before freeing them, and checks their contents
+ * again then, so an aggregate page reused while fragments of it are still
+ * in the stack shows up as overwritten data. An aggregate page must also
+ * have no other reference when it is submitted.
+ *
+ * The time spent in rx_bottom() per frame, without the checks, is
+ * reported for the configured rx_copybreak and for copying every frame.
+ */
+
+#include <linux/signal.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/mii.h>
+#include <linux/ethtool.h>
+#include <linux/usb.h>
+#include <linux/crc32.h>
+#include <linux/if_vlan.h>
+#include <linux/uaccess.h>
+#include <linux/list.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/mdio.h>
+#include <linux/of.h>
+#include <net/ip6_checksum.h>
+
+static int fake_netif_receive_skb(struct sk_buff *skb);
+static int fake_usb_submit_urb(struct urb *urb, gfp_t mem_flags);
+
+/* the test must not bind to, or be loaded for, real adapters */
+#undef MODULE_DEVICE_TABLE
+#define MODULE_DEVICE_TABLE(type, name)
+#undef module_usb_driver
+#define module_usb_driver(__usb_driver) \
+	static struct usb_driver *r8152_test_driver __maybe_unused = \
+		&(__usb_driver)
+
+#define netif_receive_skb	fake_netif_receive_skb
+#define usb_submit_urb		fake_usb_submit_urb
+#include "r8152_shield.c"
+#undef usb_submit_urb
+#undef netif_receive_skb
+
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
+#include <asm/unaligned.h>
+
+#define TEST_EXPECT_MAX		8192
+#define TEST_ETH_P		0x88b5	/* local experimental ethertype */
+#define TEST_MAX_HOLD		4096
+
+static unsigned int iterations = 10000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "rx_bottom() runs per pass");
+
+static unsigned int seed = 1;
+module_param(seed, uint, 0444);
+MODULE_PARM_DESC(seed, "seed of the frames and the completion pattern");
+
+static unsigned int hold = 256;
+module_param(hold, uint, 0444);
+MODULE_PARM_DESC(hold, "frames the fake stack holds before freeing one");
+
+static unsigned int truncate_every = 7;
+module_param(truncate_every, uint, 0444);
+MODULE_PARM_DESC(truncate_every, "cut the last frame of every nth aggregate, 0 never");
+
+static unsigned int submit_fail_every = 89;
+module_param(submit_fail_every, uint, 0444);
+MODULE_PARM_DESC(submit_fail_every, "refuse every nth submission, 0 never");
+
+struct test_frame {
+	u32 seq;
+	u16 len;	/* without CRC */
+	u16 vlan;
+};
+
+struct r8152_test {
+	struct r8152 *tp;
+	struct rnd_state rnd;
+
+	/* fake device: submitted aggregates in order */
+	struct rx_agg *fifo[RTL8152_MAX_RX];
+	unsigned int fifo_head;
+	unsigned int fifo_n;
+	struct page *last_page[RTL8152_MAX_RX];
+
+	/* frames sent and not yet received */
+	struct test_frame expect[TEST_EXPECT_MAX];
+	unsigned int expect_head;
+	unsigned int expect_n;
+
+	/* fake stack */
+	struct sk_buff *held[TEST_MAX_HOLD];
+	unsigned int held_next;
+
+	u32 seq;
+	u64 aggs;
+	u64 submits;
+	u64 frames;
+	u64 frag_frames;
+	u64 new_pages;
+	u32 max_target;
+	u64 rx_ns;
+	u64 check_ns;
+	unsigned int errors;
+};
+
+static struct r8152_test *test;
+
+#define test_fail(t, fmt, arg...)					\
+do {									\
+	(t)->errors++;							\
+	pr_err_ratelimited("r8152_test: " fmt "\n", ##arg);		\
+} while (0)
+
+static u8 test_byte(u32 seq, unsigned int i)
+{
+	return (u8)(seq * 7 + i);
+}
+
+/* the bytes after the Ethernet header: seq, then a pattern.*/
+static bool test_payload_ok(struct sk_buff *skb, u32 seq)
+{
+	u8 buf[64];
+	unsigned int off, i, n;
+
+	for (off = 0; off < skb->len; off += n) {
+		n = min_t(unsigned int, sizeof(buf), skb->len - off);
+		if (skb_copy_bits(skb, off, buf, n))
+			return false;
+		for (i = 0; i < n; i++) {
+			if (off + i < 4) {
+				if (buf[i] != (u8)(seq >> (8 * (off + i))))
+					return false;
+			} else if (buf[i] != test_byte(seq, off + i)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void test_free_skb(struct r8152_test *t, struct sk_buff *skb)
+{
+	if (!skb)
+		return;
+
+	if (!test_payload_ok(skb, *(u32 *)skb->cb))
+		test_fail(t, "frame %u overwritten while in the stack",
+			  *(u32 *)skb->cb);
+	kfree_skb(skb);
+}
+
+static int fake_netif_receive_skb(struct sk_buff *skb)
+{
+	struct r8152_test *t = test;
+	ktime_t start = ktime_get();
+	struct test_frame *f;
+
+	if (!t->expect_n) {
+		test_fail(t, "frame received that was never sent");
+		kfree_skb(skb);
+		return NET_RX_DROP;
+	}
+
+	f = &t->expect[t->expect_head];
+	t->expect_head = (t->expect_head + 1) % TEST_EXPECT_MAX;
+	t->expect_n--;
+
+	if (skb->len != f->len - ETH_HLEN ||
+	    skb->protocol != htons(TEST_ETH_P))
+		test_fail(t, "frame %u: len %u proto 0x%x, want len %u",
+			  f->seq, skb->len, ntohs(skb->protocol),
+			  f->len - ETH_HLEN);
+	else if (!test_payload_ok(skb, f->seq))
+		test_fail(t, "frame %u: data mismatch", f->seq);
+
+	if (!!f->vlan != !!skb_vlan_tag_present(skb) ||
+	    (f->vlan && skb_vlan_tag_get(skb) != f->vlan))
+		test_fail(t, "frame %u: vlan tag 0x%x, want 0x%x", f->seq,
+			  skb_vlan_tag_present(skb) ?
+			  skb_vlan_tag_get(skb) : 0, f->vlan);
+
+	if (skb_is_nonlinear(skb))
+		t->frag_frames++;
+	t->frames++;
+
+	*(u32 *)skb->cb = f->seq;
+	test_free_skb(t, t->held[t->held_next]);
+	t->held[t->held_next] = skb;
+	t->held_next = (t->held_next + 1) % hold;
+
+	t->check_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	return NET_RX_SUCCESS;
+}
+
+static int fake_usb_submit_urb(struct urb *urb, gfp_t mem_flags)
+{
+	struct r8152_test *t = test;
+	struct rx_agg *agg = urb->context;
+	unsigned int i, idx = agg - t->tp->rx_info;
+
+	t->submits++;
+	if (submit_fail_every && !(t->submits % submit_fail_every))
+		return -EPIPE;
+
+	if (urb->transfer_buffer != agg->buffer ||
+	    urb->transfer_buffer_length != AGG_BUF_SZ)
+		test_fail(t, "aggregate %u submitted with a wrong buffer", idx);
+
+	if (page_count(agg->page) != 1)
+		test_fail(t, "aggregate %u submitted while its page is in use",
+			  idx);
+
+	for (i = 0; i < t->fifo_n; i++) {
+		if (t->fifo[(t->fifo_head + i) % RTL8152_MAX_RX] == agg) {
+			test_fail(t, "aggregate %u submitted twice", idx);
+			return -EBUSY;
+		}
+	}
+
+	if (agg->page != t->last_page[idx]) {
+		t->last_page[idx] = agg->page;
+		t->new_pages++;
+	}
+
+	t->fifo[(t->fifo_head + t->fifo_n++) % RTL8152_MAX_RX] = agg;
+	return 0;
+}
+
+static unsigned int test_frame_len(struct r8152_test *t)
+{
+	u32 r = prandom_u32_state(&t->rnd);
+
+	/* half small frames, half anything up to a full frame */
+	if (r & 1)
+		return ETH_ZLEN + (r >> 1) % 200;
+
+	return ETH_ZLEN + (r >> 1) % (ETH_FRAME_LEN - ETH_ZLEN + 1);
+}
+
+static void test_put_frame(u8 *data, unsigned int len, u32 seq)
+{
+	struct ethhdr *eth = (struct ethhdr *)data;
+	u8 *payload = data + ETH_HLEN;
+	unsigned int i;
+
+	eth_broadcast_addr(eth->h_dest);
+	eth_zero_addr(eth->h_source);
+	eth->h_proto = htons(TEST_ETH_P);
+
+	put_unaligned_le32(seq, payload);
+	for (i = 4; i < len - ETH_HLEN; i++)
+		payload[i] = test_byte(seq, i);
+
+	/* the CRC is not checked by the driver */
+	memset(data + len, 0xcc, CRC_SIZE);
+}
+
+/* Fill one aggregate the way the adapter does and complete it.*/
+static void test_complete(struct r8152_test *t, struct rx_agg *agg)
+{
+	unsigned int nr = 1 + prandom_u32_state(&t->rnd) % 64;
+	unsigned int off = 0, end = 0, last_off = 0, actual = 0;
+	u8 *buf = agg->buffer;
+	struct test_frame *f;
+	struct rx_desc *desc;
+	unsigned int len;
+	u16 vlan;
+
+	while (nr--) {
+		len = test_frame_len(t);
+		end = off + sizeof(*desc) + len + CRC_SIZE;
+		if (end > AGG_BUF_SZ)
+			break;
+
+		vlan = 0;
+		if (!(prandom_u32_state(&t->rnd) % 4))
+			vlan = 1 + prandom_u32_state(&t->rnd) % (VLAN_N_VID - 2);
+
+		desc = (struct rx_desc *)(buf + off);
+		memset(desc, 0, sizeof(*desc));
+		desc->opts1 = cpu_to_le32(len + CRC_SIZE);
+		if (vlan)
+			desc->opts2 = cpu_to_le32(RX_VLAN_TAG | swab16(vlan));
+		test_put_frame(buf + off + sizeof(*desc), len, t->seq);
+
+		f = &t->expect[(t->expect_head + t->expect_n++) %
+			       TEST_EXPECT_MAX];
+		f->seq = t->seq++;
+		f->len = len;
+		f->vlan = vlan;
+
+		last_off = off;
+		actual = end;
+		off = ALIGN(end, RX_ALIGN);
+	}
+
+	/* cut the last frame anywhere from its descriptor on */
+	t->aggs++;
+	if (truncate_every && actual && !(t->aggs % truncate_every)) {
+		actual = last_off +
+			 prandom_u32_state(&t->rnd) % (actual - last_off);
+		t->expect_n--;
+	}
+
+	agg->urb->actual_length = actual;
+	agg->urb->status = 0;
+	read_bulk_callback(agg->urb);
+}
+
+static unsigned int test_rx_done_len(struct r8152 *tp)
+{
+	struct list_head *pos;
+	unsigned long flags;
+	unsigned int n = 0;
+
+	spin_lock_irqsave(&tp->rx_lock, flags);
+	list_for_each(pos, &tp->rx_done)
+		n++;
+	spin_unlock_irqrestore(&tp->rx_lock, flags);
+
+	return n;
+}
+
+static int test_round(struct r8152_test *t)
+{
+	struct r8152 *tp = t->tp;
+	struct rx_agg *agg;
+	unsigned int k = 0;
+	u64 check_ns;
+	ktime_t start;
+
+	if (t->fifo_n)
+		k = 1 + prandom_u32_state(&t->rnd) % t->fifo_n;
+	else if (list_empty(&tp->rx_done))
+		test_fail(t, "nothing in flight and nothing to retry");
+
+	local_bh_disable();
+	while (k--) {
+		agg = t->fifo[t->fifo_head];
+		t->fifo_head = (t->fifo_head + 1) % RTL8152_MAX_RX;
+		t->fifo_n--;
+		test_complete(t, agg);
+	}
+
+	check_ns = t->check_ns;
+	start = ktime_get();
+	rx_bottom(tp);
+	t->rx_ns += ktime_to_ns(ktime_sub(ktime_get(), start)) -
+		    (t->check_ns - check_ns);
+	local_bh_enable();
+
+	if (t->expect_n) {
+		test_fail(t, "%u frames not received", t->expect_n);
+		t->expect_head = (t->expect_head + t->expect_n) %
+				 TEST_EXPECT_MAX;
+		t->expect_n = 0;
+	}
+
+	if (tp->netdev->stats.rx_dropped)
+		test_fail(t, "%lu frames dropped", tp->netdev->stats.rx_dropped);
+
+	if (tp->rx_active != t->fifo_n + test_rx_done_len(tp))
+		test_fail(t, "rx_active %u, %u in flight", tp->rx_active,
+			  t->fifo_n);
+
+	if (tp->rx_target < tp->rx_base || tp->rx_target > RTL8152_MAX_RX)
+		test_fail(t, "rx_target %u out of %u..%u", tp->rx_target,
+			  tp->rx_base, RTL8152_MAX_RX);
+	t->max_target = max(t->max_target, tp->rx_target);
+
+	return t->errors ? -EINVAL : 0;
+}
+
+static void test_noop_tasklet(unsigned long data)
+{
+}
+
+static void test_noop_work(struct work_struct *work)
+{
+}
+
+static int test_setup(struct r8152_test *t)
+{
+	struct net_device *netdev;
+	struct r8152 *tp;
+	struct urb *urb;
+	int i, ret;
+
+	netdev = alloc_etherdev(sizeof(struct r8152));
+	if (!netdev)
+		return -ENOMEM;
+
+	tp = netdev_priv(netdev);
+	tp->netdev = netdev;
+	tp->version = RTL_VER_02;
+	tp->udev = kzalloc(sizeof(*tp->udev), GFP_KERNEL);
+	if (!tp->udev) {
+		free_netdev(netdev);
+		return -ENOMEM;
+	}
+	t->tp = tp;
+
+	/* never registered, so no link watch; just report carrier */
+	clear_bit(__LINK_STATE_NOCARRIER, &netdev->state);
+	tasklet_init(&tp->tl, test_noop_tasklet, 0);
+	INIT_DELAYED_WORK(&tp->schedule, test_noop_work);
+	spin_lock_init(&tp->rx_lock);
+	set_bit(WORK_ENABLE, &tp->flags);
+
+	for (i = 0; i < RTL8152_MAX_RX; i++) {
+		if (rtl_rx_agg_new_page(&tp->rx_info[i], NUMA_NO_NODE,
+					GFP_KERNEL))
+			return -ENOMEM;
+
+		urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!urb)
+			return -ENOMEM;
+
+		INIT_LIST_HEAD(&tp->rx_info[i].list);
+		tp->rx_info[i].context = tp;
+		tp->rx_info[i].urb = urb;
+	}
+
+	/* as rtl_start_rx() on a gigabit link */
+	INIT_LIST_HEAD(&tp->rx_done);
+	INIT_LIST_HEAD(&tp->rx_idle);
+	INIT_LIST_HEAD(&tp->rx_used);
+	tp->rx_active = 0;
+	tp->rx_base = rtl_rx_base_target(LINK_STATUS | _1000bps);
+	tp->rx_target = tp->rx_base;
+	for (i = 0; i < RTL8152_MAX_RX; i++)
+		list_add_tail(&tp->rx_info[i].list, &tp->rx_idle);
+
+	ret = rtl_rx_refill(tp, GFP_KERNEL);
+	if (ret)
+		return ret;
+
+	return t->errors ? -EINVAL : 0;
+}
+
+static void test_teardown(struct r8152_test *t)
+{
+	struct r8152 *tp = t->tp;
+	unsigned int i;
+
+	for (i = 0; i < hold; i++) {
+		test_free_skb(t, t->held[i]);
+		t->held[i] = NULL;
+	}
+
+	if (!tp)
+		return;
+
+	cancel_delayed_work_sync(&tp->schedule);
+	tasklet_kill(&tp->tl);
+	free_all_mem(tp);
+	kfree(tp->udev);
+	free_netdev(tp->netdev);
+	t->tp = NULL;
+}
+
+static int test_pass(unsigned int copybreak, const char *name)
+{
+	struct r8152_test *t = test;
+	unsigned int saved = rx_copybreak;
+	unsigned int i;
+	int ret;
+
+	memset(t, 0, sizeof(*t));
+	prandom_seed_state(&t->rnd, seed);
+	rx_copybreak = copybreak;
+
+	ret = test_setup(t);
+	for (i = 0; !ret && i < iterations; i++)
+		ret = test_round(t);
+
+	test_teardown(t);
+	rx_copybreak = saved;
+	if (!ret && t->errors)
+		ret = -EINVAL;
+
+	if (ret) {
+		pr_err("r8152_test: %s: failed: %d, %u errors (seed %u)\n",
+		       name, ret, t->errors, seed);
+		return ret;
+	}
+
+	pr_info("r8152_test: %s: %llu frames in %llu aggregates, %llu with fragments, %llu new pages, window up to %u, %llu ns/frame\n",
+		name, t->frames, t->aggs, t->frag_frames, t->new_pages,
+		t->max_target, t->frames ? div64_u64(t->rx_ns, t->frames) : 0);
+
+	return 0;
+}
+
+static int __init r8152_test_init(void)
+{
+	int ret;
+
+	if (!hold || hold > TEST_MAX_HOLD) {
+		pr_err("r8152_test: hold must be 1..%d\n", TEST_MAX_HOLD);
+		return -EINVAL;
+	}
+
+	test = vzalloc(sizeof(*test));
+	if (!test)
+		return -ENOMEM;
+
+	ret = test_pass(rx_copybreak, "copybreak");
+	if (!ret)
+		ret = test_pass(AGG_BUF_SZ, "copy all");
+
+	vfree(test);
+	test = NULL;
+	return ret;
+}
+
+static void __exit r8152_test_exit(void)
+{
+}
+
+module_init(r8152_test_init);
+module_exit(r8152_test_exit);
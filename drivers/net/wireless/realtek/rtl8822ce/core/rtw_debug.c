@@ -151,6 +151,10 @@ void dump_drv_cfg(void *sel)
 	RTW_PRINT_SEL(sel, "CONFIG_RTW_NETIF_SG\n");
 #endif
 
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+	RTW_PRINT_SEL(sel, "CONFIG_RTW_TX_ZEROCOPY\n");
+#endif
+
 #ifdef CONFIG_RTW_WIFI_HAL
 	RTW_PRINT_SEL(sel, "CONFIG_RTW_WIFI_HAL\n");
 #endif
@@ -2782,6 +2782,106 @@ This sub-routine will perform all the following:
 6. apply sw-encrypt, if necessary.
 
 */
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+/*
+ * Build the 802.11 header, IV, mesh control and LLC/SNAP in the xmit
+ * buffer and leave the payload in the skb for the HCI to map. Returns
+ * _FAIL without touching the frame if it has to take the copy path.
+ */
+static s32 rtw_xmitframe_coalesce_zc(_adapter *padapter, _pkt *pkt, struct xmit_frame *pxmitframe)
+{
+	struct xmit_priv *pxmitpriv = &padapter->xmitpriv;
+	struct pkt_attrib *pattrib = &pxmitframe->attrib;
+	struct pkt_file pktfile;
+	u8 *mem_start, *pframe;
+	uint inline_len, segs;
+	u32 overhead;
+
+	if (!pxmitpriv->tx_zc_max_segs || pkt == NULL || pxmitframe->buf_addr == NULL)
+		return _FAIL;
+
+	if (pxmitframe->frame_tag != DATA_FRAMETAG || pattrib->pktlen < RTW_TX_ZC_MIN_LEN)
+		return _FAIL;
+
+	/* sw encryption and the TKIP MIC work on the payload in the xmit_buf */
+	if (pattrib->bswenc || pattrib->encrypt == _TKIP_)
+		return _FAIL;
+
+	/* leave payloads that need 802.11 fragmentation to the copy path */
+	overhead = pattrib->hdrlen + pattrib->iv_len + XATTRIB_GET_MCTRL_LEN(pattrib) + SNAP_SIZE + sizeof(u16);
+	if (!IS_MCAST(pattrib->ra) && pattrib->pktlen + overhead > pxmitpriv->frag_len - 4)
+		return _FAIL;
+
+	segs = rtw_os_pkt_zc_segs(pkt, pattrib->pkt_hdrlen, pattrib->pktlen, &inline_len);
+	if (segs == 0 || segs > pxmitpriv->tx_zc_max_segs)
+		return _FAIL;
+
+	/* only the PCI HCI enables zero-copy, no early mode or usb offset */
+	mem_start = pxmitframe->buf_addr + TXDESC_OFFSET;
+
+	if (rtw_make_wlanhdr(padapter, mem_start, pattrib) == _FAIL)
+		return _FAIL;
+
+	ClearMFrag(mem_start);
+	pframe = mem_start + pattrib->hdrlen;
+
+	if (pattrib->iv_len) {
+		_rtw_memcpy(pframe, pattrib->iv, pattrib->iv_len);
+		pframe += pattrib->iv_len;
+	}
+
+	#ifdef CONFIG_RTW_MESH
+	if (MLME_IS_MESH(padapter)) {
+		rtw_mesh_tx_build_mctrl(padapter, pattrib, pframe);
+		pframe += XATTRIB_GET_MCTRL_LEN(pattrib);
+	}
+	#endif
+
+	pframe += rtw_put_snap(pframe, pattrib->ether_type);
+
+	if (inline_len) {
+		_rtw_open_pktfile(pkt, &pktfile);
+		_rtw_pktfile_read(&pktfile, NULL, pattrib->pkt_hdrlen);
+		pframe += _rtw_pktfile_read(&pktfile, pframe, inline_len);
+	}
+
+	pxmitframe->zc_hdr_len = pframe - mem_start;
+	pxmitframe->zc_off = pattrib->pkt_hdrlen + inline_len;
+	pxmitframe->zc_len = pattrib->pktlen - inline_len;
+
+	pattrib->nr_frags = 1;
+	pattrib->last_txcmdsz = pxmitframe->zc_hdr_len + pxmitframe->zc_len;
+
+	if (IS_MCAST(pattrib->ra))
+		pattrib->vcs_mode = NONE_VCS;
+	else
+		update_attrib_vcs_info(padapter, pxmitframe);
+
+	return _SUCCESS;
+}
+
+/*
+ * Fall back to a coalesced frame after the HCI failed to map the payload:
+ * copy it behind the header built by rtw_xmitframe_coalesce_zc().
+ */
+void rtw_xmitframe_zc_linearize(struct xmit_frame *pxmitframe)
+{
+	struct pkt_file pktfile;
+	u8 *pframe;
+
+	if (!pxmitframe->zc_len)
+		return;
+
+	pframe = pxmitframe->buf_addr + TXDESC_OFFSET + pxmitframe->zc_hdr_len;
+
+	_rtw_open_pktfile(pxmitframe->pkt, &pktfile);
+	_rtw_pktfile_read(&pktfile, NULL, pxmitframe->zc_off);
+	_rtw_pktfile_read(&pktfile, pframe, pxmitframe->zc_len);
+
+	pxmitframe->zc_len = 0;
+}
+#endif /* CONFIG_RTW_TX_ZEROCOPY */
+
 s32 rtw_xmitframe_coalesce(_adapter *padapter, _pkt *pkt, struct xmit_frame *pxmitframe)
 {
 	struct pkt_file pktfile;
@@ -2835,6 +2935,12 @@ s32 rtw_xmitframe_coalesce(_adapter *padapter, _pkt *pkt, struct xmit_frame *pxm
 		return _FAIL;
 	}
 
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+	pxmitframe->zc_len = 0;
+	if (rtw_xmitframe_coalesce_zc(padapter, pkt, pxmitframe) == _SUCCESS)
+		return _SUCCESS;
+#endif
+
 	pbuf_start = pxmitframe->buf_addr;
 
 #ifdef CONFIG_USB_TX_AGGREGATION
@@ -3733,6 +3839,9 @@ void rtw_init_xmitframe(struct xmit_frame *pxframe)
 		pxframe->ack_report = 0;
 #endif
 
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+		pxframe->zc_len = 0;
+#endif
 	}
 }
 
@@ -56,6 +56,13 @@ s32 rtl8822ce_init_xmit_priv(_adapter *padapter)
 #endif
 	rtl8822c_init_xmit_priv(padapter);
 
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+	/* TXBD segment 0 carries TX_WIFI_INFO, segment 1 the 802.11 header */
+	if (padapter->registrypriv.tx_zerocopy)
+		pxmitpriv->tx_zc_max_segs = rtw_min(RTW_TX_ZC_MAX_SEGS,
+			((TX_BUFFER_SEG_NUM == 0) ? 2 : ((TX_BUFFER_SEG_NUM == 1) ? 4 : 8)) - 2);
+#endif
+
 	return ret;
 }
 
@@ -277,6 +284,65 @@ static u16 ffaddr2dma(u32 addr)
 }
 */
 
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+/*
+ * Map the payload of a frame built by rtw_xmitframe_coalesce_zc() and move
+ * the skb to the xmit_buf, which keeps it until tx done. If mapping fails
+ * the payload is copied into the xmit_buf after all.
+ */
+static void rtl8822ce_xmitframe_zc_map(_adapter *padapter,
+				       struct xmit_frame *pxmitframe)
+{
+	struct dvobj_priv *pdvobjpriv = adapter_to_dvobj(padapter);
+	struct xmit_buf *pxmitbuf = pxmitframe->pxmitbuf;
+	int nr;
+
+	if (!pxmitframe->zc_len)
+		return;
+
+	nr = rtw_os_pkt_zc_map(&pdvobjpriv->ppcidev->dev, pxmitframe->pkt,
+			       pxmitframe->zc_off, pxmitframe->zc_len,
+			       pxmitbuf->zc_dma, pxmitbuf->zc_seg_len,
+			       padapter->xmitpriv.tx_zc_max_segs,
+			       &pxmitbuf->zc_head);
+	if (nr <= 0) {
+		rtw_xmitframe_zc_linearize(pxmitframe);
+		return;
+	}
+
+	pxmitbuf->zc_nr = nr;
+	pxmitbuf->zc_pkt = pxmitframe->pkt;
+	pxmitframe->pkt = NULL;
+}
+
+static void rtl8822ce_xmitbuf_zc_release(_adapter *padapter,
+					 struct xmit_buf *pxmitbuf)
+{
+	struct dvobj_priv *pdvobjpriv = adapter_to_dvobj(padapter);
+
+	if (!pxmitbuf->zc_nr)
+		return;
+
+	rtw_os_pkt_zc_unmap(&pdvobjpriv->ppcidev->dev, pxmitbuf->zc_dma,
+			    pxmitbuf->zc_seg_len, pxmitbuf->zc_nr,
+			    pxmitbuf->zc_head);
+	pxmitbuf->zc_nr = 0;
+
+	rtw_os_pkt_complete(padapter, pxmitbuf->zc_pkt);
+	pxmitbuf->zc_pkt = NULL;
+}
+#endif /* CONFIG_RTW_TX_ZEROCOPY */
+
+/* Bytes of the MPDU that sit in the xmit_buf behind TX_WIFI_INFO */
+static s32 rtl8822ce_xmitbuf_data_len(struct xmit_frame *pxmitframe, s32 sz)
+{
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+	if (pxmitframe->pxmitbuf->zc_nr)
+		return pxmitframe->zc_hdr_len;
+#endif
+	return sz;
+}
+
 /*
  * Fill tx buffer desciptor. Map each buffer address in tx buffer descriptor
  * segment. Designed for tx buffer descriptor architecture
@@ -293,10 +359,11 @@ static void rtl8822ce_update_txbd(struct xmit_frame *pxmitframe,
 		((TX_BUFFER_SEG_NUM == 0) ? 2 : ((TX_BUFFER_SEG_NUM == 1) ? 4 : 8));
 	u16 tx_page_size_reg = 1;
 	u16 page_size_length = 0;
+	s32 buf_sz = rtl8822ce_xmitbuf_data_len(pxmitframe, sz);
 
-	/* map TX DESC buf_addr (including TX DESC + tx data) */
+	/* map TX DESC buf_addr (including TX DESC + tx data in xmit_buf) */
 	mapping = pci_map_single(pdvobjpriv->ppcidev, pxmitframe->buf_addr ,
-				 sz + TX_WIFI_INFO_SIZE, PCI_DMA_TODEVICE);
+				 buf_sz + TX_WIFI_INFO_SIZE, PCI_DMA_TODEVICE);
 
 	/* Calculate page size.
 	 * Total buffer length including TX_WIFI_INFO and PacketLen */
@@ -335,14 +402,26 @@ static void rtl8822ce_update_txbd(struct xmit_frame *pxmitframe,
 	SET_TX_BD_PHYSICAL_ADDR0_LOW(txbd, mapping);
 
 	/*
-	 * It is assumed that in linux implementation, packet is coalesced
-	 * in only one buffer. Extension mode is not supported here
+	 * The coalesced packet, or only its 802.11 header for zero-copy,
+	 * follows in one buffer. Extension mode is not supported here
 	 */
-	SET_TXBUFFER_DESC_LEN_WITH_OFFSET(txbd, 1, sz);
+	SET_TXBUFFER_DESC_LEN_WITH_OFFSET(txbd, 1, buf_sz);
 	/* don't using extendsion mode. */
 	SET_TXBUFFER_DESC_AMSDU_WITH_OFFSET(txbd, 1, 0);
 	SET_TXBUFFER_DESC_ADD_LOW_WITH_OFFSET(txbd, 1,
 				      mapping + TX_WIFI_INFO_SIZE); /* pkt */
+
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+	/* zero-copy payload, mapped from the skb */
+	for (i = 0; i < pxmitframe->pxmitbuf->zc_nr; i++) {
+		struct xmit_buf *pxmitbuf = pxmitframe->pxmitbuf;
+
+		SET_TXBUFFER_DESC_LEN_WITH_OFFSET(txbd, i + 2,
+						  pxmitbuf->zc_seg_len[i]);
+		SET_TXBUFFER_DESC_ADD_LOW_WITH_OFFSET(txbd, i + 2,
+						      pxmitbuf->zc_dma[i]);
+	}
+#endif
 #endif
 
 	/*buf_desc_debug("TX:%s, txbd = 0x%p\n", __FUNCTION__, txbd);*/
@@ -629,6 +708,9 @@ s32 rtl8822ce_dump_xframe(_adapter *padapter, struct xmit_frame *pxmitframe)
 	    (pxmitframe->attrib.dhcp_pkt != 1))
 		rtw_issue_addbareq_cmd(padapter, pxmitframe, _FALSE);
 #endif /* CONFIG_80211N_HT */
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+	rtl8822ce_xmitframe_zc_map(padapter, pxmitframe);
+#endif
 	for (t = 0; t < pattrib->nr_frags; t++) {
 
 		if (inner_ret != _SUCCESS && ret == _SUCCESS)
@@ -661,6 +743,9 @@ s32 rtl8822ce_dump_xframe(_adapter *padapter, struct xmit_frame *pxmitframe)
 			_exit_critical(&pdvobjpriv->irq_th_lock, &irqL);
 			rtw_sctx_done_err(&pxmitbuf->sctx,
 					  RTW_SCTX_DONE_TX_DESC_NA);
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+			rtl8822ce_xmitbuf_zc_release(padapter, pxmitbuf);
+#endif
 			rtw_free_xmitbuf(pxmitpriv, pxmitbuf);
 			RTW_INFO("##### Tx desc unavailable !#####\n");
 			break;
@@ -678,7 +763,8 @@ s32 rtl8822ce_dump_xframe(_adapter *padapter, struct xmit_frame *pxmitframe)
 		if (pxmitbuf->buf_tag != XMITBUF_CMD)
 			rtl8822ce_enqueue_xmitbuf(ptx_ring, pxmitbuf);
 
-		pxmitbuf->len = sz + TX_WIFI_INFO_SIZE;
+		pxmitbuf->len = rtl8822ce_xmitbuf_data_len(pxmitframe, sz) +
+				TX_WIFI_INFO_SIZE;
 		w_sz = sz;
 
 		/* Please comment here */
@@ -1095,8 +1181,13 @@ dump_pkt:
 				}
 
 				/* always return ndis_packet after
-				 * rtw_xmitframe_coalesce */
-				rtw_os_xmit_complete(padapter, pxmitframe);
+				 * rtw_xmitframe_coalesce, except for a zero-copy
+				 * frame whose payload is still to be mapped from
+				 * it; the xmit_buf releases that one after unmap */
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+				if (!pxmitframe->zc_len)
+#endif
+					rtw_os_xmit_complete(padapter, pxmitframe);
 			}
 
 
@@ -1320,6 +1411,9 @@ void rtl8822ce_free_txbd_ring(_adapter *padapter, unsigned int prio)
 			pci_unmap_single(pdev,
 				GET_TX_BD_PHYSICAL_ADDR0_LOW(txbd),
 				pxmitbuf->len, PCI_DMA_TODEVICE);
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+			rtl8822ce_xmitbuf_zc_release(padapter, pxmitbuf);
+#endif
 
 			rtw_free_xmitbuf(t_priv, pxmitbuf);
 
@@ -1463,6 +1557,10 @@ void rtl8822ce_tx_isr(PADAPTER Adapter, int prio)
 			pci_unmap_single(pdvobjpriv->ppcidev,
 				GET_TX_BD_PHYSICAL_ADDR0_LOW(tx_desc),
 				pxmitbuf->len, PCI_DMA_TODEVICE);
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+			rtl8822ce_xmitbuf_zc_release(pxmitbuf->padapter,
+						     pxmitbuf);
+#endif
 			rtw_sctx_done(&pxmitbuf->sctx);
 			rtw_free_xmitbuf(&(pxmitbuf->padapter->xmitpriv),
 					 pxmitbuf);
@@ -1537,6 +1635,10 @@ void rtl8822ce_tx_isr(PADAPTER Adapter, int prio)
 			pci_unmap_single(pdvobjpriv->ppcidev,
 				 GET_TX_BD_PHYSICAL_ADDR0_LOW(tx_desc),
 					 pxmitbuf->len, PCI_DMA_TODEVICE);
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+			rtl8822ce_xmitbuf_zc_release(pxmitbuf->padapter,
+						     pxmitbuf);
+#endif
 			rtw_sctx_done(&pxmitbuf->sctx);
 			rtw_free_xmitbuf(&(pxmitbuf->padapter->xmitpriv),
 					 pxmitbuf);
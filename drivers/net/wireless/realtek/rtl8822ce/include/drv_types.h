@@ -200,6 +200,9 @@ struct registry_priv {
 	u8	lps_1t1r;
 #endif
 	u8	lps_chk_by_tp;
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+	u8	tx_zerocopy;
+#endif
 #ifdef CONFIG_WOWLAN
 	u8	wow_power_mgnt;
 	u8	wow_lps_level;
@@ -519,6 +519,19 @@ struct pkt_attrib {
 #define XATTRIB_GET_MCTRL_LEN(xattrib) 0
 #endif
 
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+/*
+ * Zero-copy tx: the 802.11 header goes into the xmit_buf, the payload is
+ * DMA mapped from the skb in at most RTW_TX_ZC_MAX_SEGS buffer segments.
+ * A linear payload head up to RTW_TX_ZC_INLINE_MAX bytes (typically the
+ * IP/TCP headers of an SG skb) is copied behind the 802.11 header rather
+ * than spending a segment on it.
+ */
+#define RTW_TX_ZC_MAX_SEGS	6
+#define RTW_TX_ZC_MIN_LEN	256
+#define RTW_TX_ZC_INLINE_MAX	128
+#endif
+
 #ifdef CONFIG_TX_AMSDU
 enum {
 	RTW_AMSDU_TIMER_UNSET = 0,
@@ -635,6 +648,13 @@ struct xmit_buf {
 #else
 	struct tx_desc *desc;
 #endif
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+	_pkt *zc_pkt; /* owned until tx done when zc_nr != 0 */
+	u8 zc_nr;
+	u8 zc_head; /* zc_dma[0] is the linear head, a dma_map_single() */
+	dma_addr_t zc_dma[RTW_TX_ZC_MAX_SEGS];
+	u16 zc_seg_len[RTW_TX_ZC_MAX_SEGS];
+#endif
 #endif
 
 #if defined(DBG_XMIT_BUF) || defined(DBG_XMIT_BUF_EXT)
@@ -659,6 +679,12 @@ struct xmit_frame {
 
 	struct xmit_buf *pxmitbuf;
 
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+	u16	zc_hdr_len;	/* bytes of the MPDU built in buf_addr */
+	u16	zc_off;		/* payload offset in pkt left for DMA */
+	u16	zc_len;		/* payload bytes left for DMA, 0: copied */
+#endif
+
 #if defined(CONFIG_SDIO_HCI) || defined(CONFIG_GSPI_HCI)
 	u8	pg_num;
 	u8	agg_num;
@@ -771,6 +797,9 @@ struct	xmit_priv	{
 	/* struct	hw_txqueue	bmc_txqueue; */
 
 	uint	frag_len;
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+	u8	tx_zc_max_segs;	/* payload DMA segments set by the HCI, 0: zero-copy off */
+#endif
 
 	_adapter	*adapter;
 
@@ -956,6 +985,9 @@ extern s32 rtw_xmit_classifier(_adapter *padapter, struct xmit_frame *pxmitframe
 extern u32 rtw_calculate_wlan_pkt_size_by_attribue(struct pkt_attrib *pattrib);
 #define rtw_wlan_pkt_size(f) rtw_calculate_wlan_pkt_size_by_attribue(&f->attrib)
 extern s32 rtw_xmitframe_coalesce(_adapter *padapter, _pkt *pkt, struct xmit_frame *pxmitframe);
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+void rtw_xmitframe_zc_linearize(struct xmit_frame *pxmitframe);
+#endif
 #if defined(CONFIG_IEEE80211W) || defined(CONFIG_RTW_MESH)
 extern s32 rtw_mgmt_xmitframe_coalesce(_adapter *padapter, _pkt *pkt, struct xmit_frame *pxmitframe);
 #endif
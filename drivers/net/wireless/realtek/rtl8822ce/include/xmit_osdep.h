@@ -85,6 +85,13 @@ extern uint _rtw_pktfile_read(struct pkt_file *pfile, u8 *rmem, uint rlen);
 extern sint rtw_endofpktfile(struct pkt_file *pfile);
 
 extern void rtw_os_pkt_complete(_adapter *padapter, _pkt *pkt);
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+uint rtw_os_pkt_zc_segs(_pkt *pkt, uint off, uint len, uint *inline_len);
+int rtw_os_pkt_zc_map(struct device *dev, _pkt *pkt, uint off, uint len,
+		      dma_addr_t *dma, u16 *seg_len, uint max_segs, u8 *head);
+void rtw_os_pkt_zc_unmap(struct device *dev, dma_addr_t *dma, u16 *seg_len,
+			 uint nr, u8 head);
+#endif
 extern void rtw_os_xmit_complete(_adapter *padapter, struct xmit_frame *pxframe);
 
 void rtw_os_wake_queue_at_free_stainfo(_adapter *padapter, int *qcnt_freed);
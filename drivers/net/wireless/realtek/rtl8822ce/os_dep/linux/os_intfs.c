@@ -106,6 +106,12 @@ MODULE_PARM_DESC(rtw_lps_1t1r, "The default LPS 1T1R setting");
 
 module_param(rtw_lps_chk_by_tp, int, 0644);
 
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+int rtw_tx_zerocopy = 1;
+module_param(rtw_tx_zerocopy, int, 0644);
+MODULE_PARM_DESC(rtw_tx_zerocopy, "DMA map tx payload from the skb instead of copying it, 0:disable, 1:enable");
+#endif
+
 #ifdef CONFIG_WOWLAN
 module_param(rtw_wow_power_mgnt, int, 0644);
 MODULE_PARM_DESC(rtw_wow_power_mgnt, "The default WOW LPS mode");
@@ -1159,6 +1165,9 @@ uint loadparam(_adapter *padapter)
 	registry_par->lps_1t1r = (u8)(rtw_lps_1t1r ? 1 : 0);
 #endif
 	registry_par->lps_chk_by_tp = (u8)rtw_lps_chk_by_tp;
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+	registry_par->tx_zerocopy = (u8)(rtw_tx_zerocopy ? 1 : 0);
+#endif
 #ifdef CONFIG_WOWLAN
 	registry_par->wow_power_mgnt = (u8)rtw_wow_power_mgnt;
 	registry_par->wow_lps_level = (u8)rtw_wow_lps_level;
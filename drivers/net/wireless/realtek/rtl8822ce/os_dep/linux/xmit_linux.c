@@ -277,6 +277,124 @@ void rtw_os_pkt_complete(_adapter *padapter, _pkt *pkt)
 	rtw_skb_free(pkt);
 }
 
+#ifdef CONFIG_RTW_TX_ZEROCOPY
+/*
+ * Count the DMA segments needed to send len bytes of pkt starting at off.
+ * A short linear head is reported in inline_len instead, for the caller
+ * to copy. Returns 0 if the range cannot be described (e.g. frag_list).
+ */
+uint rtw_os_pkt_zc_segs(_pkt *pkt, uint off, uint len, uint *inline_len)
+{
+	struct sk_buff *skb = (struct sk_buff *)pkt;
+	uint headlen = skb_headlen(skb);
+	uint segs = 0, sz;
+	int i;
+
+	*inline_len = 0;
+
+	if (off + len > skb->len || skb_has_frag_list(skb))
+		return 0;
+
+	if (off < headlen) {
+		sz = rtw_min(headlen - off, len);
+		if (sz <= RTW_TX_ZC_INLINE_MAX && sz < len)
+			*inline_len = sz;
+		else
+			segs++;
+		len -= sz;
+		off = 0;
+	} else
+		off -= headlen;
+
+	for (i = 0; len && i < skb_shinfo(skb)->nr_frags; i++) {
+		sz = skb_frag_size(&skb_shinfo(skb)->frags[i]);
+		if (off >= sz) {
+			off -= sz;
+			continue;
+		}
+		sz = rtw_min(sz - off, len);
+		segs++;
+		len -= sz;
+		off = 0;
+	}
+
+	return len ? 0 : segs;
+}
+
+/*
+ * Map len bytes of pkt starting at off for device reads, one entry of
+ * dma/seg_len per linear or page fragment piece. *head is set when the
+ * first entry is the linear head, which may cross a page boundary and is
+ * mapped with dma_map_single(). Returns the number of segments, or -1
+ * with nothing left mapped.
+ */
+int rtw_os_pkt_zc_map(struct device *dev, _pkt *pkt, uint off, uint len,
+		      dma_addr_t *dma, u16 *seg_len, uint max_segs, u8 *head)
+{
+	struct sk_buff *skb = (struct sk_buff *)pkt;
+	uint headlen = skb_headlen(skb);
+	uint nr = 0, sz;
+	int i;
+
+	*head = _FALSE;
+
+	if (off < headlen) {
+		sz = rtw_min(headlen - off, len);
+		dma[nr] = dma_map_single(dev, skb->data + off, sz,
+					 DMA_TO_DEVICE);
+		if (dma_mapping_error(dev, dma[nr]))
+			return -1;
+		*head = _TRUE;
+		seg_len[nr++] = sz;
+		len -= sz;
+		off = 0;
+	} else
+		off -= headlen;
+
+	for (i = 0; len && i < skb_shinfo(skb)->nr_frags; i++) {
+		const skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+
+		sz = skb_frag_size(frag);
+		if (off >= sz) {
+			off -= sz;
+			continue;
+		}
+		if (nr == max_segs)
+			goto err;
+
+		sz = rtw_min(sz - off, len);
+		dma[nr] = skb_frag_dma_map(dev, frag, off, sz, DMA_TO_DEVICE);
+		if (dma_mapping_error(dev, dma[nr]))
+			goto err;
+		seg_len[nr++] = sz;
+		len -= sz;
+		off = 0;
+	}
+
+	if (len)
+		goto err;
+
+	return nr;
+
+err:
+	rtw_os_pkt_zc_unmap(dev, dma, seg_len, nr, *head);
+	return -1;
+}
+
+void rtw_os_pkt_zc_unmap(struct device *dev, dma_addr_t *dma, u16 *seg_len,
+			 uint nr, u8 head)
+{
+	while (nr--) {
+		if (nr == 0 && head)
+			dma_unmap_single(dev, dma[0], seg_len[0],
+					 DMA_TO_DEVICE);
+		else
+			dma_unmap_page(dev, dma[nr], seg_len[nr],
+				       DMA_TO_DEVICE);
+	}
+}
+#endif /* CONFIG_RTW_TX_ZEROCOPY */
+
 void rtw_os_xmit_complete(_adapter *padapter, struct xmit_frame *pxframe)
 {
 	if (pxframe->pkt)
@@ -20,6 +20,7 @@
 #include <linux/string.h>
 #include <linux/of_address.h>
 #include <linux/dma-buf.h>
+#include <linux/sort.h>
 
 #include <tegra-soc-hwpm-log.h>
 #include <hal/tegra-soc-hwpm-structures.h>
@@ -801,6 +802,133 @@ static bool t234_soc_hwpm_ip_reg_check(struct hwpm_resource_aperture *aperture,
 	return false;
 }
 
+static int t234_soc_hwpm_alist_index_cmp(const void *a, const void *b)
+{
+	const struct hwpm_alist_index_entry *ea = a;
+	const struct hwpm_alist_index_entry *eb = b;
+
+	if (ea->abs_pa != eb->abs_pa)
+		return (ea->abs_pa < eb->abs_pa) ? -1 : 1;
+	return (ea->order < eb->order) ? -1 : (ea->order > eb->order);
+}
+
+void t234_soc_hwpm_free_alist_index(struct tegra_soc_hwpm *hwpm)
+{
+	kvfree(hwpm->alist_index);
+	hwpm->alist_index = NULL;
+	hwpm->alist_index_size = 0U;
+	hwpm->alist_index_hint = 0U;
+}
+
+/*
+ * Build a sorted index of the allowlists of all reserved resources. The walk
+ * order matches t234_soc_hwpm_find_aperture() so that for duplicate addresses
+ * the same aperture wins.
+ */
+int t234_soc_hwpm_build_alist_index(struct tegra_soc_hwpm *hwpm)
+{
+	struct hwpm_alist_index_entry *entry = NULL;
+	struct hwpm_resource_aperture *aperture = NULL;
+	u32 alist_idx = 0U;
+	u32 count = 0U;
+	int res_idx = 0;
+	int aprt_idx = 0;
+
+	t234_soc_hwpm_free_alist_index(hwpm);
+
+	for (res_idx = 0; res_idx < TERGA_SOC_HWPM_NUM_RESOURCES; res_idx++) {
+		if (!hwpm->hwpm_resources[res_idx].reserved)
+			continue;
+		for (aprt_idx = 0;
+		     aprt_idx < hwpm->hwpm_resources[res_idx].map_size;
+		     aprt_idx++) {
+			aperture = &(hwpm->hwpm_resources[res_idx].map[aprt_idx]);
+			if (aperture->alist)
+				count += aperture->alist_size;
+		}
+	}
+	if (count == 0U)
+		return 0;
+
+	hwpm->alist_index = kvmalloc_array(count, sizeof(*hwpm->alist_index),
+					   GFP_KERNEL);
+	if (!hwpm->alist_index) {
+		tegra_soc_hwpm_err("Couldn't allocate allowlist index");
+		return -ENOMEM;
+	}
+
+	entry = hwpm->alist_index;
+	for (res_idx = 0; res_idx < TERGA_SOC_HWPM_NUM_RESOURCES; res_idx++) {
+		if (!hwpm->hwpm_resources[res_idx].reserved)
+			continue;
+		for (aprt_idx = 0;
+		     aprt_idx < hwpm->hwpm_resources[res_idx].map_size;
+		     aprt_idx++) {
+			aperture = &(hwpm->hwpm_resources[res_idx].map[aprt_idx]);
+			if (!aperture->alist)
+				continue;
+			for (alist_idx = 0; alist_idx < aperture->alist_size;
+			     alist_idx++, entry++) {
+				entry->abs_pa = aperture->start_abs_pa +
+					aperture->alist[alist_idx].reg_offset;
+				entry->pa = aperture->start_pa +
+					aperture->alist[alist_idx].reg_offset;
+				entry->aperture = aperture;
+				entry->order = entry - hwpm->alist_index;
+			}
+		}
+	}
+
+	sort(hwpm->alist_index, count, sizeof(*hwpm->alist_index),
+	     t234_soc_hwpm_alist_index_cmp, NULL);
+	hwpm->alist_index_size = count;
+	tegra_soc_hwpm_dbg("Allowlist index: %u entries", count);
+
+	return 0;
+}
+
+/*
+ * Look phys_addr up in the allowlist index. Reg ops usually walk a register
+ * block in order, so the entry after the previous match is tried before the
+ * binary search.
+ */
+static struct hwpm_resource_aperture *t234_soc_hwpm_alist_index_lookup(
+		struct tegra_soc_hwpm *hwpm, u64 phys_addr, u64 *updated_pa)
+{
+	struct hwpm_alist_index_entry *index = hwpm->alist_index;
+	u32 hint = hwpm->alist_index_hint;
+	u32 lo = 0U;
+	u32 hi = hwpm->alist_index_size;
+	u32 mid = 0U;
+
+	if ((hint < hi) && (index[hint].abs_pa == phys_addr) &&
+	    ((hint == 0U) || (index[hint - 1U].abs_pa != phys_addr))) {
+		lo = hint;
+		goto found;
+	}
+	if ((hint + 1U < hi) && (index[hint + 1U].abs_pa == phys_addr) &&
+	    (index[hint].abs_pa != phys_addr)) {
+		lo = hint + 1U;
+		goto found;
+	}
+
+	/* Lower bound, first entry with abs_pa >= phys_addr */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2U;
+		if (index[mid].abs_pa < phys_addr)
+			lo = mid + 1U;
+		else
+			hi = mid;
+	}
+	if ((lo == hwpm->alist_index_size) || (index[lo].abs_pa != phys_addr))
+		return NULL;
+
+found:
+	hwpm->alist_index_hint = lo;
+	*updated_pa = index[lo].pa;
+	return index[lo].aperture;
+}
+
 /*
  * Find an aperture in which phys_addr lies. If check_reservation is true, then
  * we also have to do a allowlist check.
@@ -814,6 +942,17 @@ struct hwpm_resource_aperture *t234_soc_hwpm_find_aperture(
 	int res_idx = 0;
 	int aprt_idx = 0;
 
+	/* Reg ops path, use the index built at bind time */
+	if (check_reservation && use_absolute_base && hwpm->alist_index) {
+		aperture = t234_soc_hwpm_alist_index_lookup(hwpm, phys_addr,
+							     updated_pa);
+		if (aperture)
+			return aperture;
+		tegra_soc_hwpm_err("Unable to find aperture: phys(0x%llx)",
+				   phys_addr);
+		return NULL;
+	}
+
 	for (res_idx = 0; res_idx < TERGA_SOC_HWPM_NUM_RESOURCES; res_idx++) {
 		if (check_reservation && !hwpm->hwpm_resources[res_idx].reserved)
 			continue;
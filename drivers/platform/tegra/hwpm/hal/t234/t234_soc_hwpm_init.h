@@ -50,6 +50,8 @@ bool t234_soc_hwpm_allowlist_check(struct hwpm_resource_aperture *aperture,
 			    u64 phys_addr, bool use_absolute_base,
 			    u64 *updated_pa);
 void t234_soc_hwpm_get_full_allowlist(struct tegra_soc_hwpm *hwpm);
+int t234_soc_hwpm_build_alist_index(struct tegra_soc_hwpm *hwpm);
+void t234_soc_hwpm_free_alist_index(struct tegra_soc_hwpm *hwpm);
 
 int t234_soc_hwpm_update_mem_bytes(struct tegra_soc_hwpm *hwpm,
 		struct tegra_soc_hwpm_update_get_put *update_get_put);
@@ -383,6 +383,8 @@ void t234_soc_hwpm_reset_resources(struct tegra_soc_hwpm *hwpm)
 	int aprt_idx = 0;
 	struct hwpm_resource_aperture *aperture = NULL;
 
+	t234_soc_hwpm_free_alist_index(hwpm);
+
 	/* Reset resource and aperture state */
 	for (res_idx = 0; res_idx < TERGA_SOC_HWPM_NUM_RESOURCES; res_idx++) {
 		if (!hwpm->hwpm_resources[res_idx].reserved)
@@ -527,5 +529,7 @@ int t234_soc_hwpm_bind_resources(struct tegra_soc_hwpm *hwpm)
 			}
 		}
 	}
-	return 0;
+
+	/* Reservations are fixed from here on, index the allowlists */
+	return t234_soc_hwpm_build_alist_index(hwpm);
 }
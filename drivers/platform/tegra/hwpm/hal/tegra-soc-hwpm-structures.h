@@ -54,7 +54,23 @@
 })
 
 struct allowlist;
+struct hwpm_resource_aperture;
 extern struct platform_device *tegra_soc_hwpm_pdev;
+
+/*
+ * One allowlisted register of a reserved resource. An array of these sorted
+ * by abs_pa is built at bind time so that reg ops can be checked without
+ * walking every aperture's allowlist.
+ */
+struct hwpm_alist_index_entry {
+	/* Address as passed in reg ops */
+	u64 abs_pa;
+	/* Address to be used for readl/writel */
+	u64 pa;
+	struct hwpm_resource_aperture *aperture;
+	/* Position in resource/aperture/allowlist walk, breaks ties */
+	u32 order;
+};
 extern const struct file_operations tegra_soc_hwpm_ops;
 
 /* Driver struct */
@@ -96,6 +112,12 @@ struct tegra_soc_hwpm {
 	bool bind_completed;
 	s32 full_alist_size;
 
+	/* Allowlist index of reserved resources, valid after bind */
+	struct hwpm_alist_index_entry *alist_index;
+	u32 alist_index_size;
+	/* Last matched alist_index entry, consecutive reg ops start here */
+	u32 alist_index_hint;
+
 	/* Debugging */
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debugfs_root;
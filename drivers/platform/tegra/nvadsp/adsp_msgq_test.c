@@ -0,0 +1,358 @@
+/*
+ * adsp_msgq_test.c
+ *
+ * Message queue and mailbox queue test against a simulated ADSP
+ *
+ * Copyright (c) 2020, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/platform_device.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/tegra_nvadsp.h>
+
+#include "dev.h"
+
+#define MSGQ_TEST_QUEUE_WSIZE	1024
+#define MSGQ_TEST_MAX_PAYLOAD	31	/* words */
+#define MSGQ_TEST_WINDOW	16	/* requests in flight */
+#define MSGQ_TEST_TIMEOUT_MS	1000
+
+/*
+ * With at most MSGQ_TEST_WINDOW messages of up to MSGQ_TEST_MAX_PAYLOAD
+ * words in flight neither queue can fill, and a queue slot is only
+ * reused once the message last held there has been answered.
+ */
+#if (MSGQ_TEST_WINDOW + 1) * (MSGQ_TEST_MAX_PAYLOAD + 1) >= \
+	MSGQ_TEST_QUEUE_WSIZE
+#error "msgq test window does not fit in the queues"
+#endif
+#if MSGQ_TEST_WINDOW > NVADSP_MBOX_QUEUE_SIZE
+#error "msgq test window does not fit in the mailbox queue"
+#endif
+
+union msgq_test_msg {
+	msgq_message_t msg;
+	int32_t words[MSGQ_MESSAGE_HEADER_WSIZE + MSGQ_TEST_MAX_PAYLOAD];
+};
+
+struct msgq_test_stats {
+	u32 sent_inplace;
+	u32 sent_copy;
+	u32 recv_inplace;
+	u32 recv_copy;
+	u32 mbox_batches;
+	u32 done;
+	u32 adsp_errors;
+	u64 elapsed_ns;
+};
+
+/**
+ * struct msgq_test - one test pass
+ *
+ * @h2a:	host to ADSP queue
+ * @a2h:	ADSP to host queue
+ * @mbox:	reply doorbells, one word per reply
+ * @inplace:	host uses the reserve/commit and peek calls
+ * @adsp_errors: malformed requests seen by the simulated ADSP
+ */
+struct msgq_test {
+	msgq_t *h2a;
+	msgq_t *a2h;
+	struct nvadsp_mbox mbox;
+	bool inplace;
+	u32 adsp_errors;
+};
+
+static DEFINE_MUTEX(msgq_test_lock);
+static u32 msgq_test_msgs = 10000;
+
+static int32_t msgq_test_size(u32 seq)
+{
+	return 1 + seq % MSGQ_TEST_MAX_PAYLOAD;
+}
+
+/*
+ * Simulated ADSP: answers every request with its payload inverted,
+ * except for the sequence number in word 0, and rings the mailbox with
+ * that number the way the hardware mailbox interrupt does.
+ */
+static int msgq_test_adsp(void *data)
+{
+	struct msgq_test *t = data;
+	union msgq_test_msg buf;
+	int32_t i;
+
+	while (!kthread_should_stop()) {
+		if (READ_ONCE(t->h2a->write_index) == t->h2a->read_index) {
+			cond_resched();
+			continue;
+		}
+
+		/* read the message only after observing the write index */
+		smp_rmb();
+		buf.msg.size = MSGQ_TEST_MAX_PAYLOAD;
+		if (msgq_dequeue_message(t->h2a, &buf.msg) ||
+		    buf.msg.size < 1) {
+			t->adsp_errors++;
+			continue;
+		}
+
+		for (i = 1; i < buf.msg.size; i++)
+			buf.msg.payload[i] = ~buf.msg.payload[i];
+
+		if (msgq_queue_message(t->a2h, &buf.msg) ||
+		    nvadsp_mboxq_enqueue(&t->mbox.recv_queue,
+					 buf.msg.payload[0]))
+			t->adsp_errors++;
+	}
+
+	return 0;
+}
+
+static int msgq_test_send(struct msgq_test *t, u32 seq,
+			  struct msgq_test_stats *st)
+{
+	int32_t size = msgq_test_size(seq);
+	union msgq_test_msg buf;
+	msgq_message_t *msg;
+	int32_t i, ret;
+
+	ret = t->inplace ? msgq_reserve_message(t->h2a, size, &msg) : -EAGAIN;
+	if (ret == -EAGAIN) {
+		/* wraps around the end of the queue, or copy mode */
+		msg = &buf.msg;
+		msg->size = size;
+	} else if (ret) {
+		return ret;
+	}
+
+	msg->payload[0] = seq;
+	for (i = 1; i < size; i++)
+		msg->payload[i] = seq + i;
+
+	if (msg != &buf.msg) {
+		st->sent_inplace++;
+		return msgq_commit_message(t->h2a, msg);
+	}
+
+	st->sent_copy++;
+	return msgq_queue_message(t->h2a, msg);
+}
+
+static int msgq_test_recv(struct msgq_test *t, u32 seq,
+			  struct msgq_test_stats *st)
+{
+	int32_t size = msgq_test_size(seq);
+	union msgq_test_msg buf;
+	msgq_message_t *msg;
+	int32_t i, ret;
+
+	ret = t->inplace ? msgq_peek_message(t->a2h, &msg) : -EAGAIN;
+	if (ret == -EAGAIN) {
+		buf.msg.size = MSGQ_TEST_MAX_PAYLOAD;
+		ret = msgq_dequeue_message(t->a2h, &buf.msg);
+		if (ret)
+			return ret;
+		msg = &buf.msg;
+		st->recv_copy++;
+	} else if (ret) {
+		return ret;
+	} else {
+		st->recv_inplace++;
+	}
+
+	if (msg->size != size || msg->payload[0] != seq)
+		ret = -EBADMSG;
+	for (i = 1; !ret && i < size; i++)
+		if (msg->payload[i] != ~(int32_t)(seq + i))
+			ret = -EBADMSG;
+
+	if (msg != &buf.msg) {
+		/* the reply is read before its space goes back to the ADSP */
+		smp_mb();
+		msgq_discard_message(t->a2h);
+	}
+
+	return ret;
+}
+
+static int msgq_test_run(struct msgq_test *t, u32 nr_msgs,
+			 struct msgq_test_stats *st)
+{
+	uint32_t words[MSGQ_TEST_WINDOW];
+	ktime_t start = ktime_get();
+	u32 sent = 0;
+	int i, n, ret = 0;
+
+	while (st->done < nr_msgs) {
+		while (sent < nr_msgs && sent - st->done < MSGQ_TEST_WINDOW) {
+			ret = msgq_test_send(t, sent, st);
+			if (ret)
+				goto out;
+			sent++;
+		}
+
+		n = nvadsp_mbox_recv_batch(&t->mbox, words, ARRAY_SIZE(words),
+					   true, MSGQ_TEST_TIMEOUT_MS);
+		if (n < 0) {
+			ret = n;
+			goto out;
+		}
+		st->mbox_batches++;
+
+		for (i = 0; i < n; i++) {
+			/* replies come back in request order */
+			if (words[i] != st->done) {
+				ret = -EBADMSG;
+				goto out;
+			}
+			ret = msgq_test_recv(t, st->done, st);
+			if (ret)
+				goto out;
+			st->done++;
+		}
+	}
+
+out:
+	st->elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	return ret;
+}
+
+static int msgq_test_pass(bool inplace, u32 nr_msgs,
+			  struct msgq_test_stats *st)
+{
+	size_t qbytes = MSGQ_HEADER_SIZE +
+			MSGQ_TEST_QUEUE_WSIZE * sizeof(int32_t);
+	uint32_t words[MSGQ_TEST_WINDOW];
+	struct task_struct *adsp;
+	struct msgq_test *t;
+	uint16_t mid = 0;
+	int ret;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	t->h2a = kzalloc(qbytes, GFP_KERNEL);
+	t->a2h = kzalloc(qbytes, GFP_KERNEL);
+	if (!t->h2a || !t->a2h) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	msgq_init(t->h2a, MSGQ_TEST_QUEUE_WSIZE);
+	msgq_init(t->a2h, MSGQ_TEST_QUEUE_WSIZE);
+	t->inplace = inplace;
+
+	ret = nvadsp_mbox_open(&t->mbox, &mid, "msgq_test", NULL, NULL);
+	if (ret)
+		goto free;
+
+	adsp = kthread_run(msgq_test_adsp, t, "adsp_msgq_test");
+	if (IS_ERR(adsp)) {
+		ret = PTR_ERR(adsp);
+		goto close;
+	}
+
+	ret = msgq_test_run(t, nr_msgs, st);
+
+	kthread_stop(adsp);
+	st->adsp_errors = t->adsp_errors;
+	if (!ret && t->adsp_errors)
+		ret = -EIO;
+
+	/* a failed pass can leave doorbells behind */
+	while (nvadsp_mbox_recv_batch(&t->mbox, words, ARRAY_SIZE(words),
+				      false, 0) > 0)
+		;
+close:
+	nvadsp_mbox_close(&t->mbox);
+free:
+	kfree(t->a2h);
+	kfree(t->h2a);
+	kfree(t);
+	return ret;
+}
+
+static void msgq_test_report(struct seq_file *s, const char *mode, int ret,
+			     const struct msgq_test_stats *st)
+{
+	seq_printf(s, "%s: %s (%d)\n", mode, ret ? "FAIL" : "PASS", ret);
+	seq_printf(s, "  messages: %u\n", st->done);
+	seq_printf(s, "  sent: %u in place, %u copied\n",
+		   st->sent_inplace, st->sent_copy);
+	seq_printf(s, "  received: %u in place, %u copied\n",
+		   st->recv_inplace, st->recv_copy);
+	seq_printf(s, "  mailbox batches: %u\n", st->mbox_batches);
+	seq_printf(s, "  adsp errors: %u\n", st->adsp_errors);
+	seq_printf(s, "  ns per message: %llu\n",
+		   st->done ? div_u64(st->elapsed_ns, st->done) : 0);
+}
+
+static int msgq_test_show(struct seq_file *s, void *data)
+{
+	struct msgq_test_stats inplace = { 0 }, copy = { 0 };
+	int ret_inplace, ret_copy;
+
+	mutex_lock(&msgq_test_lock);
+	ret_inplace = msgq_test_pass(true, msgq_test_msgs, &inplace);
+	ret_copy = msgq_test_pass(false, msgq_test_msgs, &copy);
+	mutex_unlock(&msgq_test_lock);
+
+	msgq_test_report(s, "in-place", ret_inplace, &inplace);
+	msgq_test_report(s, "copy", ret_copy, &copy);
+
+	return 0;
+}
+
+static int msgq_test_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, msgq_test_show, inode->i_private);
+}
+
+static const struct file_operations msgq_test_fops = {
+	.open = msgq_test_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+int adsp_msgq_test_init(struct platform_device *pdev)
+{
+	struct nvadsp_drv_data *drv = platform_get_drvdata(pdev);
+	struct dentry *dir;
+
+	if (IS_ERR_OR_NULL(drv->adsp_debugfs_root))
+		return -ENOENT;
+
+	dir = debugfs_create_dir("msgq_test", drv->adsp_debugfs_root);
+	if (IS_ERR_OR_NULL(dir))
+		return -ENOMEM;
+
+	debugfs_create_u32("messages", S_IRUGO | S_IWUSR, dir,
+			   &msgq_test_msgs);
+
+	if (!debugfs_create_file("run", S_IRUSR, dir, NULL,
+				 &msgq_test_fops)) {
+		debugfs_remove_recursive(dir);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
@@ -456,6 +456,11 @@ static int __init nvadsp_probe(struct platform_device *pdev)
 	if (ret)
 		goto err;
 
+#ifdef CONFIG_TEGRA_ADSP_MSGQ_TEST
+	if (adsp_msgq_test_init(pdev))
+		dev_err(dev, "unable to create msgq test debug fs files\n");
+#endif
+
 #ifdef CONFIG_TEGRA_ADSP_ACTMON
 	ret = ape_actmon_probe(pdev);
 	if (ret)
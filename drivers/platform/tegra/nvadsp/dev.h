@@ -274,6 +274,10 @@ int adsp_cpustat_init(struct platform_device *pdev);
 int adsp_cpustat_exit(struct platform_device *pdev);
 #endif
 
+#ifdef CONFIG_TEGRA_ADSP_MSGQ_TEST
+int adsp_msgq_test_init(struct platform_device *pdev);
+#endif
+
 #if defined(CONFIG_TEGRA_ADSP_FILEIO)
 int adspff_init(struct platform_device *pdev);
 void adspff_exit(void);
@@ -25,23 +25,27 @@ static struct nvadsp_mbox *nvadsp_mboxes[NVADSP_MAILBOX_MAX];
 static DECLARE_BITMAP(nvadsp_mbox_ids, NVADSP_MAILBOX_MAX);
 static struct nvadsp_drv_data *nvadsp_drv_data;
 
+static inline uint16_t mboxq_count(struct nvadsp_mbox_queue *queue)
+{
+	return (uint16_t)(READ_ONCE(queue->tail) - READ_ONCE(queue->head));
+}
+
 static inline bool is_mboxq_empty(struct nvadsp_mbox_queue *queue)
 {
-	return (queue->count == 0);
+	return (mboxq_count(queue) == 0);
 }
 
 static inline bool is_mboxq_full(struct nvadsp_mbox_queue *queue)
 {
-	return (queue->count == NVADSP_MBOX_QUEUE_SIZE);
+	return (mboxq_count(queue) == NVADSP_MBOX_QUEUE_SIZE);
 }
 
 static void mboxq_init(struct nvadsp_mbox_queue *queue)
 {
 	queue->head = 0;
 	queue->tail = 0;
-	queue->count = 0;
-	init_completion(&queue->comp);
-	spin_lock_init(&queue->lock);
+	init_waitqueue_head(&queue->wait);
+	spin_lock_init(&queue->read_lock);
 }
 
 static void mboxq_destroy(struct nvadsp_mbox_queue *queue)
@@ -51,29 +55,26 @@ static void mboxq_destroy(struct nvadsp_mbox_queue *queue)
 
 	queue->head = 0;
 	queue->tail = 0;
-	queue->count = 0;
 }
 
+/* Producer side, called from the mailbox interrupt only */
 static status_t mboxq_enqueue(struct nvadsp_mbox_queue *queue,
 				   uint32_t data)
 {
-	unsigned long flags;
-	int ret = 0;
+	uint16_t tail = queue->tail;
 
-	if (is_mboxq_full(queue)) {
-		ret = -EINVAL;
-		goto out;
-	}
-	spin_lock_irqsave(&queue->lock, flags);
-	if (is_mboxq_empty(queue))
-		complete_all(&queue->comp);
-
-	queue->array[queue->tail] = data;
-	queue->tail = (queue->tail + 1) & NVADSP_MBOX_QUEUE_SIZE_MASK;
-	queue->count++;
-	spin_unlock_irqrestore(&queue->lock, flags);
- out:
-	return ret;
+	if ((uint16_t)(tail - smp_load_acquire(&queue->head)) ==
+						NVADSP_MBOX_QUEUE_SIZE)
+		return -EINVAL;
+
+	queue->array[tail & NVADSP_MBOX_QUEUE_SIZE_MASK] = data;
+	smp_store_release(&queue->tail, tail + 1);
+
+	/* wq_has_sleeper() orders the tail update against the waiter check */
+	if (wq_has_sleeper(&queue->wait))
+		wake_up(&queue->wait);
+
+	return 0;
 }
 
 status_t nvadsp_mboxq_enqueue(struct nvadsp_mbox_queue *queue,
@@ -82,55 +83,54 @@ status_t nvadsp_mboxq_enqueue(struct nvadsp_mbox_queue *queue,
 	return mboxq_enqueue(queue, data);
 }
 
-static status_t mboxq_dequeue(struct nvadsp_mbox_queue *queue,
-					  uint32_t *data)
+/*
+ * Consumer side. Dequeues up to @count words and returns the number of
+ * words dequeued, or -EBUSY if the queue is empty.
+ */
+static int mboxq_dequeue_batch(struct nvadsp_mbox_queue *queue,
+			       uint32_t *data, unsigned int count)
 {
 	unsigned long flags;
-	int ret = 0;
+	uint16_t head, avail;
+	unsigned int i;
+
+	spin_lock_irqsave(&queue->read_lock, flags);
 
-	spin_lock_irqsave(&queue->lock, flags);
-	if (is_mboxq_empty(queue)) {
-		ret = -EBUSY;
-		goto comp;
+	head = queue->head;
+	avail = smp_load_acquire(&queue->tail) - head;
+	if (avail == 0) {
+		spin_unlock_irqrestore(&queue->read_lock, flags);
+		return -EBUSY;
 	}
 
-	*data = queue->array[queue->head];
-	queue->head = (queue->head + 1) & NVADSP_MBOX_QUEUE_SIZE_MASK;
-	queue->count--;
+	count = min_t(unsigned int, count, avail);
+	for (i = 0; i < count; i++)
+		data[i] = queue->array[(head + i) & NVADSP_MBOX_QUEUE_SIZE_MASK];
 
-	if (is_mboxq_empty(queue))
-		goto comp;
-	else
-		goto out;
- comp:
-	reinit_completion(&queue->comp);
- out:
-	spin_unlock_irqrestore(&queue->lock, flags);
-	return ret;
+	smp_store_release(&queue->head, head + count);
+
+	spin_unlock_irqrestore(&queue->read_lock, flags);
+
+	return count;
 }
 
 static void mboxq_dump(struct nvadsp_mbox_queue *queue)
 {
-	unsigned long flags;
 	uint16_t head, count;
 	uint32_t data;
 
-	spin_lock_irqsave(&queue->lock, flags);
-
-	count = queue->count;
+	count = mboxq_count(queue);
 	pr_info("nvadsp: queue %p count:%d\n", queue, count);
 
 	pr_info("nvadsp: queue data: ");
-	head = queue->head;
+	head = READ_ONCE(queue->head);
 	while (count) {
-		data = queue->array[head];
-		head = (head + 1) & NVADSP_MBOX_QUEUE_SIZE_MASK;
+		data = queue->array[head & NVADSP_MBOX_QUEUE_SIZE_MASK];
+		head++;
 		count--;
 		pr_info("0x%x ", data);
 	}
 	pr_info(" dumped\n");
-
-	spin_unlock_irqrestore(&queue->lock, flags);
 }
 
 static uint16_t nvadsp_mbox_alloc_mboxid(void)
@@ -258,8 +258,20 @@ status_t nvadsp_mbox_send(struct nvadsp_mbox *mbox, uint32_t data,
 }
 EXPORT_SYMBOL(nvadsp_mbox_send);
 
-status_t nvadsp_mbox_recv(struct nvadsp_mbox *mbox, uint32_t *data, bool block,
-			  unsigned int timeout)
+/**
+ * nvadsp_mbox_recv_batch - receive several mailbox words at once
+ * @mbox:	mailbox opened without a handler
+ * @data:	output buffer
+ * @count:	capacity of @data in words
+ * @block:	wait for at least one word if the mailbox is empty
+ * @timeout:	wait timeout in msecs
+ *
+ * Returns the number of words received, or a negative error code.
+ * Concurrent readers each get a distinct, in-order run of words.
+ */
+int nvadsp_mbox_recv_batch(struct nvadsp_mbox *mbox, uint32_t *data,
+			   unsigned int count, bool block,
+			   unsigned int timeout)
 {
 	int ret = 0;
 
@@ -268,21 +280,21 @@ status_t nvadsp_mbox_recv(struct nvadsp_mbox *mbox, uint32_t *data, bool block,
 		goto out;
 	}
 
-	if (!mbox) {
+	if (!mbox || !data || !count) {
 		ret = -EINVAL;
 		goto out;
 	}
 
  retry:
-	ret = mboxq_dequeue(&mbox->recv_queue, data);
-	if (!ret)
+	ret = mboxq_dequeue_batch(&mbox->recv_queue, data, count);
+	if (ret > 0)
 		goto out;
 
 	if (ret == -EBUSY) {
 		if (block) {
-			ret = wait_for_completion_timeout(
-					  &mbox->recv_queue.comp,
-					  msecs_to_jiffies(timeout));
+			ret = wait_event_timeout(mbox->recv_queue.wait,
+					!is_mboxq_empty(&mbox->recv_queue),
+					msecs_to_jiffies(timeout));
 			if (ret) {
 				block = false;
 				goto retry;
@@ -300,6 +312,15 @@ status_t nvadsp_mbox_recv(struct nvadsp_mbox *mbox, uint32_t *data, bool block,
  out:
 	return ret;
 }
+EXPORT_SYMBOL(nvadsp_mbox_recv_batch);
+
+status_t nvadsp_mbox_recv(struct nvadsp_mbox *mbox, uint32_t *data, bool block,
+			  unsigned int timeout)
+{
+	int ret = nvadsp_mbox_recv_batch(mbox, data, 1, block, timeout);
+
+	return ret < 0 ? ret : 0;
+}
 EXPORT_SYMBOL(nvadsp_mbox_recv);
 
 status_t nvadsp_mbox_close(struct nvadsp_mbox *mbox)
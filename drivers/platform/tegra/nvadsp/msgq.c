@@ -87,6 +87,8 @@ int32_t msgq_queue_message(msgq_t *msgq, const msgq_message_t *message)
 			ret = -ENOSPC;
 		} else if (msize < qremainder) {
 			msgq_wmemcpy(first, message, msize);
+			/* message must land before the reader sees the index */
+			wmb();
 			msgq->write_index = wi + MSGQ_MESSAGE_HEADER_WSIZE +
 				message->size;
 		} else {
@@ -94,6 +96,7 @@ int32_t msgq_queue_message(msgq_t *msgq, const msgq_message_t *message)
 			msgq_wmemcpy(first, message, qremainder);
 			msgq_wmemcpy(msgq->queue, (int32_t *)message +
 				qremainder, msize - qremainder);
+			wmb();
 			msgq->write_index = wi + MSGQ_MESSAGE_HEADER_WSIZE +
 				message->size - msgq->size;
 		}
@@ -176,3 +179,119 @@ int32_t msgq_dequeue_message(msgq_t *msgq, msgq_message_t *message)
 	return ret;
 }
 EXPORT_SYMBOL(msgq_dequeue_message);
+/**
+ * msgq_reserve_message - Reserves space for a message in the queue
+ * @msgq:           pointer to the client message queue
+ * @size:           payload size of the message in words
+ * @message:        set to the reserved message slot on success
+ *
+ * This function returns 0 if no error has occurred. The caller builds
+ * the message directly in the queue and publishes it with
+ * msgq_commit_message(), which avoids the copy done by
+ * msgq_queue_message(). The payload size may be reduced, but not
+ * increased, before commit. -ENOSPC is returned if the queue cannot
+ * hold the message. -EAGAIN is returned if the message would wrap
+ * around the end of the queue; msgq_queue_message() must be used then.
+ *
+ * Only one message may be reserved at a time.
+ */
+int32_t msgq_reserve_message(msgq_t *msgq, int32_t size,
+			     msgq_message_t **message)
+{
+	int32_t ri, wi, qremainder, qsize, msize;
+	bool wrap;
+
+	if (!msgq || !message || size < 0) {
+		pr_err("NULL: msgq %p message %p\n", msgq, message);
+		return -EFAULT; /* Bad Address */
+	}
+
+	ri = READ_ONCE(msgq->read_index);
+	wi = msgq->write_index;
+	wrap = ri <= wi;
+	qremainder = wrap ? msgq->size - wi : ri - wi;
+	qsize = wrap ? qremainder + ri : qremainder;
+	msize = MSGQ_MESSAGE_HEADER_WSIZE + size;
+
+	if (qsize <= msize) {
+		/* don't allow read == write */
+		pr_err("%s failed: msgq ri: %d, wi %d, msg size %d\n",
+			__func__, ri, wi, size);
+		return -ENOSPC;
+	}
+
+	if (msize > qremainder)
+		return -EAGAIN;
+
+	*message = (msgq_message_t *)&msgq->queue[wi];
+	(*message)->size = size;
+
+	return 0;
+}
+EXPORT_SYMBOL(msgq_reserve_message);
+/**
+ * msgq_commit_message - Publishes a message reserved in the queue
+ * @msgq:           pointer to the client message queue
+ * @message:        message returned by msgq_reserve_message()
+ *
+ * This function returns 0 if no error has occurred, or -EINVAL if
+ * @message is not the slot at the current write index.
+ */
+int32_t msgq_commit_message(msgq_t *msgq, const msgq_message_t *message)
+{
+	int32_t wi;
+
+	if (!msgq || !message) {
+		pr_err("NULL: msgq %p message %p\n", msgq, message);
+		return -EFAULT; /* Bad Address */
+	}
+
+	wi = msgq->write_index;
+	if ((const int32_t *)message != &msgq->queue[wi])
+		return -EINVAL;
+
+	wi += MSGQ_MESSAGE_HEADER_WSIZE + message->size;
+
+	/* message contents must land before the reader sees the index */
+	wmb();
+	msgq->write_index = wi < msgq->size ? wi : wi - msgq->size;
+
+	return 0;
+}
+EXPORT_SYMBOL(msgq_commit_message);
+/**
+ * msgq_peek_message - Returns the message at the head of the queue
+ * @msgq:           pointer to the client message queue
+ * @message:        set to the message at the head of the queue
+ *
+ * This function returns 0 if no error has occurred. The message is
+ * read in place and is released with msgq_discard_message() once the
+ * caller is done with it. -ENOMSG is returned if the queue is empty
+ * and -EAGAIN if the message wraps around the end of the queue, in
+ * which case msgq_dequeue_message() must be used.
+ */
+int32_t msgq_peek_message(msgq_t *msgq, msgq_message_t **message)
+{
+	msgq_message_t *msg;
+	int32_t ri;
+
+	if (!msgq || !message) {
+		pr_err("NULL: msgq %p message %p\n", msgq, message);
+		return -EFAULT; /* Bad Address */
+	}
+
+	ri = msgq->read_index;
+	if (ri == READ_ONCE(msgq->write_index))
+		return -ENOMSG;
+
+	/* read message contents only after observing the write index */
+	rmb();
+	msg = (msgq_message_t *)&msgq->queue[ri];
+	if (ri + MSGQ_MESSAGE_HEADER_WSIZE + msg->size > msgq->size)
+		return -EAGAIN;
+
+	*message = msg;
+
+	return 0;
+}
+EXPORT_SYMBOL(msgq_peek_message);
@@ -24,6 +24,8 @@
 #include <linux/hardirq.h>
 #include <linux/interrupt.h>
 #include <linux/iopoll.h>
+#include <linux/completion.h>
+#include <linux/list.h>
 
 #include "tegra_virt_alt_ivc.h"
 #include "tegra_virt_alt_ivc_common.h"
@@ -33,44 +35,236 @@ static struct nvaudio_ivc_ctxt *saved_ivc_ctxt;
 static void nvaudio_ivc_deinit(struct nvaudio_ivc_ctxt *ictxt);
 static int nvaudio_ivc_init(struct nvaudio_ivc_ctxt *ictxt);
 
-int nvaudio_ivc_send_retry(struct nvaudio_ivc_ctxt *ictxt,
-		struct nvaudio_ivc_msg *msg, int size)
+/* A reply slot for one request. The server answers requests in the
+ * order it receives them, so replies are counted on ictxt->rx_seq and
+ * the reply numbered req->seq belongs to req. A reply numbered before
+ * the oldest pending request is late and dropped.
+ *
+ * When a request times out its reply may have been lost or may still
+ * arrive. rx_seq is moved on to the oldest request still pending so a
+ * lost reply cannot hold back every later one, and the request is
+ * counted in rx_late. While rx_late is set, a reply whose cmd does not
+ * match the request it is numbered for is taken as such a late reply:
+ * it is dropped without consuming the number. A late reply with the
+ * same cmd cannot be told apart, the wire format carries no tag.
+ */
+struct nvaudio_ivc_req {
+	struct list_head		node;
+	struct nvaudio_ivc_ctxt		*ictxt;
+	struct nvaudio_ivc_msg		*msg;
+	struct completion		done;
+	u32				seq;
+	int				err;
+};
+
+static void nvaudio_ivc_delay(bool atomic)
+{
+	if (atomic)
+		udelay(100);
+	else
+		usleep_range(100, 200);
+}
+
+static int nvaudio_ivc_wait_notified(struct nvaudio_ivc_ctxt *ictxt,
+		bool atomic)
 {
-	int err = 0;
 	int dcnt = 50;
 
-	if (!ictxt || !ictxt->ivck || !msg || !size)
-		return -EINVAL;
+	while (tegra_hv_ivc_channel_notified(ictxt->ivck) != 0) {
+		dev_err(ictxt->dev, "channel notified returns non zero\n");
+		dcnt--;
+		nvaudio_ivc_delay(atomic);
+		if (!dcnt)
+			return -EIO;
+	}
 
-	err = nvaudio_ivc_send(ictxt, msg, size);
+	return 0;
+}
 
-	while (err < 0 && dcnt--) {
-		udelay(100);
-		err = nvaudio_ivc_send(ictxt, msg, size);
+/* Move rx_seq on to the oldest pending request; ivck_rx_lock held */
+static void nvaudio_ivc_rx_resync(struct nvaudio_ivc_ctxt *ictxt)
+{
+	struct nvaudio_ivc_req *head;
+	u32 seq;
+
+	head = list_first_entry_or_null(&ictxt->pending,
+				struct nvaudio_ivc_req, node);
+	seq = head ? head->seq : ictxt->tx_seq;
+
+	if ((s32)(seq - ictxt->rx_seq) > 0)
+		ictxt->rx_seq = seq;
+}
+
+/* Hand every available reply to the request waiting for it */
+static void nvaudio_ivc_rx_drain(struct nvaudio_ivc_ctxt *ictxt)
+{
+	struct nvaudio_ivc_msg *rx_msg = &ictxt->rx_msg;
+	struct nvaudio_ivc_req *req;
+	unsigned long flags = 0;
+	int len;
+
+	spin_lock_irqsave(&ictxt->ivck_rx_lock, flags);
+
+	while (tegra_hv_ivc_can_read(ictxt->ivck)) {
+		len = tegra_hv_ivc_read(ictxt->ivck, rx_msg,
+					sizeof(struct nvaudio_ivc_msg));
+
+		req = list_first_entry_or_null(&ictxt->pending,
+					struct nvaudio_ivc_req, node);
+		if (!req || (s32)(ictxt->rx_seq - req->seq) < 0) {
+			dev_warn_ratelimited(ictxt->dev,
+				"dropping late reply, cmd %d\n", rx_msg->cmd);
+			if (ictxt->rx_late)
+				ictxt->rx_late--;
+			ictxt->rx_seq++;
+			nvaudio_ivc_rx_resync(ictxt);
+			continue;
+		}
+
+		if (ictxt->rx_late && len == sizeof(struct nvaudio_ivc_msg) &&
+		    rx_msg->cmd != req->msg->cmd) {
+			dev_warn_ratelimited(ictxt->dev,
+				"dropping late reply, cmd %d\n", rx_msg->cmd);
+			ictxt->rx_late--;
+			continue;
+		}
+
+		ictxt->rx_seq = req->seq + 1;
+		list_del_init(&req->node);
+		if (len != sizeof(struct nvaudio_ivc_msg)) {
+			dev_err(ictxt->dev,
+				"IVC read failure (msg size error)\n");
+			req->err = -EIO;
+		} else if (rx_msg->cmd != req->msg->cmd) {
+			dev_err(ictxt->dev, "reply cmd %d for request cmd %d\n",
+				rx_msg->cmd, req->msg->cmd);
+			req->err = -EIO;
+		} else {
+			memcpy(req->msg, rx_msg, sizeof(struct nvaudio_ivc_msg));
+			req->err = len;
+		}
+		complete(&req->done);
+	}
+
+	spin_unlock_irqrestore(&ictxt->ivck_rx_lock, flags);
+}
+
+static irqreturn_t nvaudio_ivc_irq(int irq, void *data)
+{
+	struct nvaudio_ivc_ctxt *ictxt = data;
+
+	if (tegra_hv_ivc_channel_notified(ictxt->ivck) != 0)
+		return IRQ_HANDLED;
+
+	nvaudio_ivc_rx_drain(ictxt);
+
+	return IRQ_HANDLED;
+}
+
+static int nvaudio_ivc_submit(struct nvaudio_ivc_req *req, int size)
+{
+	struct nvaudio_ivc_ctxt *ictxt = req->ictxt;
+	unsigned long flags = 0;
+	int len, err = 0;
+
+	spin_lock_irqsave(&ictxt->ivck_rx_lock, flags);
+	spin_lock(&ictxt->ivck_tx_lock);
+
+	if (!tegra_hv_ivc_can_write(ictxt->ivck)) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	/* Queue first, the reply must not find an empty pending list */
+	req->seq = ictxt->tx_seq;
+	list_add_tail(&req->node, &ictxt->pending);
+
+	len = tegra_hv_ivc_write(ictxt->ivck, req->msg, size);
+	if (len != size) {
+		pr_err("%s: write Error\n", __func__);
+		list_del_init(&req->node);
+		err = -EIO;
+		goto out;
+	}
+	ictxt->tx_seq++;
+
+out:
+	spin_unlock(&ictxt->ivck_tx_lock);
+	spin_unlock_irqrestore(&ictxt->ivck_rx_lock, flags);
+	return err;
+}
+
+static int nvaudio_ivc_submit_retry(struct nvaudio_ivc_req *req, int size,
+		bool atomic)
+{
+	int err;
+	int dcnt = 50;
+
+	init_completion(&req->done);
+	INIT_LIST_HEAD(&req->node);
+	req->err = -ETIMEDOUT;
+
+	err = nvaudio_ivc_submit(req, size);
+
+	while (err == -EBUSY && dcnt--) {
+		nvaudio_ivc_delay(atomic);
+		err = nvaudio_ivc_submit(req, size);
 	}
 	return (dcnt < 0) ? -ETIMEDOUT : err;
+}
+
+static bool nvaudio_ivc_req_done(struct nvaudio_ivc_req *req)
+{
+	nvaudio_ivc_rx_drain(req->ictxt);
 
+	return completion_done(&req->done);
 }
-EXPORT_SYMBOL_GPL(nvaudio_ivc_send_retry);
 
-int nvaudio_ivc_send(struct nvaudio_ivc_ctxt *ictxt,
-		struct nvaudio_ivc_msg *msg, int size)
+/* Replies are polled for in atomic context or when the irq is missing */
+static int nvaudio_ivc_wait_reply(struct nvaudio_ivc_req *req, bool atomic)
+{
+	struct nvaudio_ivc_ctxt *ictxt = req->ictxt;
+	unsigned long flags = 0;
+	bool done = false;
+	int err;
+
+	if (atomic)
+		readx_poll_timeout_atomic(nvaudio_ivc_req_done, req, done,
+				done, 10, NVAUDIO_IVC_WAIT_TIMEOUT);
+	else if (!ictxt->irq_ready)
+		readx_poll_timeout(nvaudio_ivc_req_done, req, done,
+				done, 100, NVAUDIO_IVC_WAIT_TIMEOUT);
+	else
+		wait_for_completion_timeout(&req->done,
+				usecs_to_jiffies(NVAUDIO_IVC_WAIT_TIMEOUT));
+
+	spin_lock_irqsave(&ictxt->ivck_rx_lock, flags);
+	if (!list_empty(&req->node)) {
+		/* no reply, do not let later replies wait behind it */
+		list_del_init(&req->node);
+		ictxt->rx_late++;
+		nvaudio_ivc_rx_resync(ictxt);
+		pr_err("%s: Waited too long for msg reply\n", __func__);
+	}
+	err = req->err;
+	spin_unlock_irqrestore(&ictxt->ivck_rx_lock, flags);
+
+	return err;
+}
+
+static int __nvaudio_ivc_send(struct nvaudio_ivc_ctxt *ictxt,
+		struct nvaudio_ivc_msg *msg, int size, bool atomic)
 {
 	int len = 0;
 	unsigned long flags = 0;
 	int err = 0;
-	int dcnt = 50;
 
 	if (!ictxt || !ictxt->ivck || !msg || !size)
 		return -EINVAL;
 
-	while (tegra_hv_ivc_channel_notified(ictxt->ivck) != 0) {
-		dev_err(ictxt->dev, "channel notified returns non zero\n");
-		dcnt--;
-		udelay(100);
-		if (!dcnt)
-			return -EIO;
-	}
+	err = nvaudio_ivc_wait_notified(ictxt, atomic);
+	if (err)
+		return err;
 
 	spin_lock_irqsave(&ictxt->ivck_tx_lock, flags);
 
@@ -92,80 +286,98 @@ fail:
 	spin_unlock_irqrestore(&ictxt->ivck_tx_lock, flags);
 	return err;
 }
-EXPORT_SYMBOL_GPL(nvaudio_ivc_send);
 
-int nvaudio_ivc_send_receive(struct nvaudio_ivc_ctxt *ictxt,
-			struct nvaudio_ivc_msg *rx_msg, int size)
+static int __nvaudio_ivc_send_retry(struct nvaudio_ivc_ctxt *ictxt,
+		struct nvaudio_ivc_msg *msg, int size, bool atomic)
 {
-
-	int len = 0;
-	unsigned long flags = 0, flags1 = 0;
 	int err = 0;
 	int dcnt = 50;
-	int status = -1;
-	struct nvaudio_ivc_msg *msg = rx_msg;
 
 	if (!ictxt || !ictxt->ivck || !msg || !size)
 		return -EINVAL;
 
-	while (tegra_hv_ivc_channel_notified(ictxt->ivck) != 0) {
-		dev_err(ictxt->dev, "channel notified returns non zero\n");
-		dcnt--;
-		udelay(100);
-		if (!dcnt)
-			return -EIO;
+	err = __nvaudio_ivc_send(ictxt, msg, size, atomic);
+
+	while (err < 0 && dcnt--) {
+		nvaudio_ivc_delay(atomic);
+		err = __nvaudio_ivc_send(ictxt, msg, size, atomic);
 	}
+	return (dcnt < 0) ? -ETIMEDOUT : err;
+}
 
-	spin_lock_irqsave(&ictxt->ivck_rx_lock, flags);
-	spin_lock_irqsave(&ictxt->ivck_tx_lock, flags1);
+static int __nvaudio_ivc_send_receive(struct nvaudio_ivc_ctxt *ictxt,
+		struct nvaudio_ivc_msg *rx_msg, int size, bool atomic)
+{
+	struct nvaudio_ivc_req req;
+	int err;
 
-	if (!tegra_hv_ivc_can_write(ictxt->ivck)) {
-		err = -EBUSY;
-		spin_unlock_irqrestore(&ictxt->ivck_tx_lock, flags1);
-		goto fail;
-	}
+	if (!ictxt || !ictxt->ivck || !rx_msg || !size)
+		return -EINVAL;
 
-	len = tegra_hv_ivc_write(ictxt->ivck, msg, size);
-	if (len != size) {
-		pr_err("%s: write Error\n", __func__);
-		err = -EIO;
-		spin_unlock_irqrestore(&ictxt->ivck_tx_lock, flags1);
-		goto fail;
-	}
-	spin_unlock_irqrestore(&ictxt->ivck_tx_lock, flags1);
+	err = nvaudio_ivc_wait_notified(ictxt, atomic);
+	if (err)
+		return err;
 
-	err = readx_poll_timeout_atomic(tegra_hv_ivc_can_read, ictxt->ivck,
-			status, status, 10, NVAUDIO_IVC_WAIT_TIMEOUT);
+	req.ictxt = ictxt;
+	req.msg = rx_msg;
 
-	if (err == -ETIMEDOUT) {
-		pr_err("%s: Waited too long for msg reply\n", __func__);
-		goto fail;
-	}
+	err = nvaudio_ivc_submit_retry(&req, size, atomic);
+	if (err)
+		return err;
 
-	/* Message available */
-	memset(rx_msg, 0, sizeof(struct nvaudio_ivc_msg));
-	len = tegra_hv_ivc_read(ictxt->ivck,
-				rx_msg,
-				sizeof(struct nvaudio_ivc_msg));
-	if (len != sizeof(struct nvaudio_ivc_msg)) {
-		dev_err(ictxt->dev, "IVC read failure (msg size error)\n");
-		err = -1;
-		goto fail;
-	}
-	err = len;
+	return nvaudio_ivc_wait_reply(&req, atomic);
+}
 
-fail:
-	spin_unlock_irqrestore(&ictxt->ivck_rx_lock, flags);
+/*
+ * The plain calls below may sleep. Callers in atomic context, e.g. a PCM
+ * trigger under the stream lock, use the _atomic variants, which only
+ * busy-wait.
+ */
+int nvaudio_ivc_send(struct nvaudio_ivc_ctxt *ictxt,
+		struct nvaudio_ivc_msg *msg, int size)
+{
+	might_sleep();
+	return __nvaudio_ivc_send(ictxt, msg, size, false);
+}
+EXPORT_SYMBOL_GPL(nvaudio_ivc_send);
 
-	return err;
+int nvaudio_ivc_send_retry(struct nvaudio_ivc_ctxt *ictxt,
+		struct nvaudio_ivc_msg *msg, int size)
+{
+	might_sleep();
+	return __nvaudio_ivc_send_retry(ictxt, msg, size, false);
+}
+EXPORT_SYMBOL_GPL(nvaudio_ivc_send_retry);
+
+int nvaudio_ivc_send_retry_atomic(struct nvaudio_ivc_ctxt *ictxt,
+		struct nvaudio_ivc_msg *msg, int size)
+{
+	return __nvaudio_ivc_send_retry(ictxt, msg, size, true);
+}
+EXPORT_SYMBOL_GPL(nvaudio_ivc_send_retry_atomic);
 
+/* Send a request and wait for its reply, which is copied back into msg.
+ * Other requests may be in flight at the same time.
+ */
+int nvaudio_ivc_send_receive(struct nvaudio_ivc_ctxt *ictxt,
+			struct nvaudio_ivc_msg *rx_msg, int size)
+{
+	might_sleep();
+	return __nvaudio_ivc_send_receive(ictxt, rx_msg, size, false);
 }
 EXPORT_SYMBOL_GPL(nvaudio_ivc_send_receive);
 
+int nvaudio_ivc_send_receive_atomic(struct nvaudio_ivc_ctxt *ictxt,
+			struct nvaudio_ivc_msg *rx_msg, int size)
+{
+	return __nvaudio_ivc_send_receive(ictxt, rx_msg, size, true);
+}
+EXPORT_SYMBOL_GPL(nvaudio_ivc_send_receive_atomic);
+
 /* Every communication with the server is identified
  * with this ivc context.
- * There can be one outstanding request to the server per
- * ivc context.
+ * Several requests to the server can be outstanding per
+ * ivc context; replies are matched in order.
  */
 struct nvaudio_ivc_ctxt *nvaudio_ivc_alloc_ctxt(struct device *dev)
 {
@@ -184,16 +396,25 @@ struct nvaudio_ivc_ctxt *nvaudio_ivc_alloc_ctxt(struct device *dev)
 	saved_ivc_ctxt = ictxt;
 	ictxt->dev = dev;
 	ictxt->timeout = 250; /* Not used in polling */
+	spin_lock_init(&ictxt->ivck_rx_lock);
+	spin_lock_init(&ictxt->ivck_tx_lock);
+	INIT_LIST_HEAD(&ictxt->pending);
+
 	if (nvaudio_ivc_init(ictxt) != 0) {
 		dev_err(dev, "nvaudio_ivc_init failed\n");
 		goto fail;
 	}
 
-	spin_lock_init(&ictxt->ivck_rx_lock);
-	spin_lock_init(&ictxt->ivck_tx_lock);
-
 	tegra_hv_ivc_channel_reset(ictxt->ivck);
 
+	/* Without the irq, replies are still collected by polling */
+	if (request_irq(ictxt->ivck->irq, nvaudio_ivc_irq, 0,
+			dev_name(dev), ictxt))
+		dev_warn(dev, "no ivc irq %d, polling for replies\n",
+			 ictxt->ivck->irq);
+	else
+		ictxt->irq_ready = true;
+
 	return ictxt;
 fail:
 	nvaudio_ivc_free_ctxt(dev);
@@ -224,8 +445,14 @@ EXPORT_SYMBOL_GPL(nvaudio_ivc_free_ctxt);
 
 static void nvaudio_ivc_deinit(struct nvaudio_ivc_ctxt *ictxt)
 {
-	if (ictxt)
-		tegra_hv_ivc_unreserve(ictxt->ivck);
+	if (!ictxt || !ictxt->ivck)
+		return;
+
+	if (ictxt->irq_ready) {
+		free_irq(ictxt->ivck->irq, ictxt);
+		ictxt->irq_ready = false;
+	}
+	tegra_hv_ivc_unreserve(ictxt->ivck);
 }
 
 static int nvaudio_ivc_init(struct nvaudio_ivc_ctxt *ictxt)
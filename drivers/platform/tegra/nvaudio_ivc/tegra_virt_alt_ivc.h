@@ -33,6 +33,15 @@ struct nvaudio_ivc_ctxt {
 	spinlock_t			ivck_rx_lock;
 	spinlock_t			ivck_tx_lock;
 	spinlock_t			lock;
+	/* requests awaiting a reply, oldest first; under ivck_rx_lock */
+	struct list_head		pending;
+	/* requests written and replies read so far; under ivck_rx_lock */
+	u32				tx_seq;
+	u32				rx_seq;
+	/* timed out requests whose reply may still arrive */
+	u32				rx_late;
+	struct nvaudio_ivc_msg		rx_msg;
+	bool				irq_ready;
 };
 
 void nvaudio_ivc_rx(struct tegra_hv_ivc_cookie *ivck);
@@ -49,10 +58,18 @@ int nvaudio_ivc_send_retry(struct nvaudio_ivc_ctxt *ictxt,
 				struct nvaudio_ivc_msg *msg,
 				int size);
 
+int nvaudio_ivc_send_retry_atomic(struct nvaudio_ivc_ctxt *ictxt,
+				struct nvaudio_ivc_msg *msg,
+				int size);
+
 int nvaudio_ivc_send_receive(struct nvaudio_ivc_ctxt *ictxt,
 				struct nvaudio_ivc_msg *msg,
 				int size);
 
+int nvaudio_ivc_send_receive_atomic(struct nvaudio_ivc_ctxt *ictxt,
+				struct nvaudio_ivc_msg *msg,
+				int size);
+
 int tegra124_virt_xbar_set_ivc(struct nvaudio_ivc_ctxt *ictxt,
 					int rx_idx,
 					int tx_idx);
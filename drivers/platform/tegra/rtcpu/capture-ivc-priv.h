@@ -27,6 +27,15 @@
 #define TOTAL_CHANNELS (NUM_CAPTURE_CHANNELS + NUM_CAPTURE_TRANSACTION_IDS)
 #define TRANS_ID_START_IDX NUM_CAPTURE_CHANNELS
 
+/** Maximum number of low-latency dispatch threads per IVC channel */
+#define CAPTURE_IVC_MAX_DISPATCH_THREADS 8
+
+/** Number of message slots in each dispatch queue (power of two) */
+#define CAPTURE_IVC_DISPATCH_QUEUE_LEN 64
+
+/** Number of log2(usec) buckets in the callback latency histogram */
+#define CAPTURE_IVC_LATENCY_BUCKETS 16
+
 /**
  * @brief Callback context of an IVC channel.
  */
@@ -39,6 +48,52 @@ struct tegra_capture_ivc_cb_ctx {
 	const void *priv_context;
 };
 
+/**
+ * @brief Latency histogram of one channel, measured from the RTCPU
+ *	notification to the completion of the client callback.
+ */
+struct tegra_capture_ivc_latency {
+	/** Number of callbacks per log2(usec) bucket */
+	u64 buckets[CAPTURE_IVC_LATENCY_BUCKETS];
+	/** Number of callbacks invoked */
+	u64 count;
+	/** Sum of all latencies in nanoseconds */
+	u64 total_ns;
+	/** Worst latency in nanoseconds */
+	u64 max_ns;
+};
+
+struct tegra_capture_ivc;
+
+/**
+ * @brief Low-latency dispatch thread context.
+ *
+ * Messages are copied out of the IVC frame by the reader and queued
+ * here; the dispatch thread then invokes the client callbacks. A given
+ * channel is always served by the same dispatch thread, so per-channel
+ * message ordering is preserved.
+ */
+struct tegra_capture_ivc_dispatch {
+	/** Back pointer to the owning IVC channel context */
+	struct tegra_capture_ivc *civc;
+	/** High-priority kthread worker */
+	struct kthread_worker *worker;
+	/** Work item draining the message queue */
+	struct kthread_work work;
+	/** Producer index (reader) */
+	unsigned int head;
+	/** Consumer index (dispatch thread) */
+	unsigned int tail;
+	/** Message slots, CAPTURE_IVC_DISPATCH_QUEUE_LEN * frame_size bytes */
+	u8 *slots;
+	/** Notification timestamp of each queued message */
+	ktime_t stamps[CAPTURE_IVC_DISPATCH_QUEUE_LEN];
+	/** Number of times the work item was queued */
+	u64 wakeups;
+	/** Number of messages dispatched */
+	u64 messages;
+};
+
 /**
  * @brief IVC channel context.
  */
@@ -59,6 +114,28 @@ struct tegra_capture_ivc {
 	spinlock_t avl_ctx_list_lock;
 	/** Linked list holding callback contexts */
 	struct list_head avl_ctx_list;
+	/**
+	 * Time in ns of the oldest RTCPU notification not yet serviced by
+	 * the reader, 0 if none. Messages are stamped with it when read.
+	 */
+	atomic64_t notify_ns;
+	/** Number of dispatch threads, 0 if callbacks run in @ref work */
+	unsigned int num_dispatch;
+	/** Size of a message slot in the dispatch queues */
+	size_t slot_size;
+	/** High-priority reader thread, used in dispatch mode */
+	struct kthread_worker *rx_worker;
+	/** Reader work item, used in dispatch mode */
+	struct kthread_work rx_work;
+	/** 1 if the reader stalled on a full dispatch queue, -1 on removal */
+	atomic_t rx_stalled;
+	/** Dispatch thread contexts */
+	struct tegra_capture_ivc_dispatch dispatch[
+		CAPTURE_IVC_MAX_DISPATCH_THREADS];
+	/** Per-channel callback latency histograms */
+	struct tegra_capture_ivc_latency *latency;
+	/** debugfs directory */
+	struct dentry *debugfs;
 };
 
 /**
@@ -100,6 +177,25 @@ static struct tegra_capture_ivc *__scivc_capture;
 static void tegra_capture_ivc_worker(
 	struct work_struct *work);
 
+/**
+ * @brief Reader thread used in low-latency dispatch mode. Copies the
+ *	pending IVC frames into the per-thread dispatch queues and wakes
+ *	each dispatch thread once per batch.
+ *
+ * @param[in]	work	kthread_work pointer
+ */
+static void tegra_capture_ivc_rx_work(
+	struct kthread_work *work);
+
+/**
+ * @brief Dispatch thread used in low-latency dispatch mode. Invokes the
+ *	client callbacks for the messages queued by the reader.
+ *
+ * @param[in]	work	kthread_work pointer
+ */
+static void tegra_capture_ivc_dispatch_work(
+	struct kthread_work *work);
+
 /**
  * @brief Implementation of IVC notify operation which gets called when we any
  * 	new message on the bus for the channel. This signals the worker thread.
@@ -20,14 +20,24 @@
 #include <linux/tegra-capture-ivc.h>
 
 #include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
 #include <linux/pm_runtime.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/tegra-ivc.h>
 #include <linux/tegra-ivc-bus.h>
 #include <linux/nospec.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+#include <uapi/linux/sched/types.h>
+#endif
 
 #include <asm/barrier.h>
 
@@ -38,6 +48,11 @@
 /* Temporay csi channel-id */
 #define CSI_TEMP_CHANNEL_ID 65
 
+static unsigned int dispatch_threads;
+module_param(dispatch_threads, uint, 0444);
+MODULE_PARM_DESC(dispatch_threads,
+	"High-priority callback dispatch threads per channel (0: workqueue)");
+
 static int tegra_capture_ivc_tx(struct tegra_capture_ivc *civc,
 				const void *req, size_t len)
 {
@@ -325,10 +340,33 @@ int tegra_capture_ivc_unregister_capture_cb(uint32_t chan_id)
 }
 EXPORT_SYMBOL(tegra_capture_ivc_unregister_capture_cb);
 
+static void tegra_capture_ivc_record_latency(
+	struct tegra_capture_ivc *civc,
+	uint32_t id,
+	ktime_t stamp)
+{
+	struct tegra_capture_ivc_latency *lat = &civc->latency[id];
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), stamp));
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	unsigned int bucket = 0;
+
+	/* Bucket 0 is below 1us, bucket n covers [2^(n-1), 2^n) us */
+	if (us != 0)
+		bucket = min_t(unsigned int, ilog2(us) + 1,
+				CAPTURE_IVC_LATENCY_BUCKETS - 1);
+
+	lat->buckets[bucket]++;
+	lat->count++;
+	lat->total_ns += ns;
+	if (ns > lat->max_ns)
+		lat->max_ns = ns;
+}
+
 static inline void tegra_capture_ivc_recv_msg(
 	struct tegra_capture_ivc *civc,
 	uint32_t id,
-	const struct tegra_capture_ivc_resp *msg)
+	const struct tegra_capture_ivc_resp *msg,
+	ktime_t stamp)
 {
 	struct device *dev = &civc->chan->dev;
 
@@ -346,6 +384,35 @@ static inline void tegra_capture_ivc_recv_msg(
 	} else {
 		/* Invoke client callback. */
 		civc->cb_ctx[id].cb_func(msg, civc->cb_ctx[id].priv_context);
+		tegra_capture_ivc_record_latency(civc, id, stamp);
+	}
+}
+
+/*
+ * Claim the oldest pending notification time for the frames about to be
+ * read. Using the oldest rather than the latest notification keeps
+ * frames queued behind a burst from being credited with a later arrival.
+ */
+static ktime_t tegra_capture_ivc_take_stamp(struct tegra_capture_ivc *civc)
+{
+	s64 ns = atomic64_xchg(&civc->notify_ns, 0);
+
+	return ns != 0 ? ns_to_ktime(ns) : ktime_get();
+}
+
+/* Hand back a claimed stamp for frames left unread in IVC */
+static void tegra_capture_ivc_return_stamp(struct tegra_capture_ivc *civc,
+					ktime_t stamp)
+{
+	s64 ns = ktime_to_ns(stamp);
+	s64 old = atomic64_read(&civc->notify_ns);
+	s64 prev;
+
+	while (old == 0 || old > ns) {
+		prev = atomic64_cmpxchg(&civc->notify_ns, old, ns);
+		if (prev == old)
+			break;
+		old = prev;
 	}
 }
 
@@ -353,6 +420,7 @@ static inline void tegra_capture_ivc_recv(struct tegra_capture_ivc *civc)
 {
 	struct ivc *ivc = &civc->chan->ivc;
 	const struct tegra_capture_ivc_resp *msg;
+	ktime_t stamp = tegra_capture_ivc_take_stamp(civc);
 	uint32_t id;
 
 	while (tegra_ivc_can_read(ivc)) {
@@ -362,7 +430,7 @@ static inline void tegra_capture_ivc_recv(struct tegra_capture_ivc *civc)
 		/* Check if message is valid */
 		if (!WARN(id >= TOTAL_CHANNELS, "Invalid rtcpu response id %u", id)) {
 			id = array_index_nospec(id, TOTAL_CHANNELS);
-			tegra_capture_ivc_recv_msg(civc, id, msg);
+			tegra_capture_ivc_recv_msg(civc, id, msg, stamp);
 		}
 
 		tegra_ivc_read_advance(ivc);
@@ -393,13 +461,299 @@ static void tegra_capture_ivc_worker(struct work_struct *work)
 	}
 }
 
+static void tegra_capture_ivc_queue(struct tegra_capture_ivc *civc)
+{
+	struct ivc *ivc = &civc->chan->ivc;
+	const struct tegra_capture_ivc_resp *msg;
+	struct tegra_capture_ivc_dispatch *disp;
+	ktime_t stamp = tegra_capture_ivc_take_stamp(civc);
+	unsigned long pending = 0;
+	unsigned int head, slot, i;
+	uint32_t id;
+
+	while (tegra_ivc_can_read(ivc)) {
+		msg = tegra_ivc_read_get_next_frame(ivc);
+		id = msg->header.channel_id;
+
+		/* Check if message is valid */
+		if (!WARN(id >= TOTAL_CHANNELS, "Invalid rtcpu response id %u", id)) {
+			id = array_index_nospec(id, TOTAL_CHANNELS);
+			disp = &civc->dispatch[id % civc->num_dispatch];
+			head = disp->head;
+
+			/*
+			 * Leave the frame in IVC if the dispatch queue is
+			 * full, the dispatch thread kicks the reader again
+			 * once it has made room.
+			 */
+			if (head - smp_load_acquire(&disp->tail) >=
+					CAPTURE_IVC_DISPATCH_QUEUE_LEN) {
+				atomic_cmpxchg(&civc->rx_stalled, 0, 1);
+				tegra_capture_ivc_return_stamp(civc, stamp);
+				__set_bit(disp - civc->dispatch, &pending);
+				break;
+			}
+
+			slot = head % CAPTURE_IVC_DISPATCH_QUEUE_LEN;
+			memcpy(disp->slots + slot * civc->slot_size, msg,
+				civc->slot_size);
+			disp->stamps[slot] = stamp;
+			smp_store_release(&disp->head, head + 1);
+
+			__set_bit(disp - civc->dispatch, &pending);
+		}
+
+		tegra_ivc_read_advance(ivc);
+	}
+
+	/* Wake up each dispatch thread once for the whole batch */
+	for_each_set_bit(i, &pending, civc->num_dispatch) {
+		disp = &civc->dispatch[i];
+		disp->wakeups++;
+		kthread_queue_work(disp->worker, &disp->work);
+	}
+}
+
+static void tegra_capture_ivc_rx_work(struct kthread_work *work)
+{
+	struct tegra_capture_ivc *civc;
+	struct tegra_ivc_channel *chan;
+
+	civc = container_of(work, struct tegra_capture_ivc, rx_work);
+	chan = civc->chan;
+
+	if (pm_runtime_get_if_in_use(&chan->dev) > 0) {
+		WARN_ON(!chan->is_ready);
+
+		tegra_capture_ivc_queue(civc);
+
+		pm_runtime_put(&chan->dev);
+	} else {
+		dev_dbg(&chan->dev, "extra wakeup");
+	}
+}
+
+static void tegra_capture_ivc_dispatch_work(struct kthread_work *work)
+{
+	struct tegra_capture_ivc_dispatch *disp;
+	struct tegra_capture_ivc *civc;
+	const struct tegra_capture_ivc_resp *msg;
+	unsigned int tail, slot;
+	uint32_t id;
+
+	disp = container_of(work, struct tegra_capture_ivc_dispatch, work);
+	civc = disp->civc;
+	tail = disp->tail;
+
+	while (tail != smp_load_acquire(&disp->head)) {
+		slot = tail % CAPTURE_IVC_DISPATCH_QUEUE_LEN;
+		msg = (const struct tegra_capture_ivc_resp *)
+			(disp->slots + slot * civc->slot_size);
+		id = array_index_nospec(msg->header.channel_id,
+					TOTAL_CHANNELS);
+
+		tegra_capture_ivc_recv_msg(civc, id, msg, disp->stamps[slot]);
+
+		smp_store_release(&disp->tail, ++tail);
+		disp->messages++;
+	}
+
+	if (atomic_cmpxchg(&civc->rx_stalled, 1, 0) == 1)
+		kthread_queue_work(civc->rx_worker, &civc->rx_work);
+}
+
 static void tegra_capture_ivc_notify(struct tegra_ivc_channel *chan)
 {
 	struct tegra_capture_ivc *civc = tegra_ivc_channel_get_drvdata(chan);
 
+	/* Only the oldest unserviced notification is kept */
+	atomic64_cmpxchg(&civc->notify_ns, 0, ktime_to_ns(ktime_get()));
+
 	/* Only 1 thread can wait on write_q, rest wait for write_lock */
 	wake_up(&civc->write_q);
-	schedule_work(&civc->work);
+
+	if (civc->num_dispatch != 0)
+		kthread_queue_work(civc->rx_worker, &civc->rx_work);
+	else
+		schedule_work(&civc->work);
+}
+
+static void tegra_capture_ivc_set_fifo(struct task_struct *task)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	sched_set_fifo(task);
+#else
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO / 2 };
+
+	sched_setscheduler_nocheck(task, SCHED_FIFO, &param);
+#endif
+}
+
+static void tegra_capture_ivc_destroy_dispatch(struct tegra_capture_ivc *civc)
+{
+	unsigned int i;
+
+	if (civc->num_dispatch == 0)
+		return;
+
+	/*
+	 * Stop dispatch threads from kicking the reader, then drain the
+	 * dispatch threads before the reader, as each may queue the other.
+	 */
+	atomic_set(&civc->rx_stalled, -1);
+
+	for (i = 0; i < civc->num_dispatch; i++)
+		kthread_flush_worker(civc->dispatch[i].worker);
+
+	kthread_destroy_worker(civc->rx_worker);
+
+	for (i = 0; i < civc->num_dispatch; i++)
+		kthread_destroy_worker(civc->dispatch[i].worker);
+
+	civc->num_dispatch = 0;
+}
+
+static int tegra_capture_ivc_setup_dispatch(struct tegra_capture_ivc *civc,
+					unsigned int num)
+{
+	struct device *dev = &civc->chan->dev;
+	struct tegra_capture_ivc_dispatch *disp;
+	struct kthread_worker *worker;
+	unsigned int i;
+
+	if (num == 0)
+		return 0;
+
+	num = min_t(unsigned int, num, CAPTURE_IVC_MAX_DISPATCH_THREADS);
+
+	civc->slot_size = civc->chan->ivc.frame_size;
+
+	worker = kthread_create_worker(0, "%s-rx", dev_name(dev));
+	if (IS_ERR(worker))
+		return PTR_ERR(worker);
+
+	tegra_capture_ivc_set_fifo(worker->task);
+	kthread_init_work(&civc->rx_work, tegra_capture_ivc_rx_work);
+	civc->rx_worker = worker;
+
+	for (i = 0; i < num; i++) {
+		disp = &civc->dispatch[i];
+
+		disp->civc = civc;
+		disp->slots = devm_kcalloc(dev, CAPTURE_IVC_DISPATCH_QUEUE_LEN,
+					civc->slot_size, GFP_KERNEL);
+		if (disp->slots == NULL)
+			goto fail;
+
+		worker = kthread_create_worker(0, "%s-cb%u", dev_name(dev), i);
+		if (IS_ERR(worker))
+			goto fail;
+
+		tegra_capture_ivc_set_fifo(worker->task);
+		kthread_init_work(&disp->work, tegra_capture_ivc_dispatch_work);
+		disp->worker = worker;
+		civc->num_dispatch = i + 1;
+	}
+
+	return 0;
+
+fail:
+	if (civc->num_dispatch == 0)
+		kthread_destroy_worker(civc->rx_worker);
+	else
+		tegra_capture_ivc_destroy_dispatch(civc);
+
+	return -ENOMEM;
+}
+
+static int tegra_capture_ivc_latency_show(struct seq_file *s, void *data)
+{
+	struct tegra_capture_ivc *civc = s->private;
+	struct tegra_capture_ivc_latency *lat;
+	uint32_t id;
+	unsigned int i;
+
+	seq_puts(s, "id count avg_us max_us buckets(<1us,<2us,<4us,...)\n");
+
+	for (id = 0; id < TOTAL_CHANNELS; id++) {
+		lat = &civc->latency[id];
+		if (lat->count == 0)
+			continue;
+
+		seq_printf(s, "%u %llu %llu %llu", id, lat->count,
+			div64_u64(lat->total_ns, lat->count * NSEC_PER_USEC),
+			div_u64(lat->max_ns, NSEC_PER_USEC));
+		for (i = 0; i < CAPTURE_IVC_LATENCY_BUCKETS; i++)
+			seq_printf(s, " %llu", lat->buckets[i]);
+		seq_putc(s, '\n');
+	}
+
+	return 0;
+}
+
+static int tegra_capture_ivc_latency_open(struct inode *inode,
+					struct file *file)
+{
+	return single_open(file, tegra_capture_ivc_latency_show,
+			inode->i_private);
+}
+
+static const struct file_operations tegra_capture_ivc_latency_fops = {
+	.open = tegra_capture_ivc_latency_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int tegra_capture_ivc_dispatch_show(struct seq_file *s, void *data)
+{
+	struct tegra_capture_ivc *civc = s->private;
+	struct tegra_capture_ivc_dispatch *disp;
+	unsigned int i;
+
+	for (i = 0; i < civc->num_dispatch; i++) {
+		disp = &civc->dispatch[i];
+		seq_printf(s, "thread %u: wakeups %llu messages %llu queued %u\n",
+			i, disp->wakeups, disp->messages,
+			READ_ONCE(disp->head) - READ_ONCE(disp->tail));
+	}
+
+	return 0;
+}
+
+static int tegra_capture_ivc_dispatch_open(struct inode *inode,
+					struct file *file)
+{
+	return single_open(file, tegra_capture_ivc_dispatch_show,
+			inode->i_private);
+}
+
+static const struct file_operations tegra_capture_ivc_dispatch_fops = {
+	.open = tegra_capture_ivc_dispatch_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void tegra_capture_ivc_debugfs_init(struct tegra_capture_ivc *civc,
+					const char *service)
+{
+	struct dentry *dir;
+	char name[32];
+
+	snprintf(name, sizeof(name), "capture-ivc-%s", service);
+
+	dir = debugfs_create_dir(name, NULL);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+
+	debugfs_create_file("latency", 0444, dir, civc,
+			&tegra_capture_ivc_latency_fops);
+	if (civc->num_dispatch != 0)
+		debugfs_create_file("dispatch", 0444, dir, civc,
+				&tegra_capture_ivc_dispatch_fops);
+
+	civc->debugfs = dir;
 }
 
 #define NV(x) "nvidia," #x
@@ -442,21 +796,37 @@ static int tegra_capture_ivc_probe(struct tegra_ivc_channel *chan)
 	for (i = TRANS_ID_START_IDX; i < ARRAY_SIZE(civc->cb_ctx); i++)
 		list_add_tail(&civc->cb_ctx[i].node, &civc->avl_ctx_list);
 
+	civc->latency = devm_kcalloc(dev, TOTAL_CHANNELS,
+				sizeof(*civc->latency), GFP_KERNEL);
+	if (unlikely(civc->latency == NULL))
+		return -ENOMEM;
+
 	tegra_ivc_channel_set_drvdata(chan, civc);
 
 	if (!strcmp("capture-control", service)) {
 		if (WARN_ON(__scivc_control != NULL))
 			return -EEXIST;
-		__scivc_control = civc;
 	} else if (!strcmp("capture", service)) {
 		if (WARN_ON(__scivc_capture != NULL))
 			return -EEXIST;
-		__scivc_capture = civc;
 	} else {
 		dev_err(dev, "Unknown ivc channel %s\n", service);
 		return -EINVAL;
 	}
 
+	ret = tegra_capture_ivc_setup_dispatch(civc, dispatch_threads);
+	if (unlikely(ret)) {
+		dev_err(dev, "failed to create dispatch threads: %d\n", ret);
+		return ret;
+	}
+
+	tegra_capture_ivc_debugfs_init(civc, service);
+
+	if (!strcmp("capture-control", service))
+		__scivc_control = civc;
+	else
+		__scivc_capture = civc;
+
 	return 0;
 }
 
@@ -465,6 +835,8 @@ static void tegra_capture_ivc_remove(struct tegra_ivc_channel *chan)
 	struct tegra_capture_ivc *civc = tegra_ivc_channel_get_drvdata(chan);
 
 	cancel_work_sync(&civc->work);
+	tegra_capture_ivc_destroy_dispatch(civc);
+	debugfs_remove_recursive(civc->debugfs);
 
 	if (__scivc_control == civc)
 		__scivc_control = NULL;
@@ -138,6 +138,8 @@ static LIST_HEAD(gte_devices);
 #define GTE_EVENT_UNREGISTERING		1
 
 #define GTE_EV_FIFO_EL			32
+/* user space side queue, holds several hardware FIFO drains */
+#define GTE_UEV_FIFO_EL			256
 #define GTE_MAX_EV_NAME_SZ		9
 
 struct gte_slices {
@@ -175,6 +177,9 @@ struct tegra_gte_dev {
 	struct list_head list;
 	void __iomem *regs;
 	spinlock_t lock; /* Hardware access lock */
+#ifdef CONFIG_TEGRA_HTS_GTE_SIM
+	struct tegra_gte_sim *sim;
+#endif
 };
 
 struct tegra_gte_ev_el {
@@ -275,14 +280,84 @@ static const struct tegra_gte_ev_table t234_aon_gte_map = {
 	.map = tegra234_aon_gpio_map,
 };
 
+#ifdef CONFIG_TEGRA_HTS_GTE_SIM
+/*
+ * Simulated register backend: while enabled, every register access of a
+ * GTE device goes to a shadow register file and the timestamp FIFO is
+ * filled by tegra_gte_sim_inject() instead of the hardware, so the FIFO
+ * decode and delivery paths run without any monitored line toggling.
+ */
+#define GTE_SIM_FIFO_EL			32
+
+struct gte_sim_el {
+	u64 tsc;
+	u32 src;
+	u32 pv;
+	u32 cv;
+};
+
+struct tegra_gte_sim {
+	struct gte_sim_el fifo[GTE_SIM_FIFO_EL];
+	unsigned int head;
+	unsigned int cnt;
+	unsigned int nregs;
+	u32 regs[];
+};
+
+static u32 tegra_gte_sim_readl(struct tegra_gte_sim *sim, u32 reg)
+{
+	struct gte_sim_el *el = &sim->fifo[sim->head];
+
+	switch (reg) {
+	case GTE_TESTATUS:
+		return sim->cnt << GTE_TESTATUS_OCCUPANCY_SHIFT;
+	case GTE_TETSCH:
+		return sim->cnt ? upper_32_bits(el->tsc) : 0;
+	case GTE_TETSCL:
+		return sim->cnt ? lower_32_bits(el->tsc) : 0;
+	case GTE_TESRC:
+		return sim->cnt ? el->src : 0;
+	case GTE_TEPCV:
+		return sim->cnt ? el->pv : 0;
+	case GTE_TECCV:
+		return sim->cnt ? el->cv : 0;
+	default:
+		return (reg >> 2) < sim->nregs ? sim->regs[reg >> 2] : 0;
+	}
+}
+
+static void tegra_gte_sim_writel(struct tegra_gte_sim *sim, u32 reg,
+				 u32 val)
+{
+	if (reg == GTE_TECMD) {
+		if ((val & GTE_TECMD_CMD_POP) && sim->cnt) {
+			sim->head = (sim->head + 1) % GTE_SIM_FIFO_EL;
+			sim->cnt--;
+		}
+	} else if ((reg >> 2) < sim->nregs) {
+		sim->regs[reg >> 2] = val;
+	}
+}
+#endif
+
 static inline u32 tegra_gte_readl(struct tegra_gte_dev *gte, u32 reg)
 {
+#ifdef CONFIG_TEGRA_HTS_GTE_SIM
+	if (gte->sim)
+		return tegra_gte_sim_readl(gte->sim, reg);
+#endif
 	return readl(gte->regs + reg);
 }
 
 static inline void tegra_gte_writel(struct tegra_gte_dev *gte, u32 reg,
 				    u32 val)
 {
+#ifdef CONFIG_TEGRA_HTS_GTE_SIM
+	if (gte->sim) {
+		tegra_gte_sim_writel(gte->sim, reg, val);
+		return;
+	}
+#endif
 	writel(val, gte->regs + reg);
 }
 
@@ -579,17 +654,21 @@ struct tegra_gte_ev_desc *tegra_gte_register_event(struct device_node *np,
 }
 EXPORT_SYMBOL(tegra_gte_register_event);
 
-int tegra_gte_retrieve_event(const struct tegra_gte_ev_desc *data,
-			     struct tegra_gte_ev_detail *hts)
+/*
+ * Drains the hardware FIFO once and pops up to n queued timestamps of the
+ * event under a single hold of the event lock.
+ */
+int tegra_gte_retrieve_events(const struct tegra_gte_ev_desc *data,
+			      struct tegra_gte_ev_detail *hts, unsigned int n)
 {
-	int ret, ev_id;
+	int ret, ev_id, i;
 	unsigned long flags;
 	struct tegra_gte_ev_el el;
 	const struct tegra_gte_ev_desc *pri;
 	struct tegra_gte_event_info *ev;
 	struct tegra_gte_dev *gte_dev;
 
-	if (!data || !hts)
+	if (!data || !hts || !n)
 		return -EINVAL;
 
 	pri = data;
@@ -614,27 +693,165 @@ int tegra_gte_retrieve_event(const struct tegra_gte_ev_desc *data,
 		goto unlock;
 	}
 
-	ret = kfifo_out(&ev->ev_fifo, (unsigned char *)&el, sizeof(el));
-	if (unlikely(ret != sizeof(el))) {
-		dev_dbg(gte_dev->pdev,
-			"Event: %d retrieved element is in improper size",
-			ev_id);
-		ret = -EINVAL;
-		goto unlock;
+	/* Pop straight into the caller's array, no scratch copy needed */
+	for (i = 0; i < n; i++) {
+		ret = kfifo_out(&ev->ev_fifo, (unsigned char *)&el, sizeof(el));
+		if (!ret)
+			break;
+		if (unlikely(ret != sizeof(el))) {
+			dev_dbg(gte_dev->pdev,
+				"Event: %d retrieved element is in improper size",
+				ev_id);
+			/* hand back what was already popped */
+			atomic_sub(i, &ev->usage);
+			ret = i ? i : -EINVAL;
+			goto unlock;
+		}
+		hts[i].dir = el.dir;
+		hts[i].ts_raw = el.tsc;
+		hts[i].ts_ns = el.tsc << GTE_TS_NS_SHIFT;
 	}
 
-	hts->dir = el.dir;
-	hts->ts_raw = el.tsc;
-	hts->ts_ns = el.tsc << GTE_TS_NS_SHIFT;
-	atomic_dec(&ev->usage);
-	ret = 0;
+	atomic_sub(i, &ev->usage);
+	ret = i;
 
 unlock:
 	spin_unlock_irqrestore(&ev->lock, flags);
+
 	return ret;
 }
+EXPORT_SYMBOL(tegra_gte_retrieve_events);
+
+int tegra_gte_retrieve_event(const struct tegra_gte_ev_desc *data,
+			     struct tegra_gte_ev_detail *hts)
+{
+	int ret;
+
+	ret = tegra_gte_retrieve_events(data, hts, 1);
+
+	return ret < 0 ? ret : 0;
+}
 EXPORT_SYMBOL(tegra_gte_retrieve_event);
 
+#ifdef CONFIG_TEGRA_HTS_GTE_SIM
+int tegra_gte_sim_enable(struct device_node *np, bool enable)
+{
+	struct tegra_gte_dev *gte_dev = NULL, *it;
+	struct tegra_gte_sim *sim = NULL;
+	unsigned long flags;
+	unsigned int nregs, i;
+	u32 reg;
+	int ret = 0;
+
+	if (!np)
+		return -EINVAL;
+
+	mutex_lock(&gte_list_lock);
+	list_for_each_entry(it, &gte_devices, list) {
+		if (it->pdev->of_node == np) {
+			gte_dev = it;
+			break;
+		}
+	}
+	if (!gte_dev) {
+		ret = -ENODEV;
+		goto unlock;
+	}
+
+	/* registered events keep their enable bits in one register file */
+	if (atomic_read(&gte_dev->usage)) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	if (enable == !!gte_dev->sim)
+		goto unlock;
+
+	if (enable) {
+		nregs = (GTE_SLICE0_TETEN +
+			 (gte_dev->num_events >> 5) * GTE_SLICE_SIZE) >> 2;
+		sim = kzalloc(sizeof(*sim) + nregs * sizeof(u32), GFP_KERNEL);
+		if (!sim) {
+			ret = -ENOMEM;
+			goto unlock;
+		}
+		sim->nregs = nregs;
+		sim->regs[GTE_TECTRL >> 2] = tegra_gte_readl(gte_dev,
+							     GTE_TECTRL);
+		for (i = 0; i < gte_dev->num_events >> 5; i++) {
+			reg = GTE_SLICE0_TETEN + i * GTE_SLICE_SIZE;
+			sim->regs[reg >> 2] = tegra_gte_readl(gte_dev, reg);
+		}
+		/* whatever the hardware still holds belongs to no event */
+		tegra_gte_read_fifo(gte_dev);
+	}
+
+	spin_lock_irqsave(&gte_dev->lock, flags);
+	swap(gte_dev->sim, sim);
+	spin_unlock_irqrestore(&gte_dev->lock, flags);
+	kfree(sim);
+
+	dev_info(gte_dev->pdev, "simulated registers %s\n",
+		 enable ? "enabled" : "disabled");
+unlock:
+	mutex_unlock(&gte_list_lock);
+	return ret;
+}
+EXPORT_SYMBOL(tegra_gte_sim_enable);
+
+int tegra_gte_sim_inject(const struct tegra_gte_ev_desc *data, u64 tsc,
+			 int dir)
+{
+	const struct tegra_gte_ev_desc *pri;
+	struct tegra_gte_event_info *ev;
+	struct tegra_gte_dev *gte_dev;
+	struct tegra_gte_sim *sim;
+	struct gte_sim_el *el;
+	unsigned long flags;
+	u32 bit;
+	int ret = 0;
+
+	if (!data)
+		return -EINVAL;
+
+	pri = data;
+	ev = container_of(pri, struct tegra_gte_event_info, pv);
+	gte_dev = ev->dev;
+	bit = BIT(pri->ev_bit);
+
+	spin_lock_irqsave(&gte_dev->lock, flags);
+	sim = gte_dev->sim;
+	if (!sim) {
+		ret = -ENODEV;
+		goto unlock;
+	}
+
+	/* the hardware only timestamps enabled lines */
+	if (!(tegra_gte_sim_readl(sim, ev->reg) & bit)) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	if (sim->cnt == GTE_SIM_FIFO_EL) {
+		ret = -ENOSPC;
+		goto unlock;
+	}
+
+	el = &sim->fifo[(sim->head + sim->cnt) % GTE_SIM_FIFO_EL];
+	el->tsc = tsc;
+	el->src = pri->slice << GTE_TESRC_SLICE_SHIFT;
+	/* edge encoding as decoded by tegra_gte_read_fifo() */
+	el->pv = dir == TEGRA_GTE_EVENT_RISING_EDGE ? bit : 0;
+	el->cv = dir == TEGRA_GTE_EVENT_RISING_EDGE ? 0 : bit;
+	sim->cnt++;
+
+unlock:
+	spin_unlock_irqrestore(&gte_dev->lock, flags);
+	return ret;
+}
+EXPORT_SYMBOL(tegra_gte_sim_inject);
+#endif
+
 /*
  * GPIO event monitoring from userspace management. Only GPIO type is supported
  * to be monitored and timestamp using GTE from the userspace.
@@ -648,8 +865,10 @@ struct gte_uspace_event_state {
 	char *label;
 	wait_queue_head_t wait;
 	struct mutex read_lock;
-	DECLARE_KFIFO(events, struct tegra_gte_hts_event_data, GTE_EV_FIFO_EL);
+	DECLARE_KFIFO(events, struct tegra_gte_hts_event_data, GTE_UEV_FIFO_EL);
 	struct tegra_gte_ev_desc *gte_data;
+	/* Drain buffer of the IRQ thread */
+	struct tegra_gte_ev_detail hw[GTE_EV_FIFO_EL];
 };
 
 static unsigned int gte_event_poll(struct file *filep,
@@ -736,23 +955,30 @@ static const struct file_operations gte_event_fileops = {
 
 static irqreturn_t gte_event_irq_thread(int irq, void *p)
 {
-	int ret;
+	int ret, i;
+	unsigned int n = 0;
 	struct gte_uspace_event_state *le = p;
 	struct tegra_gte_hts_event_data ge;
-	struct tegra_gte_ev_detail hw;
+	struct tegra_gte_ev_detail *hw = le->hw;
 
-	memset(&ge, 0, sizeof(ge));
-	ret = tegra_gte_retrieve_event(le->gte_data, &hw);
-	if (ret == 0) {
-		ge.timestamp = hw.ts_ns;
-		ge.dir = hw.dir;
-	} else {
+	/*
+	 * A burst of edges is drained in one go; the interrupts of the
+	 * edges already collected here find the event FIFO empty.
+	 */
+	ret = tegra_gte_retrieve_events(le->gte_data, hw, ARRAY_SIZE(le->hw));
+	if (ret <= 0) {
 		dev_dbg(le->gdev->pdev, "failed to retrieve event\n");
 		return IRQ_HANDLED;
 	}
 
-	ret = kfifo_put(&le->events, ge);
-	if (ret != 0)
+	memset(&ge, 0, sizeof(ge));
+	for (i = 0; i < ret; i++) {
+		ge.timestamp = hw[i].ts_ns;
+		ge.dir = hw[i].dir;
+		n += kfifo_put(&le->events, ge);
+	}
+
+	if (n != 0)
 		wake_up_poll(&le->wait, POLLIN);
 
 	return IRQ_HANDLED;
@@ -19,6 +19,11 @@
 #include <linux/tegra-gte.h>
 #include <linux/gpio.h>
 #include <linux/timer.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/of.h>
+#include <uapi/linux/tegra-gte-ioctl.h>
 
 /*
  * Sample GTE test driver demonstrating GTE API usage.
@@ -28,6 +33,16 @@
  *
  * Note: gpio_out and gpio_in need to be shorted externally using some wire
  * in order for this test driver to work for the GPIO monitoring.
+ *
+ * Writing N to gpio_burst generates N back to back rising edges on gpio_out
+ * and collects them with a single tegra_gte_retrieve_events() call; reading
+ * gpio_burst shows the result of the last burst.
+ *
+ * With sim=1 (CONFIG_TEGRA_HTS_GTE_SIM) no wiring is needed: the LIC GTE is
+ * switched to its simulated register backend, and after registering lic_irq
+ * through lic_irq_en_dis, writing N to sim_burst injects N alternating edges
+ * into the simulated FIFO and checks that tegra_gte_retrieve_events()
+ * returns every one of them in order; reading sim_burst shows the result.
  */
 
 /*
@@ -53,12 +68,31 @@ module_param(gpio_out, int, 0660);
 static int lic_irq = -EINVAL;
 module_param(lic_irq, int, 0660);
 
+/* Use the simulated register backend of the LIC GTE instead of gpios */
+static bool sim;
+module_param(sim, bool, 0440);
+
+#define GTE_TEST_MAX_BURST	32
+#define GTE_TEST_MAX_SIM_BURST	1000000
+/* raw counter ticks between two simulated edges */
+#define GTE_TEST_SIM_TICKS	3
+
 static struct tegra_gte_test {
 	struct tegra_gte_ev_desc *data_lic;
 	struct tegra_gte_ev_desc *data_gpio;
 	int gpio_in_irq;
 	struct timer_list timer;
 	struct kobject *kobj;
+	bool in_burst;
+	int burst_edges;
+	int burst_cnt;
+	bool burst_monotonic;
+	struct tegra_gte_ev_detail burst_hts[GTE_TEST_MAX_BURST];
+	u64 sim_tsc;
+	unsigned long sim_edges;
+	unsigned long sim_cnt;
+	unsigned long sim_bad;
+	u64 sim_ns;
 } gte;
 
 /*
@@ -200,17 +234,196 @@ static ssize_t show_lic_irq_ts(struct kobject *kobj,
 			 hts.ts_raw, hts.ts_ns);
 }
 
+/*
+ * Sysfs attribute to generate a burst of gpio_in edges and retrieve all
+ * their timestamps in one batch
+ */
+static ssize_t store_gpio_burst(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	unsigned long val = 0;
+	int i, ret;
+
+	if (!gte.data_gpio) {
+		pr_info("gpio_in is not registered\n");
+		return -EINVAL;
+	}
+
+	if (kstrtoul(buf, 10, &val) < 0 || !val || val > GTE_TEST_MAX_BURST)
+		return -EINVAL;
+
+	/* Keep the ISR from consuming the burst one edge at a time */
+	WRITE_ONCE(gte.in_burst, true);
+	gpio_set_value(gpio_out, 0);
+	for (i = 0; i < val; i++) {
+		udelay(10);
+		gpio_set_value(gpio_out, 1);
+		udelay(10);
+		gpio_set_value(gpio_out, 0);
+	}
+	udelay(100);
+
+	ret = tegra_gte_retrieve_events(gte.data_gpio, gte.burst_hts,
+					ARRAY_SIZE(gte.burst_hts));
+	WRITE_ONCE(gte.in_burst, false);
+
+	gte.burst_edges = val;
+	gte.burst_cnt = ret;
+	gte.burst_monotonic = true;
+	for (i = 1; i < ret; i++) {
+		if (gte.burst_hts[i].ts_raw < gte.burst_hts[i - 1].ts_raw)
+			gte.burst_monotonic = false;
+	}
+
+	if (ret < 0) {
+		pr_err("burst retrieve failed: %d\n", ret);
+		return ret;
+	}
+
+	pr_info("burst: %lu edges, %d timestamps, monotonic %d\n",
+		val, ret, gte.burst_monotonic);
+	return count;
+}
+
+/* Shows the result of the last gpio burst */
+static ssize_t show_gpio_burst(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       char *buf)
+{
+	ssize_t len;
+	int i;
+
+	len = scnprintf(buf, PAGE_SIZE,
+			"edges: %d, retrieved: %d, monotonic: %d\n",
+			gte.burst_edges, gte.burst_cnt, gte.burst_monotonic);
+	for (i = 0; i < gte.burst_cnt; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "dir: %d, ts_raw: %llu, ts_ns: %llu\n",
+				 gte.burst_hts[i].dir,
+				 gte.burst_hts[i].ts_raw,
+				 gte.burst_hts[i].ts_ns);
+
+	return len;
+}
+
+static bool tegra_gte_test_sim_check(const struct tegra_gte_ev_detail *hts,
+				     unsigned long k, u64 tsc0)
+{
+	int dir = k & 1 ? TEGRA_GTE_EVENT_FALLING_EDGE :
+			  TEGRA_GTE_EVENT_RISING_EDGE;
+
+	return hts->ts_raw == tsc0 + k * GTE_TEST_SIM_TICKS &&
+	       hts->dir == dir && hts->ts_ns >= hts->ts_raw;
+}
+
+/*
+ * Sysfs attribute to push a burst of simulated lic_irq edges through the
+ * GTE FIFO decode and retrieve them in batches
+ */
+static ssize_t store_sim_burst(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       const char *buf, size_t count)
+{
+	unsigned long val = 0, in = 0, out = 0, bad = 0, k;
+	u64 tsc0, t0;
+	int dir, i, ret = 0;
+
+	if (!sim || !gte.data_lic) {
+		pr_info("sim is off or lic_irq is not registered\n");
+		return -EINVAL;
+	}
+
+	if (kstrtoul(buf, 10, &val) < 0 || !val ||
+	    val > GTE_TEST_MAX_SIM_BURST)
+		return -EINVAL;
+
+	tsc0 = gte.sim_tsc;
+	t0 = ktime_get_ns();
+	while (out < val) {
+		/* fill the simulated hardware FIFO ... */
+		for (; in < val; in++) {
+			dir = in & 1 ? TEGRA_GTE_EVENT_FALLING_EDGE :
+				       TEGRA_GTE_EVENT_RISING_EDGE;
+			ret = tegra_gte_sim_inject(gte.data_lic,
+					tsc0 + in * GTE_TEST_SIM_TICKS, dir);
+			if (ret)
+				break;
+		}
+		if (ret && ret != -ENOSPC)
+			break;
+
+		/* ... and drain it through the retrieve API */
+		ret = tegra_gte_retrieve_events(gte.data_lic, gte.burst_hts,
+						ARRAY_SIZE(gte.burst_hts));
+		if (ret == -EAGAIN && in == out) {
+			/* nothing could be queued */
+			ret = -EIO;
+			break;
+		}
+		if (ret == -EAGAIN) {
+			/* injected edges never made it out: lost */
+			ret = -ENODATA;
+			break;
+		}
+		if (ret < 0)
+			break;
+
+		for (i = 0; i < ret; i++) {
+			k = out + i;
+			if (!tegra_gte_test_sim_check(&gte.burst_hts[i], k,
+						      tsc0))
+				bad++;
+		}
+		out += ret;
+		ret = 0;
+	}
+	gte.sim_ns = ktime_get_ns() - t0;
+	gte.sim_tsc = tsc0 + in * GTE_TEST_SIM_TICKS;
+
+	gte.sim_edges = val;
+	gte.sim_cnt = out;
+	gte.sim_bad = bad;
+
+	if (ret < 0) {
+		pr_err("sim burst failed after %lu of %lu: %d\n",
+		       out, val, ret);
+		return ret;
+	}
+
+	pr_info("sim burst: %lu edges, %lu retrieved, %lu bad\n",
+		val, out, bad);
+	return count;
+}
+
+/* Shows the result of the last simulated burst */
+static ssize_t show_sim_burst(struct kobject *kobj,
+			      struct kobj_attribute *attr,
+			      char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE,
+			 "edges: %lu, retrieved: %lu, bad: %lu, ns/edge: %llu\n",
+			 gte.sim_edges, gte.sim_cnt, gte.sim_bad,
+			 gte.sim_cnt ? div_u64(gte.sim_ns, gte.sim_cnt) : 0);
+}
+
 struct kobj_attribute gpio_en_dis_attr =
 		__ATTR(gpio_en_dis, 0220, NULL, store_gpio_en_dis);
 struct kobj_attribute lic_irq_en_dis_attr =
 		__ATTR(lic_irq_en_dis, 0220, NULL, store_lic_irq_en_dis);
 struct kobj_attribute lic_irq_ts_attr =
 		__ATTR(lic_irq_ts, 0440, show_lic_irq_ts, NULL);
+struct kobj_attribute gpio_burst_attr =
+		__ATTR(gpio_burst, 0660, show_gpio_burst, store_gpio_burst);
+struct kobj_attribute sim_burst_attr =
+		__ATTR(sim_burst, 0660, show_sim_burst, store_sim_burst);
 
 static struct attribute *attrs[] = {
 	&gpio_en_dis_attr.attr,
 	&lic_irq_en_dis_attr.attr,
 	&lic_irq_ts_attr.attr,
+	&gpio_burst_attr.attr,
+	&sim_burst_attr.attr,
 	NULL,
 };
 
@@ -248,6 +461,9 @@ static irqreturn_t tegra_gte_test_gpio_isr(int irq, void *data)
 	struct tegra_gte_ev_detail hts;
 	struct tegra_gte_test *gte = data;
 
+	if (READ_ONCE(gte->in_burst))
+		return IRQ_HANDLED;
+
 	if (tegra_gte_retrieve_event((gte->data_gpio), &hts) != 0) {
 		pr_info("No timestamp available\n");
 		return IRQ_HANDLED;
@@ -258,10 +474,42 @@ static irqreturn_t tegra_gte_test_gpio_isr(int irq, void *data)
 	return IRQ_HANDLED;
 }
 
+static int tegra_gte_test_sim_enable(bool enable)
+{
+	struct device_node *np;
+	int ret;
+
+	np = of_find_compatible_node(NULL, NULL, "nvidia,tegra194-gte-lic");
+	if (!np) {
+		pr_err("Could not locate lic gte node\n");
+		return -EINVAL;
+	}
+
+	ret = tegra_gte_sim_enable(np, enable);
+	of_node_put(np);
+	return ret;
+}
+
 static int __init tegra_gte_test_init(void)
 {
 	int ret = 0;
 
+	if (sim) {
+		/* nothing to wire up, only the LIC GTE is used */
+		ret = tegra_gte_test_sim_enable(true);
+		if (ret) {
+			pr_err("failed to enable simulated GTE: %d\n", ret);
+			return ret;
+		}
+
+		ret = tegra_gte_test_sysfs_create();
+		if (ret) {
+			pr_err("sysfs creation failed\n");
+			tegra_gte_test_sim_enable(false);
+		}
+		return ret;
+	}
+
 	if (gpio_out == -EINVAL || gpio_in == -EINVAL || lic_irq == EINVAL) {
 		pr_err("Invalid gpio_out, gpio_in and irq\n");
 		return -EINVAL;
@@ -346,6 +594,13 @@ free_gpio_out:
 
 static void __exit tegra_gte_test_exit(void)
 {
+	if (sim) {
+		kobject_put(gte.kobj);
+		tegra_gte_unregister_event(gte.data_lic);
+		tegra_gte_test_sim_enable(false);
+		return;
+	}
+
 	free_irq(gte.gpio_in_irq, &gte);
 	gpio_free(gpio_in);
 	gpio_free(gpio_out);
@@ -0,0 +1,818 @@
+/*
+ * Loopback test of the Trusty IPC driver, run at module load.
+ *
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+/*
+ * trusty-ipc.c is built into this module and bound to a fake virtio
+ * device instead of one exported by Trusty. The device plays the secure
+ * side from a work item: it reads the tx vring, answers connection
+ * requests for TEST_SRV_NAME and echoes every data message back through
+ * the rx vring. The fake device uses an id no real device has, so this
+ * copy of the driver and the real one never bind each other's devices.
+ *
+ * A channel is opened through tipc_open() and driven with the same
+ * read/write helpers the character device and the batch ioctls use.
+ * Each round queues depth messages, notifying the secure side only for
+ * the last one as TIPC_IOC_SEND_MSGS does, and then reads all replies.
+ * Every shareable buffer the driver allocates is counted. After a warm up
+ * round no message may allocate as long as depth stays within the rx
+ * pool; deeper rounds report the rate they need. The copy in and out of
+ * user memory done by the ioctls is not covered.
+ */
+
+#define pr_fmt(fmt)	"trusty-ipc-test: " fmt
+
+#include <linux/atomic.h>
+#include <linux/export.h>
+#include <linux/gfp.h>
+#include <linux/module.h>
+#include <linux/trusty/trusty.h>
+#include <linux/virtio_ids.h>
+
+static atomic_t tipc_test_allocs = ATOMIC_INIT(0);
+
+static void *tipc_test_alloc_pages_exact(size_t size, gfp_t gfp_mask)
+{
+	atomic_inc(&tipc_test_allocs);
+	return alloc_pages_exact(size, gfp_mask);
+}
+
+static int tipc_test_dev_enabled(void)
+{
+	return TRUSTY_DEV_ENABLED;
+}
+
+#define TEST_VIRTIO_ID		(0xfff0)
+
+#define alloc_pages_exact	tipc_test_alloc_pages_exact
+#define is_trusty_dev_enabled	tipc_test_dev_enabled
+#undef VIRTIO_ID_TRUSTY_IPC
+#define VIRTIO_ID_TRUSTY_IPC	TEST_VIRTIO_ID
+/*
+ * The real driver may be loaded as well, so drop the exports. The test
+ * calls tipc_init() itself and tipc_exit() stays the module exit.
+ */
+#undef EXPORT_SYMBOL
+#define EXPORT_SYMBOL(sym)
+#undef subsys_initcall
+#define subsys_initcall(fn)
+#undef MODULE_DESCRIPTION
+#define MODULE_DESCRIPTION(desc)
+#include "trusty-ipc.c"
+#undef MODULE_DESCRIPTION
+#define MODULE_DESCRIPTION(desc)	MODULE_INFO(description, desc)
+#undef is_trusty_dev_enabled
+#undef alloc_pages_exact
+
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/uio.h>
+#include <linux/virtio_ring.h>
+#include <linux/workqueue.h>
+
+#define TEST_RING_SIZE		(32)
+#define TEST_RING_ALIGN		(PAGE_SIZE)
+#define TEST_REMOTE_ADDR	(1000)
+#define TEST_SRV_NAME		"test.echo"
+#define TEST_MAX_PAYLOAD	(1024)
+
+static unsigned int rounds = 1000;
+module_param(rounds, uint, 0444);
+MODULE_PARM_DESC(rounds, "rounds timed per depth");
+
+static unsigned int depth = TIPC_MAX_BATCH;
+module_param(depth, uint, 0444);
+MODULE_PARM_DESC(depth, "messages in flight for the deepest pass");
+
+/* vring indices, named from the driver's side */
+enum {
+	TEST_RXVQ,
+	TEST_TXVQ,
+	TEST_NUM_VQS,
+};
+
+struct tipc_test_vring {
+	void *va;
+	size_t size;
+	struct vring vr;
+	struct virtqueue *vq;
+	u16 last_avail;
+};
+
+struct tipc_test_dev {
+	struct virtio_device vdev;
+	struct tipc_dev_config config;
+	struct tipc_test_vring vrings[TEST_NUM_VQS];
+	struct mutex lock; /* serializes the secure side */
+	struct work_struct work;
+	bool stopped;
+	bool rx_pending;
+	u8 status;
+	atomic_t kicks;
+	unsigned int errors;
+};
+
+struct tipc_test {
+	struct tipc_test_dev *t;
+	struct tipc_dn_chan *dn;
+	u8 *txbuf;
+	u8 *rxbuf;
+	u32 tx_seq;
+	u32 rx_seq;
+};
+
+#define vdev_to_test(vd) container_of((vd), struct tipc_test_dev, vdev)
+
+/*****************************************************************************/
+
+static bool tipc_test_avail(struct tipc_test_dev *t,
+			    struct tipc_test_vring *tvr)
+{
+	return tvr->last_avail !=
+		virtio16_to_cpu(&t->vdev, READ_ONCE(tvr->vr.avail->idx));
+}
+
+/* take the next buffer the driver posted, NULL if there is none */
+static void *tipc_test_pop(struct tipc_test_dev *t,
+			   struct tipc_test_vring *tvr, u16 *head, u32 *len)
+{
+	struct vring_desc *desc;
+	u16 slot;
+
+	if (!tipc_test_avail(t, tvr))
+		return NULL;
+
+	/* read the entry only after seeing the index */
+	virt_rmb();
+	slot = tvr->last_avail++ % tvr->vr.num;
+	*head = virtio16_to_cpu(&t->vdev, tvr->vr.avail->ring[slot]);
+	desc = &tvr->vr.desc[*head];
+	*len = virtio32_to_cpu(&t->vdev, desc->len);
+
+	return phys_to_virt(virtio64_to_cpu(&t->vdev, desc->addr));
+}
+
+static void tipc_test_push(struct tipc_test_dev *t,
+			   struct tipc_test_vring *tvr, u16 head, u32 len)
+{
+	struct vring_used_elem *used;
+	u16 idx = virtio16_to_cpu(&t->vdev, tvr->vr.used->idx);
+
+	used = &tvr->vr.used->ring[idx % tvr->vr.num];
+	used->id = cpu_to_virtio32(&t->vdev, head);
+	used->len = cpu_to_virtio32(&t->vdev, len);
+
+	/* publish the entry before the index */
+	virt_wmb();
+	tvr->vr.used->idx = cpu_to_virtio16(&t->vdev, idx + 1);
+}
+
+static bool tipc_test_reply(struct tipc_test_dev *t, u32 src, u32 dst,
+			    const void *data, size_t len)
+{
+	struct tipc_test_vring *rx = &t->vrings[TEST_RXVQ];
+	struct tipc_msg_hdr *hdr;
+	u32 size = 0;
+	u16 head = 0;
+
+	hdr = tipc_test_pop(t, rx, &head, &size);
+	if (!hdr)
+		return false;
+
+	if (size < sizeof(*hdr) + len) {
+		pr_err("rx buffer of %u bytes is too small\n", size);
+		t->errors++;
+		len = 0;
+	}
+
+	hdr->src = src;
+	hdr->dst = dst;
+	hdr->reserved = 0;
+	hdr->len = len;
+	hdr->flags = 0;
+	memcpy(hdr->data, data, len);
+
+	tipc_test_push(t, rx, head, sizeof(*hdr) + len);
+	t->rx_pending = true;
+	return true;
+}
+
+static bool tipc_test_send_ctrl(struct tipc_test_dev *t, u32 type,
+				const void *body, u32 body_len)
+{
+	u8 buf[sizeof(struct tipc_ctrl_msg) +
+	       sizeof(struct tipc_conn_rsp_body)];
+	struct tipc_ctrl_msg *msg = (struct tipc_ctrl_msg *)buf;
+
+	msg->type = type;
+	msg->body_len = body_len;
+	if (body_len)
+		memcpy(msg->body, body, body_len);
+
+	return tipc_test_reply(t, TIPC_CTRL_ADDR, TIPC_CTRL_ADDR,
+			       buf, sizeof(*msg) + body_len);
+}
+
+static void tipc_test_handle_ctrl(struct tipc_test_dev *t,
+				  struct tipc_msg_hdr *hdr)
+{
+	struct tipc_ctrl_msg *msg = (struct tipc_ctrl_msg *)hdr->data;
+	struct tipc_conn_req_body *req = (struct tipc_conn_req_body *)msg->body;
+	struct tipc_conn_rsp_body rsp;
+
+	if (hdr->len < sizeof(*msg) ||
+	    hdr->len != sizeof(*msg) + msg->body_len) {
+		pr_err("bad control message length %u\n", hdr->len);
+		t->errors++;
+		return;
+	}
+
+	switch (msg->type) {
+	case TIPC_CTRL_MSGTYPE_CONN_REQ:
+		if (msg->body_len != sizeof(*req)) {
+			pr_err("bad connect request length %u\n",
+			       msg->body_len);
+			t->errors++;
+			return;
+		}
+		memset(&rsp, 0, sizeof(rsp));
+		rsp.target = hdr->src;
+		rsp.status = strcmp(req->name, TEST_SRV_NAME) ?
+			     ERR_NOT_FOUND : NO_ERROR;
+		rsp.remote = TEST_REMOTE_ADDR;
+		rsp.max_msg_size = t->config.msg_buf_max_size;
+		rsp.max_msg_cnt = TEST_RING_SIZE;
+		tipc_test_send_ctrl(t, TIPC_CTRL_MSGTYPE_CONN_RSP,
+				    &rsp, sizeof(rsp));
+		break;
+	case TIPC_CTRL_MSGTYPE_DISC_REQ:
+		break;
+	default:
+		pr_err("unexpected control message %u\n", msg->type);
+		t->errors++;
+	}
+}
+
+static void tipc_test_handle_tx(struct tipc_test_dev *t,
+				struct tipc_msg_hdr *hdr, u32 len)
+{
+	if (len < sizeof(*hdr) || len != sizeof(*hdr) + hdr->len) {
+		pr_err("bad tx message length %u\n", len);
+		t->errors++;
+		return;
+	}
+
+	if (hdr->dst == TIPC_CTRL_ADDR) {
+		tipc_test_handle_ctrl(t, hdr);
+	} else if (hdr->dst == TEST_REMOTE_ADDR) {
+		tipc_test_reply(t, TEST_REMOTE_ADDR, hdr->src,
+				hdr->data, hdr->len);
+	} else {
+		pr_err("message to unknown address 0x%x\n", hdr->dst);
+		t->errors++;
+	}
+}
+
+static void tipc_test_signal(struct tipc_test_dev *t, bool tx_done)
+{
+	/* return tx buffers before the replies become visible */
+	if (tx_done)
+		vring_interrupt(0, t->vrings[TEST_TXVQ].vq);
+
+	if (t->rx_pending) {
+		t->rx_pending = false;
+		vring_interrupt(0, t->vrings[TEST_RXVQ].vq);
+	}
+}
+
+static void tipc_test_work(struct work_struct *work)
+{
+	struct tipc_test_dev *t = container_of(work, struct tipc_test_dev,
+					       work);
+	struct tipc_test_vring *tx = &t->vrings[TEST_TXVQ];
+	struct tipc_msg_hdr *hdr;
+	bool tx_done = false;
+	u32 len = 0;
+	u16 head = 0;
+
+	mutex_lock(&t->lock);
+	if (t->stopped)
+		goto out;
+
+	/*
+	 * A tx message gets at most one reply, so only take one while an
+	 * rx buffer is posted. The driver kicks the rx vring when it posts
+	 * more, which runs this again.
+	 */
+	while (tipc_test_avail(t, &t->vrings[TEST_RXVQ])) {
+		hdr = tipc_test_pop(t, tx, &head, &len);
+		if (!hdr)
+			break;
+
+		tipc_test_handle_tx(t, hdr, len);
+		tipc_test_push(t, tx, head, 0);
+		tx_done = true;
+	}
+
+	tipc_test_signal(t, tx_done);
+out:
+	mutex_unlock(&t->lock);
+}
+
+static int tipc_test_go_online(struct tipc_test_dev *t)
+{
+	struct tipc_virtio_dev *vds = t->vdev.priv;
+	int ret = 0;
+
+	mutex_lock(&t->lock);
+	if (tipc_test_send_ctrl(t, TIPC_CTRL_MSGTYPE_GO_ONLINE, NULL, 0))
+		tipc_test_signal(t, false);
+	else
+		ret = -EIO;
+	mutex_unlock(&t->lock);
+
+	if (!ret && (vds->state != VDS_ONLINE || !vds->cdev_node.dev))
+		ret = -EIO;
+
+	return ret;
+}
+
+/*****************************************************************************/
+
+static bool tipc_test_notify(struct virtqueue *vq)
+{
+	struct tipc_test_dev *t = vdev_to_test(vq->vdev);
+
+	if (vq->index == TEST_TXVQ)
+		atomic_inc(&t->kicks);
+
+	schedule_work(&t->work);
+	return true;
+}
+
+static void tipc_test_reset(struct virtio_device *vdev)
+{
+	struct tipc_test_dev *t = vdev_to_test(vdev);
+
+	mutex_lock(&t->lock);
+	t->stopped = true;
+	t->status = 0;
+	mutex_unlock(&t->lock);
+
+	cancel_work_sync(&t->work);
+}
+
+static u64 tipc_test_get_features(struct virtio_device *vdev)
+{
+	return 0;
+}
+
+static int tipc_test_finalize_features(struct virtio_device *vdev)
+{
+	return 0;
+}
+
+static void tipc_test_get_config(struct virtio_device *vdev,
+				 unsigned int offset, void *buf,
+				 unsigned int len)
+{
+	struct tipc_test_dev *t = vdev_to_test(vdev);
+
+	if (offset + len <= sizeof(t->config))
+		memcpy(buf, (u8 *)&t->config + offset, len);
+}
+
+static void tipc_test_set_config(struct virtio_device *vdev,
+				 unsigned int offset, const void *buf,
+				 unsigned int len)
+{
+}
+
+static u8 tipc_test_get_status(struct virtio_device *vdev)
+{
+	return vdev_to_test(vdev)->status;
+}
+
+static void tipc_test_set_status(struct virtio_device *vdev, u8 status)
+{
+	vdev_to_test(vdev)->status = status;
+}
+
+static void tipc_test_del_vqs(struct virtio_device *vdev)
+{
+	struct tipc_test_dev *t = vdev_to_test(vdev);
+	struct tipc_test_vring *tvr;
+	unsigned int i;
+
+	cancel_work_sync(&t->work);
+
+	for (i = 0; i < TEST_NUM_VQS; i++) {
+		tvr = &t->vrings[i];
+		if (tvr->vq) {
+			vring_del_virtqueue(tvr->vq);
+			tvr->vq = NULL;
+		}
+		if (tvr->va) {
+			free_pages_exact(tvr->va, tvr->size);
+			tvr->va = NULL;
+		}
+	}
+}
+
+static struct virtqueue *tipc_test_find_vq(struct virtio_device *vdev,
+					   unsigned int id,
+					   vq_callback_t *callback,
+					   const char *name, bool ctx)
+{
+	struct tipc_test_dev *t = vdev_to_test(vdev);
+	struct tipc_test_vring *tvr = &t->vrings[id];
+
+	tvr->size = PAGE_ALIGN(vring_size(TEST_RING_SIZE, TEST_RING_ALIGN));
+	tvr->va = alloc_pages_exact(tvr->size, GFP_KERNEL | __GFP_ZERO);
+	if (!tvr->va)
+		return ERR_PTR(-ENOMEM);
+
+	vring_init(&tvr->vr, TEST_RING_SIZE, tvr->va, TEST_RING_ALIGN);
+	tvr->last_avail = 0;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+	tvr->vq = vring_new_virtqueue(id, TEST_RING_SIZE, TEST_RING_ALIGN,
+				      vdev, true, ctx, tvr->va,
+				      tipc_test_notify, callback, name);
+#else
+	tvr->vq = vring_new_virtqueue(id, TEST_RING_SIZE, TEST_RING_ALIGN,
+				      vdev, true, tvr->va,
+				      tipc_test_notify, callback, name);
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0) */
+	if (!tvr->vq) {
+		free_pages_exact(tvr->va, tvr->size);
+		tvr->va = NULL;
+		return ERR_PTR(-ENOMEM);
+	}
+
+	return tvr->vq;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+static int tipc_test_find_vqs(struct virtio_device *vdev, unsigned int nvqs,
+			      struct virtqueue *vqs[],
+			      vq_callback_t *callbacks[],
+			      const char * const names[],
+			      const bool *ctx,
+			      struct irq_affinity *desc)
+#else
+static int tipc_test_find_vqs(struct virtio_device *vdev, unsigned int nvqs,
+			      struct virtqueue *vqs[],
+			      vq_callback_t *callbacks[],
+			      const char * const names[])
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0) */
+{
+	struct tipc_test_dev *t = vdev_to_test(vdev);
+	unsigned int i;
+	int ret;
+
+	if (nvqs != TEST_NUM_VQS)
+		return -EINVAL;
+
+	for (i = 0; i < nvqs; i++) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+		vqs[i] = tipc_test_find_vq(vdev, i, callbacks[i], names[i],
+					   ctx ? ctx[i] : false);
+#else
+		vqs[i] = tipc_test_find_vq(vdev, i, callbacks[i], names[i],
+					   false);
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0) */
+		if (IS_ERR(vqs[i])) {
+			ret = PTR_ERR(vqs[i]);
+			tipc_test_del_vqs(vdev);
+			return ret;
+		}
+	}
+
+	mutex_lock(&t->lock);
+	t->stopped = false;
+	mutex_unlock(&t->lock);
+
+	return 0;
+}
+
+static const struct virtio_config_ops tipc_test_config_ops = {
+	.get_features = tipc_test_get_features,
+	.finalize_features = tipc_test_finalize_features,
+	.get = tipc_test_get_config,
+	.set = tipc_test_set_config,
+	.get_status = tipc_test_get_status,
+	.set_status = tipc_test_set_status,
+	.reset    = tipc_test_reset,
+	.find_vqs = tipc_test_find_vqs,
+	.del_vqs  = tipc_test_del_vqs,
+};
+
+static void tipc_test_release_dev(struct device *dev)
+{
+	kfree(vdev_to_test(dev_to_virtio(dev)));
+}
+
+/*****************************************************************************/
+
+static size_t tipc_test_len(u32 seq)
+{
+	return sizeof(u32) + seq % TEST_MAX_PAYLOAD;
+}
+
+static void tipc_test_fill(u8 *buf, u32 seq)
+{
+	size_t len = tipc_test_len(seq);
+	size_t i;
+
+	memcpy(buf, &seq, sizeof(seq));
+	for (i = sizeof(seq); i < len; i++)
+		buf[i] = (u8)(seq + i);
+}
+
+static bool tipc_test_check(const u8 *buf, u32 seq)
+{
+	size_t len = tipc_test_len(seq);
+	size_t i;
+
+	if (memcmp(buf, &seq, sizeof(seq)))
+		return false;
+
+	for (i = sizeof(seq); i < len; i++)
+		if (buf[i] != (u8)(seq + i))
+			return false;
+
+	return true;
+}
+
+static void tipc_test_iter(struct iov_iter *iter, int dir, struct kvec *kv,
+			   size_t len)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+	iov_iter_kvec(iter, dir, kv, 1, len);
+#else
+	iov_iter_kvec(iter, ITER_KVEC | dir, kv, 1, len);
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0) */
+}
+
+static int tipc_test_send(struct tipc_test *tt, bool notify)
+{
+	u32 seq = tt->tx_seq++;
+	size_t len = tipc_test_len(seq);
+	struct kvec kv = { .iov_base = tt->txbuf, .iov_len = len };
+	struct iov_iter iter;
+	ssize_t ret;
+
+	tipc_test_fill(tt->txbuf, seq);
+	tipc_test_iter(&iter, WRITE, &kv, len);
+
+	ret = dn_write_msg(tt->dn, &iter, 0, notify);
+	if (ret == -EAGAIN) {
+		/* out of tx buffers: flush and wait, as dn_send_batch() */
+		vds_kick_txvq(tt->dn->chan->vds);
+		ret = dn_write_msg(tt->dn, &iter, TXBUF_TIMEOUT, notify);
+	}
+	if (ret != (ssize_t)len) {
+		pr_err("sending message %u failed: %zd\n", seq, ret);
+		return ret < 0 ? ret : -EIO;
+	}
+
+	return 0;
+}
+
+static int tipc_test_recv(struct tipc_test *tt)
+{
+	u32 seq = tt->rx_seq++;
+	struct kvec kv = { .iov_base = tt->rxbuf, .iov_len = PAGE_SIZE };
+	struct iov_iter iter;
+	ssize_t ret;
+
+	if (!wait_event_timeout(tt->dn->readq, _got_rx(tt->dn),
+				msecs_to_jiffies(REPLY_TIMEOUT))) {
+		pr_err("no reply to message %u\n", seq);
+		return -ETIMEDOUT;
+	}
+
+	tipc_test_iter(&iter, READ, &kv, PAGE_SIZE);
+	ret = dn_read_msg(tt->dn, &iter, true);
+	if (ret < 0) {
+		pr_err("reading reply %u failed: %zd\n", seq, ret);
+		return ret;
+	}
+
+	if (ret != (ssize_t)tipc_test_len(seq) ||
+	    !tipc_test_check(tt->rxbuf, seq)) {
+		pr_err("reply %u is corrupt\n", seq);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int tipc_test_round(struct tipc_test *tt, unsigned int n)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < n; i++) {
+		ret = tipc_test_send(tt, i == n - 1);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < n; i++) {
+		ret = tipc_test_recv(tt);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int tipc_test_pass(struct tipc_test *tt, unsigned int n)
+{
+	u64 msgs = (u64)rounds * n;
+	unsigned int allocs, kicks, i;
+	ktime_t start;
+	u64 ns = 0;
+	int ret;
+
+	/* one untimed round fills the tx free list and the rx pool */
+	ret = tipc_test_round(tt, n);
+	if (ret)
+		return ret;
+
+	allocs = atomic_read(&tipc_test_allocs);
+	kicks = atomic_read(&tt->t->kicks);
+
+	start = ktime_get();
+	for (i = 0; i < rounds; i++) {
+		ret = tipc_test_round(tt, n);
+		if (ret)
+			return ret;
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	allocs = atomic_read(&tipc_test_allocs) - allocs;
+	kicks = atomic_read(&tt->t->kicks) - kicks;
+
+	pr_info("depth %u: %llu messages, %u allocations, %u kicks, %llu ns/message\n",
+		n, msgs, allocs, kicks, msgs ? div64_u64(ns, msgs) : 0);
+
+	if (n <= TIPC_RX_POOL_MAX && allocs) {
+		pr_err("depth %u allocated %u buffers in steady state\n",
+		       n, allocs);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int tipc_test_run(struct tipc_test_dev *t)
+{
+	struct tipc_virtio_dev *vds = t->vdev.priv;
+	const unsigned int depths[] = { 1, TIPC_RX_POOL_MAX, depth };
+	struct tipc_test tt = { .t = t };
+	struct inode *inode = NULL;
+	struct file *filp = NULL;
+	unsigned int i;
+	int ret = 0;
+
+	/* tipc_open() and tipc_release() only look at these fields */
+	inode = kzalloc(sizeof(*inode), GFP_KERNEL);
+	filp = kzalloc(sizeof(*filp), GFP_KERNEL);
+	tt.txbuf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	tt.rxbuf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!inode || !filp || !tt.txbuf || !tt.rxbuf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	inode->i_cdev = &vds->cdev_node.cdev;
+
+	ret = tipc_open(inode, filp);
+	if (ret) {
+		pr_err("open failed: %d\n", ret);
+		goto out;
+	}
+	tt.dn = filp->private_data;
+
+	ret = tipc_chan_connect(tt.dn->chan, TEST_SRV_NAME);
+	if (!ret)
+		ret = dn_wait_for_reply(tt.dn, REPLY_TIMEOUT);
+	if (ret) {
+		pr_err("connect failed: %d\n", ret);
+		goto release;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(depths); i++) {
+		ret = tipc_test_pass(&tt, depths[i]);
+		if (ret)
+			break;
+	}
+
+release:
+	tipc_release(inode, filp);
+out:
+	kfree(tt.rxbuf);
+	kfree(tt.txbuf);
+	kfree(filp);
+	kfree(inode);
+	return ret;
+}
+
+/* tipc_exit() is __exit, undo tipc_init() by hand when the test fails */
+static void tipc_test_undo_init(void)
+{
+	unregister_virtio_driver(&virtio_tipc_driver);
+	class_destroy(tipc_class);
+	unregister_chrdev_region(MKDEV(tipc_major, 0), MAX_DEVICES);
+}
+
+static int __init tipc_test_init(void)
+{
+	struct tipc_test_dev *t = NULL;
+	int ret = 0;
+
+	if (!rounds || !depth || depth > TIPC_MAX_BATCH) {
+		pr_err("rounds must be set and depth be 1..%d\n",
+		       TIPC_MAX_BATCH);
+		return -EINVAL;
+	}
+
+	ret = tipc_init();
+	if (ret)
+		return ret;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	mutex_init(&t->lock);
+	INIT_WORK(&t->work, tipc_test_work);
+	atomic_set(&t->kicks, 0);
+	t->config.msg_buf_max_size = PAGE_SIZE;
+	t->config.msg_buf_alignment = PAGE_SIZE;
+	strlcpy(t->config.dev_name, "test", sizeof(t->config.dev_name));
+
+	t->vdev.dev.release = tipc_test_release_dev;
+	t->vdev.id.device = TEST_VIRTIO_ID;
+	t->vdev.config = &tipc_test_config_ops;
+
+	ret = register_virtio_device(&t->vdev);
+	if (ret) {
+		pr_err("failed to register the device: %d\n", ret);
+		kfree(t);
+		goto err;
+	}
+
+	if (t->vdev.dev.driver != &virtio_tipc_driver.driver) {
+		pr_err("the device was not bound\n");
+		ret = -ENODEV;
+	}
+
+	if (!ret) {
+		ret = tipc_test_go_online(t);
+		if (ret)
+			pr_err("the device did not go online\n");
+	}
+
+	if (!ret)
+		ret = tipc_test_run(t);
+
+	flush_work(&t->work);
+	if (!ret && t->errors) {
+		pr_err("%u bad messages reached the secure side\n",
+		       t->errors);
+		ret = -EIO;
+	}
+
+	/* releases t */
+	unregister_virtio_device(&t->vdev);
+
+	if (ret)
+		goto err;
+
+	pr_info("passed\n");
+	return 0;
+
+err:
+	tipc_test_undo_init();
+	return ret;
+}
+
+module_init(tipc_test_init);
+
+MODULE_DESCRIPTION("Trusty IPC loopback test");
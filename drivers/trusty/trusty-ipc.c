@@ -49,6 +49,12 @@
 #define DEFAULT_MSG_BUF_SIZE		PAGE_SIZE
 #define DEFAULT_MSG_BUF_ALIGN		PAGE_SIZE
 
+/* rx buffers kept per channel for reuse instead of being freed */
+#define TIPC_RX_POOL_MAX		8
+
+/* max number of messages moved by one batch ioctl */
+#define TIPC_MAX_BATCH			64
+
 #define TIPC_CTRL_ADDR			53
 #define TIPC_ANY_ADDR			0xFFFFFFFF
 
@@ -56,6 +62,10 @@
 
 #define TIPC_IOC_MAGIC			'r'
 #define TIPC_IOC_CONNECT		_IOW(TIPC_IOC_MAGIC, 0x80, char *)
+#define TIPC_IOC_SEND_MSGS		_IOW(TIPC_IOC_MAGIC, 0x81, \
+					     struct tipc_msg_batch)
+#define TIPC_IOC_RECV_MSGS		_IOW(TIPC_IOC_MAGIC, 0x82, \
+					     struct tipc_msg_batch)
 #if defined(CONFIG_COMPAT)
 #define TIPC_IOC_CONNECT_COMPAT		_IOW(TIPC_IOC_MAGIC, 0x80, \
 					     compat_uptr_t)
@@ -63,6 +73,21 @@
 
 struct tipc_virtio_dev;
 
+/*
+ * One message of a TIPC_IOC_SEND_MSGS/TIPC_IOC_RECV_MSGS batch. On
+ * receive, len is updated to the size of the message placed in base.
+ */
+struct tipc_msg_iov {
+	__u64 base;
+	__u64 len;
+};
+
+struct tipc_msg_batch {
+	__u64 iov;	/* user pointer to an array of struct tipc_msg_iov */
+	__u32 cnt;	/* number of entries in iov */
+	__u32 reserved;
+};
+
 struct tipc_dev_config {
 	u32 msg_buf_max_size;
 	u32 msg_buf_alignment;
@@ -157,6 +182,9 @@ struct tipc_chan {
 	u32 max_msg_size;
 	u32 max_msg_cnt;
 	char srv_name[MAX_SRV_NAME_LEN];
+	spinlock_t rx_pool_lock; /* protects rx_pool */
+	struct list_head rx_pool;
+	uint rx_pool_cnt;
 };
 
 static struct class *tipc_class;
@@ -248,6 +276,7 @@ static void _free_chan(struct kref *kref)
 	if (ch->ops && ch->ops->handle_release)
 		ch->ops->handle_release(ch->ops_arg);
 
+	_free_msg_buf_list(&ch->rx_pool);
 	kref_put(&ch->vds->refcount, _free_vds);
 	kfree(ch);
 }
@@ -263,6 +292,46 @@ static void vds_free_msg_buf(struct tipc_virtio_dev *vds,
 	_free_msg_buf(mb);
 }
 
+/*
+ * Every rx buffer a channel consumes is handed back to the rx virtqueue
+ * and replaced by one returned by the reader, so a small per channel
+ * pool is enough to avoid allocating for each inbound message.
+ */
+static struct tipc_msg_buf *chan_get_pooled_rxbuf(struct tipc_chan *chan)
+{
+	struct tipc_msg_buf *mb;
+
+	spin_lock(&chan->rx_pool_lock);
+	mb = list_first_entry_or_null(&chan->rx_pool,
+				      struct tipc_msg_buf, node);
+	if (mb) {
+		list_del(&mb->node);
+		chan->rx_pool_cnt--;
+	}
+	spin_unlock(&chan->rx_pool_lock);
+
+	if (!mb)
+		mb = vds_alloc_msg_buf(chan->vds);
+
+	return mb;
+}
+
+static void chan_put_pooled_rxbuf(struct tipc_chan *chan,
+				  struct tipc_msg_buf *mb)
+{
+	spin_lock(&chan->rx_pool_lock);
+	if (chan->rx_pool_cnt < TIPC_RX_POOL_MAX &&
+	    mb->buf_sz == chan->vds->msg_buf_max_sz) {
+		list_add(&mb->node, &chan->rx_pool);
+		chan->rx_pool_cnt++;
+		mb = NULL;
+	}
+	spin_unlock(&chan->rx_pool_lock);
+
+	if (mb)
+		vds_free_msg_buf(chan->vds, mb);
+}
+
 static bool _put_txbuf_locked(struct tipc_virtio_dev *vds,
 			      struct tipc_msg_buf *mb)
 {
@@ -361,7 +430,7 @@ static struct tipc_msg_buf *vds_get_txbuf(struct tipc_virtio_dev *vds,
 }
 
 static int vds_queue_txbuf(struct tipc_virtio_dev *vds,
-			   struct tipc_msg_buf *mb)
+			   struct tipc_msg_buf *mb, bool notify)
 {
 	int err;
 	struct scatterlist sg;
@@ -371,7 +440,8 @@ static int vds_queue_txbuf(struct tipc_virtio_dev *vds,
 	if (vds->state == VDS_ONLINE) {
 		sg_init_one(&sg, mb->buf_va, mb->wpos);
 		err = virtqueue_add_outbuf(vds->txvq, &sg, 1, mb, GFP_KERNEL);
-		need_notify = virtqueue_kick_prepare(vds->txvq);
+		if (notify)
+			need_notify = virtqueue_kick_prepare(vds->txvq);
 	} else {
 		err = -ENODEV;
 	}
@@ -383,6 +453,20 @@ static int vds_queue_txbuf(struct tipc_virtio_dev *vds,
 	return err;
 }
 
+/* notify the other side of tx buffers queued without notification */
+static void vds_kick_txvq(struct tipc_virtio_dev *vds)
+{
+	bool need_notify = false;
+
+	mutex_lock(&vds->lock);
+	if (vds->state == VDS_ONLINE)
+		need_notify = virtqueue_kick_prepare(vds->txvq);
+	mutex_unlock(&vds->lock);
+
+	if (need_notify)
+		virtqueue_notify(vds->txvq);
+}
+
 static int vds_add_channel(struct tipc_virtio_dev *vds,
 			   struct tipc_chan *chan)
 {
@@ -464,6 +548,8 @@ static struct tipc_chan *vds_create_channel(struct tipc_virtio_dev *vds,
 	mutex_init(&chan->lock);
 	kref_init(&chan->refcount);
 	chan->state = TIPC_DISCONNECTED;
+	spin_lock_init(&chan->rx_pool_lock);
+	INIT_LIST_HEAD(&chan->rx_pool);
 
 	ret = vds_add_channel(vds, chan);
 	if (ret) {
@@ -524,7 +610,7 @@ struct tipc_msg_buf *tipc_chan_get_rxbuf(struct tipc_chan *chan)
 	if (!is_trusty_dev_enabled())
 		return ERR_PTR(-ENODEV);
 
-	return vds_alloc_msg_buf(chan->vds);
+	return chan_get_pooled_rxbuf(chan);
 }
 EXPORT_SYMBOL(tipc_chan_get_rxbuf);
 
@@ -533,7 +619,7 @@ void tipc_chan_put_rxbuf(struct tipc_chan *chan, struct tipc_msg_buf *mb)
 	if (!is_trusty_dev_enabled())
 		return;
 
-	vds_free_msg_buf(chan->vds, mb);
+	chan_put_pooled_rxbuf(chan, mb);
 }
 EXPORT_SYMBOL(tipc_chan_put_rxbuf);
 
@@ -556,7 +642,8 @@ void tipc_chan_put_txbuf(struct tipc_chan *chan, struct tipc_msg_buf *mb)
 }
 EXPORT_SYMBOL(tipc_chan_put_txbuf);
 
-int tipc_chan_queue_msg(struct tipc_chan *chan, struct tipc_msg_buf *mb)
+static int _chan_queue_msg(struct tipc_chan *chan, struct tipc_msg_buf *mb,
+			   bool notify)
 {
 	int err;
 
@@ -567,7 +654,7 @@ int tipc_chan_queue_msg(struct tipc_chan *chan, struct tipc_msg_buf *mb)
 	switch (chan->state) {
 	case TIPC_CONNECTED:
 		fill_msg_hdr(mb, chan->local, chan->remote);
-		err = vds_queue_txbuf(chan->vds, mb);
+		err = vds_queue_txbuf(chan->vds, mb, notify);
 		if (err) {
 			/* this should never happen */
 			pr_err("%s: failed to queue tx buffer (%d)\n",
@@ -589,6 +676,11 @@ int tipc_chan_queue_msg(struct tipc_chan *chan, struct tipc_msg_buf *mb)
 	mutex_unlock(&chan->lock);
 	return err;
 }
+
+int tipc_chan_queue_msg(struct tipc_chan *chan, struct tipc_msg_buf *mb)
+{
+	return _chan_queue_msg(chan, mb, true);
+}
 EXPORT_SYMBOL(tipc_chan_queue_msg);
 
 
@@ -624,7 +716,7 @@ int tipc_chan_connect(struct tipc_chan *chan, const char *name)
 		strcpy(chan->srv_name, body->name);
 
 		fill_msg_hdr(txbuf, chan->local, TIPC_CTRL_ADDR);
-		err = vds_queue_txbuf(chan->vds, txbuf);
+		err = vds_queue_txbuf(chan->vds, txbuf, true);
 		if (err) {
 			/* this should never happen */
 			pr_err("%s: failed to queue tx buffer (%d)\n",
@@ -690,7 +782,7 @@ int tipc_chan_shutdown(struct tipc_chan *chan)
 		body->target = chan->remote;
 
 		fill_msg_hdr(txbuf, chan->local, TIPC_CTRL_ADDR);
-		err = vds_queue_txbuf(chan->vds, txbuf);
+		err = vds_queue_txbuf(chan->vds, txbuf, true);
 		if (err) {
 			/* this should never happen */
 			pr_err("%s: failed to queue tx buffer (%d)\n",
@@ -952,50 +1044,6 @@ static int dn_connect_ioctl(struct tipc_dn_chan *dn, char __user *usr_name)
 	return dn_wait_for_reply(dn, REPLY_TIMEOUT);
 }
 
-static long tipc_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
-{
-	int ret;
-	struct tipc_dn_chan *dn = filp->private_data;
-
-	if (_IOC_TYPE(cmd) != TIPC_IOC_MAGIC)
-		return -EINVAL;
-
-	switch (cmd) {
-	case TIPC_IOC_CONNECT:
-		ret = dn_connect_ioctl(dn, (char __user *)arg);
-		break;
-	default:
-		pr_warn("%s: Unhandled ioctl cmd: 0x%x\n",
-			__func__, cmd);
-		ret = -EINVAL;
-	}
-	return ret;
-}
-
-#if defined(CONFIG_COMPAT)
-static long tipc_compat_ioctl(struct file *filp,
-			      unsigned int cmd, unsigned long arg)
-{
-	int ret;
-	struct tipc_dn_chan *dn = filp->private_data;
-	void __user *user_req = compat_ptr(arg);
-
-	if (_IOC_TYPE(cmd) != TIPC_IOC_MAGIC)
-		return -EINVAL;
-
-	switch (cmd) {
-	case TIPC_IOC_CONNECT_COMPAT:
-		ret = dn_connect_ioctl(dn, user_req);
-		break;
-	default:
-		pr_warn("%s: Unhandled ioctl cmd: 0x%x\n",
-			__func__, cmd);
-		ret = -EINVAL;
-	}
-	return ret;
-}
-#endif
-
 static inline bool _got_rx(struct tipc_dn_chan *dn)
 {
 	if (dn->state != TIPC_CONNECTED)
@@ -1007,13 +1055,12 @@ static inline bool _got_rx(struct tipc_dn_chan *dn)
 	return false;
 }
 
-static ssize_t tipc_read_iter(struct kiocb *iocb, struct iov_iter *iter)
+static ssize_t dn_read_msg(struct tipc_dn_chan *dn, struct iov_iter *iter,
+			   bool nonblock)
 {
 	ssize_t ret;
 	size_t len;
 	struct tipc_msg_buf *mb;
-	struct file *filp = iocb->ki_filp;
-	struct tipc_dn_chan *dn = filp->private_data;
 
 	mutex_lock(&dn->lock);
 
@@ -1032,7 +1079,7 @@ static ssize_t tipc_read_iter(struct kiocb *iocb, struct iov_iter *iter)
 
 		mutex_unlock(&dn->lock);
 
-		if (filp->f_flags & O_NONBLOCK)
+		if (nonblock)
 			return -EAGAIN;
 
 		if (wait_event_interruptible(dn->readq, _got_rx(dn)))
@@ -1063,17 +1110,12 @@ out:
 	return ret;
 }
 
-static ssize_t tipc_write_iter(struct kiocb *iocb, struct iov_iter *iter)
+static ssize_t dn_write_msg(struct tipc_dn_chan *dn, struct iov_iter *iter,
+			    long timeout, bool notify)
 {
 	ssize_t ret;
 	size_t len;
-	long timeout = TXBUF_TIMEOUT;
 	struct tipc_msg_buf *txbuf = NULL;
-	struct file *filp = iocb->ki_filp;
-	struct tipc_dn_chan *dn = filp->private_data;
-
-	if (filp->f_flags & O_NONBLOCK)
-		timeout = 0;
 
 	txbuf = tipc_chan_get_txbuf_timeout(dn->chan, timeout);
 	if (IS_ERR(txbuf))
@@ -1097,7 +1139,7 @@ static ssize_t tipc_write_iter(struct kiocb *iocb, struct iov_iter *iter)
 	}
 
 	/* queue message */
-	ret = tipc_chan_queue_msg(dn->chan, txbuf);
+	ret = _chan_queue_msg(dn->chan, txbuf, notify);
 	if (ret)
 		goto err_out;
 
@@ -1108,6 +1150,178 @@ err_out:
 	return ret;
 }
 
+static ssize_t tipc_read_iter(struct kiocb *iocb, struct iov_iter *iter)
+{
+	struct file *filp = iocb->ki_filp;
+
+	return dn_read_msg(filp->private_data, iter,
+			   filp->f_flags & O_NONBLOCK);
+}
+
+static ssize_t tipc_write_iter(struct kiocb *iocb, struct iov_iter *iter)
+{
+	long timeout = TXBUF_TIMEOUT;
+	struct file *filp = iocb->ki_filp;
+
+	if (filp->f_flags & O_NONBLOCK)
+		timeout = 0;
+
+	return dn_write_msg(filp->private_data, iter, timeout, true);
+}
+
+static int dn_import_msg_iov(struct tipc_msg_iov __user *uiov, int rw,
+			     struct iovec *iov, struct iov_iter *iter)
+{
+	struct tipc_msg_iov miov;
+
+	if (copy_from_user(&miov, uiov, sizeof(miov)))
+		return -EFAULT;
+
+	return import_single_range(rw, u64_to_user_ptr(miov.base),
+				   miov.len, iov, iter);
+}
+
+/*
+ * Send up to batch->cnt messages, notifying the secure side once for the
+ * whole batch. Returns the number of messages queued, or an error if
+ * none was.
+ */
+static long dn_send_batch(struct tipc_dn_chan *dn, struct file *filp,
+			  struct tipc_msg_batch *batch)
+{
+	long ret = 0;
+	u32 i;
+	bool last;
+	struct iovec iov;
+	struct iov_iter iter;
+	struct tipc_msg_iov __user *uiov = u64_to_user_ptr(batch->iov);
+
+	for (i = 0; i < batch->cnt; i++) {
+		ret = dn_import_msg_iov(&uiov[i], WRITE, &iov, &iter);
+		if (ret)
+			break;
+
+		last = (i == batch->cnt - 1);
+		ret = dn_write_msg(dn, &iter, 0, last);
+		if (ret == -EAGAIN && !(filp->f_flags & O_NONBLOCK)) {
+			/* out of tx buffers: flush what we have and wait */
+			vds_kick_txvq(dn->chan->vds);
+			ret = dn_write_msg(dn, &iter, TXBUF_TIMEOUT, last);
+		}
+		if (ret < 0)
+			break;
+	}
+
+	if (i && i != batch->cnt)
+		vds_kick_txvq(dn->chan->vds);
+
+	return i ? i : ret;
+}
+
+/*
+ * Receive up to batch->cnt messages. Only the first one is waited for,
+ * the rest are taken if already queued. Returns the number of messages
+ * received, or an error if none was.
+ */
+static long dn_recv_batch(struct tipc_dn_chan *dn, struct file *filp,
+			  struct tipc_msg_batch *batch)
+{
+	long ret = 0;
+	u32 i;
+	bool nonblock = filp->f_flags & O_NONBLOCK;
+	struct iovec iov;
+	struct iov_iter iter;
+	struct tipc_msg_iov __user *uiov = u64_to_user_ptr(batch->iov);
+
+	for (i = 0; i < batch->cnt; i++) {
+		ret = dn_import_msg_iov(&uiov[i], READ, &iov, &iter);
+		if (ret)
+			break;
+
+		ret = dn_read_msg(dn, &iter, nonblock || i);
+		if (ret < 0)
+			break;
+
+		if (put_user((__u64)ret, &uiov[i].len)) {
+			/* message is consumed, count it anyway */
+			ret = -EFAULT;
+			i++;
+			break;
+		}
+	}
+
+	return i ? i : ret;
+}
+
+static long dn_batch_ioctl(struct tipc_dn_chan *dn, struct file *filp,
+			   unsigned int cmd, void __user *arg)
+{
+	struct tipc_msg_batch batch;
+
+	if (copy_from_user(&batch, arg, sizeof(batch)))
+		return -EFAULT;
+
+	if (!batch.cnt || batch.cnt > TIPC_MAX_BATCH || batch.reserved)
+		return -EINVAL;
+
+	if (cmd == TIPC_IOC_SEND_MSGS)
+		return dn_send_batch(dn, filp, &batch);
+
+	return dn_recv_batch(dn, filp, &batch);
+}
+
+static long tipc_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	int ret;
+	struct tipc_dn_chan *dn = filp->private_data;
+
+	if (_IOC_TYPE(cmd) != TIPC_IOC_MAGIC)
+		return -EINVAL;
+
+	switch (cmd) {
+	case TIPC_IOC_CONNECT:
+		ret = dn_connect_ioctl(dn, (char __user *)arg);
+		break;
+	case TIPC_IOC_SEND_MSGS:
+	case TIPC_IOC_RECV_MSGS:
+		ret = dn_batch_ioctl(dn, filp, cmd, (void __user *)arg);
+		break;
+	default:
+		pr_warn("%s: Unhandled ioctl cmd: 0x%x\n",
+			__func__, cmd);
+		ret = -EINVAL;
+	}
+	return ret;
+}
+
+#if defined(CONFIG_COMPAT)
+static long tipc_compat_ioctl(struct file *filp,
+			      unsigned int cmd, unsigned long arg)
+{
+	int ret;
+	struct tipc_dn_chan *dn = filp->private_data;
+	void __user *user_req = compat_ptr(arg);
+
+	if (_IOC_TYPE(cmd) != TIPC_IOC_MAGIC)
+		return -EINVAL;
+
+	switch (cmd) {
+	case TIPC_IOC_CONNECT_COMPAT:
+		ret = dn_connect_ioctl(dn, user_req);
+		break;
+	case TIPC_IOC_SEND_MSGS:
+	case TIPC_IOC_RECV_MSGS:
+		ret = dn_batch_ioctl(dn, filp, cmd, user_req);
+		break;
+	default:
+		pr_warn("%s: Unhandled ioctl cmd: 0x%x\n",
+			__func__, cmd);
+		ret = -EINVAL;
+	}
+	return ret;
+}
+#endif
+
 static unsigned int tipc_poll(struct file *filp, poll_table *wait)
 {
 	unsigned int mask = 0;
@@ -2888,6 +2888,30 @@ static const struct file_operations dbg_flip_stats_ops = {
 	.release = single_release,
 };
 
+static int dbg_bw_cache_show(struct seq_file *m, void *unused)
+{
+	struct tegra_dc *dc = m->private;
+
+	if (WARN_ON(!dc))
+		return -EINVAL;
+
+	tegra_dc_bw_cache_show(m, dc);
+
+	return 0;
+}
+
+static int dbg_bw_cache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dbg_bw_cache_show, inode->i_private);
+}
+
+static const struct file_operations dbg_bw_cache_ops = {
+	.open = dbg_bw_cache_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int dbg_measure_latency_show(struct seq_file *m, void *unused)
 {
 	struct tegra_dc *dc = m->private;
@@ -3073,6 +3097,13 @@ static void tegra_dc_create_debugfs(struct tegra_dc *dc)
 	if (!retval)
 		goto remove_out;
 
+	if (!tegra_dc_is_nvdisplay()) {
+		retval = debugfs_create_file("bw_cache", 0444, dc->debugdir,
+					dc, &dbg_bw_cache_ops);
+		if (!retval)
+			goto remove_out;
+	}
+
 	if (dc->out_ops->get_connector_instance) {
 		char sor_path[CHAR_BUF_SIZE_MAX];
 		int ctrl_num = -1;
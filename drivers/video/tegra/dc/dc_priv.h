@@ -163,6 +163,8 @@ int tegra_dc_config_frame_end_intr(struct tegra_dc *dc, bool enable);
 int _tegra_dc_wait_for_frame_end(struct tegra_dc *dc,
 	u32 timeout_ms);
 
+struct seq_file;
+
 /* defined in bandwidth.c, used in dc.c */
 void tegra_dc_clear_bandwidth(struct tegra_dc *dc);
 void tegra_dc_program_bandwidth(struct tegra_dc *dc, bool use_new);
@@ -172,6 +174,7 @@ void tegra_dc_bandwidth_renegotiate(void *p, u32 avail_bw);
 #endif
 unsigned long tegra_dc_get_bandwidth(struct tegra_dc_win *windows[], int n);
 long tegra_calc_min_bandwidth(struct tegra_dc *dc);
+void tegra_dc_bw_cache_show(struct seq_file *m, struct tegra_dc *dc);
 long tegra_nvdisp_calc_min_bandwidth(struct tegra_dc *dc);
 
 /* defined in mode.c, used in dc.c, window.c and hdmi2.0.c */
@@ -21,6 +21,8 @@
 #include <linux/clk.h>
 #include <linux/clk/tegra.h>
 #include <linux/math64.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
 
 #include <linux/nvhost.h>
 #include <trace/events/display.h>
@@ -41,6 +43,14 @@ static int use_dynamic_emc = 1;
 
 module_param_named(use_dynamic_emc, use_dynamic_emc, int, 0644);
 
+static int use_bw_cache = 1;
+
+module_param_named(use_bw_cache, use_bw_cache, int, 0644);
+
+static int verify_bw_cache;
+
+module_param_named(verify_bw_cache, verify_bw_cache, int, 0644);
+
 DEFINE_MUTEX(tegra_dcs_total_bw_lock);
 
 /* windows A, B, C for first and second display */
@@ -513,6 +523,289 @@ static void calc_disp_params(struct tegra_dc *dc,
 	mutex_unlock(&tegra_dcs_total_bw_lock);
 }
 
+/*
+ * Latency allowance result cache
+ * ------------------------------
+ * Flips that toggle overlays usually cycle between a handful of window
+ * configurations. Searching for an EMC frequency that satisfies LA/PTSA
+ * (which calls calc_disp_params() and clk_round_rate() once per DRAM
+ * step) is the bulk of the bandwidth programming cost for such flips.
+ *
+ * Programmed LA results are memoized per head, keyed by a canonical
+ * description of everything the search reads: window format, source and
+ * destination size, tiling/rotation/enable flags, the display mode, the
+ * requested bw together with the bw of the other windows in the same
+ * internal/external class, and the global state owned by the other heads
+ * (their bw and an LA generation they bump whenever they program a
+ * different LA). A cached result is re-validated by
+ * tegra_set_disp_latency_allowance(); on failure the full search runs as
+ * before. Checks (set_la == 0) are never served from the cache. With the
+ * verify_bw_cache module parameter set, every hit is first compared with
+ * a fresh search and dropped if they disagree; the counts are in the
+ * per-head "bw_cache" debugfs file.
+ */
+#define TEGRA_DC_LA_CACHE_SIZE		16
+#define TEGRA_DC_BW_WIN_FLAGS		(TEGRA_WIN_FLAG_ENABLED | \
+					TEGRA_WIN_FLAG_TILED | \
+					TEGRA_WIN_FLAG_BLOCKLINEAR | \
+					TEGRA_WIN_FLAG_SCAN_COLUMN)
+
+struct tegra_dc_bw_win_key {
+	u32 fmt;
+	u32 flags;
+	u32 in_w;
+	u32 in_h;
+	u32 out_w;
+	u32 out_h;
+	u32 pclk;
+	u32 h_total;
+	u32 v_total;
+	u32 h_active;
+	u32 v_active;
+};
+
+struct tegra_dc_la_key {
+	struct tegra_dc_bw_win_key win;
+	u32 la_id;
+	u32 bw_mbps;
+	u32 head_bw_mbps;
+	u32 class_bw_mbps;
+	u32 num_active;
+	u32 other_bw_mbps;
+	u32 other_gen;
+};
+
+struct tegra_dc_la_entry {
+	struct tegra_dc_la_key key;
+	struct dc_to_la_params disp_params;
+	unsigned long emc_freq_hz;
+	unsigned long dram_freq_hz;
+	u64 last_use;
+	bool valid;
+};
+
+/* LA last programmed for a window, to tell real LA changes from replays */
+struct tegra_dc_la_prog {
+	struct dc_to_la_params disp_params;
+	unsigned long emc_freq_hz;
+	unsigned long bw_mbps;
+	bool valid;
+};
+
+struct tegra_dc_bw_cache {
+	struct tegra_dc_la_entry la[TEGRA_DC_LA_CACHE_SIZE];
+	struct tegra_dc_la_prog prog[DC_N_WINDOWS];
+	u32 la_gen;
+	u64 clock;
+	u64 la_hits;
+	u64 la_misses;
+	u64 la_stale;
+	u64 la_verified;
+	u64 la_mismatch;
+	u64 la_hit_ns;
+	u64 la_miss_ns;
+};
+
+static DEFINE_MUTEX(tegra_dc_bw_cache_lock);
+static struct tegra_dc_bw_cache tegra_dc_bw_caches[ARRAY_SIZE(la_id_tab)];
+
+static void tegra_dc_bw_win_key(struct tegra_dc *dc, struct tegra_dc_win *w,
+	struct tegra_dc_bw_win_key *key)
+{
+	const struct tegra_dc_mode *mode = &dc->mode;
+
+	memset(key, 0, sizeof(*key));
+	key->fmt = w->fmt;
+	key->flags = w->flags & TEGRA_DC_BW_WIN_FLAGS;
+	key->in_w = dfixed_trunc(w->w);
+	key->in_h = dfixed_trunc(w->h);
+	key->out_w = w->out_w;
+	key->out_h = w->out_h;
+	key->pclk = mode->pclk;
+	key->h_total = mode->h_active + mode->h_front_porch +
+			mode->h_back_porch + mode->h_sync_width;
+	key->v_total = mode->v_active + mode->v_front_porch +
+			mode->v_back_porch + mode->v_sync_width;
+	key->h_active = mode->h_active;
+	key->v_active = mode->v_active;
+}
+
+/* Sum of the LA bw (MBps) of the windows sharing @la_id's buffer class */
+static unsigned int tegra_dc_la_class_bw(struct tegra_dc *dc,
+	enum tegra_la_id la_id, unsigned int *num_active)
+{
+	bool internal = is_internal_win(la_id);
+	unsigned int total = 0;
+	int i = 0;
+
+	*num_active = 0;
+
+	for_each_set_bit(i, &dc->valid_windows,
+			tegra_dc_get_numof_dispwindows()) {
+		struct tegra_dc_win *curr_win = tegra_dc_get_window(dc, i);
+		enum tegra_la_id curr_win_la_id =
+				la_id_tab[dc->ctrl_num][curr_win->idx];
+		unsigned int curr_win_bw;
+
+		if (is_internal_win(curr_win_la_id) != internal)
+			continue;
+
+		if (WIN_IS_ENABLED(curr_win))
+			(*num_active)++;
+
+		curr_win_bw = max(curr_win->bandwidth,
+					curr_win->new_bandwidth);
+		if (curr_win_bw != UINT_MAX)
+			curr_win_bw = curr_win_bw / 1000 + 1;
+
+		total += curr_win_bw;
+	}
+
+	return total;
+}
+
+static u32 tegra_dc_head_bw_mbps(struct tegra_dc *dc)
+{
+	unsigned long head_bw = max(dc->new_bw_kbps, dc->bw_kbps);
+
+	return (head_bw != ULONG_MAX) ? head_bw / 1000 + 1 : U32_MAX;
+}
+
+/* Called with tegra_dc_bw_cache_lock held */
+static void tegra_dc_la_key(struct tegra_dc *dc, struct tegra_dc_win *w,
+	unsigned long bw, struct tegra_dc_la_key *key)
+{
+	enum tegra_la_id la_id = la_id_tab[dc->ctrl_num][w->idx];
+	int i;
+
+	memset(key, 0, sizeof(*key));
+	tegra_dc_bw_win_key(dc, w, &key->win);
+	key->la_id = la_id;
+	key->bw_mbps = bw;
+	key->head_bw_mbps = tegra_dc_head_bw_mbps(dc);
+	key->class_bw_mbps = tegra_dc_la_class_bw(dc, la_id, &key->num_active);
+
+	/* PTSA is shared, so the other heads' LA state is part of the input */
+	for (i = 0; i < ARRAY_SIZE(tegra_dc_bw_caches); i++) {
+		struct tegra_dc *other = tegra_dc_get_dc(i);
+
+		if (i == dc->ctrl_num)
+			continue;
+
+		key->other_gen += tegra_dc_bw_caches[i].la_gen;
+		if (other && other->enabled)
+			key->other_bw_mbps += tegra_dc_head_bw_mbps(other);
+	}
+}
+
+/*
+ * Record the LA programmed for @w and bump this head's generation if it
+ * differs from what was there, so the other heads drop cached results
+ * computed against the old PTSA state. Called with tegra_dc_bw_cache_lock
+ * held.
+ */
+static void tegra_dc_la_programmed(struct tegra_dc_bw_cache *cache,
+	struct tegra_dc_win *w, unsigned long emc_freq_hz, unsigned long bw,
+	const struct dc_to_la_params *disp_params)
+{
+	struct tegra_dc_la_prog *prog = &cache->prog[w->idx];
+
+	if (prog->valid && prog->emc_freq_hz == emc_freq_hz &&
+			prog->bw_mbps == bw &&
+			!memcmp(&prog->disp_params, disp_params,
+				sizeof(*disp_params)))
+		return;
+
+	prog->disp_params = *disp_params;
+	prog->emc_freq_hz = emc_freq_hz;
+	prog->bw_mbps = bw;
+	prog->valid = true;
+	cache->la_gen++;
+}
+
+static struct tegra_dc_la_entry *tegra_dc_la_cache_find(
+	struct tegra_dc_bw_cache *cache, const struct tegra_dc_la_key *key)
+{
+	int i;
+
+	for (i = 0; i < TEGRA_DC_LA_CACHE_SIZE; i++) {
+		struct tegra_dc_la_entry *e = &cache->la[i];
+
+		if (e->valid && !memcmp(&e->key, key, sizeof(*key))) {
+			e->last_use = ++cache->clock;
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+static void tegra_dc_la_cache_insert(struct tegra_dc_bw_cache *cache,
+	const struct tegra_dc_la_key *key,
+	const struct dc_to_la_params *disp_params,
+	unsigned long emc_freq_hz, unsigned long dram_freq_hz)
+{
+	struct tegra_dc_la_entry *victim = &cache->la[0];
+	int i;
+
+	/* Reuse an entry with the same key, else evict the LRU one */
+	for (i = 0; i < TEGRA_DC_LA_CACHE_SIZE; i++) {
+		struct tegra_dc_la_entry *e = &cache->la[i];
+
+		if (e->valid && !memcmp(&e->key, key, sizeof(*key))) {
+			victim = e;
+			break;
+		}
+		if (!e->valid || e->last_use < victim->last_use)
+			victim = e;
+		if (!e->valid)
+			break;
+	}
+
+	victim->key = *key;
+	victim->disp_params = *disp_params;
+	victim->emc_freq_hz = emc_freq_hz;
+	victim->dram_freq_hz = dram_freq_hz;
+	victim->last_use = ++cache->clock;
+	victim->valid = true;
+}
+
+void tegra_dc_bw_cache_show(struct seq_file *m, struct tegra_dc *dc)
+{
+	struct tegra_dc_bw_cache *cache;
+	u64 saved_ns = 0;
+
+	if (tegra_dc_is_nvdisplay() ||
+			dc->ctrl_num >= ARRAY_SIZE(tegra_dc_bw_caches))
+		return;
+
+	cache = &tegra_dc_bw_caches[dc->ctrl_num];
+
+	mutex_lock(&tegra_dc_bw_cache_lock);
+
+	if (cache->la_hits && cache->la_misses) {
+		u64 miss_avg = div64_u64(cache->la_miss_ns, cache->la_misses);
+		u64 hit_avg = div64_u64(cache->la_hit_ns, cache->la_hits);
+
+		if (miss_avg > hit_avg)
+			saved_ns = (miss_avg - hit_avg) * cache->la_hits;
+	}
+
+	seq_printf(m, "enabled: %d\n", use_bw_cache);
+	seq_printf(m, "la_gen: %u\n", cache->la_gen);
+	seq_printf(m, "la_hits: %llu\n", cache->la_hits);
+	seq_printf(m, "la_misses: %llu\n", cache->la_misses);
+	seq_printf(m, "la_stale: %llu\n", cache->la_stale);
+	seq_printf(m, "verify: %d\n", verify_bw_cache);
+	seq_printf(m, "la_verified: %llu\n", cache->la_verified);
+	seq_printf(m, "la_mismatch: %llu\n", cache->la_mismatch);
+	seq_printf(m, "la_hit_ns: %llu\n", cache->la_hit_ns);
+	seq_printf(m, "la_miss_ns: %llu\n", cache->la_miss_ns);
+	seq_printf(m, "saved_ns: %llu\n", saved_ns);
+
+	mutex_unlock(&tegra_dc_bw_cache_lock);
+}
+
 /*
  * tegra_dc_process_bandwidth_renegotiate() is only called in code
  * sections wrapped by CONFIG_TEGRA_ISOMGR.  Thus it is also wrapped
@@ -526,6 +819,66 @@ static void tegra_dc_process_bandwidth_renegotiate(struct tegra_dc *dc,
 }
 #endif
 
+/*
+ * Redo the EMC search for a cache hit without programming anything, with
+ * tegra_check_disp_latency_allowance() standing in for the set, and tell
+ * whether it lands on the cached frequencies and display parameters.
+ * Called with tegra_dc_bw_cache_lock held.
+ */
+static bool tegra_dc_la_cache_verify(struct tegra_dc *dc,
+	struct tegra_dc_win *w, unsigned long bw,
+	const struct tegra_dc_la_entry *e)
+{
+	struct dc_to_la_params disp_params;
+	struct clk *dram_clk = NULL;
+	unsigned long emc_freq_hz = 0;
+	unsigned long dram_freq_hz = 0;
+	int err;
+
+	dram_clk = clk_get_sys("tegra_emc", "emc");
+	dram_freq_hz = clk_round_rate(dram_clk,
+		tegra_emc_bw_to_freq_req(bw * 1000000));
+	emc_freq_hz = dram_freq_hz / bwmgr_get_emc_to_dram_freq_factor();
+
+	while (1) {
+		unsigned long next_emc_freq_hz = 0;
+
+		calc_disp_params(dc, w,
+				la_id_tab[dc->ctrl_num][w->idx],
+				emc_freq_hz, bw, &disp_params);
+
+		err = tegra_check_disp_latency_allowance(
+			la_id_tab[dc->ndev->id][w->idx],
+			emc_freq_hz, bw, disp_params);
+		if (!err)
+			break;
+
+		dram_freq_hz = clk_round_rate(dram_clk, dram_freq_hz + 1000000);
+
+		next_emc_freq_hz = dram_freq_hz /
+			bwmgr_get_emc_to_dram_freq_factor();
+
+		if (emc_freq_hz == next_emc_freq_hz)
+			break;
+		emc_freq_hz = next_emc_freq_hz;
+	}
+
+	clk_put(dram_clk);
+
+	if (err || emc_freq_hz != e->emc_freq_hz ||
+			dram_freq_hz != e->dram_freq_hz ||
+			memcmp(&disp_params, &e->disp_params,
+				sizeof(disp_params))) {
+		dev_warn_ratelimited(&dc->ndev->dev,
+			"LA cache mismatch on win %d: cached emc %lu dram %lu, fresh emc %lu dram %lu (%d)\n",
+			w->idx, e->emc_freq_hz, e->dram_freq_hz,
+			emc_freq_hz, dram_freq_hz, err);
+		return false;
+	}
+
+	return true;
+}
+
 /* uses the larger of w->bandwidth or w->new_bandwidth */
 static int tegra_dc_handle_latency_allowance(struct tegra_dc *dc,
 	struct tegra_dc_win *w, int set_la)
@@ -536,6 +889,11 @@ static int tegra_dc_handle_latency_allowance(struct tegra_dc *dc,
 	struct clk *dram_clk = NULL;
 	unsigned long emc_freq_hz = 0;
 	unsigned long dram_freq_hz = 0;
+	struct tegra_dc_bw_cache *cache = &tegra_dc_bw_caches[dc->ctrl_num];
+	struct tegra_dc_la_entry *e;
+	struct tegra_dc_la_key key;
+	bool cached = use_bw_cache && set_la;
+	ktime_t start = ktime_get();
 
 	BUG_ON(dc->ctrl_num >= ARRAY_SIZE(la_id_tab));
 	BUG_ON(w->idx >= ARRAY_SIZE(*la_id_tab));
@@ -548,6 +906,45 @@ static int tegra_dc_handle_latency_allowance(struct tegra_dc *dc,
 	if (bw != ULONG_MAX)
 		bw = bw / 1000 + 1;
 
+	if (cached) {
+		mutex_lock(&tegra_dc_bw_cache_lock);
+		tegra_dc_la_key(dc, w, bw, &key);
+		e = tegra_dc_la_cache_find(cache, &key);
+		if (e && verify_bw_cache) {
+			if (tegra_dc_la_cache_verify(dc, w, bw, e)) {
+				cache->la_verified++;
+			} else {
+				/* serve nothing that a fresh search disputes */
+				e->valid = false;
+				e = NULL;
+				cache->la_mismatch++;
+			}
+		}
+		if (e) {
+			ret = tegra_set_disp_latency_allowance(
+				la_id_tab[dc->ndev->id][w->idx],
+				e->emc_freq_hz, bw, e->disp_params);
+			if (!ret) {
+				tegra_bwmgr_set_emc(dc->emc_la_handle,
+					e->dram_freq_hz,
+					TEGRA_BWMGR_SET_EMC_FLOOR);
+				tegra_dc_la_programmed(cache, w,
+					e->emc_freq_hz, bw, &e->disp_params);
+				cache->la_hits++;
+				cache->la_hit_ns += ktime_to_ns(
+					ktime_sub(ktime_get(), start));
+				mutex_unlock(&tegra_dc_bw_cache_lock);
+				return ret;
+			}
+
+			/* LA/PTSA state moved under us, redo the search */
+			e->valid = false;
+			cache->la_stale++;
+			ret = 0;
+		}
+		mutex_unlock(&tegra_dc_bw_cache_lock);
+	}
+
 	/* use clk_round_rate on root dram clock instead to get correct rate */
 	dram_clk = clk_get_sys("tegra_emc", "emc");
 	dram_freq_hz = set_la ?
@@ -597,6 +994,25 @@ static int tegra_dc_handle_latency_allowance(struct tegra_dc *dc,
 
 	clk_put(dram_clk);
 
+	if (set_la) {
+		mutex_lock(&tegra_dc_bw_cache_lock);
+		/* A failed set leaves nothing worth replaying */
+		if (!ret) {
+			tegra_dc_la_programmed(cache, w, emc_freq_hz, bw,
+				&disp_params);
+			if (cached)
+				tegra_dc_la_cache_insert(cache, &key,
+					&disp_params, emc_freq_hz,
+					dram_freq_hz);
+		}
+		if (cached) {
+			cache->la_misses++;
+			cache->la_miss_ns += ktime_to_ns(
+				ktime_sub(ktime_get(), start));
+		}
+		mutex_unlock(&tegra_dc_bw_cache_lock);
+	}
+
 	return ret;
 }
 
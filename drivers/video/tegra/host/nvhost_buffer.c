@@ -21,6 +21,7 @@
 #include <linux/uaccess.h>
 #include <linux/slab.h>
 #include <linux/dma-buf.h>
+#include <linux/rculist.h>
 #include <linux/cvnas.h>
 
 #include "dev.h"
@@ -36,8 +37,11 @@
  * @size:		Size of the buffer
  * @user_map_count:	Buffer reference count from user space
  * @submit_map_count:	Buffer reference count from task submit
- * @rb_node:		pinned buffer node
+ * @refcount:		user_map_count + submit_map_count; only drops to
+ *			zero under the buffers mutex, which then unmaps
+ * @hash_node:		pinned buffer node
  * @list_head:		List entry
+ * @rcu:		Deferred free for lock-free readers
  *
  */
 struct nvhost_vm_buffer {
@@ -50,31 +54,44 @@ struct nvhost_vm_buffer {
 	enum nvhost_buffers_heap heap;
 
 	s32 user_map_count;
-	s32 submit_map_count;
+	atomic_t submit_map_count;
+	atomic_t refcount;
 
-	struct rb_node rb_node;
+	struct hlist_node hash_node;
 	struct list_head list_head;
+	struct rcu_head rcu;
 };
 
+/*
+ * Caller holds rcu_read_lock(). A buffer that is being unmapped may still
+ * be visible; skip it, since a newer mapping of the same dma_buf can follow
+ * it in the chain.
+ */
+static struct nvhost_vm_buffer *nvhost_find_map_buffer_rcu(
+		struct nvhost_buffers *nvhost_buffers, struct dma_buf *dmabuf)
+{
+	struct nvhost_vm_buffer *vm;
+
+	hash_for_each_possible_rcu(nvhost_buffers->hash, vm, hash_node,
+				   (unsigned long)dmabuf)
+		if (vm->dmabuf == dmabuf && atomic_read(&vm->refcount) != 0)
+			return vm;
+
+	return NULL;
+}
+
+/* Caller holds the buffers mutex, which serializes all hash updates */
 static struct nvhost_vm_buffer *nvhost_find_map_buffer(
 		struct nvhost_buffers *nvhost_buffers, struct dma_buf *dmabuf)
 {
-	struct rb_root *root = &nvhost_buffers->rb_root;
-	struct rb_node *node = root->rb_node;
 	struct nvhost_vm_buffer *vm;
 
-	/* check in a sorted tree */
-	while (node) {
-		vm = rb_entry(node, struct nvhost_vm_buffer,
-						rb_node);
+	lockdep_assert_held(&nvhost_buffers->mutex);
 
-		if (vm->dmabuf > dmabuf)
-			node = node->rb_left;
-		else if (vm->dmabuf != dmabuf)
-			node = node->rb_right;
-		else
+	hash_for_each_possible(nvhost_buffers->hash, vm, hash_node,
+			       (unsigned long)dmabuf)
+		if (vm->dmabuf == dmabuf && atomic_read(&vm->refcount) != 0)
 			return vm;
-	}
 
 	return NULL;
 }
@@ -83,25 +100,8 @@ static void nvhost_buffer_insert_map_buffer(
 				struct nvhost_buffers *nvhost_buffers,
 				struct nvhost_vm_buffer *new_vm)
 {
-	struct rb_node **new_node = &(nvhost_buffers->rb_root.rb_node);
-	struct rb_node *parent = NULL;
-
-	/* Figure out where to put the new node */
-	while (*new_node) {
-		struct nvhost_vm_buffer *vm =
-			rb_entry(*new_node, struct nvhost_vm_buffer,
-						rb_node);
-		parent = *new_node;
-
-		if (vm->dmabuf > new_vm->dmabuf)
-			new_node = &((*new_node)->rb_left);
-		else
-			new_node = &((*new_node)->rb_right);
-	}
-
-	/* Add new node and rebalance tree */
-	rb_link_node(&new_vm->rb_node, parent, new_node);
-	rb_insert_color(&new_vm->rb_node, &nvhost_buffers->rb_root);
+	hash_add_rcu(nvhost_buffers->hash, &new_vm->hash_node,
+		     (unsigned long)new_vm->dmabuf);
 
 	/* Add the node into a list  */
 	list_add_tail(&new_vm->list_head, &nvhost_buffers->list_head);
@@ -113,15 +113,15 @@ int nvhost_get_iova_addr(struct nvhost_buffers *nvhost_buffers,
 	struct nvhost_vm_buffer *vm;
 	int err = -EINVAL;
 
-	mutex_lock(&nvhost_buffers->mutex);
+	rcu_read_lock();
 
-	vm = nvhost_find_map_buffer(nvhost_buffers, dmabuf);
+	vm = nvhost_find_map_buffer_rcu(nvhost_buffers, dmabuf);
 	if (vm) {
 		*addr = vm->addr;
 		err = 0;
 	}
 
-	mutex_unlock(&nvhost_buffers->mutex);
+	rcu_read_unlock();
 
 	return err;
 }
@@ -177,6 +177,8 @@ static int nvhost_buffer_map(struct platform_device *pdev,
 	vm->size = dmabuf->size;
 	vm->addr = dma_addr;
 	vm->user_map_count = 1;
+	atomic_set(&vm->submit_map_count, 0);
+	atomic_set(&vm->refcount, 1);
 
 	return err;
 
@@ -195,22 +197,28 @@ static void nvhost_free_buffers(struct kref *kref)
 	kfree(nvhost_buffers);
 }
 
+/* Called with the buffers mutex held once refcount has dropped to zero */
 static void nvhost_buffer_unmap(struct nvhost_buffers *nvhost_buffers,
 				struct nvhost_vm_buffer *vm)
 {
 	nvhost_dbg_fn("");
 
-	if ((vm->user_map_count != 0) || (vm->submit_map_count != 0))
-		return;
+	hash_del_rcu(&vm->hash_node);
+	list_del(&vm->list_head);
 
 	dma_buf_unmap_attachment(vm->attach, vm->sgt, DMA_BIDIRECTIONAL);
 	dma_buf_detach(vm->dmabuf, vm->attach);
 	dma_buf_put(vm->dmabuf);
 
-	rb_erase(&vm->rb_node, &nvhost_buffers->rb_root);
-	list_del(&vm->list_head);
+	kfree_rcu(vm, rcu);
+}
 
-	kfree(vm);
+/* Drop one reference; called with the buffers mutex held */
+static void nvhost_buffer_put(struct nvhost_buffers *nvhost_buffers,
+			      struct nvhost_vm_buffer *vm)
+{
+	if (atomic_dec_and_test(&vm->refcount))
+		nvhost_buffer_unmap(nvhost_buffers, vm);
 }
 
 struct nvhost_buffers *nvhost_buffer_init(struct platform_device *pdev)
@@ -226,7 +234,7 @@ struct nvhost_buffers *nvhost_buffer_init(struct platform_device *pdev)
 
 	nvhost_buffers->pdev = pdev;
 	mutex_init(&nvhost_buffers->mutex);
-	nvhost_buffers->rb_root = RB_ROOT;
+	hash_init(nvhost_buffers->hash);
 	INIT_LIST_HEAD(&nvhost_buffers->list_head);
 	kref_init(&nvhost_buffers->kref);
 
@@ -236,6 +244,35 @@ nvhost_buffer_init_err:
 	return ERR_PTR(err);
 }
 
+/*
+ * Look up a pinned buffer and take a reference on it. Mappings are only
+ * created and destroyed under the mutex, so the common case needs no
+ * lock. A buffer whose refcount already reached zero is being unmapped;
+ * the mutex then tells whether a newer mapping of the dma_buf exists.
+ */
+static struct nvhost_vm_buffer *nvhost_buffer_get(
+		struct nvhost_buffers *nvhost_buffers, struct dma_buf *dmabuf)
+{
+	struct nvhost_vm_buffer *vm;
+
+	rcu_read_lock();
+	vm = nvhost_find_map_buffer_rcu(nvhost_buffers, dmabuf);
+	if (vm != NULL && !atomic_inc_not_zero(&vm->refcount))
+		vm = NULL;
+	rcu_read_unlock();
+
+	if (vm != NULL)
+		return vm;
+
+	mutex_lock(&nvhost_buffers->mutex);
+	vm = nvhost_find_map_buffer(nvhost_buffers, dmabuf);
+	if (vm != NULL)
+		atomic_inc(&vm->refcount);
+	mutex_unlock(&nvhost_buffers->mutex);
+
+	return vm;
+}
+
 int nvhost_buffer_submit_pin(struct nvhost_buffers *nvhost_buffers,
 			     struct dma_buf **dmabufs, u32 count,
 			     dma_addr_t *paddr, size_t *psize,
@@ -246,14 +283,12 @@ int nvhost_buffer_submit_pin(struct nvhost_buffers *nvhost_buffers,
 
 	kref_get(&nvhost_buffers->kref);
 
-	mutex_lock(&nvhost_buffers->mutex);
-
 	for (i = 0; i < count; i++) {
-		vm = nvhost_find_map_buffer(nvhost_buffers, dmabufs[i]);
+		vm = nvhost_buffer_get(nvhost_buffers, dmabufs[i]);
 		if (vm == NULL)
 			goto submit_err;
 
-		vm->submit_map_count++;
+		atomic_inc(&vm->submit_map_count);
 		paddr[i] = vm->addr;
 		psize[i] = vm->size;
 
@@ -262,12 +297,9 @@ int nvhost_buffer_submit_pin(struct nvhost_buffers *nvhost_buffers,
 			heap[i] = vm->heap;
 	}
 
-	mutex_unlock(&nvhost_buffers->mutex);
 	return 0;
 
 submit_err:
-	mutex_unlock(&nvhost_buffers->mutex);
-
 	count = i;
 
 	nvhost_buffer_submit_unpin(nvhost_buffers, dmabufs, count);
@@ -288,7 +320,9 @@ int nvhost_buffer_pin(struct nvhost_buffers *nvhost_buffers,
 	for (i = 0; i < count; i++) {
 		vm = nvhost_find_map_buffer(nvhost_buffers, dmabufs[i]);
 		if (vm) {
+			/* refcount is never zero for a hashed buffer here */
 			vm->user_map_count++;
+			atomic_inc(&vm->refcount);
 			continue;
 		}
 
@@ -326,21 +360,42 @@ void nvhost_buffer_submit_unpin(struct nvhost_buffers *nvhost_buffers,
 {
 	struct nvhost_vm_buffer *vm;
 	int i = 0;
+	bool locked = false;
 
-	mutex_lock(&nvhost_buffers->mutex);
+	rcu_read_lock();
 
 	for (i = 0; i < count; i++) {
 
-		vm = nvhost_find_map_buffer(nvhost_buffers, dmabufs[i]);
+		vm = locked ?
+			nvhost_find_map_buffer(nvhost_buffers, dmabufs[i]) :
+			nvhost_find_map_buffer_rcu(nvhost_buffers, dmabufs[i]);
 		if (vm == NULL)
 			continue;
 
-		if (vm->submit_map_count-- < 0)
-			vm->submit_map_count = 0;
-		nvhost_buffer_unmap(nvhost_buffers, vm);
+		if (atomic_dec_if_positive(&vm->submit_map_count) < 0)
+			continue;
+
+		/* Drop the reference unless it is the last one */
+		if (atomic_add_unless(&vm->refcount, -1, 1))
+			continue;
+
+		/*
+		 * The last reference is dropped under the mutex. Holding
+		 * our reference keeps vm alive across the switch from rcu
+		 * to the mutex.
+		 */
+		if (!locked) {
+			rcu_read_unlock();
+			mutex_lock(&nvhost_buffers->mutex);
+			locked = true;
+		}
+		nvhost_buffer_put(nvhost_buffers, vm);
 	}
 
-	mutex_unlock(&nvhost_buffers->mutex);
+	if (locked)
+		mutex_unlock(&nvhost_buffers->mutex);
+	else
+		rcu_read_unlock();
 
 	kref_put(&nvhost_buffers->kref, nvhost_free_buffers);
 }
@@ -356,12 +411,11 @@ void nvhost_buffer_unpin(struct nvhost_buffers *nvhost_buffers,
 		struct nvhost_vm_buffer *vm = NULL;
 
 		vm = nvhost_find_map_buffer(nvhost_buffers, dmabufs[i]);
-		if (vm == NULL)
+		if (vm == NULL || vm->user_map_count == 0)
 			continue;
 
-		if (vm->user_map_count-- < 0)
-			vm->user_map_count = 0;
-		nvhost_buffer_unmap(nvhost_buffers, vm);
+		vm->user_map_count--;
+		nvhost_buffer_put(nvhost_buffers, vm);
 	}
 
 	mutex_unlock(&nvhost_buffers->mutex);
@@ -375,8 +429,12 @@ void nvhost_buffer_release(struct nvhost_buffers *nvhost_buffers)
 	mutex_lock(&nvhost_buffers->mutex);
 	list_for_each_entry_safe(vm, n, &nvhost_buffers->list_head,
 				 list_head) {
+		s32 user_map_count = vm->user_map_count;
+
 		vm->user_map_count = 0;
-		nvhost_buffer_unmap(nvhost_buffers, vm);
+		if (user_map_count &&
+		    atomic_sub_and_test(user_map_count, &vm->refcount))
+			nvhost_buffer_unmap(nvhost_buffers, vm);
 	}
 	mutex_unlock(&nvhost_buffers->mutex);
 
@@ -20,6 +20,9 @@
 #define __NVHOST_NVHOST_BUFFER_H__
 
 #include <linux/dma-buf.h>
+#include <linux/hashtable.h>
+
+#define NVHOST_BUFFERS_HASH_BITS	6
 
 enum nvhost_buffers_heap {
 	NVHOST_BUFFERS_HEAP_DRAM = 0,
@@ -30,9 +33,11 @@ enum nvhost_buffers_heap {
  * @brief		Information needed for buffers
  *
  * pdev			Pointer to NVHOST device
- * rb_root		RB tree root for of all the buffers used by a file pointer
+ * hash			RCU hash of all the buffers used by a file pointer,
+ *			keyed by dma_buf; submit paths look up and reference
+ *			buffers without taking the mutex
  * list			List for traversing through all the buffers
- * mutex		Mutex for the buffer tree and the buffer list
+ * mutex		Mutex for mapping, unmapping and the buffer list
  * kref			Reference count for the bufferlist
  *
  */
@@ -40,7 +45,7 @@ struct nvhost_buffers {
 	struct platform_device *pdev;
 
 	struct list_head list_head;
-	struct rb_root rb_root;
+	DECLARE_HASHTABLE(hash, NVHOST_BUFFERS_HASH_BITS);
 	struct mutex mutex;
 
 	struct kref kref;
@@ -0,0 +1,478 @@
+/*
+ * NVHOST buffer pin benchmark against a fake dma_buf exporter
+ *
+ * Copyright (c) 2021, NVIDIA Corporation.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+/*
+ * Runs at module load. nvhost_buffer.c is built into this module with the
+ * CVNAS window redirected to an empty one, and the buffers come from a
+ * fake exporter whose mappings hand out a fixed IOVA per buffer without
+ * touching an IOMMU. The module carries its own copy of the buffer code,
+ * so it can only be built as a module.
+ *
+ * Half of the buffers stay pinned by user space for the whole run, the
+ * other half are pinned and unpinned at random by a mapper thread. The
+ * submit threads meanwhile pin random sets of buffers for a submit, look
+ * one of them up and unpin them again, the way the PVA and DLA task paths
+ * do. Every address handed out must be the one of its buffer, the
+ * exporter must never see a buffer mapped twice or unmapped while a
+ * submit holds it, and a submit may only fail when it named a buffer the
+ * mapper may have unpinned. At the end no buffer may be left mapped.
+ */
+
+#include <linux/cvnas.h>
+
+#include "dev.h"
+
+/* nvhost_dbg_mask lives in the nvhost module and is not exported */
+#undef nvhost_dbg_fn
+#define nvhost_dbg_fn(fmt, arg...)	do { } while (0)
+
+static phys_addr_t fake_cvsram_base(void)
+{
+	return 0;
+}
+
+static size_t fake_cvsram_size(void)
+{
+	return 0;
+}
+
+#define nvcvnas_get_cvsram_base	fake_cvsram_base
+#define nvcvnas_get_cvsram_size	fake_cvsram_size
+#include "nvhost_buffer.c"
+#undef nvcvnas_get_cvsram_size
+#undef nvcvnas_get_cvsram_base
+
+#include <linux/completion.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/scatterlist.h>
+
+#define TEST_BUFFERS		(64)
+#define TEST_MAX_THREADS	(16)
+#define TEST_MAX_SUBMIT		(8)
+#define TEST_IOVA_BASE		(0x40000000ULL)
+
+static unsigned int threads = 4;
+module_param(threads, uint, 0444);
+MODULE_PARM_DESC(threads, "submit threads");
+
+static unsigned int iterations = 100000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "submits per thread");
+
+static unsigned int seed = 1;
+module_param(seed, uint, 0444);
+MODULE_PARM_DESC(seed, "seed of the buffer choices");
+
+/* odd buffers are pinned and unpinned by the mapper thread.*/
+#define TEST_CHURN(i)		((i) & 1)
+
+/* freed by the exporter release, which may run after the test returned.*/
+struct fake_buf {
+	struct dma_buf *dmabuf;
+	struct page *page;
+	dma_addr_t iova;
+	atomic_t maps;
+	atomic_t *errors;
+};
+
+struct test_ctx {
+	struct platform_device *pdev;
+	struct nvhost_buffers *bufs;
+	struct fake_buf *fb[TEST_BUFFERS];
+	struct completion done;
+	atomic_t running;
+	atomic_t errors;
+	atomic64_t submits;
+	atomic64_t churn_fails;
+	u64 mapper_ops;
+};
+
+struct test_thread {
+	struct test_ctx *t;
+	struct task_struct *task;
+	struct rnd_state rnd;
+};
+
+#define test_fail(errors, fmt, arg...)					\
+do {									\
+	atomic_inc(errors);						\
+	pr_err_ratelimited("nvhost_buffer_test: " fmt "\n", ##arg);	\
+} while (0)
+
+static struct sg_table *fake_map_dma_buf(struct dma_buf_attachment *attach,
+					 enum dma_data_direction dir)
+{
+	struct fake_buf *fb = attach->dmabuf->priv;
+	struct sg_table *sgt;
+
+	if (atomic_inc_return(&fb->maps) != 1)
+		test_fail(fb->errors, "buffer 0x%llx mapped twice",
+			  (u64)fb->iova);
+
+	sgt = kzalloc(sizeof(*sgt), GFP_KERNEL);
+	if (!sgt)
+		goto err;
+
+	if (sg_alloc_table(sgt, 1, GFP_KERNEL)) {
+		kfree(sgt);
+		goto err;
+	}
+
+	sg_set_page(sgt->sgl, fb->page, PAGE_SIZE, 0);
+	sg_dma_address(sgt->sgl) = fb->iova;
+	sg_dma_len(sgt->sgl) = PAGE_SIZE;
+
+	return sgt;
+
+err:
+	atomic_dec(&fb->maps);
+	return ERR_PTR(-ENOMEM);
+}
+
+static void fake_unmap_dma_buf(struct dma_buf_attachment *attach,
+			       struct sg_table *sgt,
+			       enum dma_data_direction dir)
+{
+	struct fake_buf *fb = attach->dmabuf->priv;
+
+	if (atomic_dec_return(&fb->maps) != 0)
+		test_fail(fb->errors, "buffer 0x%llx unmapped twice",
+			  (u64)fb->iova);
+
+	sg_free_table(sgt);
+	kfree(sgt);
+}
+
+static void fake_release(struct dma_buf *dmabuf)
+{
+	struct fake_buf *fb = dmabuf->priv;
+
+	__free_page(fb->page);
+	kfree(fb);
+}
+
+static int fake_mmap(struct dma_buf *dmabuf, struct vm_area_struct *vma)
+{
+	return -EINVAL;
+}
+
+static const struct dma_buf_ops fake_dma_buf_ops = {
+	.map_dma_buf = fake_map_dma_buf,
+	.unmap_dma_buf = fake_unmap_dma_buf,
+	.release = fake_release,
+	.mmap = fake_mmap,
+};
+
+static struct fake_buf *fake_buf_create(struct test_ctx *t, unsigned int i)
+{
+	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+	struct fake_buf *fb;
+
+	fb = kzalloc(sizeof(*fb), GFP_KERNEL);
+	if (!fb)
+		return NULL;
+
+	fb->page = alloc_page(GFP_KERNEL);
+	if (!fb->page) {
+		kfree(fb);
+		return NULL;
+	}
+
+	fb->iova = TEST_IOVA_BASE + i * PAGE_SIZE;
+	fb->errors = &t->errors;
+	atomic_set(&fb->maps, 0);
+
+	exp_info.ops = &fake_dma_buf_ops;
+	exp_info.size = PAGE_SIZE;
+	exp_info.flags = O_RDWR;
+	exp_info.priv = fb;
+
+	fb->dmabuf = dma_buf_export(&exp_info);
+	if (IS_ERR(fb->dmabuf)) {
+		__free_page(fb->page);
+		kfree(fb);
+		return NULL;
+	}
+
+	return fb;
+}
+
+/* a finished thread waits here so that kthread_stop() always finds it.*/
+static int test_thread_park(void)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static void test_submit(struct test_thread *th)
+{
+	struct test_ctx *t = th->t;
+	struct dma_buf *dmabufs[TEST_MAX_SUBMIT];
+	struct fake_buf *fb[TEST_MAX_SUBMIT];
+	dma_addr_t paddr[TEST_MAX_SUBMIT];
+	size_t psize[TEST_MAX_SUBMIT];
+	dma_addr_t addr = 0;
+	bool churn = false;
+	unsigned int i, n, idx;
+	int err;
+
+	n = 1 + prandom_u32_state(&th->rnd) % TEST_MAX_SUBMIT;
+	for (i = 0; i < n; i++) {
+		idx = prandom_u32_state(&th->rnd) % TEST_BUFFERS;
+		fb[i] = t->fb[idx];
+		dmabufs[i] = fb[i]->dmabuf;
+		churn |= TEST_CHURN(idx);
+	}
+
+	err = nvhost_buffer_submit_pin(t->bufs, dmabufs, n, paddr, psize,
+				       NULL);
+	if (err) {
+		if (!churn)
+			test_fail(&t->errors,
+				  "submit of pinned buffers failed: %d", err);
+		else
+			atomic64_inc(&t->churn_fails);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (paddr[i] != fb[i]->iova || psize[i] != PAGE_SIZE)
+			test_fail(&t->errors,
+				  "buffer 0x%llx pinned at 0x%llx size %zu",
+				  (u64)fb[i]->iova, (u64)paddr[i], psize[i]);
+		if (atomic_read(&fb[i]->maps) != 1)
+			test_fail(&t->errors,
+				  "buffer 0x%llx unmapped under a submit",
+				  (u64)fb[i]->iova);
+	}
+
+	i = prandom_u32_state(&th->rnd) % n;
+	err = nvhost_get_iova_addr(t->bufs, dmabufs[i], &addr);
+	if (err || addr != fb[i]->iova)
+		test_fail(&t->errors, "lookup of 0x%llx gave 0x%llx: %d",
+			  (u64)fb[i]->iova, (u64)addr, err);
+
+	nvhost_buffer_submit_unpin(t->bufs, dmabufs, n);
+	atomic64_inc(&t->submits);
+}
+
+static int test_submitter(void *data)
+{
+	struct test_thread *th = data;
+	struct test_ctx *t = th->t;
+	unsigned int i;
+
+	for (i = 0; i < iterations && !kthread_should_stop(); i++) {
+		test_submit(th);
+		cond_resched();
+	}
+
+	if (atomic_dec_and_test(&t->running))
+		complete(&t->done);
+
+	return test_thread_park();
+}
+
+static int test_mapper(void *data)
+{
+	struct test_thread *th = data;
+	struct test_ctx *t = th->t;
+	u8 pinned[TEST_BUFFERS] = { 0 };
+	struct dma_buf *dmabuf;
+	unsigned int idx;
+	u32 r;
+	int err;
+
+	while (!kthread_should_stop()) {
+		r = prandom_u32_state(&th->rnd);
+		idx = (r % (TEST_BUFFERS / 2)) * 2 + 1;
+		dmabuf = t->fb[idx]->dmabuf;
+
+		if (!pinned[idx] || (pinned[idx] < 2 && (r & BIT(31)))) {
+			err = nvhost_buffer_pin(t->bufs, &dmabuf, 1);
+			if (err)
+				test_fail(&t->errors, "pin failed: %d", err);
+			else
+				pinned[idx]++;
+		} else {
+			nvhost_buffer_unpin(t->bufs, &dmabuf, 1);
+			pinned[idx]--;
+		}
+
+		t->mapper_ops++;
+		cond_resched();
+	}
+
+	for (idx = 0; idx < TEST_BUFFERS; idx++) {
+		dmabuf = t->fb[idx]->dmabuf;
+		while (pinned[idx]--)
+			nvhost_buffer_unpin(t->bufs, &dmabuf, 1);
+	}
+
+	return 0;
+}
+
+static int test_run(struct test_ctx *t, struct test_thread *th, u64 *ns)
+{
+	struct test_thread *mapper = &th[threads];
+	ktime_t start;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i <= threads; i++) {
+		th[i].t = t;
+		prandom_seed_state(&th[i].rnd, seed + i);
+	}
+
+	mapper->task = kthread_run(test_mapper, mapper, "nvhost_buf_map");
+	if (IS_ERR(mapper->task))
+		return PTR_ERR(mapper->task);
+
+	atomic_set(&t->running, threads);
+	start = ktime_get();
+	for (i = 0; i < threads; i++) {
+		th[i].task = kthread_run(test_submitter, &th[i],
+					 "nvhost_buf_sub%u", i);
+		if (IS_ERR(th[i].task)) {
+			ret = PTR_ERR(th[i].task);
+			break;
+		}
+	}
+
+	if (!ret)
+		wait_for_completion(&t->done);
+	*ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	while (i--)
+		kthread_stop(th[i].task);
+	kthread_stop(mapper->task);
+
+	return ret;
+}
+
+static int __init nvhost_buffer_test_init(void)
+{
+	struct test_thread *th = NULL;
+	struct test_ctx *t = NULL;
+	struct dma_buf *dmabuf;
+	unsigned int i = 0;
+	u64 submits = 0;
+	u64 ns = 0;
+	int ret = 0;
+
+	if (!threads || threads > TEST_MAX_THREADS) {
+		pr_err("nvhost_buffer_test: threads must be 1..%d\n",
+		       TEST_MAX_THREADS);
+		return -EINVAL;
+	}
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	th = kcalloc(threads + 1, sizeof(*th), GFP_KERNEL);
+	if (!t || !th) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	init_completion(&t->done);
+	atomic_set(&t->errors, 0);
+	atomic64_set(&t->submits, 0);
+	atomic64_set(&t->churn_fails, 0);
+
+	t->pdev = platform_device_register_simple("nvhost-buffer-test", -1,
+						  NULL, 0);
+	if (IS_ERR(t->pdev)) {
+		ret = PTR_ERR(t->pdev);
+		goto free;
+	}
+
+	for (i = 0; i < TEST_BUFFERS; i++) {
+		t->fb[i] = fake_buf_create(t, i);
+		if (!t->fb[i]) {
+			ret = -ENOMEM;
+			goto put;
+		}
+	}
+
+	t->bufs = nvhost_buffer_init(t->pdev);
+	if (IS_ERR(t->bufs)) {
+		ret = PTR_ERR(t->bufs);
+		goto put;
+	}
+
+	for (i = 0; i < TEST_BUFFERS; i += 2) {
+		dmabuf = t->fb[i]->dmabuf;
+		ret = nvhost_buffer_pin(t->bufs, &dmabuf, 1);
+		if (ret)
+			goto release;
+	}
+
+	ret = test_run(t, th, &ns);
+
+	for (i = 0; i < TEST_BUFFERS; i += 2) {
+		dmabuf = t->fb[i]->dmabuf;
+		nvhost_buffer_unpin(t->bufs, &dmabuf, 1);
+	}
+
+	for (i = 0; i < TEST_BUFFERS; i++)
+		if (atomic_read(&t->fb[i]->maps))
+			test_fail(&t->errors, "buffer 0x%llx left mapped",
+				  (u64)t->fb[i]->iova);
+
+	submits = atomic64_read(&t->submits);
+	if (!ret && atomic_read(&t->errors))
+		ret = -EINVAL;
+	if (!ret)
+		pr_info("nvhost_buffer_test: passed: %u threads, %llu submits, %lld refused, %llu mapper pins/unpins, %llu ns/submit\n",
+			threads, submits,
+			(long long)atomic64_read(&t->churn_fails),
+			t->mapper_ops,
+			submits ? div64_u64(ns * threads, submits) : 0);
+	else
+		pr_err("nvhost_buffer_test: failed: %d, %d errors (seed %u)\n",
+		       ret, atomic_read(&t->errors), seed);
+
+release:
+	nvhost_buffer_release(t->bufs);
+	i = TEST_BUFFERS;
+put:
+	while (i--)
+		dma_buf_put(t->fb[i]->dmabuf);
+	platform_device_unregister(t->pdev);
+free:
+	kfree(th);
+	kfree(t);
+	return ret;
+}
+
+static void __exit nvhost_buffer_test_exit(void)
+{
+}
+
+module_init(nvhost_buffer_test_init);
+module_exit(nvhost_buffer_test_exit);
+
+MODULE_DESCRIPTION("NVHOST buffer pin benchmark");
+MODULE_LICENSE("GPL v2");
+MODULE_AUTHOR("NVIDIA Corporation");
@@ -15,6 +15,7 @@
  */
 
 #include <linux/mutex.h>
+#include <linux/dma-buf.h>
 #include "nvhost_buffer.h"
 #include "pva.h"
 #include "nvpva_client.h"
@@ -46,6 +47,8 @@ client_context_search_locked(struct pva *dev, pid_t pid)
 				c_free->pva = dev;
 				c_free->curr_sema_value = 0;
 				mutex_init(&c_free->sema_val_lock);
+				mutex_init(&c_free->pin_lock);
+				hash_init(c_free->pins);
 				c_free->buffers = nvhost_buffer_init(dev->pdev);
 				if (IS_ERR(c_free->buffers)) {
 					dev_err(&dev->pdev->dev,
@@ -89,10 +92,127 @@ void nvpva_client_context_get(struct nvpva_client_context *client)
 	mutex_unlock(&dev->clients_lock);
 }
 
+static void nvpva_client_pin_release(struct kref *ref)
+{
+	struct nvpva_client_pin *pin =
+		container_of(ref, struct nvpva_client_pin, ref);
+
+	nvhost_buffer_submit_unpin(pin->client->buffers, &pin->dmabuf, 1);
+	dma_buf_put(pin->dmabuf);
+	kfree(pin);
+}
+
+static struct nvpva_client_pin *
+nvpva_client_pin_find_locked(struct nvpva_client_context *client,
+			     struct dma_buf *dmabuf)
+{
+	struct nvpva_client_pin *pin;
+
+	hash_for_each_possible(client->pins, pin, node, (unsigned long)dmabuf)
+		if (pin->dmabuf == dmabuf)
+			return pin;
+
+	return NULL;
+}
+
+/* Resolve a pinned buffer once so that submits can skip
+ * nvhost_buffer_submit_pin() for it. Entries are keyed by the
+ * dma_buf itself, an fd number may name another buffer later.
+ * The buffer must already be pinned in client->buffers.
+ */
+int nvpva_client_pin_add(struct nvpva_client_context *client,
+			 struct dma_buf *dmabuf)
+{
+	struct nvpva_client_pin *pin;
+	int err = 0;
+
+	mutex_lock(&client->pin_lock);
+	pin = nvpva_client_pin_find_locked(client, dmabuf);
+	if (pin != NULL) {
+		pin->pin_count += 1;
+		goto unlock;
+	}
+
+	pin = kzalloc(sizeof(*pin), GFP_KERNEL);
+	if (pin == NULL) {
+		err = -ENOMEM;
+		goto unlock;
+	}
+
+	err = nvhost_buffer_submit_pin(client->buffers, &dmabuf, 1,
+				       &pin->dma_addr, &pin->size,
+				       &pin->heap);
+	if (err) {
+		kfree(pin);
+		goto unlock;
+	}
+
+	kref_init(&pin->ref);
+	pin->client = client;
+	pin->pin_count = 1;
+	/* the entry holds its own dmabuf reference */
+	get_dma_buf(dmabuf);
+	pin->dmabuf = dmabuf;
+	hash_add(client->pins, &pin->node, (unsigned long)dmabuf);
+
+unlock:
+	mutex_unlock(&client->pin_lock);
+
+	return err;
+}
+
+void nvpva_client_pin_remove(struct nvpva_client_context *client,
+			     struct dma_buf *dmabuf)
+{
+	struct nvpva_client_pin *pin;
+
+	mutex_lock(&client->pin_lock);
+	pin = nvpva_client_pin_find_locked(client, dmabuf);
+	if (pin != NULL && --pin->pin_count == 0U) {
+		hash_del(&pin->node);
+		kref_put(&pin->ref, nvpva_client_pin_release);
+	}
+	mutex_unlock(&client->pin_lock);
+}
+
+/* Look up a persistent pin; the caller owns a reference on success */
+struct nvpva_client_pin *nvpva_client_pin_get(
+				struct nvpva_client_context *client,
+				struct dma_buf *dmabuf)
+{
+	struct nvpva_client_pin *pin;
+
+	mutex_lock(&client->pin_lock);
+	pin = nvpva_client_pin_find_locked(client, dmabuf);
+	if (pin != NULL)
+		kref_get(&pin->ref);
+	mutex_unlock(&client->pin_lock);
+
+	return pin;
+}
+
+void nvpva_client_pin_put(struct nvpva_client_pin *pin)
+{
+	kref_put(&pin->ref, nvpva_client_pin_release);
+}
+
 /* Free a client context from the client array */
 static void
 nvpva_client_context_free_locked(struct nvpva_client_context *client)
 {
+	struct nvpva_client_pin *pin;
+	struct hlist_node *tmp;
+	int bkt;
+
+	/* Tasks hold a client reference, so only cache references remain */
+	mutex_lock(&client->pin_lock);
+	hash_for_each_safe(client->pins, bkt, tmp, pin, node) {
+		hash_del(&pin->node);
+		kref_put(&pin->ref, nvpva_client_pin_release);
+	}
+	mutex_unlock(&client->pin_lock);
+	mutex_destroy(&client->pin_lock);
+
 	nvhost_buffer_release(client->buffers);
 	mutex_destroy(&client->sema_val_lock);
 	client->buffers = NULL;
@@ -19,9 +19,30 @@
 
 #include <linux/kref.h>
 #include <linux/mutex.h>
+#include <linux/hashtable.h>
+#include "nvhost_buffer.h"
 #include "pva_vpu_exe.h"
 
+/* Buckets for the persistent pin cache, keyed by dma_buf */
+#define NVPVA_CLIENT_PIN_HASH_BITS	6
+
 struct pva;
+struct nvpva_client_context;
+
+/* A buffer resolved once at pin time and reused across submits */
+struct nvpva_client_pin {
+	struct hlist_node node;
+	struct kref ref;
+	struct nvpva_client_context *client;
+
+	/* Number of outstanding NVPVA_IOCTL_PIN calls for this buffer */
+	u32 pin_count;
+
+	struct dma_buf *dmabuf;
+	dma_addr_t dma_addr;
+	size_t size;
+	enum nvhost_buffers_heap heap;
+};
 
 struct nvpva_client_context {
 	/* Reference to the device*/
@@ -39,6 +60,10 @@ struct nvpva_client_context {
 	u32 curr_sema_value;
 	struct mutex sema_val_lock;
 
+	/* Persistent pins, looked up by dma_buf on submit */
+	struct mutex pin_lock;
+	DECLARE_HASHTABLE(pins, NVPVA_CLIENT_PIN_HASH_BITS);
+
 	/* Data structure to track elf context for vpu parsing */
 	struct nvpva_elf_context elf_ctx;
 };
@@ -51,4 +76,13 @@ struct nvpva_client_context *nvpva_client_context_alloc(struct pva *dev,
 							pid_t pid);
 void nvpva_client_context_put(struct nvpva_client_context *client);
 
+int nvpva_client_pin_add(struct nvpva_client_context *client,
+			 struct dma_buf *dmabuf);
+void nvpva_client_pin_remove(struct nvpva_client_context *client,
+			     struct dma_buf *dmabuf);
+struct nvpva_client_pin *nvpva_client_pin_get(
+				struct nvpva_client_context *client,
+				struct dma_buf *dmabuf);
+void nvpva_client_pin_put(struct nvpva_client_pin *pin);
+
 #endif /* NVPVA_CLIENT_H */
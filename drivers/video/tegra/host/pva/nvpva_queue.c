@@ -464,3 +464,31 @@ void nvpva_queue_free_task_memory(struct nvpva_queue *queue, int index)
 	clear_bit(index%64, &task_pool->alloc_table[index/64]);
 	mutex_unlock(&task_pool->lock);
 }
+
+void *nvpva_queue_get_task_kmem(struct nvpva_queue *queue,
+				dma_addr_t dma_addr)
+{
+	struct nvpva_queue_task_pool *task_pool =
+			(struct nvpva_queue_task_pool *)queue->task_pool;
+	dma_addr_t offset;
+	unsigned long index;
+	void *kmem = NULL;
+
+	if (queue->task_dma_size == 0 || dma_addr < task_pool->dma_addr)
+		return NULL;
+
+	offset = dma_addr - task_pool->dma_addr;
+	if (offset % queue->task_dma_size)
+		return NULL;
+
+	index = offset / queue->task_dma_size;
+
+	mutex_lock(&task_pool->lock);
+	if (index < task_pool->max_task_cnt &&
+	    test_bit(index%64, &task_pool->alloc_table[index/64]))
+		kmem = (u8 *)task_pool->kmem_addr +
+			index * queue->task_kmem_size;
+	mutex_unlock(&task_pool->lock);
+
+	return kmem;
+}
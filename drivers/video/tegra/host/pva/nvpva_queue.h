@@ -263,6 +263,21 @@ int nvpva_queue_alloc_task_memory(
  */
 void nvpva_queue_free_task_memory(struct nvpva_queue *queue, int index);
 
+/**
+ * @brief	Find the task memory backing a task dma address
+ *
+ * This function maps a task dma address reported by the firmware back
+ * to the kernel memory of its pool slot without walking the task list.
+ *
+ * @param queue		Pointer to an allocated queue
+ * @param dma_addr	Task dma address reported on completion
+ * @return		Kernel memory of the slot, or NULL when the address
+ *			does not belong to an allocated slot of the pool
+ *
+ */
+void *nvpva_queue_get_task_kmem(struct nvpva_queue *queue,
+				dma_addr_t dma_addr);
+
 /**
  * @brief	Sets the attribute to the queue
  *
@@ -234,6 +234,8 @@ struct pva_version_config {
  * r5_dbg_wait		Set the r5 debugger to wait
  * timeout_enabled	Set pva timeout enabled based on debug
  * slcg_disable		Second level Clock Gating control variable
+ * persistent_pin	Resolve pinned buffers once at pin time and reuse
+ *			the mappings across submits
  *
  */
 struct pva {
@@ -278,6 +280,7 @@ struct pva {
 	u32 vmem_war_disable;
 	bool vpu_perf_counters_enable;
 	bool vpu_debug_enabled;
+	bool persistent_pin;
 
 	struct work_struct pva_abort_handler_work;
 	bool booted;
@@ -22,6 +22,7 @@
 #include <linux/platform_device.h>
 #include "dev.h"
 #include "pva.h"
+#include "pva_queue.h"
 
 static void pva_read_crashdump(struct seq_file *s, struct pva_seg_info *seg_info)
 {
@@ -125,6 +126,22 @@ static const struct file_operations print_version_fops = {
 	.release = single_release,
 };
 
+static int completion_test_show(struct seq_file *s, void *data)
+{
+	return pva_queue_completion_test(s->private, s);
+}
+
+static int completion_test_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, completion_test_show, inode->i_private);
+}
+
+static const struct file_operations completion_test_fops = {
+	.open = completion_test_open,
+	.read = seq_read,
+	.release = single_release,
+};
+
 static int get_log_level(void *data, u64 *val)
 {
 	struct pva *pva = (struct pva *) data;
@@ -178,6 +195,10 @@ void pva_debugfs_init(struct platform_device *pdev)
 	debugfs_create_u32("cg_disable", 0644, de, &pva->slcg_disable);
 	debugfs_create_bool("vpu_perf_counters_enable", 0644, de,
 			    &pva->vpu_perf_counters_enable);
+	debugfs_create_bool("persistent_pin", 0644, de,
+			    &pva->persistent_pin);
 	debugfs_create_file("log_level", 0644, de, pva,
 			    &log_level_fops);
+	debugfs_create_file("completion_test", S_IRUSR, de, pva,
+			    &completion_test_fops);
 }
@@ -427,6 +427,13 @@ static int pva_pin(struct pva_private *priv, void *arg)
 	err = nvhost_buffer_pin(priv->client->buffers, &dmabuf[0], 1);
 	out_arg->pin_id = in_arg->pin.import_id;
 
+	/* A failure here only costs the submit time fast path */
+	if ((err == 0) && priv->pva->persistent_pin &&
+	    nvpva_client_pin_add(priv->client, dmabuf[0]))
+		dev_dbg(&priv->pva->pdev->dev,
+			"no persistent pin for handle: %u",
+			in_arg->pin.import_id);
+
 	dma_buf_put(dmabuf[0]);
 out:
 	return err;
@@ -446,6 +453,8 @@ static int pva_unpin(struct pva_private *priv, void *arg)
 		goto out;
 	}
 
+	/* in-flight tasks keep their own reference on the entry */
+	nvpva_client_pin_remove(priv->client, dmabuf[0]);
 	nvhost_buffer_unpin(priv->client->buffers, &dmabuf[0], 1);
 
 	dma_buf_put(dmabuf[0]);
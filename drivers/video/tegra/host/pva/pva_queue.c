@@ -20,6 +20,7 @@
 #include <linux/kernel.h>
 #include <linux/mutex.h>
 #include <linux/percpu.h>
+#include <linux/random.h>
 #include "pva_dma.h"
 #include <linux/delay.h>
 #include <asm/ioctls.h>
@@ -118,11 +119,28 @@ static void pva_task_unpin_mem(struct pva_submit_task *task)
 	for (i = 0; i < task->num_pinned; i++) {
 		struct pva_pinned_memory *mem = &task->pinned_memory[i];
 
+		if (mem->pin != NULL) {
+			nvpva_client_pin_put(mem->pin);
+			continue;
+		}
+
 		nvhost_buffer_submit_unpin(task->client->buffers, &mem->dmabuf,
 					   1);
 		dma_buf_put(mem->dmabuf);
 	}
 	task->num_pinned = 0;
+	hash_init(task->pinned_hash);
+}
+
+static struct pva_pinned_memory *find_pinned_mem(struct pva_submit_task *task,
+						 int fd)
+{
+	struct pva_pinned_memory *mem;
+
+	hash_for_each_possible(task->pinned_hash, mem, node, fd)
+		if (mem->fd == fd)
+			return mem;
+	return NULL;
 }
 
 struct pva_pinned_memory *pva_task_pin_mem(struct pva_submit_task *task,
@@ -130,12 +148,7 @@ struct pva_pinned_memory *pva_task_pin_mem(struct pva_submit_task *task,
 {
 	int err;
 	struct pva_pinned_memory *mem;
-
-	if (task->num_pinned >= ARRAY_SIZE(task->pinned_memory)) {
-		task_err(task, "too many objects to pin");
-		err = -ENOMEM;
-		goto err_out;
-	}
+	struct nvpva_client_pin *pin;
 
 	if (!dmafd) {
 		task_err(task, "pin_id is 0");
@@ -143,8 +156,20 @@ struct pva_pinned_memory *pva_task_pin_mem(struct pva_submit_task *task,
 		goto err_out;
 	}
 
+	/* objects are often referenced many times by one task */
+	mem = find_pinned_mem(task, dmafd);
+	if (mem != NULL)
+		return mem;
+
+	if (task->num_pinned >= ARRAY_SIZE(task->pinned_memory)) {
+		task_err(task, "too many objects to pin");
+		err = -ENOMEM;
+		goto err_out;
+	}
+
 	mem = &task->pinned_memory[task->num_pinned];
 	mem->fd = dmafd;
+	mem->pin = NULL;
 	mem->dmabuf = dma_buf_get(dmafd);
 	if (IS_ERR_OR_NULL(mem->dmabuf)) {
 		task_err(task, "can't get dmabuf from pin_id: %ld",
@@ -152,13 +177,30 @@ struct pva_pinned_memory *pva_task_pin_mem(struct pva_submit_task *task,
 		err = -EFAULT;
 		goto err_out;
 	}
+
+	pin = task->pva->persistent_pin ?
+		nvpva_client_pin_get(task->client, mem->dmabuf) : NULL;
+	if (pin != NULL) {
+		/* the pin keeps the buffer alive until the task retires */
+		dma_buf_put(mem->dmabuf);
+		mem->pin = pin;
+		mem->dmabuf = pin->dmabuf;
+		mem->dma_addr = pin->dma_addr;
+		mem->size = pin->size;
+		mem->heap = pin->heap;
+		goto out;
+	}
+
 	err = nvhost_buffer_submit_pin(task->client->buffers, &mem->dmabuf, 1,
 				       &mem->dma_addr, &mem->size, &mem->heap);
 	if (err) {
 		task_err(task, "submit pin failed; Is the handled pinned?");
+		dma_buf_put(mem->dmabuf);
 		goto err_out;
 	}
 
+out:
+	hash_add(task->pinned_hash, &mem->node, dmafd);
 	task->num_pinned += 1;
 	return mem;
 err_out:
@@ -655,6 +697,28 @@ void pva_task_free(struct kref *ref)
 	up(&my_queue->task_pool_sem);
 }
 
+/*
+ * Find the finished task and unlink it; since two tasks can be scheduled at
+ * the same time, the finished one is not necessarily the first one. The task
+ * address identifies its pool slot, so no list walk is needed; the slot only
+ * counts if it still holds a task that is linked in.
+ */
+static struct pva_submit_task *pva_queue_take_done_task(
+	struct nvpva_queue *queue, dma_addr_t addr)
+{
+	struct pva_submit_task *task;
+
+	mutex_lock(&queue->list_lock);
+	task = nvpva_queue_get_task_kmem(queue, addr);
+	if (task && task->dma_addr == addr && !list_empty(&task->node))
+		list_del_init(&task->node);
+	else
+		task = NULL;
+	mutex_unlock(&queue->list_lock);
+
+	return task;
+}
+
 static void update_one_task(struct pva *pva)
 {
 	struct platform_device *pdev = pva->pdev;
@@ -664,7 +728,6 @@ static void update_one_task(struct pva *pva)
 	struct pva_submit_task *task;
 	struct pva_hw_task *hw_task;
 	struct pva_task_statistics_s *stats;
-	bool found;
 	u64 vpu_time = 0u;
 	u64 r5_overhead = 0u;
 	const u32 tsc_ticks_to_us = 31;
@@ -672,23 +735,8 @@ static void update_one_task(struct pva *pva)
 	WARN_ON(!task_info.valid);
 	WARN_ON(task_info.queue >= MAX_PVA_QUEUE_COUNT);
 	queue = &pva->pool->queues[task_info.queue];
-	/* find the finished task; since two tasks can be scheduled at the same
- * time, the finished one is not necessarily the first one
- */
-	found = false;
-	mutex_lock(&queue->list_lock);
-	/* since we are only taking one entry out, we don't need to use the safe
- * version
- */
-	list_for_each_entry(task, &queue->tasklist, node) {
-		if (task->dma_addr == task_info.addr) {
-			list_del(&task->node);
-				found = true;
-				break;
-		}
-	}
-	mutex_unlock(&queue->list_lock);
-	if (!found) {
+	task = pva_queue_take_done_task(queue, task_info.addr);
+	if (task == NULL) {
 		pr_err("pva: unexpected task: queue:%u, valid:%u, error:%u, vpu:%u",
 		       task_info.queue, task_info.valid, task_info.error,
 		       task_info.vpu);
@@ -730,6 +778,230 @@ void pva_task_update(struct work_struct *work)
 	for (i = 0; i < n_tasks; i++)
 		update_one_task(pva);
 }
+
+#define PVA_COMPLETION_TEST_STEPS	100000
+
+/* State of a task pool slot as the fake firmware sees it */
+enum pva_completion_test_slot {
+	COMPLETION_TEST_FREE = 0,
+	COMPLETION_TEST_ALLOCATED,
+	COMPLETION_TEST_LINKED,
+};
+
+struct pva_completion_test {
+	struct nvpva_queue *queue;
+	struct rnd_state rnd;
+	struct pva_submit_task *tasks[MAX_PVA_TASK_COUNT_PER_QUEUE];
+	u8 state[MAX_PVA_TASK_COUNT_PER_QUEUE];
+	dma_addr_t base;
+	u32 reports;
+	u32 completed;
+	u32 rejected;
+	u32 errors;
+};
+
+/* Random slot in the given state, or -1 if there is none */
+static int pva_completion_test_pick(struct pva_completion_test *t, u8 state)
+{
+	u32 start = prandom_u32_state(&t->rnd) % MAX_PVA_TASK_COUNT_PER_QUEUE;
+	u32 i, idx;
+
+	for (i = 0; i < MAX_PVA_TASK_COUNT_PER_QUEUE; i++) {
+		idx = (start + i) % MAX_PVA_TASK_COUNT_PER_QUEUE;
+		if (t->state[idx] == state)
+			return idx;
+	}
+
+	return -1;
+}
+
+static dma_addr_t pva_completion_test_addr(struct pva_completion_test *t,
+					   u32 idx)
+{
+	return t->base + idx * t->queue->task_dma_size;
+}
+
+/*
+ * Report addr as completed the way the firmware does and check that the
+ * task found is the one the old tasklist walk finds, and the one expected.
+ */
+static void pva_completion_test_report(struct pva_completion_test *t,
+				       dma_addr_t addr,
+				       struct pva_submit_task *expected)
+{
+	struct nvpva_queue *queue = t->queue;
+	struct pva_submit_task *task, *walk = NULL;
+
+	mutex_lock(&queue->list_lock);
+	list_for_each_entry(task, &queue->tasklist, node) {
+		if (task->dma_addr == addr) {
+			walk = task;
+			break;
+		}
+	}
+	mutex_unlock(&queue->list_lock);
+
+	task = pva_queue_take_done_task(queue, addr);
+	t->reports++;
+	if (task != walk || task != expected) {
+		pr_err_ratelimited("pva: completion of 0x%llx found %p, list walk %p, expected %p\n",
+				   (u64)addr, task, walk, expected);
+		t->errors++;
+	}
+
+	if (task == NULL) {
+		t->rejected++;
+		return;
+	}
+
+	t->completed++;
+	t->state[task->pool_index] = COMPLETION_TEST_ALLOCATED;
+}
+
+static void pva_completion_test_free(struct pva_completion_test *t, u32 idx)
+{
+	struct nvpva_queue *queue = t->queue;
+
+	/* a lookup that failed to unlink must not leave a freed task linked */
+	mutex_lock(&queue->list_lock);
+	if (!list_empty(&t->tasks[idx]->node))
+		list_del_init(&t->tasks[idx]->node);
+	mutex_unlock(&queue->list_lock);
+
+	nvpva_queue_free_task_memory(queue, idx);
+	t->tasks[idx] = NULL;
+	t->state[idx] = COMPLETION_TEST_FREE;
+}
+
+static void pva_completion_test_step(struct pva_completion_test *t)
+{
+	struct nvpva_queue *queue = t->queue;
+	struct nvpva_queue_task_mem_info mem;
+	struct pva_submit_task *task;
+	u32 r = prandom_u32_state(&t->rnd);
+	int idx;
+
+	switch (r % 8) {
+	case 0:
+	case 1:
+	case 2:
+		/* submit: the slot is filled in before it is linked */
+		if (pva_completion_test_pick(t, COMPLETION_TEST_FREE) < 0 ||
+		    nvpva_queue_alloc_task_memory(queue, &mem))
+			break;
+		task = mem.kmem_addr;
+		task->dma_addr = mem.dma_addr;
+		task->pool_index = mem.pool_index;
+		INIT_LIST_HEAD(&task->node);
+		t->tasks[mem.pool_index] = task;
+		t->state[mem.pool_index] = COMPLETION_TEST_ALLOCATED;
+		break;
+	case 3:
+		idx = pva_completion_test_pick(t, COMPLETION_TEST_ALLOCATED);
+		if (idx < 0)
+			break;
+		mutex_lock(&queue->list_lock);
+		list_add_tail(&t->tasks[idx]->node, &queue->tasklist);
+		mutex_unlock(&queue->list_lock);
+		t->state[idx] = COMPLETION_TEST_LINKED;
+		break;
+	case 4:
+	case 5:
+		/* completion, then the same completion reported again */
+		idx = pva_completion_test_pick(t, COMPLETION_TEST_LINKED);
+		if (idx < 0)
+			break;
+		task = t->tasks[idx];
+		pva_completion_test_report(t, task->dma_addr, task);
+		pva_completion_test_report(t, task->dma_addr, NULL);
+		pva_completion_test_free(t, idx);
+		break;
+	case 6:
+		/* any slot; only a linked task may be found */
+		idx = (r >> 8) % MAX_PVA_TASK_COUNT_PER_QUEUE;
+		pva_completion_test_report(t, pva_completion_test_addr(t, idx),
+			t->state[idx] == COMPLETION_TEST_LINKED ?
+			t->tasks[idx] : NULL);
+		if (t->state[idx] == COMPLETION_TEST_ALLOCATED &&
+		    ((r >> 16) & 1))
+			pva_completion_test_free(t, idx);
+		break;
+	default:
+		/* addresses which are not a slot start */
+		idx = (r >> 8) % MAX_PVA_TASK_COUNT_PER_QUEUE;
+		pva_completion_test_report(t,
+			pva_completion_test_addr(t, idx) + 4 * (1 + (r >> 16) % 16),
+			NULL);
+		pva_completion_test_report(t, t->base - queue->task_dma_size,
+					   NULL);
+		pva_completion_test_report(t,
+			pva_completion_test_addr(t, MAX_PVA_TASK_COUNT_PER_QUEUE),
+			NULL);
+		break;
+	}
+}
+
+/*
+ * Test the completion lookup against a fake firmware. A queue of its own
+ * gets tasks allocated, linked and completed in random order, and the
+ * fake firmware also reports duplicate, stale and bogus task addresses.
+ * Every report is checked against the tasklist walk used before.
+ */
+int pva_queue_completion_test(struct pva *pva, struct seq_file *s)
+{
+	struct nvpva_queue_task_mem_info mem;
+	struct pva_completion_test *t;
+	u32 i, seed;
+	int idx;
+	int err = 0;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (t == NULL)
+		return -ENOMEM;
+
+	t->queue = nvpva_queue_alloc(pva->pool, MAX_PVA_TASK_COUNT_PER_QUEUE);
+	if (IS_ERR(t->queue)) {
+		err = PTR_ERR(t->queue);
+		goto free;
+	}
+	seed = prandom_u32();
+	prandom_seed_state(&t->rnd, seed);
+
+	/* the pool base is learnt from the first slot handed out */
+	err = nvpva_queue_alloc_task_memory(t->queue, &mem);
+	if (err)
+		goto put;
+	t->base = mem.dma_addr -
+		  (dma_addr_t)mem.pool_index * t->queue->task_dma_size;
+	nvpva_queue_free_task_memory(t->queue, mem.pool_index);
+
+	for (i = 0; i < PVA_COMPLETION_TEST_STEPS; i++)
+		pva_completion_test_step(t);
+
+	/* drain */
+	while ((idx = pva_completion_test_pick(t, COMPLETION_TEST_LINKED)) >= 0)
+		pva_completion_test_report(t,
+			pva_completion_test_addr(t, idx), t->tasks[idx]);
+	while ((idx = pva_completion_test_pick(t,
+				COMPLETION_TEST_ALLOCATED)) >= 0)
+		pva_completion_test_free(t, idx);
+
+	if (!list_empty(&t->queue->tasklist)) {
+		pr_err("pva: completion test left tasks linked\n");
+		t->errors++;
+	}
+
+	seq_printf(s, "%s: %u reports, %u completed, %u rejected, %u errors (seed %u)\n",
+		   t->errors ? "FAIL" : "PASS", t->reports, t->completed,
+		   t->rejected, t->errors, seed);
+
+put:
+	nvpva_queue_put(t->queue);
+free:
+	kfree(t);
+	return err;
+}
+
 static void
 pva_queue_dump(struct nvpva_queue *queue, struct seq_file *s)
 {
@@ -847,7 +1119,7 @@ remove_tasks:
 		struct pva_submit_task *task = task_header->tasks[i];
 
 		mutex_lock(&queue->list_lock);
-		list_del(&task->node);
+		list_del_init(&task->node);
 		mutex_unlock(&queue->list_lock);
 
 		(void)nvhost_syncpt_dec_max_ext(host1x_pdev, queue->syncpt_id,
@@ -1020,17 +1292,6 @@ unlock:
 	return err;
 }
 
-static struct pva_pinned_memory *find_pinned_mem(struct pva_submit_task *task,
-						 int fd)
-{
-	u32 i;
-
-	for (i = 0; i < task->num_pinned; i++)
-		if (task->pinned_memory[i].fd == fd)
-			return &task->pinned_memory[i];
-	return NULL;
-}
-
 static void pva_queue_cleanup_semaphore(struct pva_submit_task *task,
 					struct nvpva_submit_fence *fence)
 {
@@ -1120,7 +1381,7 @@ static int pva_queue_abort(struct nvpva_queue *queue)
 
 	list_for_each_entry_safe(task, n, &queue->tasklist, node) {
 		pva_queue_cleanup(queue, task);
-		list_del(&task->node);
+		list_del_init(&task->node);
 		kref_put(&task->ref, pva_task_free);
 	}
 
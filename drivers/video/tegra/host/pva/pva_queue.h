@@ -18,6 +18,7 @@
 #ifndef PVA_QUEUE_H
 #define PVA_QUEUE_H
 
+#include <linux/hashtable.h>
 #include <uapi/linux/nvpva_ioctl.h>
 #include "nvpva_queue.h"
 #include "nvhost_buffer.h"
@@ -26,15 +27,24 @@
 #include "pva-task.h"
 
 struct dma_buf;
+struct nvpva_client_pin;
+struct pva;
+struct seq_file;
 
 extern struct nvpva_queue_ops pva_queue_ops;
 
+/* Log2 of the per-task pinned_memory lookup buckets */
+#define PVA_TASK_PIN_HASH_BITS	5
+
 struct pva_pinned_memory {
 	int fd;
 	dma_addr_t dma_addr;
 	size_t size;
 	struct dma_buf *dmabuf;
 	enum nvhost_buffers_heap heap;
+	/* set when the mapping is borrowed from a persistent pin */
+	struct nvpva_client_pin *pin;
+	struct hlist_node node;
 };
 
 /**
@@ -123,6 +133,7 @@ struct pva_submit_task {
 
 	struct pva_pinned_memory pinned_memory[256];
 	u32 num_pinned;
+	DECLARE_HASHTABLE(pinned_hash, PVA_TASK_PIN_HASH_BITS);
 	u8 num_pva_fence_actions[NVPVA_MAX_FENCE_TYPES];
 	struct nvpva_fence_action
 		pva_fence_actions[NVPVA_MAX_FENCE_TYPES]
@@ -242,6 +253,8 @@ void pva_task_free(struct kref *ref);
 
 void pva_task_update(struct work_struct *work);
 
+int pva_queue_completion_test(struct pva *pva, struct seq_file *s);
+
 struct pva_pinned_memory *pva_task_pin_mem(struct pva_submit_task *task,
 					   u32 dmafd);
 
@@ -474,6 +474,9 @@ struct nvs_fn_if {
 	int (*suspend)(void *handle);
 	int (*resume)(void *handle);
 	int (*handler)(void *handle, void *buffer, s64 ts);
+	/* optional: n samples stride bytes apart with n timestamps */
+	int (*handler_batch)(void *handle, void *buffer, unsigned int stride,
+			     s64 *ts, unsigned int n);
 };
 
 extern const char * const nvs_float_significances[];
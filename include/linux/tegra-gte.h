@@ -82,6 +82,28 @@ int tegra_gte_unregister_event(struct tegra_gte_ev_desc *desc);
 int tegra_gte_retrieve_event(const struct tegra_gte_ev_desc *desc,
 			     struct tegra_gte_ev_detail *hts);
 
+/*
+ * GTE multiple event retrieval function
+ *
+ * Parameters:
+ *
+ * Input:
+ * @desc:	This parameter should be the same as returned from register
+ * @n:		Size of the @hts array
+ *
+ * Output:
+ * @hts:	hts event details, oldest first
+ *
+ * Returns:
+ *		Returns the number of events retrieved (at least 1) for
+ *		success and negative error code for the failure, -EAGAIN
+ *		when no event is pending
+ *
+ * Note:	API is not stable and subject to change.
+ */
+int tegra_gte_retrieve_events(const struct tegra_gte_ev_desc *desc,
+			      struct tegra_gte_ev_detail *hts, unsigned int n);
+
 #else /* ! CONFIG_TEGRA_HTS_GTE */
 static inline struct tegra_gte_ev_desc *tegra_gte_register_event(
 					struct device_node *np, u32 ev_id)
@@ -100,5 +122,64 @@ static inline int tegra_gte_retrieve_event(const struct tegra_gte_ev_desc *desc,
 	return -ENOSYS;
 }
 
+static inline int tegra_gte_retrieve_events(
+					const struct tegra_gte_ev_desc *desc,
+					struct tegra_gte_ev_detail *hts,
+					unsigned int n)
+{
+	return -ENOSYS;
+}
+
 #endif /* ! CONFIG_TEGRA_HTS_GTE */
+
+#ifdef CONFIG_TEGRA_HTS_GTE_SIM
+/*
+ * GTE simulated register backend switch
+ *
+ * Parameters:
+ *
+ * Input:
+ * @np:		Device node of the GTE instance
+ * @enable:	true to route register accesses to the simulated backend,
+ *		false to go back to the hardware
+ *
+ * Returns:
+ *		Returns 0 for success, -EBUSY while any event is registered
+ *		and any other value for the failure
+ *
+ * Note:	Test only, API is not stable and subject to change.
+ */
+int tegra_gte_sim_enable(struct device_node *np, bool enable);
+
+/*
+ * GTE simulated timestamp injection
+ *
+ * Parameters:
+ *
+ * Input:
+ * @desc:	This parameter should be the same as returned from register
+ * @tsc:	Raw timestamp of the edge
+ * @dir:	TEGRA_GTE_EVENT_RISING_EDGE or TEGRA_GTE_EVENT_FALLING_EDGE
+ *
+ * Returns:
+ *		Returns 0 for success, -ENOSPC when the simulated hardware
+ *		FIFO is full and any other value for the failure
+ *
+ * Note:	Test only, API is not stable and subject to change.
+ */
+int tegra_gte_sim_inject(const struct tegra_gte_ev_desc *desc, u64 tsc,
+			 int dir);
+
+#else /* ! CONFIG_TEGRA_HTS_GTE_SIM */
+static inline int tegra_gte_sim_enable(struct device_node *np, bool enable)
+{
+	return -ENOSYS;
+}
+
+static inline int tegra_gte_sim_inject(const struct tegra_gte_ev_desc *desc,
+				       u64 tsc, int dir)
+{
+	return -ENOSYS;
+}
+#endif /* ! CONFIG_TEGRA_HTS_GTE_SIM */
 #endif
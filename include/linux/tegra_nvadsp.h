@@ -66,6 +66,11 @@ status_t nvadsp_arb_sema_release(nvadsp_arb_sema_t *);
 
 /*
  * Mailbox Queue
+ *
+ * Single-producer (mailbox interrupt) ring. head and tail are free
+ * running and only ever written by the readers and the producer
+ * respectively, so the producer takes no lock. Several threads may read
+ * the same mailbox, so readers serialize on read_lock.
  */
 #define NVADSP_MBOX_QUEUE_SIZE		32
 #define NVADSP_MBOX_QUEUE_SIZE_MASK	(NVADSP_MBOX_QUEUE_SIZE - 1)
@@ -73,9 +78,8 @@ struct nvadsp_mbox_queue {
 	uint32_t array[NVADSP_MBOX_QUEUE_SIZE];
 	uint16_t head;
 	uint16_t tail;
-	uint16_t count;
-	struct completion comp;
-	spinlock_t lock;
+	wait_queue_head_t wait;
+	spinlock_t read_lock;
 };
 
 status_t nvadsp_mboxq_enqueue(struct nvadsp_mbox_queue *, uint32_t);
@@ -109,6 +113,9 @@ status_t nvadsp_mbox_send(struct nvadsp_mbox *mbox, uint32_t data,
 			  uint32_t flags, bool block, unsigned int timeout);
 status_t nvadsp_mbox_recv(struct nvadsp_mbox *mbox, uint32_t *data, bool block,
 			  unsigned int timeout);
+int nvadsp_mbox_recv_batch(struct nvadsp_mbox *mbox, uint32_t *data,
+			   unsigned int count, bool block,
+			   unsigned int timeout);
 status_t nvadsp_mbox_close(struct nvadsp_mbox *mbox);
 
 #ifdef CONFIG_MBOX_ACK_HANDLER
@@ -151,6 +158,10 @@ void msgq_init(msgq_t *msgq, int32_t size);
 int32_t msgq_queue_message(msgq_t *msgq, const msgq_message_t *message);
 int32_t msgq_dequeue_message(msgq_t *msgq, msgq_message_t *message);
 #define msgq_discard_message(msgq) msgq_dequeue_message(msgq, NULL)
+int32_t msgq_reserve_message(msgq_t *msgq, int32_t size,
+			     msgq_message_t **message);
+int32_t msgq_commit_message(msgq_t *msgq, const msgq_message_t *message);
+int32_t msgq_peek_message(msgq_t *msgq, msgq_message_t **message);
 
 /*
  * DRAM Sharing
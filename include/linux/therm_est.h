@@ -222,5 +222,20 @@ struct therm_fan_estimator {
 	int nonsleep_hyst;
 
 	bool is_continuous_gov;
+
+	/* predictive mode: trips are crossed early by the slope's lead */
+	bool predictive;
+	long slope; /* smoothed, in millicelsius per second */
+	long lead; /* subtracted from trip temps, 0 unless predictive */
+	long trip_cmp_temp; /* cur_temp + lead, used for trip crossing */
+	long last_est_temp;
+	unsigned long last_sample_jiffies;
+	long predict_horizon_ms;
+	long cur_polling_period;
+	long min_polling_period;
+	long max_polling_period;
+	/* time the estimate spent at or above throttle_temp, 0: off */
+	long throttle_temp;
+	u64 time_above_throttle_ms;
 };
 #endif /* _LINUX_THERM_EST_H */
@@ -182,9 +182,27 @@ struct camera_common_sensor_ops {
 	int (*stop_streaming)(struct tegracam_device *tc_dev);
 };
 
+#define TEGRACAM_SHADOW_SIZE	64
+
+struct tegracam_shadow_reg {
+	u32 addr;
+	u8 val;
+};
+
+/* last values written to the sensor through the control blob */
+struct tegracam_reg_shadow {
+	struct tegracam_shadow_reg regs[TEGRACAM_SHADOW_SIZE];
+	u32 num_regs;
+	u32 next_evict;
+	/* command registers, e.g. group hold, always written through */
+	const u32 *nocache_regs;
+	u32 num_nocache_regs;
+};
+
 struct tegracam_sensor_data {
 	struct sensor_blob mode_blob;
 	struct sensor_blob ctrls_blob;
+	struct tegracam_reg_shadow shadow;
 };
 
 struct tegracam_ctrl_ops {
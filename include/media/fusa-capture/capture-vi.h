@@ -35,6 +35,7 @@
 
 struct tegra_vi_channel;
 struct capture_buffer_table;
+struct vi_capture_sim;
 
 /**
  * @brief VI channel capture context.
@@ -98,6 +99,16 @@ struct vi_capture {
 		/**< Bitmask of RCE-assigned VI FW channel(s). */
 	uint64_t vi2_channel_mask;
 		/**< Bitmask of RCE-assigned VI FW channel(s) for 2nd VI. */
+
+	void (*status_notify)(void *priv);
+		/**< Called on each capture status completion, if set */
+	void *status_notify_priv; /**< Argument passed to status_notify */
+	spinlock_t status_notify_lock;
+		/**< Serializes status_notify calls against updates */
+#ifdef CONFIG_TEGRA_CAPTURE_VI_SIM
+	struct vi_capture_sim *sim;
+		/**< Simulated RCE, if the channel was opened in sim mode */
+#endif
 };
 
 /**
@@ -447,6 +458,38 @@ int vi_capture_status(
 	struct tegra_vi_channel *chan,
 	int32_t timeout_ms);
 
+/**
+ * @brief Consume the capture status of the head of the capture request
+ *	  FIFO queue if it has already been received, without blocking.
+ *
+ * @param[in]	chan	VI channel context
+ *
+ * @returns	0 (status consumed), -EAGAIN (not yet complete),
+ *		neg. errno (failure)
+ */
+int vi_capture_status_poll(
+	struct tegra_vi_channel *chan);
+
+/**
+ * @brief Register a function to be called whenever a capture status is
+ *	  received, so a client can retire frames without blocking in
+ *	  @ref vi_capture_status. Call with @a notify NULL to unregister.
+ *
+ * The function is called from the capture IVC callback and must not
+ * block. Once this returns with @a notify NULL, the previous function is
+ * neither running nor called again.
+ *
+ * @param[in]	chan	VI channel context
+ * @param[in]	notify	Notification function
+ * @param[in]	priv	Argument for @a notify
+ *
+ * @returns	0 (success), neg. errno (failure)
+ */
+int vi_capture_set_status_notify(
+	struct tegra_vi_channel *chan,
+	void (*notify)(void *priv),
+	void *priv);
+
 /**
  * @brief Setup VI compand in RCE.
  *
@@ -471,4 +514,27 @@ int vi_capture_set_progress_status_notifier(
 	struct tegra_vi_channel *chan,
 	struct vi_capture_progress_status_req *req);
 
+#ifdef CONFIG_TEGRA_CAPTURE_VI_SIM
+/**
+ * @brief Give the simulated RCE the CPU view of a kernel client's capture
+ * descriptor ring, so that it can write the status records. Channels set
+ * up from user space use the ring pinned by @ref vi_capture_setup.
+ *
+ * Does nothing on a channel that is not simulated.
+ *
+ * @param[in]	chan		VI channel context
+ * @param[in]	requests	Capture descriptor ring passed to
+ *				@ref vi_capture_setup
+ */
+void vi_capture_sim_set_requests(
+	struct tegra_vi_channel *chan,
+	void *requests);
+#else
+static inline void vi_capture_sim_set_requests(
+	struct tegra_vi_channel *chan,
+	void *requests)
+{
+}
+#endif
+
 #endif /* __FUSA_CAPTURE_VI_H__ */
@@ -207,6 +207,10 @@ struct tegra_channel {
 	spinlock_t dequeue_lock;
 	struct work_struct status_work;
 	struct work_struct error_work;
+	struct delayed_work retire_work;
+	unsigned long retire_deadline;
+	struct mutex enqueue_lock;
+	bool capture_running;
 
 	void __iomem *csibase[TEGRA_CSI_BLOCKS];
 	unsigned int stride_align;
@@ -430,6 +434,7 @@ struct tegra_vi_fops {
 	void (*vi_stride_align)(unsigned int *bpl);
 	void (*vi_unit_get_device_handle)(struct platform_device *pdev,
 		uint32_t csi_steam_id, struct device **dev);
+	void (*vi_buffer_queue)(struct tegra_channel *chan);
 };
 
 struct tegra_csi_fops {
@@ -32,6 +32,12 @@ int convert_table_to_blob(struct sensor_blob *pkt,
 			const struct reg_8 table[],
 			u16 wait_ms_addr, u16 end_addr);
 int write_sensor_blob(struct regmap *regmap, struct sensor_blob *blob);
+int write_sensor_blob_cached(struct regmap *regmap,
+			struct tegracam_reg_shadow *shadow,
+			struct sensor_blob *blob);
+void tegracam_shadow_invalidate(struct tegracam_reg_shadow *shadow);
+void tegracam_shadow_set_nocache(struct tegracam_reg_shadow *shadow,
+			const u32 *regs, u32 num_regs);
 int tegracam_write_blobs(struct tegracam_ctrl_handler *hdl);
 
 bool is_tvcf_supported(u32 version);
@@ -1975,11 +1975,11 @@ static int tegra_ivc_start_playback(
 
 
 	if (ack_required)
-		err = nvaudio_ivc_send_receive(adsp->hivc_client,
+		err = nvaudio_ivc_send_receive_atomic(adsp->hivc_client,
 					&msg,
 					sizeof(struct nvaudio_ivc_msg));
 	else
-		err = nvaudio_ivc_send_retry(adsp->hivc_client,
+		err = nvaudio_ivc_send_retry_atomic(adsp->hivc_client,
 					&msg,
 					sizeof(struct nvaudio_ivc_msg));
 	return err;
@@ -1999,11 +1999,11 @@ static int tegra_ivc_start_capture(
 	msg.params.dmaif_info.id = ivc_msg_admaif_id;
 
 	if (ack_required)
-		err = nvaudio_ivc_send_receive(adsp->hivc_client,
+		err = nvaudio_ivc_send_receive_atomic(adsp->hivc_client,
 					&msg,
 					sizeof(struct nvaudio_ivc_msg));
 	else
-		err = nvaudio_ivc_send_retry(adsp->hivc_client,
+		err = nvaudio_ivc_send_retry_atomic(adsp->hivc_client,
 					&msg,
 					sizeof(struct nvaudio_ivc_msg));
 	return err;
@@ -2023,11 +2023,11 @@ static int tegra_ivc_stop_playback(
 	msg.ack_required = ack_required;
 
 	if (ack_required)
-		err = nvaudio_ivc_send_receive(adsp->hivc_client,
+		err = nvaudio_ivc_send_receive_atomic(adsp->hivc_client,
 					&msg,
 					sizeof(struct nvaudio_ivc_msg));
 	else
-		err = nvaudio_ivc_send_retry(adsp->hivc_client,
+		err = nvaudio_ivc_send_retry_atomic(adsp->hivc_client,
 					&msg,
 					sizeof(struct nvaudio_ivc_msg));
 	return err;
@@ -2047,11 +2047,11 @@ static int tegra_ivc_stop_capture(
 	msg.ack_required = ack_required;
 
 	if (ack_required)
-		err = nvaudio_ivc_send_receive(adsp->hivc_client,
+		err = nvaudio_ivc_send_receive_atomic(adsp->hivc_client,
 					&msg,
 					sizeof(struct nvaudio_ivc_msg));
 	else
-		err = nvaudio_ivc_send_retry(adsp->hivc_client,
+		err = nvaudio_ivc_send_retry_atomic(adsp->hivc_client,
 					&msg,
 					sizeof(struct nvaudio_ivc_msg));
 
@@ -131,7 +131,7 @@ static void tegra210_admaif_start_playback(struct snd_soc_dai *dai)
 	msg.cmd = NVAUDIO_START_PLAYBACK;
 	msg.params.dmaif_info.id = dai->id;
 	msg.ack_required = true;
-	err = nvaudio_ivc_send_receive(data->hivc_client,
+	err = nvaudio_ivc_send_receive_atomic(data->hivc_client,
 			&msg, sizeof(struct nvaudio_ivc_msg));
 
 	if (err < 0)
@@ -150,7 +150,7 @@ static void tegra210_admaif_stop_playback(struct snd_soc_dai *dai)
 	msg.params.dmaif_info.id = dai->id;
 
 	msg.ack_required = true;
-	err = nvaudio_ivc_send_receive(data->hivc_client,
+	err = nvaudio_ivc_send_receive_atomic(data->hivc_client,
 			&msg, sizeof(struct nvaudio_ivc_msg));
 
 	if (err < 0)
@@ -169,7 +169,7 @@ static void tegra210_admaif_start_capture(struct snd_soc_dai *dai)
 	msg.params.dmaif_info.id = dai->id;
 
 	msg.ack_required = true;
-	err = nvaudio_ivc_send_receive(data->hivc_client,
+	err = nvaudio_ivc_send_receive_atomic(data->hivc_client,
 			&msg, sizeof(struct nvaudio_ivc_msg));
 
 	if (err < 0)
@@ -188,7 +188,7 @@ static void tegra210_admaif_stop_capture(struct snd_soc_dai *dai)
 	msg.params.dmaif_info.id = dai->id;
 
 	msg.ack_required = true;
-	err = nvaudio_ivc_send_receive(data->hivc_client,
+	err = nvaudio_ivc_send_receive_atomic(data->hivc_client,
 			&msg, sizeof(struct nvaudio_ivc_msg));
 	if (err < 0)
 		pr_err("%s: error on ivc_send\n", __func__);
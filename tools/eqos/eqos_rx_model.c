@@ -0,0 +1,434 @@
+/*
+ * eqos_rx_model - user-space model of the eqos Rx page recycling.
+ *
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * Replays the Rx refill and recycle decisions of desc_alloc_skb(),
+ * eqos_rx_get_skb() and eqos_unmap_rx_skb() on a ring of RX_DESC_CNT
+ * descriptors without the MAC. Pages are plain allocations with a model
+ * refcount; the stack is a FIFO that frees each skb a number of packets
+ * after it was received, so it holds buffers like a socket queue that is
+ * drained with some delay. The same traffic is replayed through the old
+ * scheme of one skb allocation and map/unmap per buffer for comparison.
+ *
+ * Every page reference is accounted for: a page may not be freed while an
+ * skb or a descriptor still points into it, and none may be left once the
+ * ring is torn down. The data of an skb is checked when the stack frees
+ * it, so a half that was flipped back to the device while still in use
+ * shows up as overwritten. The program exits non-zero on any of these.
+ *
+ * Build:
+ *	gcc -O2 -o eqos_rx_model eqos_rx_model.c
+ *
+ * Example Usage:
+ *	eqos_rx_model -n 1000000 -c 256 -d 64 -m imix
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* as in yheader.h and a 64-bit arm kernel with 4K pages */
+#define RX_DESC_CNT		256
+#define EQOS_RX_BUF_LEN		2048
+#define PAGE_SIZE		4096u
+#define SMP_CACHE_BYTES		64
+#define NET_SKB_PAD		64
+#define NET_IP_ALIGN		0
+#define EQOS_RX_HEADROOM	(NET_SKB_PAD + NET_IP_ALIGN)
+#define SKB_SHINFO_SIZE		320
+#define USHRT_MAX		0xffff
+#define NAPI_BUDGET		64
+
+#define SKB_DATA_ALIGN(x)	(((x) + SMP_CACHE_BYTES - 1) & \
+				 ~(SMP_CACHE_BYTES - 1))
+
+struct page {
+	unsigned char *va;
+	unsigned int order;
+	int refcount;
+};
+
+struct rx_swcx_desc {
+	struct page *page;
+	unsigned int page_offset;
+	unsigned int pagecnt_bias;
+	unsigned char *buf;		/* old scheme: the skb data */
+};
+
+struct skb {
+	struct page *page;		/* NULL for copied or old scheme */
+	unsigned char *data;
+	unsigned int len;
+	unsigned char tag;		/* the byte the frame was filled with */
+};
+
+struct model {
+	bool pages;
+	unsigned int copybreak;
+	unsigned int order;
+	unsigned int truesize;
+	struct rx_swcx_desc ring[RX_DESC_CNT];
+	struct skb *held;
+	unsigned int hold;
+	unsigned long head;
+	unsigned long pages_live;
+	unsigned long page_alloc_n;
+	unsigned long page_reuse_n;
+	unsigned long copybreak_n;
+	unsigned long buf_alloc_n;
+	unsigned long map_n;
+	unsigned long sync_n;
+	unsigned long errors;
+};
+
+static unsigned int get_order(unsigned int size)
+{
+	unsigned int order = 0;
+
+	while ((PAGE_SIZE << order) < size)
+		order++;
+
+	return order;
+}
+
+static void model_error(struct model *m, const char *what)
+{
+	if (!m->errors++)
+		fprintf(stderr, "error: %s\n", what);
+}
+
+static struct page *alloc_page_order(unsigned int order)
+{
+	struct page *page = malloc(sizeof(*page));
+
+	if (!page)
+		return NULL;
+
+	page->va = aligned_alloc(PAGE_SIZE, PAGE_SIZE << order);
+	if (!page->va) {
+		free(page);
+		return NULL;
+	}
+	page->order = order;
+	page->refcount = 1;
+
+	return page;
+}
+
+static void page_ref_sub(struct model *m, struct page *page, int nr)
+{
+	page->refcount -= nr;
+	if (page->refcount < 0)
+		model_error(m, "page reference dropped twice");
+	if (page->refcount > 0)
+		return;
+
+	free(page->va);
+	free(page);
+	m->pages_live--;
+}
+
+/* eqos_rx_buf_geometry() */
+static void model_geometry(struct model *m)
+{
+	unsigned int truesize =
+		SKB_DATA_ALIGN(EQOS_RX_HEADROOM + EQOS_RX_BUF_LEN) +
+		SKB_DATA_ALIGN(SKB_SHINFO_SIZE);
+
+	m->order = get_order(2 * truesize);
+	m->truesize = (PAGE_SIZE << m->order) / 2;
+}
+
+/* desc_alloc_skb() */
+static int model_refill(struct model *m, struct rx_swcx_desc *d)
+{
+	if (!m->pages) {
+		if (d->buf)
+			return 0;
+		d->buf = malloc(EQOS_RX_HEADROOM + EQOS_RX_BUF_LEN);
+		if (!d->buf)
+			return -1;
+		m->buf_alloc_n++;
+		m->map_n++;
+		return 0;
+	}
+
+	if (!d->page) {
+		d->page = alloc_page_order(m->order);
+		if (!d->page)
+			return -1;
+		m->pages_live++;
+		m->map_n++;
+
+		d->page->refcount += USHRT_MAX - 1;
+		d->page_offset = 0;
+		d->pagecnt_bias = USHRT_MAX;
+		m->page_alloc_n++;
+	}
+
+	m->sync_n++;
+	return 0;
+}
+
+/* eqos_unmap_rx_skb() */
+static void model_unmap(struct model *m, struct rx_swcx_desc *d)
+{
+	if (d->buf) {
+		free(d->buf);
+		d->buf = NULL;
+		m->map_n++;
+	}
+
+	if (d->page) {
+		m->map_n++;
+		page_ref_sub(m, d->page, d->pagecnt_bias);
+		d->page = NULL;
+	}
+}
+
+/* eqos_rx_page_reusable() */
+static bool model_page_reusable(struct rx_swcx_desc *d)
+{
+	struct page *page = d->page;
+
+	if (page->refcount - (int)d->pagecnt_bias > 1)
+		return false;
+
+	if (d->pagecnt_bias == 1) {
+		page->refcount += USHRT_MAX - 1;
+		d->pagecnt_bias = USHRT_MAX;
+	}
+
+	return true;
+}
+
+/* eqos_rx_get_skb(), with the old per-buffer unmap for comparison */
+static int model_get_skb(struct model *m, struct rx_swcx_desc *d,
+			 unsigned int len, struct skb *skb)
+{
+	unsigned char *va;
+
+	if (!m->pages) {
+		m->map_n++;
+		skb->page = NULL;
+		skb->data = d->buf;
+		d->buf = NULL;
+		return 0;
+	}
+
+	va = d->page->va + d->page_offset;
+	m->sync_n++;
+
+	if (len <= m->copybreak) {
+		skb->page = NULL;
+		skb->data = malloc(SKB_DATA_ALIGN(NET_SKB_PAD + len));
+		if (!skb->data)
+			return -1;
+		memcpy(skb->data + NET_SKB_PAD, va + EQOS_RX_HEADROOM, len);
+		m->copybreak_n++;
+		return 0;
+	}
+
+	skb->page = d->page;
+	skb->data = va;
+	d->pagecnt_bias--;
+
+	if (model_page_reusable(d)) {
+		d->page_offset ^= m->truesize;
+		m->page_reuse_n++;
+	} else {
+		model_unmap(m, d);
+	}
+
+	return 0;
+}
+
+static void model_free_skb(struct model *m, struct skb *skb)
+{
+	if (!skb->data)
+		return;
+
+	if (skb->data[EQOS_RX_HEADROOM] != skb->tag ||
+	    skb->data[EQOS_RX_HEADROOM + skb->len - 1] != skb->tag)
+		model_error(m, "skb data overwritten while in the stack");
+
+	if (skb->page) {
+		if (skb->page->refcount <= 0)
+			model_error(m, "skb points into a freed page");
+		page_ref_sub(m, skb->page, 1);
+	} else {
+		free(skb->data);
+	}
+
+	skb->page = NULL;
+	skb->data = NULL;
+}
+
+static unsigned int model_len(const char *mix, unsigned int i)
+{
+	/* 7:4:1 IMIX of 64, 576 and 1500 byte frames */
+	static const unsigned int imix[12] = {
+		64, 576, 64, 1500, 64, 576, 64, 64, 576, 64, 576, 64,
+	};
+
+	if (!strcmp(mix, "imix"))
+		return imix[i % 12];
+	if (!strcmp(mix, "small"))
+		return 64;
+	if (!strcmp(mix, "large"))
+		return 1500;
+
+	return 60 + rand() % (1514 - 60 + 1);
+}
+
+/* Rx of one frame into descriptor d, with the device write done by memset */
+static int model_rx(struct model *m, struct rx_swcx_desc *d, unsigned int len)
+{
+	struct skb *skb = &m->held[m->head % m->hold];
+	unsigned char tag = (m->head * 2654435761u) >> 24;
+	unsigned char *va;
+
+	va = m->pages ? d->page->va + d->page_offset : d->buf;
+	memset(va + EQOS_RX_HEADROOM, tag, len);
+
+	/* the skb received hold packets ago leaves the stack */
+	model_free_skb(m, skb);
+
+	if (model_get_skb(m, d, len, skb))
+		return -1;
+	skb->len = len;
+	skb->tag = tag;
+	if (skb->page && skb->page->refcount <= 0)
+		model_error(m, "skb handed out of a freed page");
+
+	m->head++;
+	return 0;
+}
+
+static int model_run(struct model *m, const char *mix, unsigned long nr,
+		     double *ns)
+{
+	struct timespec t0, t1;
+	unsigned long i;
+	unsigned int cur = 0, dirty = 0, n;
+	int ret = 0;
+
+	m->held = calloc(m->hold, sizeof(*m->held));
+	if (!m->held)
+		return -1;
+
+	model_geometry(m);
+	for (n = 0; n < RX_DESC_CNT; n++)
+		if (model_refill(m, &m->ring[n]))
+			return -1;
+
+	srand(1);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < nr && !ret; i++) {
+		ret = model_rx(m, &m->ring[cur], model_len(mix, i));
+		cur = (cur + 1) % RX_DESC_CNT;
+
+		/* refill what the poll consumed, once per budget */
+		if (++dirty == NAPI_BUDGET) {
+			for (n = 0; n < dirty && !ret; n++)
+				ret = model_refill(m, &m->ring[(cur - dirty + n +
+						    RX_DESC_CNT) % RX_DESC_CNT]);
+			dirty = 0;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	*ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+
+	for (n = 0; n < m->hold; n++)
+		model_free_skb(m, &m->held[n]);
+	for (n = 0; n < RX_DESC_CNT; n++)
+		model_unmap(m, &m->ring[n]);
+	free(m->held);
+
+	if (m->pages_live)
+		model_error(m, "pages left after teardown");
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct model *m[2];
+	const char *mix = "imix";
+	unsigned long nr = 1000000;
+	unsigned int copybreak = 256;
+	unsigned int hold = 64;
+	double ns[2];
+	int i, c;
+
+	while ((c = getopt(argc, argv, "n:c:d:m:h")) != -1) {
+		switch (c) {
+		case 'n':
+			nr = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			copybreak = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			hold = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mix = optarg;
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-n packets] [-c copybreak] "
+				"[-d stack depth] [-m imix|small|large|random]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (!hold) {
+		fprintf(stderr, "stack depth must be at least 1\n");
+		return 1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		m[i] = calloc(1, sizeof(*m[i]));
+		if (!m[i])
+			return 1;
+		m[i]->pages = i;
+		m[i]->copybreak = copybreak;
+		m[i]->hold = hold;
+		if (model_run(m[i], mix, nr, &ns[i])) {
+			fprintf(stderr, "allocation failed\n");
+			return 1;
+		}
+	}
+
+	printf("%lu %s packets, copybreak %u, stack depth %u\n",
+	       nr, mix, copybreak, hold);
+	printf("per skb:  %lu allocs, %lu maps/unmaps, %.1f ns/packet\n",
+	       m[0]->buf_alloc_n, m[0]->map_n, ns[0] / nr);
+	printf("per page: %lu page allocs, %lu reuses, %lu copied, "
+	       "%lu maps/unmaps, %lu syncs, %.1f ns/packet\n",
+	       m[1]->page_alloc_n, m[1]->page_reuse_n, m[1]->copybreak_n,
+	       m[1]->map_n, m[1]->sync_n, ns[1] / nr);
+	printf("recycle rate: %.2f%% of built skbs, %.4f page allocs/packet\n",
+	       nr > m[1]->copybreak_n ?
+	       100.0 * m[1]->page_reuse_n / (nr - m[1]->copybreak_n) : 0.0,
+	       (double)m[1]->page_alloc_n / nr);
+
+	if (m[0]->errors || m[1]->errors) {
+		fprintf(stderr, "FAIL: %lu errors\n",
+			m[0]->errors + m[1]->errors);
+		return 1;
+	}
+
+	return 0;
+}